@@ -1,6 +1,7 @@
 #include "CommandLine.hh"
 
 #include <thread>
+#include <mutex>
 #include <iostream>
 #include <utility> // pair
 #include <cstdio>
@@ -119,6 +120,7 @@ struct CommandLine::implementation {
     };
 
     std::unordered_map<std::string, command_holder> commands;
+    std::mutex commands_mutex; // apps are initialized concurrently
 
     HistEvent hev;
     bool keep_reading { true };
@@ -291,7 +293,10 @@ void CommandLine::registerCommand(
             std::move(pos_opts),
             help
         };
-    m_impl->commands.emplace(std::move(spec), std::move(holder));
+    {
+        std::lock_guard<std::mutex> lock(m_impl->commands_mutex);
+        m_impl->commands.emplace(std::move(spec), std::move(holder));
+    }
     LOG(INFO) << "Command " << cmd_name << " registered";
 }
 
@@ -17,7 +17,13 @@
 #include "Controller.hh"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <future>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <mutex>
 #include <thread>
@@ -33,7 +39,10 @@
 
 #include "types/exception.hh"
 
+#include "MessageLog.hh"
 #include "OFMsgUnion.hh"
+#include "PacketInAdmission.hh"
+#include "SendQueue.hh"
 #include "SwitchConnection.hh"
 
 
@@ -45,27 +54,63 @@ REGISTER_APPLICATION(Controller, {""})
 
 class SwitchConnectionImpl : public SwitchConnection {
 public:
-    SwitchConnectionImpl(OFConnection* ofconn_, uint64_t dpid)
+    SwitchConnectionImpl(OFConnection* ofconn_, uint64_t dpid,
+                         const sendq::Settings& send_queue_settings)
         : SwitchConnection(ofconn_, dpid)
-    { }
+    {
+        if (send_queue_settings.enabled) {
+            m_send_queue.reset(new sendq::SendQueue(send_queue_settings));
+        }
+    }
 
+    // called by the thread of the new connection
     void replace(OFConnection* ofconn_)
-    { m_ofconn = ofconn_; }
+    {
+        m_ofconn = ofconn_;
+        own();
+        flushQueue();
+    }
+
+    using SwitchConnection::flushQueue;
+    using SwitchConnection::confirm;
+
+    sendq::Stats queueStats() const
+    {
+        if (not m_send_queue) return sendq::Stats();
+        auto ret = m_send_queue->stats();
+        ret.unconfirmed_bytes = unconfirmed();
+        return ret;
+    }
+
+    void replayed()
+    { m_replayed = true; }
 };
 
 typedef std::shared_ptr<SwitchConnectionImpl> SwitchConnectionImplPtr;
 typedef std::weak_ptr<SwitchConnectionImpl> SwitchConnectionImplWeakPtr;
 
+class ControllerImpl;
+
 struct SwitchBase {
     SwitchConnectionImplPtr connection;
     uint8_t max_table;
+    uint16_t miss_send_len;
+    ControllerImpl* controller;
+    admission::SwitchAdmission admission;
 
 public:
     SwitchBase(OFConnection* ofconn,
             uint64_t dpid,
-            uint8_t max_table)
-        : connection{ new SwitchConnectionImpl{ofconn, dpid} },
-        max_table(max_table)
+            uint8_t max_table,
+            uint16_t miss_send_len,
+            ControllerImpl* controller,
+            const admission::Settings& admission_settings,
+            const sendq::Settings& send_queue_settings)
+        : connection{ new SwitchConnectionImpl{ofconn, dpid, send_queue_settings} },
+        max_table(max_table),
+        miss_send_len(miss_send_len),
+        controller(controller),
+        admission(admission_settings)
     {
         clearTables();
         for (uint8_t i = 0; i < max_table; ++i){
@@ -134,7 +179,7 @@ private:
         fm.table_id(table);
         fm.flags(of13::OFPFF_CHECK_OVERLAP | of13::OFPFF_SEND_FLOW_REM);
         of13::ApplyActions act;
-        of13::OutputAction out(of13::OFPP_CONTROLLER, 128); // TODO : unhardcore
+        of13::OutputAction out(of13::OFPP_CONTROLLER, miss_send_len);
         act.add_action(out);
         fm.add_instruction(act);
 
@@ -144,6 +189,22 @@ private:
 };
 
 
+// Posted to an application after switchUp of a replayed switch.
+// Events of a thread are delivered in order, so the queued signal
+// is handled when the fence is delivered and destroyed.
+class ReplayFence : public QEvent {
+public:
+    explicit ReplayFence(std::promise<void> done)
+        : QEvent(QEvent::User), m_done(std::move(done))
+    { }
+
+    ~ReplayFence()
+    { m_done.set_value(); }
+
+private:
+    std::promise<void> m_done;
+};
+
 class ControllerImpl : public OFServer {
     const uint32_t min_xid = 0xfff;
     Controller &app;
@@ -154,12 +215,26 @@ public:
     Config config;
     Config root_config;
     uint8_t max_table;
-
-    std::unordered_map<uint8_t, CommonHandlers*> handlers;
+    uint16_t miss_send_len;
+    admission::Settings admission_settings;
+    sendq::Settings send_queue_settings;
+
+    // Record/replay of received messages
+    std::unique_ptr<msglog::Writer> capture;
+    std::string replay_file;
+    bool replay_paced{true};
+    bool replay_quit{false};
+    std::thread replay_thread;
+    std::atomic_bool replay_stop{false};
+    std::vector<QObject*> replay_fences; // an application of every thread
+
+    std::array<CommonHandlers*, 256> handlers{}; // indexed by message type
     std::unordered_map<uint64_t, SwitchBase> switches;
+    mutable std::mutex switches_mutex;
 
     // OFResponse
     std::vector<OFTransaction*> static_ofresponse;
+    std::mutex static_ofresponse_mutex;
     // Make sure that we don't intersect with libfluid_base
     uint32_t min_session_xid{min_xid};
     //uint32_t last_xid;
@@ -175,6 +250,14 @@ public:
               // last_xid(min_xid)
     { }
 
+    ~ControllerImpl()
+    {
+        replay_stop = true;
+        if (replay_thread.joinable()) {
+            replay_thread.join();
+        }
+    }
+
     void message_callback(OFConnection *ofconn, uint8_t type, void *data, size_t len) override
     {
         if (cbench && type == of13::OFPT_PACKET_IN) {
@@ -189,28 +272,258 @@ public:
             return;
         }
 
-
         SwitchBase *ctx = reinterpret_cast<SwitchBase *>(ofconn->get_application_data());
 
-        auto it = handlers.find(type);
-        if( it != handlers.end()){
-            it->second->apply(data, ctx->connection);
+        if (capture) {
+            capture->write(ctx ? ctx->connection->dpid() : 0, type, data, len);
+        }
+
+        if (type == of13::OFPT_PACKET_IN && ctx && ctx->admission.enabled()) {
+            admit(ofconn, ctx, data, len);
+            return;
+        }
+
+        dispatch(ofconn, type, data, len);
+    }
+
+    static void* drain_callback(void* arg)
+    {
+        auto ofconn = static_cast<OFConnection*>(arg);
+        auto ctx = reinterpret_cast<SwitchBase*>(ofconn->get_application_data());
+        if (ctx) {
+            ctx->controller->drain(ofconn, ctx);
+        }
+        return nullptr;
+    }
+
+    static void* flush_callback(void* arg)
+    {
+        auto ofconn = static_cast<OFConnection*>(arg);
+        auto ctx = reinterpret_cast<SwitchBase*>(ofconn->get_application_data());
+        if (ctx) {
+            ctx->connection->flushQueue();
+        }
+        return nullptr;
+    }
+
+    void connection_callback(OFConnection *ofconn, OFConnection::Event type) override
+    {
+        auto ctx = reinterpret_cast<SwitchBase*>(ofconn->get_application_data());
+
+        if (type == OFConnection::EVENT_STARTED) {
+            LOG(INFO) << "Connection id=" << ofconn->get_id() << " started";
+            ofconn->set_application_data(nullptr);
+        }
+
+        else if (type == OFConnection::EVENT_ESTABLISHED) {
+            LOG(INFO) << "Connection id=" << ofconn->get_id() << " established";
+        }
+
+        else if (type == OFConnection::EVENT_FAILED_NEGOTIATION) {
+            LOG(INFO) << "Connection id=" << ofconn->get_id() << ": failed version negotiation";
+        }
+
+        else if (type == OFConnection::EVENT_CLOSED) {
+            LOG(INFO) << "Connection id=" << ofconn->get_id() << " closed by the user";
+            if (ctx) {
+                ofconn->set_application_data(nullptr);
+                flush(ctx);
+                emit app.switchDown(ctx->connection);
+                ctx->connection->replace(nullptr);
+           }
+        }
+
+        else if (type == OFConnection::EVENT_DEAD) {
+            LOG(INFO) << "Connection id=" << ofconn->get_id() << " closed due to inactivity";
+            if (ctx) {
+                ofconn->set_application_data(nullptr);
+                flush(ctx);
+                emit app.switchDown(ctx->connection);
+                ctx->connection->replace(nullptr);
+           }
+        }
+    }
+
+    /**
+     * Feeds captured messages through the handlers in capture order
+     * from a single thread. Replayed switches have no connection:
+     * they are alive, but everything sent to them is dropped.
+     * Admission control is bypassed, the log has all offered packet-ins.
+     */
+    void replay()
+    {
+        using clock = std::chrono::steady_clock;
+        using std::chrono::nanoseconds;
+
+        std::unordered_map<uint64_t, SwitchBase*> replayed;
+        uint64_t messages = 0, skipped = 0;
+        auto start = clock::now();
+
+        try {
+            msglog::Reader reader(replay_file);
+            msglog::Record rec;
+            while (not replay_stop && reader.next(rec)) {
+                if (replay_paced) {
+                    std::this_thread::sleep_until(start + nanoseconds(rec.time));
+                }
+
+                SwitchBase* ctx = nullptr;
+                auto it = replayed.find(rec.dpid);
+                if (it != replayed.end()) {
+                    ctx = it->second;
+                } else if (rec.type != of13::OFPT_FEATURES_REPLY) {
+                    ++skipped;
+                    continue;
+                }
+
+                auto data = new uint8_t[rec.len];
+                std::memcpy(data, rec.data, rec.len);
+                ctx = process(nullptr, ctx, rec.type, data, rec.len);
+                if (ctx && rec.type == of13::OFPT_FEATURES_REPLY) {
+                    replayed[ctx->connection->dpid()] = ctx;
+                    wait_switch_up();
+                }
+                ++messages;
+            }
+        } catch (const std::exception& e) {
+            LOG(ERROR) << "Replay of " << replay_file << " failed: " << e.what();
+        }
+
+        double secs = std::chrono::duration<double>(clock::now() - start).count();
+        LOG(INFO) << "Replayed " << messages << " messages of "
+                  << replayed.size() << " switches in " << secs << " s ("
+                  << (secs > 0 ? messages / secs : 0.0) << " msg/s), "
+                  << skipped << " messages of unknown switches skipped";
+
+        if (replay_quit) {
+            QMetaObject::invokeMethod(qApp, "quit", Qt::QueuedConnection);
+        }
+    }
+
+    /**
+     * Waits until applications handle switchUp of a replayed switch,
+     * otherwise its next messages may come before they know the switch.
+     */
+    void wait_switch_up()
+    {
+        std::vector<std::future<void>> done;
+        for (QObject* app : replay_fences) {
+            std::promise<void> fence;
+            done.push_back(fence.get_future());
+            QCoreApplication::postEvent(app, new ReplayFence(std::move(fence)));
+        }
+        for (auto& f : done) {
+            while (f.wait_for(std::chrono::milliseconds(100)) !=
+                       std::future_status::ready) {
+                if (replay_stop)
+                    return;
+            }
+        }
+    }
+
+private:
+    void admit(OFConnection *ofconn, SwitchBase *ctx, void *data, size_t len)
+    {
+        admission::Message msg{data, len, admission::classify(data, len)};
+
+        if (ctx->admission.tryAdmit(msg.cls)) {
+            dispatch(ofconn, of13::OFPT_PACKET_IN, data, len);
+            return;
+        }
+
+        admission::Message evicted;
+        if (not ctx->admission.enqueue(msg, evicted)) {
+            DVLOG(5) << "Dropping " << admission::to_string(msg.cls)
+                     << " packet-in from connection " << ofconn->get_id();
+            free_data(data);
+        } else if (evicted.data) {
+            free_data(evicted.data);
+        }
+
+        drain(ofconn, ctx);
+    }
+
+    void drain(OFConnection *ofconn, SwitchBase *ctx)
+    {
+        admission::Message msg;
+        while (ctx->admission.dequeue(msg)) {
+            dispatch(ofconn, of13::OFPT_PACKET_IN, msg.data, msg.len);
+        }
+    }
+
+    void flush(SwitchBase *ctx)
+    {
+        for (auto& msg : ctx->admission.flush()) {
+            free_data(msg.data);
         }
+    }
+
+    void dispatch(OFConnection *ofconn, uint8_t type, void *data, size_t len)
+    {
+        SwitchBase *ctx = reinterpret_cast<SwitchBase *>(ofconn->get_application_data());
+        process(ofconn, ctx, type, data, len);
+    }
 
+    static int connection_id(OFConnection *ofconn)
+    {
+        return ofconn ? ofconn->get_id() : -1;
+    }
 
+    /**
+     * Passes message to handlers and frees it.
+     * `ofconn` is null for replayed messages.
+     * @return switch context, it is created by features reply.
+     */
+    SwitchBase* process(OFConnection *ofconn, SwitchBase *ctx,
+                        uint8_t type, void *data, size_t len)
+    {
         if (ctx == nullptr && type != of13::OFPT_FEATURES_REPLY) {
             LOG(WARNING) << "Switch send message before feature reply";
             OFMsg::free_buffer(static_cast<uint8_t *>(data));
-            return;
+            return nullptr;
+        }
+
+        // Every message is decoded once into the per-thread object.
+        // Transactions may keep it after return, so it is reused
+        // only when nobody else holds it.
+        thread_local std::shared_ptr<OFMsgUnion> decoded;
+        if (not decoded || decoded.use_count() > 1) {
+            decoded = std::make_shared<OFMsgUnion>();
         }
+        OFMsgUnion& msg = *decoded;
 
         try {
-            OFMsgUnion msg(type, data, len);
+            msg.reset(type, data, len);
+
+            if (ctx && type == of13::OFPT_BARRIER_REPLY &&
+                ctx->connection->confirm(msg.base()->xid())) {
+                // barrier of the send queue, nobody else waits for it
+                free_data(data);
+                return ctx;
+            }
+
+            if (ctx && handlers[type]) {
+                handlers[type]->apply(msg, ctx->connection);
+            }
 
             switch (type) {
             case of13::OFPT_FEATURES_REPLY:
                 ctx = createSwitchBase(ofconn, msg.featuresReply.datapath_id());
-                ofconn->set_application_data(ctx);
+                if (ofconn) {
+                    ofconn->set_application_data(ctx);
+                    if (ctx->admission.enabled()) {
+                        ofconn->add_timed_callback(&ControllerImpl::drain_callback,
+                                                   admission_settings.drain_interval,
+                                                   ofconn);
+                    }
+                    if (send_queue_settings.enabled) {
+                        ofconn->add_timed_callback(&ControllerImpl::flush_callback,
+                                                   send_queue_settings.drain_interval,
+                                                   ofconn);
+                    }
+                } else {
+                    ctx->connection->replayed();
+                }
                 emit app.switchUp(ctx->connection, msg.featuresReply);
                 break;
             case of13::OFPT_PORT_STATUS:
@@ -233,21 +546,19 @@ public:
                 }
 
                 if (transaction) {
-                    auto msg_copy = std::make_shared<OFMsgUnion>(type, data, len);
-
                     if (type == of13::OFPT_ERROR) {
-                        emit transaction->error(ctx->connection, msg_copy);
+                        emit transaction->error(ctx->connection, decoded);
                     } else {
-                        emit transaction->response(ctx->connection, msg_copy);
+                        emit transaction->response(ctx->connection, decoded);
                     }
                 }
             }
             }
         } catch (const OFMsgParseError &e) {
-            LOG(WARNING) << "Malformed message received from connection " << ofconn->get_id();
+            LOG(WARNING) << "Malformed message received from connection " << connection_id(ofconn);
         } catch (const OFMsgUnhandledType &e) {
             LOG(WARNING) << "Unhandled message type " << e.msg_type()
-                    << " received from connection " << ofconn->get_id();
+                    << " received from connection " << connection_id(ofconn);
         } catch (const std::exception &e) {
             LOG(ERROR) << "Unhandled exception: " << e.what();
         } catch (...) {
@@ -255,44 +566,9 @@ public:
         }
 
         free_data(data);
+        return ctx;
     }
 
-    void connection_callback(OFConnection *ofconn, OFConnection::Event type) override
-    {
-        auto ctx = reinterpret_cast<SwitchBase*>(ofconn->get_application_data());
-
-        if (type == OFConnection::EVENT_STARTED) {
-            LOG(INFO) << "Connection id=" << ofconn->get_id() << " started";
-            ofconn->set_application_data(nullptr);
-        }
-
-        else if (type == OFConnection::EVENT_ESTABLISHED) {
-            LOG(INFO) << "Connection id=" << ofconn->get_id() << " established";
-        }
-
-        else if (type == OFConnection::EVENT_FAILED_NEGOTIATION) {
-            LOG(INFO) << "Connection id=" << ofconn->get_id() << ": failed version negotiation";
-        }
-
-        else if (type == OFConnection::EVENT_CLOSED) {
-            LOG(INFO) << "Connection id=" << ofconn->get_id() << " closed by the user";
-            if (ctx) {
-                ofconn->set_application_data(nullptr);
-                emit app.switchDown(ctx->connection);
-                ctx->connection->replace(nullptr);
-           }
-        }
-
-        else if (type == OFConnection::EVENT_DEAD) {
-            LOG(INFO) << "Connection id=" << ofconn->get_id() << " closed due to inactivity";
-            if (ctx) {
-                ofconn->set_application_data(nullptr);
-                emit app.switchDown(ctx->connection);
-                ctx->connection->replace(nullptr);
-           }
-        }
-    }
-private:
     SwitchBase *createSwitchBase(OFConnection *ofconn, uint64_t dpid)
     {
 
@@ -300,8 +576,7 @@ private:
         if (it != switches.end())
             goto ret;
         {
-            static std::mutex mutex;
-            std::lock_guard<std::mutex> lock(mutex);
+            std::lock_guard<std::mutex> lock(switches_mutex);
 
             it = switches.find(dpid);
             if (it != switches.end())
@@ -311,7 +586,11 @@ private:
                                   std::forward_as_tuple(dpid),
                                   std::forward_as_tuple(ofconn,
                                                         dpid,
-                                                        max_table))
+                                                        max_table,
+                                                        miss_send_len,
+                                                        this,
+                                                        admission_settings,
+                                                        send_queue_settings))
                           .first;
             return &it->second;
         }
@@ -347,13 +626,48 @@ void Controller::init(Loader*, const Config& rootConfig)
     impl->config = config;
     impl->root_config = rootConfig;
     impl->max_table = config_get(config, "tables.max_table", 0);
+    // bytes of table-miss packets sent to controller, 65535 for whole ones
+    impl->miss_send_len = config_get(config, "miss-send-len", 128);
+    impl->admission_settings = admission::Settings::fromConfig(config);
+    impl->send_queue_settings = sendq::Settings::fromConfig(config);
+
+    std::string capture = config_get(config, "capture", "");
+    if (not capture.empty()) {
+        impl->capture.reset(new msglog::Writer(capture));
+        LOG(INFO) << "Capturing OpenFlow messages to " << capture;
+    }
+    impl->replay_file = config_get(config, "replay", "");
+    impl->replay_paced = config_get(config, "replay-pacing", "recorded") != "fast";
+    impl->replay_quit = config_get(config, "replay-quit", false);
 }
 
 void Controller::startUp(Loader*)
 {
+    impl->cbench = config_get(impl->config, "cbench", false);
+
+    if (not impl->replay_file.empty()) {
+        LOG(INFO) << "Replaying OpenFlow messages from " << impl->replay_file
+                  << (impl->replay_paced ? " at recorded pace" : " at full speed")
+                  << ", switch connections are not accepted";
+        // applications are in their threads already
+        std::unordered_set<QThread*> threads;
+        for (Application* app : Application::registry) {
+            if (app->thread() != qApp->thread() &&
+                threads.insert(app->thread()).second) {
+                impl->replay_fences.push_back(app);
+            }
+        }
+        impl->started = true;
+        // Other applications may be still starting up. The main event loop
+        // runs only when all of them are started, so start replay from it.
+        QTimer::singleShot(0, qApp, [this]() {
+            impl->replay_thread = std::thread(&ControllerImpl::replay, impl.get());
+        });
+        return;
+    }
+
     impl->start(/* block: */ false);
     impl->started = true;
-    impl->cbench = config_get(impl->config, "cbench", false);
 }
 
 void Controller::__register_handler__(uint8_t t, CommonHandlers* h)
@@ -361,7 +675,10 @@ void Controller::__register_handler__(uint8_t t, CommonHandlers* h)
     if (impl->started) {
         LOG(ERROR) << "Register handler after startup";
     }
-    impl->handlers.emplace(t, h);
+    if (impl->handlers[t] && impl->handlers[t] != h) {
+        LOG(ERROR) << "Overwriting handlers of message type " << int(t);
+    }
+    impl->handlers[t] = h;
 }
 
 OFTransaction* Controller::registerStaticTransaction(Application *caller)
@@ -371,6 +688,7 @@ OFTransaction* Controller::registerStaticTransaction(Application *caller)
         return 0;
     }
 
+    std::lock_guard<std::mutex> lock(impl->static_ofresponse_mutex);
     uint32_t xid = impl->min_session_xid++;
 
     OFTransaction* ret = new OFTransaction(xid, caller);
@@ -398,4 +716,28 @@ uint8_t Controller::maxTable() const
     return impl->max_table;
 }
 
+std::vector<admission::Stats> Controller::admissionStats() const
+{
+    std::vector<admission::Stats> ret;
+    std::lock_guard<std::mutex> lock(impl->switches_mutex);
+    ret.reserve(impl->switches.size());
+    for (const auto& sw : impl->switches) {
+        ret.push_back(sw.second.admission.stats());
+        ret.back().dpid = sw.first;
+    }
+    return ret;
+}
+
+std::vector<sendq::Stats> Controller::sendQueueStats() const
+{
+    std::vector<sendq::Stats> ret;
+    std::lock_guard<std::mutex> lock(impl->switches_mutex);
+    ret.reserve(impl->switches.size());
+    for (const auto& sw : impl->switches) {
+        ret.push_back(sw.second.connection->queueStats());
+        ret.back().dpid = sw.first;
+    }
+    return ret;
+}
+
 Controller::~Controller() = default;
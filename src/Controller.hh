@@ -19,12 +19,16 @@
 #include "Common.hh"
 #include "Application.hh"
 #include "Loader.hh"
+#include "OFMsgUnion.hh"
 #include "OFTransaction.hh"
+#include "PacketInAdmission.hh"
+#include "SendQueue.hh"
 #include "SwitchConnection.hh"
 
 #include "api/PacketMissHandler.hh"
 #include "SwitchConnectionFwd.hh"
 
+#include <mutex>
 #include <vector>
 
 using runos::SwitchConnectionPtr;
@@ -33,22 +37,22 @@ using runos::FloodImplementation;
 using runos::OfMessageHandler;
 
 struct CommonHandlers{
-    virtual void apply(void *data, SwitchConnectionPtr connection) = 0;
+    /**
+     * @param msg already decoded message, its type matches
+     *            the type this handlers are registered for.
+     */
+    virtual void apply(OFMsgUnion& msg, SwitchConnectionPtr connection) = 0;
     virtual ~CommonHandlers(){}
 };
 
 template <class ofMessage>
 class Handlers : public CommonHandlers{
-    class OFMsgParseError : std::exception { };
     std::vector<OfMessageHandler<ofMessage>> handlers;
 public:
-    void apply(void *data, SwitchConnectionPtr connection) override{
-        ofMessage msg;
-        if( msg.unpack(static_cast<uint8_t *>(data)) != 0 ){
-            throw OFMsgParseError();
-        }
-        for (auto h : handlers){
-            h(msg, connection);
+    void apply(OFMsgUnion& msg, SwitchConnectionPtr connection) override{
+        auto& concrete = static_cast<ofMessage&>(*msg.base());
+        for (auto& h : handlers){
+            h(concrete, connection);
         }
     }
     friend class Controller;
@@ -73,6 +77,8 @@ public:
     template<class ofMessage>
     void registerHandler(OfMessageHandler<ofMessage> handler){
         static Handlers<ofMessage> handlers;
+        static std::mutex mutex; // apps are initialized concurrently
+        std::lock_guard<std::mutex> lock(mutex);
         ofMessage tmp;
         __register_handler__(tmp.type(), &handlers);
         handlers.handlers.push_back(handler);
@@ -97,6 +103,16 @@ public:
       */
     uint8_t maxTable() const;
 
+    /**
+      * get packet-in admission control counters of connected switches
+      */
+    std::vector<runos::admission::Stats> admissionStats() const;
+
+    /**
+      * get send queue counters of connected switches
+      */
+    std::vector<runos::sendq::Stats> sendQueueStats() const;
+
 signals:
 
     /**
@@ -0,0 +1,149 @@
+#include "Controller.hh"
+
+#include "Common.hh"
+#include "CommandLine.hh"
+#include "types/latency.hh"
+
+using namespace cli;
+using namespace runos;
+
+struct ShowAdmission {
+    Controller* app;
+    ShowAdmission(Controller* app) : app(app) { }
+    void operator()(const options::variables_map& vm, Outside& out)
+    {
+        auto dpid = vm["dpid"];
+        bool found = false;
+
+        for (const auto& st : app->admissionStats()) {
+            if (not dpid.empty() && st.dpid != dpid.as<uint64_t>())
+                continue;
+            found = true;
+            print_stats(st, out);
+        }
+
+        if (not found) {
+            out.warning("No admission stats available");
+        }
+    }
+
+    void print_stats(const admission::Stats& st, Outside& out)
+    {
+        out.print("Switch. Dpid        : 0x{:x}\n"
+                  "        Queue depth : {:d}\n",
+                  st.dpid, st.queue_depth);
+        for (size_t i = 0; i < admission::class_count; ++i) {
+            const auto& cls = st.classes[i];
+            out.print("        {:<10} : admitted {:d}, queued {:d}, dropped {:d}\n",
+                      admission::to_string(static_cast<admission::PacketClass>(i)),
+                      cls.admitted, cls.queued, cls.dropped);
+        }
+    }
+
+    options::options_description get_descriptions() const {
+        options::options_description desc;
+        desc.add_options()
+            ("dpid,d", options::value<uint64_t>(),
+             "Dpid of switch, stats about should be printed");
+        return desc;
+    }
+};
+
+struct ShowSendQueue {
+    Controller* app;
+    ShowSendQueue(Controller* app) : app(app) { }
+    void operator()(const options::variables_map& vm, Outside& out)
+    {
+        auto dpid = vm["dpid"];
+        bool found = false;
+
+        for (const auto& st : app->sendQueueStats()) {
+            if (not dpid.empty() && st.dpid != dpid.as<uint64_t>())
+                continue;
+            found = true;
+            out.print("Switch. Dpid        : 0x{:x}\n"
+                      "        Queue depth : {:d} messages, {:d} bytes\n"
+                      "        Peak        : {:d} bytes\n"
+                      "        Unconfirmed : {:d} bytes\n"
+                      "        Messages    : queued {:d}, sent {:d}, dropped {:d}\n"
+                      "        Overflows   : {:d}\n",
+                      st.dpid, st.queue_depth, st.queue_bytes, st.peak_bytes,
+                      st.unconfirmed_bytes,
+                      st.queued, st.sent, st.dropped, st.overflows);
+        }
+
+        if (not found) {
+            out.warning("No send queue stats available");
+        }
+    }
+
+    options::options_description get_descriptions() const {
+        options::options_description desc;
+        desc.add_options()
+            ("dpid,d", options::value<uint64_t>(),
+             "Dpid of switch, stats about should be printed");
+        return desc;
+    }
+};
+
+struct ShowLatency {
+    void operator()(const options::variables_map& vm, Outside& out)
+    {
+        if (not vm["reset"].empty()) {
+            latency::reset();
+            out.print("Latency histograms are reset");
+            return;
+        }
+        if (not latency::enabled()) {
+            out.warning("Latency stats are disabled");
+        }
+
+        auto snapshot = latency::snapshot();
+        out.print("{:<9} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}",
+                  "stage, us", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+        for (size_t i = 0; i < latency::stage_count; ++i) {
+            const auto& h = snapshot[i];
+            out.print("{:<9} {:>10d} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}",
+                      latency::to_string(static_cast<latency::Stage>(i)),
+                      h.count(), h.mean() / 1e3,
+                      h.quantile(0.5) / 1e3, h.quantile(0.9) / 1e3,
+                      h.quantile(0.99) / 1e3, h.quantile(0.999) / 1e3,
+                      h.max() / 1e3);
+        }
+    }
+
+    options::options_description get_descriptions() const {
+        options::options_description desc;
+        desc.add_options()
+            ("reset,r", "Reset histograms");
+        return desc;
+    }
+};
+
+class ControllerCli : public Application {
+SIMPLE_APPLICATION(ControllerCli, "controller-cli")
+public:
+    void init(Loader* loader, const Config& config) override
+    {
+        auto app = Controller::get(loader);
+        auto cli = CommandLine::get(loader);
+        ShowAdmission show_admission{app};
+        auto desc = show_admission.get_descriptions();
+        cli->registerCommand("admission", std::move(desc), std::move(show_admission),
+                             "Print packet-in admission control stats");
+
+        ShowSendQueue show_send_queue{app};
+        auto send_queue_desc = show_send_queue.get_descriptions();
+        cli->registerCommand("send-queue", std::move(send_queue_desc),
+                             std::move(show_send_queue),
+                             "Print send queue stats of switches");
+
+        ShowLatency show_latency;
+        auto latency_desc = show_latency.get_descriptions();
+        cli->registerCommand("latency", std::move(latency_desc), std::move(show_latency),
+                             "Print per-stage packet-in latency");
+    }
+};
+
+REGISTER_APPLICATION(ControllerCli,
+        {"controller", "command-line-interface", ""})
@@ -16,6 +16,7 @@
 
 #include "HostManager.hh"
 
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
 #include <fluid/util/ipaddr.hh>
 
@@ -35,7 +36,7 @@ REGISTER_APPLICATION(HostManager, {"switch-manager", "rest-listener", ""})
 
 struct HostImpl {
     uint64_t id;
-    std::string mac;
+    ethaddr mac;
     ipv4addr ip;
     uint64_t switchID;
     uint32_t switchPort;
@@ -43,10 +44,26 @@ struct HostImpl {
 
 struct HostManagerImpl {
     // mac address -> Host
-    std::unordered_map<std::string, Host*> hosts;
+    std::unordered_map<ethaddr, Host*> hosts;
+    // ip address -> Host, hosts with unknown address aren't here
+    std::unordered_map<ipv4addr, Host*> by_ip;
+    // dpid -> port -> attached hosts
+    std::unordered_map<uint64_t,
+        std::unordered_map<uint32_t, std::vector<Host*>>> by_port;
 };
 
-Host::Host(std::string mac, ipv4addr ip)
+namespace {
+const ipv4addr unknown_ip("0.0.0.0");
+
+ethaddr port_mac(of13::Port& port)
+{
+    ethaddr::bytes_type octets;
+    std::copy_n(port.hw_addr().get_data(), octets.size(), octets.begin());
+    return ethaddr(octets);
+}
+}
+
+Host::Host(ethaddr mac, ipv4addr ip)
 {
     m = new HostImpl;
     m->mac = mac;
@@ -60,11 +77,11 @@ Host::~Host()
 uint64_t Host::id() const
 { return m->id; }
 
-std::string Host::mac() const
+ethaddr Host::mac() const
 { return m->mac; }
 
-std::string Host::ip() const
-{ return boost::lexical_cast<std::string>(m->ip); }
+ipv4addr Host::ip() const
+{ return m->ip; }
 
 uint64_t Host::switchID() const
 { return m->switchID; }
@@ -76,7 +93,7 @@ json11::Json Host::to_json() const
 {
     return json11::Json::object {
         {"ID", id_str()},
-        {"mac", mac()},
+        {"mac", boost::lexical_cast<std::string>(mac())},
         {"switch_id", boost::lexical_cast<std::string>(switchID())},
         {"switch_port", (int)switchPort()}
     };
@@ -92,7 +109,7 @@ json11::Json Host::formFloodlightJSON()
 
     return json11::Json::object {
         {"entityClass", "DefaultEntityClass"},
-        {"mac", mac()},
+        {"mac", boost::lexical_cast<std::string>(mac())},
         {"ipv4", "[]"},
         {"vlan", "[]"},
         {"attachmentPoint", attach},
@@ -136,8 +153,7 @@ void HostManager::init(Loader *loader, const Config &config)
 //            [=](Packet& pkt, FlowPtr, Decision decision) {
 //                auto tpkt = packet_cast<TraceablePacket>(pkt);
 //
-//                ethaddr eth_src = pkt.load(ofb_eth_src);
-//                std::string host_mac = boost::lexical_cast<std::string>(eth_src);
+//                ethaddr host_mac = pkt.load(ofb_eth_src);
 //
 //                ipv4addr host_ip("0.0.0.0");
 //                if (pkt.test(ofb_eth_type == 0x0800)) {
@@ -163,8 +179,8 @@ void HostManager::init(Loader *loader, const Config &config)
 //                              << ", Switch ID: " << sw->id() << ", port: " << in_port;
 //                } else {
 //                    Host* h = getHost(host_mac);
-//                    if (host_ip != "0.0.0.0") {
-//                        h->ip(host_ip);
+//                    if (host_ip != unknown_ip) {
+//                        setHostIp(h, host_ip);
 //                    }
 //                }
 //
@@ -189,98 +205,169 @@ void HostManager::onSwitchDiscovered(Switch* dp)
 void HostManager::onSwitchDown(Switch *dp)
 {
     delHostForSwitch(dp);
+
+    std::lock_guard<std::mutex> lk(mutex);
     for (of13::Port port : dp->ports()) {
-        auto pos = std::find(switch_macs.begin(), switch_macs.end(), port.hw_addr().to_string());
+        auto pos = switch_macs.find(port_mac(port));
         if (pos != switch_macs.end())
             switch_macs.erase(pos);
     }
 }
 
-void HostManager::addHost(Switch* sw, ipv4addr ip, std::string mac, uint32_t port)
+void HostManager::addHost(Switch* sw, ipv4addr ip, ethaddr mac, uint32_t port)
 {
     std::lock_guard<std::mutex> lk(mutex);
 
     Host* dev = createHost(mac, ip);
-    attachHost(mac, sw->id(), port);
+    attachHost(dev, sw->id(), port);
     addEvent(Event::Add, dev);
     dev->connectedSince(time(NULL));
     emit hostDiscovered(dev);
 }
 
-Host* HostManager::createHost(std::string mac, ipv4addr ip)
+Host* HostManager::createHost(ethaddr mac, ipv4addr ip)
 {
+    auto old = m->hosts.find(mac);
+    if (old != m->hosts.end()) {
+        // host is rediscovered, indexes must not point to the old one
+        detachHost(old->second);
+        auto by_ip = m->by_ip.find(old->second->ip());
+        if (by_ip != m->by_ip.end() && by_ip->second == old->second)
+            m->by_ip.erase(by_ip);
+    }
+
     Host* dev = new Host(mac, ip);
     m->hosts[mac] = dev;
+    if (ip != unknown_ip)
+        m->by_ip[ip] = dev;
     return dev;
 }
 
-bool HostManager::findMac(std::string mac)
+bool HostManager::findMac(ethaddr mac)
 {
-    if (m->hosts.count(mac) > 0)
-        return true;
-    return false;
+    std::lock_guard<std::mutex> lk(mutex);
+    return m->hosts.count(mac) > 0;
 }
 
-bool HostManager::isSwitch(std::string mac)
+bool HostManager::isSwitch(ethaddr mac)
 {
-    for (auto sw_mac : switch_macs) {
-        if (sw_mac == mac)
-            return true;
-    }
-    return false;
+    std::lock_guard<std::mutex> lk(mutex);
+    return switch_macs.count(mac) > 0;
+}
+
+void HostManager::attachHost(Host* dev, uint64_t id, uint32_t port)
+{
+    dev->switchID(id);
+    dev->switchPort(port);
+    m->by_port[id][port].push_back(dev);
+}
+
+void HostManager::detachHost(Host* dev)
+{
+    auto sw = m->by_port.find(dev->switchID());
+    if (sw == m->by_port.end())
+        return;
+    auto port = sw->second.find(dev->switchPort());
+    if (port == sw->second.end())
+        return;
+
+    auto& attached = port->second;
+    attached.erase(std::remove(attached.begin(), attached.end(), dev),
+                   attached.end());
+    if (attached.empty())
+        sw->second.erase(port);
+    if (sw->second.empty())
+        m->by_port.erase(sw);
 }
 
-void HostManager::attachHost(std::string mac, uint64_t id, uint32_t port)
+void HostManager::setHostIp(Host* dev, ipv4addr ip)
 {
-    m->hosts[mac]->switchID(id);
-    m->hosts[mac]->switchPort(port);
+    std::lock_guard<std::mutex> lk(mutex);
+
+    auto old = m->by_ip.find(dev->ip());
+    if (old != m->by_ip.end() && old->second == dev)
+        m->by_ip.erase(old);
+    dev->ip(ip);
+    if (ip != unknown_ip)
+        m->by_ip[ip] = dev;
 }
 
 void HostManager::delHostForSwitch(Switch *dp)
 {
-    auto itr = m->hosts.begin();
-    while (itr != m->hosts.end()) {
-        if (itr->second->switchID() == dp->id()) {
-            addEvent(Event::Delete, itr->second);
-            m->hosts.erase(itr++);
+    std::lock_guard<std::mutex> lk(mutex);
+
+    auto sw = m->by_port.find(dp->id());
+    if (sw == m->by_port.end())
+        return;
+
+    for (auto& port : sw->second) {
+        for (Host* dev : port.second) {
+            addEvent(Event::Delete, dev);
+            m->hosts.erase(dev->mac());
+            auto by_ip = m->by_ip.find(dev->ip());
+            if (by_ip != m->by_ip.end() && by_ip->second == dev)
+                m->by_ip.erase(by_ip);
         }
-        else
-            ++itr;
     }
+    m->by_port.erase(sw);
 }
 
 Host* HostManager::getHost(std::string mac)
 {
-    if (m->hosts.count(mac) > 0)
-        return m->hosts[mac];
-    else
+    try {
+        return getHost(ethaddr(mac));
+    } catch (ethaddr::bad_representation&) {
+        // e.g. malformed rest request
         return nullptr;
+    }
+}
+
+Host* HostManager::getHost(ethaddr mac)
+{
+    std::lock_guard<std::mutex> lk(mutex);
+    auto it = m->hosts.find(mac);
+    return it != m->hosts.end() ? it->second : nullptr;
 }
 
 Host* HostManager::getHost(ipv4addr ip)
 {
-    auto string_ip = boost::lexical_cast<std::string>(ip);
-    for (auto it : m->hosts) {
-        if (it.second->ip() == string_ip)
-            return it.second;
-    }
-    return nullptr;
+    std::lock_guard<std::mutex> lk(mutex);
+    auto it = m->by_ip.find(ip);
+    return it != m->by_ip.end() ? it->second : nullptr;
+}
+
+std::vector<Host*> HostManager::getHosts(uint64_t dpid, uint32_t port)
+{
+    std::lock_guard<std::mutex> lk(mutex);
+    auto sw = m->by_port.find(dpid);
+    if (sw == m->by_port.end())
+        return {};
+    auto it = sw->second.find(port);
+    if (it == sw->second.end())
+        return {};
+    return it->second;
 }
 
 void HostManager::newPort(Switch *, of13::Port port)
 {
-    switch_macs.push_back(port.hw_addr().to_string());
+    std::lock_guard<std::mutex> lk(mutex);
+    switch_macs.insert(port_mac(port));
 }
 
-std::unordered_map<std::string, Host*> HostManager::hosts()
+std::unordered_map<ethaddr, Host*> HostManager::hosts()
 {
+    std::lock_guard<std::mutex> lk(mutex);
     return m->hosts;
 }
 
 json11::Json HostManager::handleGET(std::vector<std::string> params, std::string body)
 {
     if (params[0] == "hosts") {
-        return json11::Json(hosts()).dump();
+        json11::Json::object ret;
+        for (const auto& host : hosts()) {
+            ret[boost::lexical_cast<std::string>(host.first)] = host.second;
+        }
+        return json11::Json(ret).dump();
     }
 
     return "{}";
@@ -21,6 +21,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <time.h>
 
 #include "Common.hh"
@@ -31,6 +32,7 @@
 #include "Rest.hh"
 #include "AppObject.hh"
 #include "json11.hpp"
+#include "types/ethaddr.hh"
 #include "types/ipv4addr.hh"
 
 /**
@@ -43,8 +45,8 @@ public:
     uint64_t id() const override;
     json11::Json to_json() const override;
     json11::Json formFloodlightJSON();
-    std::string mac() const;
-    std::string ip() const;
+    ethaddr mac() const;
+    ipv4addr ip() const;
     uint64_t switchID() const;
     uint32_t switchPort()const;
     void switchID(uint64_t id);
@@ -52,7 +54,7 @@ public:
     void ip(std::string ip);
     void ip(ipv4addr ip);
 
-    Host(std::string mac, ipv4addr ip);
+    Host(ethaddr mac, ipv4addr ip);
     ~Host();
 };
 
@@ -73,9 +75,12 @@ public:
 
     void init(Loader* loader, const Config& config) override;
 
-    std::unordered_map<std::string, Host*> hosts();
+    std::unordered_map<ethaddr, Host*> hosts();
     Host* getHost(std::string mac);
+    Host* getHost(ethaddr mac);
     Host* getHost(ipv4addr ip);
+    /** Hosts attached to the switch port */
+    std::vector<Host*> getHosts(uint64_t dpid, uint32_t port);
 
     // rest
     bool eventable() override {return true;}
@@ -90,14 +95,17 @@ signals:
     void hostDiscovered(Host* dev);
 private:
     struct HostManagerImpl* m;
-    std::vector<std::string> switch_macs;
+    // ports of the same switch may share an address
+    std::unordered_multiset<ethaddr> switch_macs;
     SwitchManager* m_switch_manager;
     std::mutex mutex;
 
-    void addHost(Switch* sw, ipv4addr ip, std::string mac, uint32_t port);
-    Host* createHost(std::string mac, ipv4addr ip);
-    bool findMac(std::string mac);
-    bool isSwitch(std::string mac);
-    void attachHost(std::string mac, uint64_t id, uint32_t port);
+    void addHost(Switch* sw, ipv4addr ip, ethaddr mac, uint32_t port);
+    Host* createHost(ethaddr mac, ipv4addr ip);
+    bool findMac(ethaddr mac);
+    bool isSwitch(ethaddr mac);
+    void attachHost(Host* dev, uint64_t id, uint32_t port);
+    void detachHost(Host* dev);
+    void setHostIp(Host* dev, ipv4addr ip);
     void delHostForSwitch(Switch* dp);
 };
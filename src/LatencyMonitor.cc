@@ -0,0 +1,86 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LatencyMonitor.hh"
+
+#include "Common.hh"
+#include "RestListener.hh"
+#include "types/latency.hh"
+
+REGISTER_APPLICATION(LatencyMonitor, {"rest-listener", ""})
+
+using namespace runos;
+
+void LatencyMonitor::init(Loader* loader, const Config& rootConfig)
+{
+    Config config = config_cd(rootConfig, "latency-monitor");
+    latency::enable(config_get(config, "enabled", true));
+    LOG(INFO) << "Packet-in latency stats are "
+              << (latency::enabled() ? "enabled" : "disabled");
+
+    RestListener::get(loader)->registerRestHandler(this);
+    acceptPath(Method::GET, "latency");
+    acceptPath(Method::DELETE, "latency");
+}
+
+json11::Json LatencyMonitor::stats() const
+{
+    auto snapshot = latency::snapshot();
+
+    json11::Json::object ret;
+    for (size_t i = 0; i < latency::stage_count; ++i) {
+        const auto& h = snapshot[i];
+        // json11 keeps numbers as double
+        ret[latency::to_string(static_cast<latency::Stage>(i))] =
+            json11::Json::object {
+                {"count", double(h.count())},
+                {"mean", h.mean()},
+                {"min", double(h.min())},
+                {"p50", double(h.quantile(0.5))},
+                {"p90", double(h.quantile(0.9))},
+                {"p99", double(h.quantile(0.99))},
+                {"p999", double(h.quantile(0.999))},
+                {"max", double(h.max())}
+            };
+    }
+    return json11::Json::object {
+        {"enabled", latency::enabled()},
+        {"unit", "ns"},
+        {"stages", ret}
+    };
+}
+
+void LatencyMonitor::reset()
+{
+    latency::reset();
+}
+
+json11::Json LatencyMonitor::handleGET(std::vector<std::string> params, std::string body)
+{
+    if (params[0] == "latency") {
+        return stats();
+    }
+    return "{}";
+}
+
+json11::Json LatencyMonitor::handleDELETE(std::vector<std::string> params, std::string body)
+{
+    if (params[0] == "latency") {
+        reset();
+        return json11::Json::object {{"latency", "reset"}};
+    }
+    return "{}";
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Application.hh"
+#include "Loader.hh"
+#include "Rest.hh"
+#include "json11.hpp"
+
+/**
+ * Exposes per-stage packet-in latency histograms (see types/latency.hh).
+ *
+ * REST:
+ *   GET    /api/latency-monitor/latency -- count, mean and percentiles
+ *                                          of every stage in nanoseconds
+ *   DELETE /api/latency-monitor/latency -- reset histograms
+ */
+class LatencyMonitor : public Application, RestHandler {
+    Q_OBJECT
+    SIMPLE_APPLICATION(LatencyMonitor, "latency-monitor")
+public:
+    void init(Loader* loader, const Config& config) override;
+
+    /** Aggregated histograms of all threads as json */
+    json11::Json stats() const;
+    void reset();
+
+    // rest
+    bool eventable() override { return false; }
+    AppType type() override { return AppType::Service; }
+    json11::Json handleGET(std::vector<std::string> params, std::string body) override;
+    json11::Json handleDELETE(std::vector<std::string> params, std::string body) override;
+};
@@ -16,11 +16,14 @@
 
 #include "LearningSwitch.hh"
 
+#include <algorithm>
+#include <chrono>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <vector>
 #include <boost/optional.hpp>
-#include <boost/thread.hpp>
 
 #include "api/Packet.hh"
 #include "api/PacketMissHandler.hh"
@@ -122,35 +125,117 @@ retic::policy route_policy(data_link_route route) {
     return p;
 }
 
+// MAC table split into independently locked shards.
+// Every shard keeps its entries in LRU order, so expired and
+// least recently seen hosts are found at the front.
 class HostsDatabase {
-    boost::shared_mutex mutex;
-    std::unordered_map<ethaddr, switch_and_port> db;
-
 public:
-    void learn(uint64_t dpid, uint32_t in_port, ethaddr mac)
+    using clock = std::chrono::steady_clock;
+
+    struct Settings {
+        clock::duration aging_time = std::chrono::seconds(300);
+        size_t capacity = 65536;
+        size_t shards = 16;
+    };
+
+    explicit HostsDatabase(Settings settings)
+        : m_settings(settings)
+        , m_shards(std::max<size_t>(settings.shards, 1))
+        , m_shard_capacity(std::max<size_t>(
+                settings.capacity / m_shards.size(), 1))
+    { }
+
+    // returns true if the host was known at another location
+    bool learn(uint64_t dpid, uint32_t in_port, ethaddr mac)
     {
         if (is_broadcast(mac)) { // should we test here??
             DLOG(WARNING) << "Broadcast source address detected";
-            return;
+            return false;
         }
 
-        VLOG(5) << mac << " seen at " << dpid << ':' << in_port;
-        {
-            boost::unique_lock< boost::shared_mutex > lock(mutex);
-            db.emplace(mac, switch_and_port{dpid, in_port});
+        const switch_and_port location{dpid, in_port};
+        const auto now = clock::now();
+        auto& shard = shardOf(mac);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.db.find(mac);
+        if (it != shard.db.end() && not expired(it->second, now)) {
+            auto& entry = it->second;
+            entry.last_seen = now;
+            shard.lru.splice(shard.lru.end(), shard.lru, entry.lru_pos);
+            if (entry.location == location)
+                return false;
+
+            LOG(INFO) << "Host " << mac << " moved from "
+                      << entry.location.dpid << ':' << entry.location.port
+                      << " to " << dpid << ':' << in_port;
+            entry.location = location;
+            return true;
+        }
+
+        if (it != shard.db.end()) {
+            shard.lru.erase(it->second.lru_pos);
+            shard.db.erase(it);
         }
+        evict(shard, now);
+
+        VLOG(5) << mac << " seen at " << dpid << ':' << in_port;
+        auto pos = shard.lru.insert(shard.lru.end(), mac);
+        shard.db.emplace(mac, Entry{location, now, pos});
+        return false;
     }
 
     boost::optional<switch_and_port> query(ethaddr mac)
     {
-        boost::shared_lock< boost::shared_mutex > lock(mutex);
+        auto& shard = shardOf(mac);
+        std::lock_guard<std::mutex> lock(shard.mutex);
 
-        auto it = db.find(mac);
-        if (it != db.end())
-            return it->second;
+        auto it = shard.db.find(mac);
+        if (it != shard.db.end() && not expired(it->second, clock::now()))
+            return it->second.location;
         else
             return boost::none;
     }
+
+private:
+    struct Entry {
+        switch_and_port location;
+        clock::time_point last_seen;
+        std::list<ethaddr>::iterator lru_pos;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<ethaddr, Entry> db;
+        std::list<ethaddr> lru; // least recently seen first
+    };
+
+    const Settings m_settings;
+    std::vector<Shard> m_shards;
+    const size_t m_shard_capacity;
+
+    Shard& shardOf(ethaddr mac)
+    {
+        return m_shards[std::hash<ethaddr>()(mac) % m_shards.size()];
+    }
+
+    bool expired(const Entry& entry, clock::time_point now) const
+    {
+        return now - entry.last_seen > m_settings.aging_time;
+    }
+
+    // drops expired entries and makes room for one more
+    void evict(Shard& shard, clock::time_point now)
+    {
+        while (not shard.lru.empty()) {
+            auto it = shard.db.find(shard.lru.front());
+            if (shard.db.size() < m_shard_capacity &&
+                    not expired(it->second, now))
+                break;
+            shard.db.erase(it);
+            shard.lru.pop_front();
+        }
+    }
 };
 
 std::ostream& operator << (std::ostream &out,const data_link_route &route){
@@ -162,10 +247,17 @@ std::ostream& operator << (std::ostream &out,const data_link_route &route){
     return out;
 }
 
-void LearningSwitch::init(Loader *loader, const Config &)
+void LearningSwitch::init(Loader *loader, const Config &rootConfig)
 {
+    auto config = config_cd(rootConfig, "learning-switch");
+    HostsDatabase::Settings settings;
+    settings.aging_time = std::chrono::seconds(
+            config_get(config, "aging-time", 300));
+    settings.capacity = config_get(config, "capacity", 65536);
+    settings.shards = config_get(config, "shards", 16);
+
     auto topology = Topology::get(loader);
-    auto db = std::make_shared<HostsDatabase>();
+    auto db = std::make_shared<HostsDatabase>(settings);
     m_stp = STP::get(loader);
 
     const auto ofb_in_port = oxm::in_port();
@@ -233,27 +325,34 @@ void LearningSwitch::init(Loader *loader, const Config &)
             uint64_t dpid = tpkt.watch(switch_id);
             uint32_t inport = tpkt.watch(ofb_in_port);
 
-            db->learn(dpid,
-                      inport,
-                      src_mac);
+            if (db->learn(dpid, inport, src_mac)) {
+                // rules and explored traces of the host still lead
+                // to its old location
+                retic->invalidate(ofb_eth_src == src_mac);
+                retic->invalidate(ofb_eth_dst == src_mac);
+            }
 
             auto target = db->query(dst_mac);
-            auto source = db->query(src_mac);
+            // not queried: the entry may be aged out or evicted already
+            switch_and_port source{dpid, inport};
 
             // Forward
             if (target) {
+                // spread flows between hosts over equivalent routes
+                size_t flow_hash = std::hash<ethaddr>()(src_mac) * 31 +
+                                   std::hash<ethaddr>()(dst_mac);
                 auto route = topology
-                             ->computeRoute(source->dpid, target->dpid);
-                if (not route.empty() or target->dpid == source->dpid){
-                    route.insert(route.begin(), *source);
+                             ->selectRoute(source.dpid, target->dpid, flow_hash);
+                if (not route.empty() or target->dpid == source.dpid){
+                    route.insert(route.begin(), source);
                     route.push_back(*target);
-                    DVLOG(10) << "Forwarding packet from " << source->dpid
+                    DVLOG(10) << "Forwarding packet from " << source.dpid
                               << "to " << target->dpid << " through route : "
                               << route;
                     return route_policy(route);
                 } else {
                     LOG(WARNING)
-                        << "Path from " << source->dpid
+                        << "Path from " << source.dpid
                         << "to " << target->dpid << "not found";
                     return stop();
                 }
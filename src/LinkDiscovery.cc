@@ -19,7 +19,9 @@
 
 #include "LinkDiscovery.hh"
 
+#include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <boost/endian/arithmetic.hpp>
 #include <boost/endian/conversion.hpp>
 
@@ -77,6 +79,10 @@ void LinkDiscovery::init(Loader *loader, const Config &rootConfig)
     /* Read configuration */
     auto config = config_cd(rootConfig, "link-discovery");
     c_poll_interval = config_get(config, "poll-interval", 120);
+    c_tick = std::max(config_get(config, "tick", 100), 1);
+    c_retries = std::max(config_get(config, "retries", 2), 0);
+    c_retry_timeout = std::max(config_get(config, "retry-timeout", 1000), 1);
+    m_start = clock::now();
 
     /* Get dependencies */
     ctrl  = Controller::get(loader);
@@ -190,8 +196,8 @@ runos::retic::policy LinkDiscovery::getPolicy() {
 
 void LinkDiscovery::startUp(Loader *)
 {
-    // Start LLDP polling
-    startTimer(c_poll_interval * 1000);
+    // Start LLDP polling and link expiration
+    startTimer(c_tick);
 }
 
 void LinkDiscovery::portUp(Switch *dp, of13::Port port)
@@ -201,31 +207,47 @@ void LinkDiscovery::portUp(Switch *dp, of13::Port port)
         return;
 
     if (!(port.state() & of13::OFPPS_LINK_DOWN)) {
+        switch_and_port ap{dp->id(), port.port_no()};
+        buildLLDP(dp, port);
         // Send first packet immediately
-        sendLLDP(dp, port);
+        sendLLDP(ap);
+        scheduleLLDP(ap);
     }
 }
 
 void LinkDiscovery::portModified(Switch* dp, of13::Port port, of13::Port old_port)
 {
+    if (port.port_no() > of13::OFPP_MAX)
+        return;
+
+    switch_and_port ap{dp->id(), port.port_no()};
     bool live = !(port.state() & of13::OFPPS_LINK_DOWN);
     bool old_live = !(old_port.state() & of13::OFPPS_LINK_DOWN);
 
+    if (live) {
+        // Port address could change, refresh prepared packet
+        buildLLDP(dp, port);
+    }
+
     if (live && !old_live) {
         // Send first packet immediately
-        sendLLDP(dp, port);
+        sendLLDP(ap);
+        scheduleLLDP(ap);
     } else if (!live && old_live) {
         // Remove discovered link if it exists
-        clearLinkAt(switch_and_port{dp->id(), port.port_no()});
+        dropLLDP(ap);
+        clearLinkAt(ap);
     }
 }
 
 void LinkDiscovery::portDown(Switch *dp, uint32_t port_no)
 {
-    clearLinkAt(switch_and_port{dp->id(), port_no});
+    switch_and_port ap{dp->id(), port_no};
+    dropLLDP(ap);
+    clearLinkAt(ap);
 }
 
-void LinkDiscovery::sendLLDP(Switch *dp, of13::Port port)
+void LinkDiscovery::buildLLDP(Switch *dp, of13::Port port)
 {
     lldp_packet lldp;
     uint8_t* mac = port.hw_addr().get_data();
@@ -242,92 +264,158 @@ void LinkDiscovery::sendLLDP(Switch *dp, of13::Port port)
     lldp.ttl_seconds = c_poll_interval;
     lldp.dpid_data   = dp->id();
 
-    VLOG(5) << "Sending LLDP packet to " << port.name();
     of13::PacketOut po;
     of13::OutputAction action(port.port_no(), of13::OFPCML_NO_BUFFER);
     po.buffer_id(OFP_NO_BUFFER);
     po.data(&lldp, sizeof lldp);
     po.add_action(action);
 
-    // Send packet 3 times to prevent drops
-    dp->connection()->send(po);
-    dp->connection()->send(po);
-    dp->connection()->send(po);
+    Beacon& beacon = m_beacons[switch_and_port{dp->id(), port.port_no()}];
+    beacon.conn = dp->connection();
+    uint8_t* buf = po.pack();
+    beacon.packet_out.assign(buf, buf + po.length());
+    OFMsg::free_buffer(buf);
+}
+
+void LinkDiscovery::sendLLDP(const switch_and_port &ap)
+{
+    auto it = m_beacons.find(ap);
+    if (it == m_beacons.end())
+        return;
+
+    VLOG(5) << "Sending LLDP packet to " << ap.dpid << ':' << ap.port;
+    const auto& packet_out = it->second.packet_out;
+    it->second.conn->send(packet_out.data(), packet_out.size());
+}
+
+bool LinkDiscovery::congested(const switch_and_port &ap) const
+{
+    auto it = m_beacons.find(ap);
+    return it != m_beacons.end() && it->second.conn->congested();
+}
+
+void LinkDiscovery::scheduleLLDP(const switch_and_port &ap)
+{
+    // Every port has its own phase within poll interval,
+    // so emission is spread evenly instead of bursts
+    tick_type interval = pollTicks();
+    // std::hash of small dpids and ports isn't uniform, mix it
+    uint64_t h = std::hash<switch_and_port>()(ap) * 0x9e3779b97f4a7c15ULL;
+    tick_type phase = (h >> 32) % interval;
+    tick_type now = currentTick();
+    tick_type next = now + (phase + interval - now % interval) % interval;
+    if (next == now)
+        next += interval;
+    m_emission.schedule(ap, next);
+}
+
+void LinkDiscovery::dropLLDP(const switch_and_port &ap)
+{
+    m_emission.cancel(ap);
+    m_beacons.erase(ap);
 }
 
 void LinkDiscovery::handleBeacon(switch_and_port from, switch_and_port to)
 {
-    DiscoveredLink link{ from, to,
-                         std::chrono::steady_clock::now() +
-                            std::chrono::seconds(c_poll_interval * 2) };
-    bool isNew = true;
-
-    // Remove older edge
-    auto out_it = m_out_edges.find(from);
-    if (out_it != m_out_edges.end()) {
-        m_links.erase(out_it->second);
-        m_out_edges.erase(from);
-        m_out_edges.erase(to);
-        isNew = false;
+    auto link_it = m_links.find(from);
+    bool isNew = link_it == m_links.end() || link_it->second.target != to;
+
+    if (isNew) {
+        // Ends of the link could belong to other links before
+        clearLinkAt(from);
+        clearLinkAt(to);
+        link_it = m_links.emplace(from, DiscoveredLink{ from, to, 0 }).first;
+        m_out_edges[from] = from;
+        m_out_edges[to] = from;
     }
 
-    // Insert new
-    auto it = m_links.insert(link).first;
-    m_out_edges[from] = it;
-    m_out_edges[to] = it;
+    // Both ends send beacon once per interval, wait a half more
+    tick_type interval = pollTicks();
+    link_it->second.retries = 0;
+    m_liveness.schedule(from, currentTick() + interval + interval / 2 + 1);
 
     if (isNew) {
         emit linkDiscovered(from, to);
     }
 }
 
-void LinkDiscovery::clearLinkAt(const switch_and_port &source)
+void LinkDiscovery::beaconMissed(const switch_and_port &source)
 {
-    VLOG(5) << "clearLinkAt " << source.dpid << ':' << source.port;
-
-    switch_and_port target;
-    auto out_edges_it = m_out_edges.find(source);
-    if (out_edges_it == m_out_edges.end())
+    auto link_it = m_links.find(source);
+    if (link_it == m_links.end())
         return;
-    auto edge_it = out_edges_it->second;
 
-    if (edge_it->source == source) {
-        target = edge_it->target;
+    DiscoveredLink& link = link_it->second;
+    if (congested(link.source) || congested(link.target)) {
+        // Beacons were deferred, the link isn't known to be broken
+        VLOG(5) << "Beacon missed on congested " << link.source.dpid << ':'
+                << link.source.port << ", check later";
+        m_liveness.schedule(source, m_liveness.now() +
+                                    (c_retry_timeout + c_tick - 1) / c_tick);
+    } else if (link.retries < c_retries) {
+        // Beacon could be lost, ask both ends again before giving up
+        ++link.retries;
+        VLOG(5) << "Beacon missed on " << link.source.dpid << ':'
+                << link.source.port << ", retry " << link.retries;
+        sendLLDP(link.source);
+        sendLLDP(link.target);
+        m_liveness.schedule(source, m_liveness.now() +
+                                    (c_retry_timeout + c_tick - 1) / c_tick);
     } else {
-        assert(edge_it->target == source);
-        target = edge_it->source;
+        clearLinkAt(source);
     }
+}
+
+void LinkDiscovery::clearLinkAt(const switch_and_port &ap)
+{
+    VLOG(5) << "clearLinkAt " << ap.dpid << ':' << ap.port;
+
+    auto out_edges_it = m_out_edges.find(ap);
+    if (out_edges_it == m_out_edges.end())
+        return;
+
+    auto link_it = m_links.find(out_edges_it->second);
+    CHECK(link_it != m_links.end());
+    DiscoveredLink link = link_it->second;
 
-    m_links.erase(edge_it);
-    CHECK(m_out_edges.erase(source) == 1);
-    CHECK(m_out_edges.erase(target) == 1);
+    m_links.erase(link_it);
+    m_liveness.cancel(link.source);
+    CHECK(m_out_edges.erase(link.source) == 1);
+    CHECK(m_out_edges.erase(link.target) == 1);
 
-    if (source < target)
-        emit linkBroken(source, target);
-    else
-        emit linkBroken(target, source);
+    emit linkBroken(link.source, link.target);
     //ctrl->invalidateTraceTree(); // TODO : smart invalidation
 }
 
-void LinkDiscovery::timerEvent(QTimerEvent*)
+LinkDiscovery::tick_type LinkDiscovery::currentTick() const
 {
-    auto now = std::chrono::steady_clock::now();
-
-    // Remove all expired links
-    while (!m_links.empty() && m_links.begin()->valid_through < now) {
-        auto top = m_links.begin();
-        assert(m_out_edges.erase(top->source) == 1);
-        assert(m_out_edges.erase(top->target) == 1);
-        emit linkBroken(top->source, top->target);
-        m_links.erase(top);
-    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        clock::now() - m_start);
+    return elapsed.count() / c_tick;
+}
 
-    // Send LLDP packets to all known links
-    for (Switch* sw : m_switch_manager->switches()) {
-        for (of13::Port &port : sw->ports()) {
-            if (port.port_no() > of13::OFPP_MAX)
-                continue;
-            sendLLDP(sw, port);
+LinkDiscovery::tick_type LinkDiscovery::pollTicks() const
+{
+    return std::max<tick_type>(c_poll_interval * 1000 / c_tick, 1);
+}
+
+void LinkDiscovery::timerEvent(QTimerEvent*)
+{
+    tick_type now = currentTick();
+
+    // Retry or remove links without recent beacons
+    m_liveness.advance(now, [this](const switch_and_port& source) {
+        beaconMissed(source);
+    });
+
+    // Send LLDP packets to ports which phase has come
+    m_emission.advance(now, [this](const switch_and_port& ap) {
+        if (congested(ap)) {
+            // don't add to the backlog, try on the next tick
+            m_emission.schedule(ap, m_emission.now() + 1);
+            return;
         }
-    }
+        sendLLDP(ap);
+        m_emission.schedule(ap, m_emission.now() + pollTicks());
+    });
 }
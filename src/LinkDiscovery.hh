@@ -16,9 +16,9 @@
 
 #pragma once
 
-#include <set>
 #include <unordered_map>
 #include <chrono>
+#include <vector>
 
 #include "Common.hh"
 #include "Switch.hh"
@@ -26,22 +26,16 @@
 #include "Loader.hh"
 #include "ILinkDiscovery.hh"
 #include "Controller.hh"
+#include "types/timer_wheel.hh"
 
 #include "retic/policies.hh"
 
 struct DiscoveredLink {
-    typedef std::chrono::time_point<std::chrono::steady_clock>
-            valid_through_t;
-
     switch_and_port source;
     switch_and_port target;
-    valid_through_t valid_through;
+    unsigned retries; // LLDP retransmissions since last beacon
 };
 
-inline bool operator<(const DiscoveredLink& a, const DiscoveredLink& b) {
-    return a.valid_through < b.valid_through;
-}
-
 class LinkDiscovery : public Application
                     , public ILinkDiscovery
 {
@@ -67,15 +61,42 @@ protected:
     void timerEvent(QTimerEvent *event) override;
 
 private:
+    typedef std::chrono::steady_clock clock;
+    typedef runos::timer_wheel<switch_and_port> timer_wheel;
+    typedef timer_wheel::tick_type tick_type;
+
+    struct Beacon {
+        runos::SwitchConnectionPtr conn;
+        std::vector<uint8_t> packet_out; // packed OFPT_PACKET_OUT with LLDP
+    };
+
     unsigned c_poll_interval;
+    unsigned c_tick;          // milliseconds
+    unsigned c_retries;
+    unsigned c_retry_timeout; // milliseconds
     SwitchManager* m_switch_manager;
+    clock::time_point m_start;
+
+    // LLDP frames of live ports and time of their next emission
+    std::unordered_map<switch_and_port, Beacon> m_beacons;
+    timer_wheel m_emission;
 
-    std::set<DiscoveredLink> m_links;
-    std::unordered_map<switch_and_port, std::set<DiscoveredLink>::iterator >
-                   m_out_edges;
+    // links by source, their ends and time of expected beacon
+    std::unordered_map<switch_and_port, DiscoveredLink> m_links;
+    std::unordered_map<switch_and_port, switch_and_port> m_out_edges;
+    timer_wheel m_liveness;
 
     Q_INVOKABLE void handleBeacon(switch_and_port from, switch_and_port to);
-    void sendLLDP(Switch *dp, of13::Port port);
+    void buildLLDP(Switch *dp, of13::Port port);
+    void sendLLDP(const switch_and_port & ap);
+    // the switch has a backlog above the send queue high watermark
+    bool congested(const switch_and_port & ap) const;
+    void scheduleLLDP(const switch_and_port & ap);
+    void dropLLDP(const switch_and_port & ap);
+    void beaconMissed(const switch_and_port & source);
     void clearLinkAt(const switch_and_port & ap);
+
+    tick_type currentTick() const;
+    tick_type pollTicks() const;
 };
 
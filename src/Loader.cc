@@ -16,6 +16,9 @@
 
 #include "Loader.hh"
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <vector>
 #include <unordered_map>
 #include <mutex>
@@ -24,10 +27,13 @@
 #include "Application.hh"
 #include "Config.hh"
 
+using clock_type = std::chrono::steady_clock;
+
 enum ApplicationState {
     APP_REGISTERED,
     APP_INITIALIZING,
     APP_INITIALIZED,
+    APP_STARTING,
     APP_STARTED
 };
 
@@ -37,21 +43,32 @@ enum LoaderState {
     RUNNING
 };
 
+class AppThread;
+
 struct AppInfo {
     Application* app;
     ApplicationState state;
 
+    // Dependency graph
+    AppThread* thread;
+    bool resolving;
+    std::vector<AppInfo*> dependents;
+    size_t ndependencies;
+    size_t pending; // dependencies not passed current stage yet
+
     AppInfo() : app(nullptr) { }
     AppInfo(Application* _app) :
-        app(_app), state(APP_REGISTERED)
+        app(_app), state(APP_REGISTERED),
+        thread(nullptr), resolving(false),
+        ndependencies(0), pending(0)
     { }
 };
 
 class AppInitializer : public QObject {
     Q_OBJECT
 public:
-    AppInitializer(const Config& config_)
-        : config(config_)
+    AppInitializer(struct LoaderImpl* loader_, const Config& config_)
+        : loader(loader_), config(config_)
     {
         QObject::connect(this, &AppInitializer::initializeApp,
                          this, &AppInitializer::initializeAppImpl,
@@ -61,32 +78,21 @@ public:
                          Qt::QueuedConnection);
     }
 signals:
-    void initializeApp(Loader*, Application*, std::mutex*);
-    void startApp(Loader*, Application*, std::mutex*);
+    void initializeApp(Loader*, Application*);
+    void startApp(Loader*, Application*);
 protected slots:
-    void initializeAppImpl(Loader*, Application*, std::mutex*);
-    void startAppImpl(Loader*, Application*, std::mutex*);
+    void initializeAppImpl(Loader*, Application*);
+    void startAppImpl(Loader*, Application*);
 private:
+    struct LoaderImpl* loader;
     const Config& config;
 };
 
-void AppInitializer::initializeAppImpl(Loader* loader, Application* app, std::mutex* end_mutex)
-{
-    app->init(loader, config);
-    end_mutex->unlock();
-}
-
-void AppInitializer::startAppImpl(Loader* loader, Application* app, std::mutex* end_mutex)
-{
-    app->startUp(loader);
-    end_mutex->unlock();
-}
-
 class AppThread : public QThread {
     Q_OBJECT
 public:
-    AppThread(const Config& config) 
-        : initializer(config)
+    AppThread(struct LoaderImpl* loader, const Config& config)
+        : initializer(loader, config)
     {
         initializer.moveToThread(this);
     }
@@ -105,25 +111,82 @@ struct LoaderImpl {
     std::vector<AppThread*> thread;
     size_t last_thread;
 
-    // Recursive initialization
-    AppInfo* initialize(std::string service);
+    // Resolved applications, dependencies go first
+    std::vector<AppInfo*> order;
+    bool parallel;
+
+    // Stage scheduling, guards AppInfo::state too
+    std::mutex mutex;
+    std::condition_variable stage_cond;
+    std::deque<AppInfo*> ready;
+    size_t in_flight;
+    size_t remaining;
+
+    // Builds dependency graph and assigns threads
+    AppInfo* resolve(std::string service);
+
+    // Runs init or startUp of resolved apps in dependency order.
+    // Independent apps are processed concurrently on their threads.
+    void runStage(ApplicationState from, ApplicationState to);
+    void launch(AppInfo* info, ApplicationState to);
+    void finished(Application* app, clock_type::duration elapsed, bool ok);
 
     LoaderImpl(Loader* loader, const Config& config_)
         : this_(loader),
           config(config_),
           state(INITIALIZING),
-          last_thread(0)
+          last_thread(0),
+          in_flight(0),
+          remaining(0)
     {
-        size_t nthreads = config_get(config_cd(config, "loader"),
-                                     "threads", 1);
+        auto loader_config = config_cd(config, "loader");
+        size_t nthreads = config_get(loader_config, "threads", 1);
+        parallel = config_get(loader_config, "parallel", true);
         thread.resize(nthreads);
         for (size_t i = 0; i < nthreads; ++i) {
-            thread[i] = new AppThread(config);
+            thread[i] = new AppThread(this, config);
             thread[i]->start();
         }
     }
 };
 
+template<class F>
+static bool run_timed(const char* stage, Application* app,
+                      clock_type::duration& elapsed, F&& f)
+{
+    auto start = clock_type::now();
+    bool ok = true;
+    try {
+        f();
+    } catch (const std::exception& e) {
+        LOG(ERROR) << stage << "(" << app->provides() << ") failed: " << e.what();
+        ok = false;
+    } catch (...) {
+        LOG(ERROR) << stage << "(" << app->provides() << ") failed";
+        ok = false;
+    }
+    elapsed = clock_type::now() - start;
+    return ok;
+}
+
+void AppInitializer::initializeAppImpl(Loader* loader_, Application* app)
+{
+    clock_type::duration elapsed;
+    bool ok = run_timed("init", app, elapsed, [&]() {
+        app->init(loader_, config);
+    });
+    loader->finished(app, elapsed, ok);
+}
+
+void AppInitializer::startAppImpl(Loader* loader_, Application* app)
+{
+    clock_type::duration elapsed;
+    bool ok = run_timed("startUp", app, elapsed, [&]() {
+        app->startUp(loader_);
+    });
+    loader->finished(app, elapsed, ok);
+}
+
 Loader::Loader(const Config& config)
     : m(new LoaderImpl(this, config))
 { }
@@ -136,7 +199,9 @@ Application* Loader::app(std::string interface) const {
     if (info_it == m->apps.end())
         throw std::out_of_range(std::string("App ") + interface + " not found");
 
-    if (info_it->second.state != APP_INITIALIZED)
+    std::lock_guard<std::mutex> lock(m->mutex);
+    auto state = info_it->second.state;
+    if (state != APP_INITIALIZED && state != APP_STARTING && state != APP_STARTED)
         throw std::out_of_range("App is not initialized yet");
     return info_it->second.app;
 }
@@ -151,36 +216,35 @@ void Loader::startAll()
         }
     }
 
-    LOG(INFO) << "Initializing...";
     auto services = m->config.at("services");
     for (auto& serviceName : services.array_items())
-        m->initialize(serviceName.string_value());
+        m->resolve(serviceName.string_value());
+
+    auto start = clock_type::now();
+
+    LOG(INFO) << "Initializing...";
+    m->runStage(APP_REGISTERED, APP_INITIALIZED);
+
+    auto initialized = clock_type::now();
 
     LOG(INFO) << "Starting...";
     m->state = STARTING;
-    for (auto& servicePair : m->apps) {
-        auto& info = servicePair.second;
-        if (info.state != APP_INITIALIZED)
-            continue;
-        
-        try {
-            LOG(INFO) << "  startUp(" << servicePair.first << ")";
-            AppThread* app_thread = qobject_cast<AppThread*>(info.app->thread());
-            std::mutex start_mutex;
-            start_mutex.lock();
-            emit app_thread->initializer.startApp(m->this_, info.app, &start_mutex);
-            start_mutex.lock();
-            info.state = APP_STARTED;
-        } catch(...) {
-            LOG(FATAL) << "Failed to start " << servicePair.first;
-        }
-    }
+    m->runStage(APP_INITIALIZED, APP_STARTED);
+
+    auto started = clock_type::now();
+
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    LOG(INFO) << "Initialized " << m->order.size() << " applications in "
+              << duration_cast<milliseconds>(initialized - start).count() << " ms, "
+              << "started in "
+              << duration_cast<milliseconds>(started - initialized).count() << " ms";
 
     m->state = RUNNING;
     LOG(INFO) << "Controller is up!";
 }
 
-AppInfo* LoaderImpl::initialize(std::string serviceId)
+AppInfo* LoaderImpl::resolve(std::string serviceId)
 {
     auto app_it = apps.find(serviceId);
     if (app_it == apps.end()) {
@@ -190,24 +254,27 @@ AppInfo* LoaderImpl::initialize(std::string serviceId)
 
     AppInfo& appInfo = app_it->second;
     Application* app = appInfo.app;
-    if (appInfo.state != APP_REGISTERED)
+    if (appInfo.thread != nullptr)
         return &appInfo;
 
-    appInfo.state = APP_INITIALIZING;
+    if (appInfo.resolving) {
+        LOG(FATAL) << "Cyclic dependencies detected on " << serviceId;
+    }
+    appInfo.resolving = true;
 
+    std::vector<AppInfo*> dependencies;
     for (auto dependsOn = app->dependsOn(config);
          !dependsOn->empty();
          ++dependsOn)
     {
-        AppInfo* dependency = initialize(*dependsOn);
+        AppInfo* dependency = resolve(*dependsOn);
         if (dependency == nullptr) {
+            appInfo.resolving = false;
             return nullptr;
         }
-        if (dependency->state == APP_INITIALIZING) {
-            LOG(FATAL) << "Cyclic dependencies detected";
-            // TODO: print cycle to log
-        }
+        dependencies.push_back(dependency);
     }
+    appInfo.resolving = false;
 
     AppThread *app_thread;
     int specific_thread = config_get(config_cd(config, app->provides()),
@@ -227,17 +294,91 @@ AppInfo* LoaderImpl::initialize(std::string serviceId)
             << ", " << last_thread << ':' << app_thread << ")";
     }
 
-
-    LOG(INFO) << "  init(" << serviceId << ")";
     app->moveToThread(app_thread);
+    appInfo.thread = app_thread;
 
-    std::mutex init_mutex;
-    init_mutex.lock();
-    emit app_thread->initializer.initializeApp(this_, app, &init_mutex);
-    init_mutex.lock();
+    for (auto dependency : dependencies) {
+        dependency->dependents.push_back(&appInfo);
+    }
+    appInfo.ndependencies = dependencies.size();
+    order.push_back(&appInfo);
 
-    appInfo.state = APP_INITIALIZED;
     return &appInfo;
 }
 
+void LoaderImpl::runStage(ApplicationState from, ApplicationState to)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    ready.clear();
+    remaining = 0;
+    for (auto info : order) {
+        if (info->state != from)
+            continue;
+        info->pending = info->ndependencies;
+        ++remaining;
+    }
+    for (auto info : order) {
+        if (info->state == from && info->pending == 0)
+            ready.push_back(info);
+    }
+
+    while (remaining > 0) {
+        while (!ready.empty() && (parallel || in_flight == 0)) {
+            AppInfo* info = ready.front();
+            ready.pop_front();
+            launch(info, to);
+        }
+
+        if (in_flight == 0) {
+            LOG(FATAL) << "Applications can't be scheduled, "
+                       << remaining << " left";
+            break;
+        }
+        stage_cond.wait(lock);
+    }
+}
+
+void LoaderImpl::launch(AppInfo* info, ApplicationState to)
+{
+    ++in_flight;
+    if (to == APP_INITIALIZED) {
+        info->state = APP_INITIALIZING;
+        LOG(INFO) << "  init(" << info->app->provides() << ")";
+        emit info->thread->initializer.initializeApp(this_, info->app);
+    } else {
+        info->state = APP_STARTING;
+        LOG(INFO) << "  startUp(" << info->app->provides() << ")";
+        emit info->thread->initializer.startApp(this_, info->app);
+    }
+}
+
+void LoaderImpl::finished(Application* app, clock_type::duration elapsed, bool ok)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    AppInfo& info = apps.at(app->provides());
+    const char* stage = info.state == APP_INITIALIZING ? "init" : "startUp";
+
+    if (not ok) {
+        LOG(FATAL) << "Failed to " << stage << " " << app->provides();
+    }
+
+    info.state = info.state == APP_INITIALIZING ? APP_INITIALIZED
+                                                : APP_STARTED;
+
+    LOG(INFO) << "  " << stage << "(" << app->provides() << ") done in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+              << " ms";
+
+    for (auto dependent : info.dependents) {
+        if (--dependent->pending == 0)
+            ready.push_back(dependent);
+    }
+
+    --in_flight;
+    --remaining;
+    stage_cond.notify_one();
+}
+
 #include "Loader.moc"
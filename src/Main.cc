@@ -75,7 +75,11 @@ int main(int argc, char* argv[]) {
     desc.add_options()
         ("help,h", "Show help and exit")
         ("config,c", po::value<std::string>(&configFile)->default_value("network-settings.json"), "Set a settings file")
-        ("profile,f", po::value<std::string>(&profile)->default_value("default"), "Set a profile of setting file");
+        ("profile,f", po::value<std::string>(&profile)->default_value("default"), "Set a profile of setting file")
+        ("capture", po::value<std::string>(), "Record received OpenFlow messages into a file")
+        ("replay", po::value<std::string>(), "Replay recorded OpenFlow messages instead of accepting switches")
+        ("replay-fast", "Replay messages as fast as possible instead of recorded pace")
+        ("replay-quit", "Quit when replay is finished");
     po::variables_map vm;
     po::parsed_options parsed = po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
     po::store(parsed, vm);
@@ -86,6 +90,18 @@ int main(int argc, char* argv[]) {
     }
     Config config = loadConfig(configFile, profile);
 
+    // command line overrides `controller` settings
+    Config controller = config_cd(config, "controller");
+    if (vm.count("capture"))
+        controller["capture"] = vm["capture"].as<std::string>();
+    if (vm.count("replay"))
+        controller["replay"] = vm["replay"].as<std::string>();
+    if (vm.count("replay-fast"))
+        controller["replay-pacing"] = "fast";
+    if (vm.count("replay-quit"))
+        controller["replay-quit"] = true;
+    config["controller"] = controller;
+
     Loader loader(config);
     loader.startAll();
 
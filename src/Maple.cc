@@ -17,9 +17,12 @@
 #include "Maple.hh"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
 #include <sstream>
 #include <memory>
@@ -35,6 +38,8 @@
 #include "oxm/field_set.hh"
 #include "oxm/openflow_basic.hh" //switch_id
 #include "types/exception.hh"
+#include "types/latency.hh"
+#include "types/lru_order.hh"
 
 #include "Controller.hh"
 #include "Decision.hh"
@@ -317,6 +322,7 @@ public:
 
     void activate()
     {
+        latency::Timer timer{latency::Stage::Install};
         installTrigger = true;
         m_installer();
         if (not disposable()) {
@@ -452,6 +458,8 @@ class MapleBackend : public maple::Backend {
     // hash by string : match={...}prio=...
     // hash provide non collision for same rules, but differenet switches
     mutable std::unordered_set<std::pair<uint64_t, size_t>> miss_rules;
+    // flows are removed by gc outside of the trace tree lock
+    std::mutex miss_mutex; // guards miss_rules and miss
     std::unordered_map<uint64_t, SwitchConnectionPtr> conections;
 
     oxm::switch_id of_switch_id = oxm::switch_id();
@@ -505,6 +513,16 @@ class MapleBackend : public maple::Backend {
         return std::move(result);
     }
 
+    static size_t barrier_hash(unsigned priority,
+                               oxm::expirementer::full_field_set const& match)
+    {
+        // hash by string : match={...}prio=...
+        std::stringstream tmp;
+        tmp << "match={" << match << "}"
+            << "prio="<<priority;
+        return std::hash<std::string>()(tmp.str());
+    }
+
 public:
     explicit MapleBackend(uint8_t table)
         : table(table), miss{new FlowImpl(table) }
@@ -552,16 +570,9 @@ public:
             test_type.id () == of_switch_id.id()){
             return;
         }
-        size_t hash;
-        std::stringstream tmp;
-        tmp << "match={" << match << "}"
-            << "prio="<<priority;
-        std::string tmp_str = tmp.str();
-        std::hash<std::string> tmp_hash;
-        hash = tmp_hash(tmp_str);
-
         // id for same rule with different switches
-        std::pair<uint64_t, size_t> full_id = {id, hash};
+        std::pair<uint64_t, size_t> full_id = {id, barrier_hash(priority, match)};
+        std::lock_guard<std::mutex> lock(miss_mutex);
         auto it = miss_rules.find(full_id);
         if (it == miss_rules.end()){
             DVLOG(20) << "barrier rule install"
@@ -574,12 +585,57 @@ public:
         }
     }
 
+    virtual void remove_barrier(unsigned priority,
+                                oxm::expirementer::full_field_set const& _match,
+                                oxm::field<> const& test,
+                                uint64_t id) override
+    {
+        oxm::type test_type = test.type();
+        if (test_type.ns() == of_switch_id.ns() &&
+            test_type.id () == of_switch_id.id()){
+            return;
+        }
+        std::lock_guard<std::mutex> lock(miss_mutex);
+        if (not miss_rules.erase({id, barrier_hash(priority, _match)}))
+            return; // wasn't installed since last remove
+
+        DVLOG(20) << "barrier rule remove"
+                  << " match={" << _match << "} "
+                  << "prio=" << priority;
+
+        std::set<uint64_t> switches = compute_switches(_match, miss);
+        auto match = _match;
+        match.erase(oxm::mask<>(of_switch_id));
+        for (auto& fs : match.included().fields()) {
+            of13::FlowMod fm;
+            fm.command(of13::OFPFC_DELETE_STRICT);
+
+            fm.table_id(table);
+            fm.cookie(miss->cookie());
+            fm.cookie_mask(uint64_t(-1));
+            fm.match(make_of_match(fs));
+            fm.priority(priority);
+
+            fm.out_port(of13::OFPP_ANY);
+            fm.out_group(of13::OFPG_ANY);
+
+            for (uint64_t dpid : switches) {
+                auto it = connections.find(dpid);
+                if (it != connections.end())
+                    it->second->send(fm);
+            }
+        }
+    }
+
     void remove(oxm::field_set const& _match) override
     {
         DVLOG(20) << "Removing flows matching {" << _match << "}" << " on switch ";
 
         // clear cache of muss_rules
-        miss_rules.clear();
+        {
+            std::lock_guard<std::mutex> lock(miss_mutex);
+            miss_rules.clear();
+        }
 
         auto match = _match;
         match.erase(oxm::mask<>(of_switch_id));
@@ -612,7 +668,10 @@ public:
                   << " with " << _match;
 
         // clear cache of muss_rules
-        miss_rules.clear();
+        {
+            std::lock_guard<std::mutex> lock(miss_mutex);
+            miss_rules.clear();
+        }
 
         auto match = _match;
         match.erase(oxm::mask<>(of_switch_id));
@@ -646,7 +705,10 @@ public:
 
         //clear cache of miss rule
         //TODO : maybe uneccessary
-        miss_rules.clear();
+        {
+            std::lock_guard<std::mutex> lock(miss_mutex);
+            miss_rules.clear();
+        }
 
         of13::FlowMod fm;
         fm.command(of13::OFPFC_DELETE);
@@ -682,10 +744,34 @@ struct runos::MapleImpl {
     MapleBackend backend;
     maple::Runtime<DecisionImpl, FlowImpl> runtime;
     PacketMissPipeline pipeline;
-    std::unordered_map<uint64_t, FlowImplPtr> flows;
     uint8_t handler_table;
 
+    // Packet-ins are handled by several connection threads.
+    // Lookups share the trace tree, augmentation and collection
+    // change it exclusively. Installers read the tree.
+    std::shared_mutex tree_mutex;
+    // flows are installed one at a time, lookups don't wait for it
+    std::mutex install_mutex;
+
+    std::mutex flows_mutex; // guards flows and lru
+    std::unordered_map<uint64_t, FlowImplPtr> flows;
+    // cookies of flows by last packet-in
+    lru_order<uint64_t> lru;
+
+    size_t max_flows{65536}; // 0 means unlimited
+    unsigned gc_interval{1024}; // packet-ins between collections
+    size_t gc_budget{4096}; // nodes visited by one gc pass, 0 means all
+    std::atomic<unsigned> packet_ins{0};
+
+    // collection runs in its own thread, packet-ins only wake it
+    std::thread gc_thread;
+    std::mutex gc_mutex;
+    std::condition_variable gc_cond;
+    bool gc_requested{false};
+    bool gc_stopping{false};
+
     std::unordered_map<std::string, PacketMissHandler> handlers;
+    std::mutex handlers_mutex;
 
     MapleImpl(Maple& maple,
               uint8_t handler_table=0)
@@ -695,6 +781,18 @@ struct runos::MapleImpl {
         , handler_table(handler_table)
     {  }
 
+    ~MapleImpl()
+    {
+        if (gc_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(gc_mutex);
+                gc_stopping = true;
+            }
+            gc_cond.notify_one();
+            gc_thread.join();
+        }
+    }
+
     void createSwitchScope(SwitchConnectionPtr conn)
     {
         backend.add_switch(conn);
@@ -703,6 +801,7 @@ struct runos::MapleImpl {
 
     DecisionImpl process(Packet& pkt, FlowImplPtr flow) const
     {
+        latency::Timer timer{latency::Stage::Execute};
         DecisionImpl ret = DecisionImpl{};
         for (auto& handler: pipeline) {
             try {
@@ -727,27 +826,135 @@ struct runos::MapleImpl {
         return false;
     }
 
+    // under flows_mutex
+    void touch(const FlowImplPtr& flow)
+    {
+        lru.touch(flow->cookie());
+    }
+
+    // under flows_mutex
+    void forget(uint64_t cookie)
+    {
+        flows.erase(cookie);
+        lru.erase(cookie);
+    }
+
+    void startGc();
+    void requestGc();
+    void collectGarbage();
     void processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connection);
     void processFlowRemoved(of13::FlowRemoved& fr);
 };
 
+void MapleImpl::startGc()
+{
+    if (gc_interval == 0)
+        return;
+
+    gc_thread = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(gc_mutex);
+        for (;;) {
+            gc_cond.wait(lock, [this]() {
+                return gc_requested || gc_stopping;
+            });
+            if (gc_stopping)
+                return;
+            gc_requested = false;
+
+            lock.unlock();
+            collectGarbage();
+            lock.lock();
+        }
+    });
+}
+
+void MapleImpl::requestGc()
+{
+    {
+        std::lock_guard<std::mutex> lock(gc_mutex);
+        gc_requested = true;
+    }
+    gc_cond.notify_one();
+}
+
+void MapleImpl::collectGarbage()
+{
+    size_t evicted = 0;
+    std::vector<FlowImplPtr> active;
+    {
+        std::lock_guard<std::mutex> lock(flows_mutex);
+        while (max_flows != 0 && flows.size() > max_flows) {
+            uint64_t cookie = lru.coldest();
+            auto it = flows.find(cookie);
+            if (it != flows.end() &&
+                it->second->state() == Flow::State::Active)
+            {
+                active.push_back(it->second);
+            }
+            forget(cookie);
+            evicted++;
+        }
+    }
+
+    // rules of evicted flows are removed by cookie, the tree isn't needed
+    for (auto& flow : active) {
+        backend.remove(flow);
+    }
+    active.clear();
+
+    // trace tree holds flows weakly, so forgotten ones are pruned now.
+    // A pass visits at most gc_budget nodes, so packet-ins wait for
+    // the exclusive lock for a bounded time between passes.
+    size_t removed = 0;
+    bool finished = false;
+    while (not finished) {
+        std::unique_lock<std::shared_mutex> lock(tree_mutex);
+        removed += runtime.gc(gc_budget);
+        finished = runtime.gc_finished();
+    }
+    if (evicted || removed) {
+        DVLOG(5) << "Trace tree gc: evicted " << evicted << " flows, "
+                 << "removed " << removed << " nodes";
+    }
+}
+
 void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connection)
 {
     DVLOG(10) << "Packet-in on switch " << connection->dpid()
               << (isTableMiss(pi) ? " (miss)" : " (inspect)");
 
+    if (gc_interval != 0 && ++packet_ins % gc_interval == 0) {
+        requestGc();
+    }
+
+    latency::Timer total_timer{latency::Stage::Total};
+
     // Serializes to/from raw buffer
+    latency::Timer parse_timer{latency::Stage::Parse};
     PacketParser pkt { pi, connection->dpid() };
+    parse_timer.stop();
+
     // Find flow in the trace tree
-    std::shared_ptr<FlowImpl> flow = runtime(pkt);
+    latency::Timer lookup_timer{latency::Stage::Lookup};
+    std::shared_ptr<FlowImpl> flow;
+    {
+        std::shared_lock<std::shared_mutex> lock(tree_mutex);
+        flow = runtime(pkt);
+    }
+    lookup_timer.stop();
 
+    {
+        // flows and lru are changed together
+        std::lock_guard<std::mutex> lock(flows_mutex);
+        // Delete flow if it doesn't found or expired
+        if (flow == nullptr || flow->state() == Flow::State::Expired) {
+            flow = std::make_shared<FlowImpl>(handler_table);
+            flows[flow->cookie()] = flow;
+        }
+        touch(flow);
+    }
     DVLOG(30) << "flow cookie is : " << std::setbase(16)
               << flow->cookie() << " packet cookie : " << pi.cookie();
-    // Delete flow if it doesn't found or expired
-    if (flow == nullptr || flow->state() == Flow::State::Expired) {
-        flow = std::make_shared<FlowImpl>(handler_table);
-        flows[flow->cookie()] = flow;
-    }
     if (flow->preprocess(pkt, flow)){
         return;
     }
@@ -762,25 +969,32 @@ void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connecti
         {
             ModTrackingPacket mpkt {pkt};
             maple::Installer installer;
-            try{
-                std::tie(flow, installer) = runtime.augment(mpkt, flow);
-            } catch (maple::priority_exceeded& e){
-                LOG(WARNING) << "Exceeded priority, Trying update trace tree"
-                             << "On switch : " << connection->dpid();
-                try {
-                    runtime.update();
+            {
+                std::unique_lock<std::shared_mutex> lock(tree_mutex);
+                latency::Timer augment_timer{latency::Stage::Augment};
+                try{
                     std::tie(flow, installer) = runtime.augment(mpkt, flow);
-                } catch (...) {
-                    LOG(ERROR) << "Exceeded priority range."
-                               << "Too many test functions"
-                               << "on switch : " << connection->dpid();
-                    // nothing we can do
-                    throw;
+                } catch (maple::priority_exceeded& e){
+                    LOG(WARNING) << "Exceeded priority, Trying update trace tree"
+                                 << "On switch : " << connection->dpid();
+                    try {
+                        runtime.update();
+                        std::tie(flow, installer) = runtime.augment(mpkt, flow);
+                    } catch (...) {
+                        LOG(ERROR) << "Exceeded priority range."
+                                   << "Too many test functions"
+                                   << "on switch : " << connection->dpid();
+                        // nothing we can do
+                        throw;
+                    }
+                        LOG(INFO) << "Updating trace tree succesful";
                 }
-                    LOG(INFO) << "Updating trace tree succesful";
             }
             flow->mods( std::move(mpkt.mods()) );
             flow->installer(installer);
+            // installer reads the tree, other packet-ins may look it up
+            std::shared_lock<std::shared_mutex> lock(tree_mutex);
+            std::lock_guard<std::mutex> install_lock(install_mutex);
             flow->activate(); // this is needed way to install flow
         }
         break;
@@ -799,6 +1013,8 @@ void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connecti
             if (not isTableMiss(pi)){
                 flow->decision(process(pkt, flow));
             } else {
+                std::shared_lock<std::shared_mutex> lock(tree_mutex);
+                std::lock_guard<std::mutex> install_lock(install_mutex);
                 flow->activate();
             }
             // Maybe this packet arrived on switch when maple reload table, but may be from remowed flows
@@ -811,14 +1027,20 @@ void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connecti
 
 void MapleImpl::processFlowRemoved(of13::FlowRemoved& fr)
 {
-    auto it = flows.find( fr.cookie() );
-    if (it == flows.end())
-        return;
-    auto flow = it->second;
+    FlowImplPtr flow;
+    {
+        std::lock_guard<std::mutex> lock(flows_mutex);
+        auto it = flows.find( fr.cookie() );
+        if (it == flows.end())
+            return;
+        flow = it->second;
+    }
 
     flow->flow_removed(fr);
-    if (flow->state() == Flow::State::Expired)
-        flows.erase(it);
+    if (flow->state() == Flow::State::Expired) {
+        std::lock_guard<std::mutex> lock(flows_mutex);
+        forget(fr.cookie());
+    }
 }
 
 
@@ -828,6 +1050,9 @@ void Maple::init(Loader* loader, const Config& root_config)
     uint8_t handler_table = ctrl->getTable("maple");
     impl.reset(new MapleImpl(*this, handler_table));
     impl->config = config_cd(root_config, "maple");
+    impl->max_flows = config_get(impl->config, "max-flows", 65536);
+    impl->gc_interval = config_get(impl->config, "gc-interval", 1024);
+    impl->gc_budget = config_get(impl->config, "gc-budget", 4096);
     ctrl->registerHandler<of13::PacketIn>(
             [=](of13::PacketIn &pi, SwitchConnectionPtr conn){
                 //TODO : create a copy of packetIn
@@ -860,6 +1085,7 @@ void Maple::startUp(Loader*)
     // TODO: print unused handlers
 
     impl->started = true;
+    impl->startGc();
 }
 
 void Maple::onSwitchUp(SwitchConnectionPtr conn, of13::FeaturesReply fr)
@@ -876,6 +1102,7 @@ void Maple::registerHandler(const char* name,
     }
 
     VLOG(10) << "Registering flow processor " << name;
+    std::lock_guard<std::mutex> lock(impl->handlers_mutex);
     impl->handlers[std::string(name)] = handler;
 }
 
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MessageLog.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/exception/errinfo_errno.hpp>
+#include <boost/exception/errinfo_file_name.hpp>
+#include <glog/logging.h>
+
+namespace runos {
+namespace msglog {
+
+namespace {
+
+const char magic[8] = {'R', 'U', 'N', 'O', 'S', 'M', 'S', 'G'};
+const uint8_t padding[8] = {};
+
+size_t padded(size_t len)
+{
+    return (len + 7) & ~size_t(7);
+}
+
+} // namespace
+
+/* ==== Writer ==== */
+
+Writer::Writer(const std::string& path)
+    : m_file(std::fopen(path.c_str(), "wb"))
+    , m_start(clock::now())
+    , m_last_flush(m_start)
+{
+    if (m_file == nullptr) {
+        RUNOS_THROW(error()
+                << boost::errinfo_errno(errno)
+                << boost::errinfo_file_name(path)
+                << errinfo_msg("Can't open message log for writing"));
+    }
+    // messages are small, let stdio batch them
+    std::setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+
+    FileHeader header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.header_size = sizeof(FileHeader);
+    header.start_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    if (std::fwrite(&header, sizeof(header), 1, m_file) != 1) {
+        std::fclose(m_file);
+        RUNOS_THROW(error()
+                << boost::errinfo_errno(errno)
+                << boost::errinfo_file_name(path)
+                << errinfo_msg("Can't write message log header"));
+    }
+}
+
+Writer::~Writer()
+{
+    std::fclose(m_file);
+}
+
+void Writer::write(uint64_t dpid, uint8_t type, const void* data, size_t len)
+{
+    RecordHeader header{};
+    header.dpid = dpid;
+    header.length = uint32_t(len);
+    header.type = type;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // under the lock: records are ordered by time
+    auto now = clock::now();
+    header.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - m_start).count();
+    size_t pad = padded(len) - len;
+    check(std::fwrite(&header, sizeof(header), 1, m_file) == 1 &&
+          std::fwrite(data, 1, len, m_file) == len &&
+          std::fwrite(padding, 1, pad, m_file) == pad);
+    ++m_records;
+
+    if (now - m_last_flush >= std::chrono::seconds(1)) {
+        check(std::fflush(m_file) == 0);
+        m_last_flush = now;
+    }
+}
+
+void Writer::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    check(std::fflush(m_file) == 0);
+}
+
+void Writer::check(bool ok)
+{
+    // disk full is not a reason to stop the controller, but say it once
+    if (not ok && not m_failed) {
+        m_failed = true;
+        LOG(ERROR) << "Message log write failed: " << std::strerror(errno)
+                   << ", the log is incomplete";
+    }
+}
+
+/* ==== Reader ==== */
+
+Reader::Reader(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        RUNOS_THROW(error()
+                << boost::errinfo_errno(errno)
+                << boost::errinfo_file_name(path)
+                << errinfo_msg("Can't open message log"));
+    }
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(FileHeader))) {
+        map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+
+    if (map == MAP_FAILED) {
+        RUNOS_THROW(error()
+                << boost::errinfo_file_name(path)
+                << errinfo_msg("Can't map message log"));
+    }
+    ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    m_size = st.st_size;
+    m_begin = static_cast<const uint8_t*>(map);
+    m_end = m_begin + m_size;
+
+    auto header = reinterpret_cast<const FileHeader*>(m_begin);
+    if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 ||
+        header->version != version ||
+        header->header_size < sizeof(FileHeader) ||
+        header->header_size > m_size)
+    {
+        ::munmap(const_cast<uint8_t*>(m_begin), m_size);
+        RUNOS_THROW(error()
+                << boost::errinfo_file_name(path)
+                << errinfo_msg("Not a message log or unsupported version"));
+    }
+    rewind();
+}
+
+Reader::~Reader()
+{
+    ::munmap(const_cast<uint8_t*>(m_begin), m_size);
+}
+
+uint64_t Reader::startTime() const
+{
+    return reinterpret_cast<const FileHeader*>(m_begin)->start_time;
+}
+
+bool Reader::next(Record& record)
+{
+    if (size_t(m_end - m_pos) < sizeof(RecordHeader))
+        return false;
+
+    auto header = reinterpret_cast<const RecordHeader*>(m_pos);
+    const uint8_t* data = m_pos + sizeof(RecordHeader);
+    if (size_t(m_end - data) < header->length)
+        return false;
+
+    record.time = header->time;
+    record.dpid = header->dpid;
+    record.type = header->type;
+    record.data = data;
+    record.len = header->length;
+
+    m_pos = data + std::min(padded(header->length), size_t(m_end - data));
+    return true;
+}
+
+void Reader::rewind()
+{
+    m_pos = m_begin + reinterpret_cast<const FileHeader*>(m_begin)->header_size;
+}
+
+} // namespace msglog
+} // namespace runos
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "types/exception.hh"
+
+namespace runos {
+namespace msglog {
+
+/**
+ * Log of OpenFlow messages received by the controller.
+ *
+ * The file is a header followed by records, every record is a fixed
+ * 24-byte header and a message in wire format padded to 8 bytes, so the
+ * file can be mapped into memory and walked without copying.
+ * Integers are stored in host byte order.
+ */
+struct FileHeader {
+    char magic[8];       // "RUNOSMSG"
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t start_time; // unix time of capture start, ns
+    uint64_t reserved;
+};
+
+struct RecordHeader {
+    uint64_t time;   // ns since capture start
+    uint64_t dpid;   // 0 if the switch is not known yet
+    uint32_t length; // message length without padding
+    uint8_t type;    // OpenFlow message type
+    uint8_t pad[3];
+};
+
+static_assert(sizeof(FileHeader) == 32, "unexpected padding");
+static_assert(sizeof(RecordHeader) == 24, "unexpected padding");
+
+constexpr uint32_t version = 1;
+
+struct error : virtual runtime_error { };
+
+struct Record {
+    uint64_t time;
+    uint64_t dpid;
+    uint8_t type;
+    const uint8_t* data;
+    size_t len;
+};
+
+/**
+ * Appends messages to the log. Thread-safe.
+ * Output is buffered and flushed at least once a second.
+ */
+class Writer {
+public:
+    explicit Writer(const std::string& path);
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void write(uint64_t dpid, uint8_t type, const void* data, size_t len);
+    void flush();
+
+    uint64_t records() const
+    { return m_records; }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::FILE* m_file;
+    clock::time_point m_start;
+    clock::time_point m_last_flush;
+    uint64_t m_records {0};
+    bool m_failed {false};
+    std::mutex m_mutex;
+
+    void check(bool ok);
+};
+
+/**
+ * Reads memory-mapped log.
+ * A record truncated by controller crash ends the log.
+ */
+class Reader {
+public:
+    explicit Reader(const std::string& path);
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    /** Unix time of capture start, ns */
+    uint64_t startTime() const;
+
+    /** @return false at the end of the log */
+    bool next(Record& record);
+
+    void rewind();
+
+private:
+    const uint8_t* m_begin;
+    const uint8_t* m_end;
+    const uint8_t* m_pos;
+    size_t m_size;
+};
+
+} // namespace msglog
+} // namespace runos
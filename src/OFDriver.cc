@@ -1,5 +1,12 @@
 #include "OFDriver.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
 #include "oxm/field_set.hh"
 #include "types/exception.hh"
 #include "SwitchConnection.hh"
@@ -11,13 +18,38 @@
 namespace runos {
 namespace {
 
+// Cookie layout: | 0 | space (7 bits) | generation (24 bits) | rule (32 bits) |
+// The highest bit is left for maple flows.
+constexpr uint64_t COOKIE_SPACE = 0x01ULL << 56;
+constexpr uint64_t SPACE_MASK = 0xff00000000000000ULL;
+constexpr uint64_t GENERATION_MASK = 0xffffffff00000000ULL;
+constexpr uint32_t MAX_GENERATION = 0xffffff;
+
+std::atomic<uint32_t> last_generation {0};
+// group ids are unique too: a replaced driver may still remove its groups
+std::atomic<uint32_t> next_group_id {630};
+
+uint64_t generation_cookie(uint32_t generation) {
+    return COOKIE_SPACE | (uint64_t(generation) << 32);
+}
+
+uint8_t to_of_group_type(GroupType type) {
+    switch (type) {
+    case GroupType::All: return of13::OFPGT_ALL;
+    case GroupType::Select: return of13::OFPGT_SELECT;
+    case GroupType::Indirect: return of13::OFPGT_INDIRECT;
+    case GroupType::FastFailover: return of13::OFPGT_FF;
+    }
+    RUNOS_THROW(invalid_argument{});
+}
+
 ActionSet convert_to_action_set(const Actions& acts) {
     ActionSet ret;
     for (const oxm::field<>& f : acts.set_fields) {
         ret.add_action(new of13::SetFieldAction(new FluidOXMAdapter(f)));
     }
     if (acts.out_port != 0) {
-        ret.add_action(new of13::OutputAction(acts.out_port, 0));// OFP_NO_BUFFER));
+        ret.add_action(new of13::OutputAction(acts.out_port, acts.max_len));
     }
     if (acts.group_id != 0) {
         ret.add_action(new of13::GroupAction(acts.group_id));
@@ -31,7 +63,7 @@ of13::ApplyActions convert_to_apply_action(const Actions& acts) {
         ret.add_action(new of13::SetFieldAction(new FluidOXMAdapter(f)));
     }
     if (acts.out_port != 0) {
-        ret.add_action(new of13::OutputAction(acts.out_port, 0)); //OFP_NO_BUFFER));
+        ret.add_action(new of13::OutputAction(acts.out_port, acts.max_len));
     }
     if (acts.group_id != 0) {
         ret.add_action(new of13::GroupAction(acts.group_id));
@@ -39,17 +71,43 @@ of13::ApplyActions convert_to_apply_action(const Actions& acts) {
     return ret;
 }
 
-ActionList convert_to_action_list(const Actions& acts) {
-    ActionList ret;
+void add_to_action_list(ActionList& ret, const Actions& acts) {
     for (const oxm::field<>& f : acts.set_fields) {
         ret.add_action(new of13::SetFieldAction(new FluidOXMAdapter(f)));
     }
     if (acts.out_port != 0) {
-        ret.add_action(new of13::OutputAction(acts.out_port, 0)); //OFP_NO_BUFFER));
+        ret.add_action(new of13::OutputAction(acts.out_port, acts.max_len));
     }
     if (acts.group_id != 0) {
         ret.add_action(new of13::GroupAction(acts.group_id));
     }
+}
+
+// bucket contents, timeouts don't matter for groups
+bool same_bucket(const Actions& lhs, const Actions& rhs) {
+    return lhs.out_port == rhs.out_port &&
+           lhs.max_len == rhs.max_len &&
+           lhs.group_id == rhs.group_id &&
+           lhs.watch_port == rhs.watch_port &&
+           lhs.set_fields == rhs.set_fields;
+}
+
+size_t hash_group(GroupType type, const std::vector<Actions>& buckets) {
+    size_t ret = std::hash<int>()(static_cast<int>(type));
+    auto combine = [&ret](size_t h) {
+        ret ^= h + 0x9e3779b9 + (ret << 6) + (ret >> 2);
+    };
+    for (auto& acts : buckets) {
+        combine(acts.out_port);
+        combine(acts.group_id);
+        combine(acts.watch_port);
+        // bits hash is expensive, types are enough to tell sets apart
+        size_t fields = 0;
+        for (const oxm::field<>& f : acts.set_fields) {
+            fields += std::hash<oxm::type>()(f.type());
+        }
+        combine(fields);
+    }
     return ret;
 }
 
@@ -57,56 +115,45 @@ class Fluid13Rule: public Rule {
 public:
     Fluid13Rule(
         SwitchConnectionPtr conn,
-        oxm::field_set match,
+        const oxm::field_set& match,
         uint8_t table,
         uint16_t prio,
-        Actions acts,
+        const Actions& acts,
         uint64_t cookie
-    ) : m_conn(conn)
-      , m_match(match)
-      , m_table(table)
-      , m_prio(prio)
-      , m_acts(acts)
-      , m_cookie(cookie)
+    ) : m_cookie(cookie)
     {
-        if (m_conn) {
+        if (conn) {
             of13::FlowMod fm;
             fm.command(of13::OFPFC_ADD);
             fm.buffer_id(OFP_NO_BUFFER);
-            fm.table_id(m_table);
+            fm.table_id(table);
             fm.cookie(m_cookie);
-            fm.match(make_of_match(m_match));
+            fm.match(make_of_match(match));
             fm.priority(prio);
 
-            fm.idle_timeout(m_acts.idle_timeout);
-            fm.hard_timeout(m_acts.hard_timeout);
+            fm.idle_timeout(acts.idle_timeout);
+            fm.hard_timeout(acts.hard_timeout);
 
-            fm.flags( of13::OFPFF_CHECK_OVERLAP |
-                      of13::OFPFF_SEND_FLOW_REM );
-            of13::ApplyActions apply_actions = convert_to_apply_action(m_acts);
+            // No OFPFF_CHECK_OVERLAP: the same rule of the next generation
+            // should replace the current one instead of being rejected.
+            fm.flags(of13::OFPFF_SEND_FLOW_REM);
+            of13::ApplyActions apply_actions = convert_to_apply_action(acts);
             fm.add_instruction(apply_actions);
-            m_conn->send(fm);
+            if (acts.goto_table != 0) {
+                of13::WriteMetadata write_metadata(acts.metadata, uint64_t(-1));
+                fm.add_instruction(write_metadata);
+                of13::GoToTable go_to_table(acts.goto_table);
+                fm.add_instruction(go_to_table);
+            }
+            conn->send(fm);
         }
     }
 
-    ~Fluid13Rule() {
-        if (m_conn) {
-            of13::FlowMod fm;
-            fm.command(of13::OFPFC_DELETE);
-            fm.cookie(m_cookie);
-            fm.cookie_mask(0xfffffffff);
-            fm.out_port(of13::OFPP_ANY);
-            fm.out_group(of13::OFPG_ANY);
-            m_conn->send(fm);
-        }
-        DVLOG(50) << "Remove flow 0x" << std::hex << m_cookie;
+    uint64_t cookie() const {
+        return m_cookie;
     }
+
 private:
-    SwitchConnectionPtr m_conn;
-    oxm::field_set m_match;
-    uint8_t m_table;
-    uint16_t m_prio;
-    Actions m_acts;
     uint64_t m_cookie;
 };
 
@@ -118,18 +165,19 @@ public:
         , m_type(type)
         , m_buckets(std::move(buckets))
     {
-        if (type != GroupType::All) {
-            RUNOS_THROW(runtime_error{}); // "Only ALL Type Supported");
-        }
         if (m_conn) {
             of13::GroupMod gm;
             gm.commmand(of13::OFPGC_ADD);
-            gm.group_type(of13::OFPGT_ALL);
+            gm.group_type(to_of_group_type(m_type));
             for (auto& acts: m_buckets) {
                 DVLOG(40) << "  Bucket!";
                 of13::Bucket b;
-                b.watch_port(of13::OFPP_ANY);
+                b.watch_port(acts.watch_port != 0 ? acts.watch_port
+                                                  : uint32_t(of13::OFPP_ANY));
                 b.watch_group(of13::OFPG_ANY);
+                if (m_type == GroupType::Select) {
+                    b.weight(1); // equal share
+                }
                 ActionSet action_set = convert_to_action_set(acts);
                 b.actions(action_set);
                 gm.add_bucket(b);
@@ -143,11 +191,17 @@ public:
         return m_id;
     }
 
+    bool same(GroupType type, const std::vector<Actions>& buckets) const {
+        return m_type == type &&
+               std::equal(m_buckets.begin(), m_buckets.end(),
+                          buckets.begin(), buckets.end(), same_bucket);
+    }
+
     ~Fluid13Group() {
         if (m_conn) {
             of13::GroupMod gm;
             gm.commmand(of13::OFPGC_DELETE);
-            gm.group_type(of13::OFPGT_ALL);
+            gm.group_type(to_of_group_type(m_type));
             gm.group_id(m_id);
             m_conn->send(gm);
         }
@@ -169,9 +223,12 @@ public:
         : m_conn(conn)
     { }
 
-    RulePtr installRule(oxm::field_set match, uint16_t prio, Actions actions, uint8_t table) override {
+    RulePtr installRule(oxm::field_set match, uint16_t prio, Actions actions,
+                        uint8_t table, uint32_t generation) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t cookie = generation_cookie(generation) | m_rule_gen;
 
-        DVLOG(40) << "Install rule with cookie: " << std::hex << m_cookie_gen;
+        DVLOG(40) << "Install rule with cookie: " << std::hex << cookie;
 
         RulePtr ret = std::make_shared<Fluid13Rule>(
             m_conn,
@@ -179,37 +236,152 @@ public:
             table,
             prio,
             actions,
-            m_cookie_gen
+            cookie
         );
-        m_cookie_gen++;
+        m_rule_gen++;
+        m_tables[generation].insert(table);
         return ret;
     }
     GroupPtr installGroup(GroupType type, std::vector<Actions> buckets) override {
+        if (type == GroupType::Indirect && buckets.size() != 1) {
+            RUNOS_THROW(invalid_argument()
+                    << errinfo_msg("Indirect group must have exactly one bucket"));
+        }
+
+        size_t hash = hash_group(type, buckets);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto range = m_groups.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            auto group = it->second.lock();
+            if (group && group->same(type, buckets)) {
+                DVLOG(40) << "Reuse group with id: " << std::hex << group->id();
+                return group;
+            }
+        }
 
-        DVLOG(40) << "Install group with id: " << std::hex << m_id_gen;
+        uint32_t id = next_group_id++;
+        DVLOG(40) << "Install group with id: " << std::hex << id;
 
-        GroupPtr ret = std::make_shared<Fluid13Group>(
+        auto ret = std::make_shared<Fluid13Group>(
             m_conn,
-            m_id_gen,
+            id,
             type,
-            buckets
+            std::move(buckets)
         );
-        m_id_gen++;
+
+        purgeGroups();
+        m_groups.emplace(hash, ret);
         return ret;
     }
 
-    void packetOut(uint8_t* data, size_t data_len, Actions actions) override {
+    void packetOut(uint8_t* data, size_t data_len,
+                   std::vector<Actions> actions, uint32_t buffer_id) override {
         of13::PacketOut po;
         po.xid(222);
-        po.buffer_id(OFP_NO_BUFFER);
-        po.actions(convert_to_action_list(actions));
-        po.data(data, data_len);
+        po.buffer_id(buffer_id);
+        ActionList action_list;
+        for (auto& acts : actions) {
+            add_to_action_list(action_list, acts);
+        }
+        po.actions(action_list);
+        if (buffer_id == buffers::no_buffer) {
+            po.data(data, data_len);
+        }
         m_conn->send(po);
     }
+
+    uint32_t nextGeneration() override {
+        uint32_t generation = last_generation.fetch_add(1) + 1;
+        if (generation > MAX_GENERATION) {
+            // wrapped, the oldest generations are long gone
+            generation &= MAX_GENERATION;
+        }
+        return generation;
+    }
+
+    void removeGeneration(uint32_t generation) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_tables.find(generation);
+        if (it == m_tables.end())
+            return;
+
+        m_conn->send(of13::BarrierRequest());
+        for (uint8_t table : it->second) {
+            DVLOG(40) << "Remove generation " << generation
+                      << " from table " << int(table);
+            of13::FlowMod fm;
+            fm.command(of13::OFPFC_DELETE);
+            fm.table_id(table);
+            fm.cookie(generation_cookie(generation));
+            fm.cookie_mask(GENERATION_MASK);
+            fm.out_port(of13::OFPP_ANY);
+            fm.out_group(of13::OFPG_ANY);
+            m_conn->send(fm);
+        }
+        m_tables.erase(it);
+    }
+
+    void removeRules(oxm::field_set match, uint32_t generation) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_tables.find(generation);
+        if (it == m_tables.end())
+            return;
+
+        for (uint8_t table : it->second) {
+            DVLOG(40) << "Remove rules of generation " << generation
+                      << " matching " << match << " from table " << int(table);
+            of13::FlowMod fm;
+            fm.command(of13::OFPFC_DELETE);
+            fm.table_id(table);
+            fm.cookie(generation_cookie(generation));
+            fm.cookie_mask(GENERATION_MASK);
+            fm.match(make_of_match(match));
+            fm.out_port(of13::OFPP_ANY);
+            fm.out_group(of13::OFPG_ANY);
+            m_conn->send(fm);
+        }
+    }
+
+    void removeAllGenerations() override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        DVLOG(40) << "Remove all generations";
+        of13::FlowMod fm;
+        fm.command(of13::OFPFC_DELETE);
+        fm.table_id(of13::OFPTT_ALL);
+        fm.cookie(COOKIE_SPACE);
+        fm.cookie_mask(SPACE_MASK);
+        fm.out_port(of13::OFPP_ANY);
+        fm.out_group(of13::OFPG_ANY);
+        m_conn->send(fm);
+        m_tables.clear();
+    }
+
 private:
     SwitchConnectionPtr m_conn;
-    uint16_t m_id_gen = 630;
-    uint64_t m_cookie_gen = 0x400000000;
+    // rules, groups and generations are changed from the packet-in
+    // threads and from the thread releasing the last backend
+    std::mutex m_mutex;
+    uint32_t m_rule_gen = 0; // unique in the lower half of cookies
+    // tables used by every not removed generation
+    std::unordered_map<uint32_t, std::set<uint8_t>> m_tables;
+
+    // installed groups by content, group is removed with its last user
+    std::unordered_multimap<size_t, std::weak_ptr<Fluid13Group>> m_groups;
+    size_t m_purge_at = 64;
+
+    // under m_mutex
+    void purgeGroups() {
+        if (m_groups.size() < m_purge_at)
+            return;
+        for (auto it = m_groups.begin(); it != m_groups.end(); ) {
+            if (it->second.expired()) {
+                it = m_groups.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        m_purge_at = std::max<size_t>(64, m_groups.size() * 2);
+    }
 };
 
 } // namespace anon
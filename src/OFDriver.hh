@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include "oxm/field_set.hh"
 
@@ -13,9 +14,20 @@ namespace ports {
     static constexpr uint32_t to_controller = 0xfffffffd; // TODO: Unhadrcode
 }
 
+namespace buffers {
+    static constexpr uint32_t no_buffer = 0xffffffff; // packet data is sent
+    static constexpr uint16_t no_buffer_len = 0xffff; // max_len to not buffer
+}
+
 struct Actions {
     uint32_t out_port = 0;
+    uint16_t max_len = buffers::no_buffer_len; // bytes sent to controller,
+                                               // the rest is buffered
     uint32_t group_id = 0;
+    uint32_t watch_port = 0; // fast failover bucket is live while port is up,
+                             // zero means any
+    uint8_t goto_table = 0; // zero means no goto, ignored in groups
+    uint64_t metadata = 0; // written when goto_table is set
     uint32_t idle_timeout = 0; // timeouts in seconds
     uint32_t hard_timeout = 0; // zero means infinity timeouts
                                // TODO: Not here
@@ -23,7 +35,11 @@ struct Actions {
     oxm::field_set set_fields;
     friend bool operator==(const Actions& lhs, const Actions& rhs) {
         return lhs.out_port == rhs.out_port &&
+               lhs.max_len == rhs.max_len &&
                lhs.group_id == rhs.group_id &&
+               lhs.watch_port == rhs.watch_port &&
+               lhs.goto_table == rhs.goto_table &&
+               lhs.metadata == rhs.metadata &&
                lhs.set_fields == rhs.set_fields &&
                lhs.hard_timeout == rhs.hard_timeout &&
                lhs.idle_timeout == rhs.idle_timeout;
@@ -40,17 +56,67 @@ public:
 };
 
 enum class GroupType {
-    All
+    All,
+    Select, // buckets are chosen by switch-computed hash
+    Indirect, // exactly one bucket
+    FastFailover // first live bucket, see Actions::watch_port
 };
 
 using RulePtr = std::shared_ptr<Rule>;
 using GroupPtr = std::shared_ptr<Group>;
 
+/**
+ * Rules are not removed one by one: every rule belongs to a generation
+ * encoded in its cookie, and a whole generation is removed at once.
+ * Dropping RulePtr doesn't remove the rule.
+ */
 class OFDriver {
 public:
-    virtual RulePtr installRule(oxm::field_set match, uint16_t prio, Actions actions, uint8_t table) = 0;
+    /**
+     * Installs rule into `generation`, which is returned by nextGeneration()
+     * and not removed yet. Older generations may still install rules.
+     */
+    virtual RulePtr installRule(oxm::field_set match, uint16_t prio, Actions actions,
+                                uint8_t table, uint32_t generation) = 0;
+    /**
+     * Groups with the same type and buckets are shared: the group
+     * is installed once and removed when the last pointer is dropped.
+     * Timeouts of bucket actions are ignored.
+     */
     virtual GroupPtr installGroup(GroupType type, std::vector<Actions> buckets) = 0;
-    virtual void packetOut(uint8_t* data, size_t data_len, Actions action) = 0;
+    /**
+     * Applies all `actions` one after another to one packet.
+     * Packet is taken from the switch buffer unless `buffer_id` is
+     * buffers::no_buffer, `data` is sent only in the latter case.
+     */
+    virtual void packetOut(uint8_t* data, size_t data_len,
+                           std::vector<Actions> actions, uint32_t buffer_id) = 0;
+
+    /**
+     * Starts a new generation for following installRule() calls.
+     * Generations are unique among all drivers of the process.
+     */
+    virtual uint32_t nextGeneration() = 0;
+
+    /**
+     * Removes all rules of `generation` with one masked-cookie
+     * FlowMod per table. It is preceded by a barrier, so rules which
+     * replace the removed ones are installed before (make-before-break).
+     */
+    virtual void removeGeneration(uint32_t generation) = 0;
+
+    /**
+     * Removes rules of `generation` which match is `match` or narrower
+     * (non-strict FlowMod delete), e.g. rules of one host.
+     */
+    virtual void removeRules(oxm::field_set match, uint32_t generation) = 0;
+
+    /**
+     * Removes rules of all generations from all tables, including
+     * rules left by a previous connection or controller run.
+     */
+    virtual void removeAllGenerations() = 0;
+
     virtual ~OFDriver() = default;
 };
 
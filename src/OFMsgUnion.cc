@@ -22,6 +22,24 @@ OFMsgUnion::OFMsgUnion()
 }
 
 OFMsgUnion::OFMsgUnion(uint8_t type, void *data, size_t len)
+    : m_base(nullptr)
+{
+    decode(type, data, len);
+}
+
+void OFMsgUnion::reset(uint8_t type, void *data, size_t len)
+{
+    clear();
+    decode(type, data, len);
+}
+
+void OFMsgUnion::clear()
+{
+    if (m_base) m_base->~OFMsg();
+    m_base = nullptr;
+}
+
+void OFMsgUnion::decode(uint8_t type, void *data, size_t len)
 {
     // Construct message object
     switch (type) {
@@ -73,7 +91,7 @@ void OFMsgUnion::reparseMultipartReply(void* data, size_t len)
     case of13::OFPMP_FLOW:
         m_base = new (&multipartReplyFlow) of13::MultipartReplyFlow; break;
     case of13::OFPMP_AGGREGATE:
-        m_base = new (&multipartReplyAggregate) of13::MultipartReplyAggregate;
+        m_base = new (&multipartReplyAggregate) of13::MultipartReplyAggregate; break;
     case of13::OFPMP_TABLE:
         m_base = new (&multipartReplyTable) of13::MultipartReplyTable; break;
     case of13::OFPMP_TABLE_FEATURES:
@@ -120,7 +138,7 @@ void OFMsgUnion::reparseMultipartReply(void* data, size_t len)
 
 OFMsgUnion::~OFMsgUnion()
 {
-    if (m_base) m_base->~OFMsg();
+    clear();
 }
 
 static struct Init {
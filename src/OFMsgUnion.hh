@@ -74,10 +74,23 @@ struct OFMsgUnion {
     //OFMsgUnion(OFMsgUnion&& other);
     ~OFMsgUnion();
 
+    OFMsgUnion(const OFMsgUnion&) = delete;
+    OFMsgUnion& operator=(const OFMsgUnion&) = delete;
+
+    /**
+     * Destroys current message and unpacks new one in place.
+     * Allows to reuse single object for a stream of messages.
+     */
+    void reset(uint8_t type, void* data, size_t len);
+
+    /** Destroys current message (base() == nullptr) */
+    void clear();
+
     OFMsg* base() const { return m_base; }
 
 private:
     OFMsg* m_base;
+    void decode(uint8_t type, void* data, size_t len);
     void reparseMultipartReply(void* data, size_t len);
 };
 
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PacketInAdmission.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include <boost/exception/info.hpp>
+
+#include "types/exception.hh"
+#include "openflow/common.hh"
+
+namespace runos {
+namespace admission {
+
+namespace {
+
+using namespace boost::endian;
+
+struct packet_in_header {
+    of::header   header;
+    big_uint32_t buffer_id;
+    big_uint16_t total_len;
+    big_uint8_t  reason;
+    big_uint8_t  table_id;
+    big_uint64_t cookie;
+    big_uint16_t match_type;
+    big_uint16_t match_length;
+};
+static_assert(sizeof(packet_in_header) == 28, "");
+
+constexpr uint8_t  OFPR_NO_MATCH = 0;
+constexpr uint16_t ETH_TYPE_VLAN = 0x8100;
+constexpr uint16_t ETH_TYPE_QINQ = 0x88a8;
+constexpr uint16_t ETH_TYPE_ARP  = 0x0806;
+constexpr uint16_t ETH_TYPE_LLDP = 0x88cc;
+
+uint16_t read_be16(const uint8_t* p)
+{
+    return uint16_t(p[0]) << 8 | p[1];
+}
+
+PacketClass parse_class(const std::string& name)
+{
+    if (name == "lldp") return PacketClass::Lldp;
+    if (name == "arp") return PacketClass::Arp;
+    if (name == "table-miss") return PacketClass::TableMiss;
+    if (name == "inspect") return PacketClass::Inspect;
+    RUNOS_THROW(invalid_argument()
+                << errinfo_str("Unknown packet-in class: " + name));
+}
+
+} // anonymous namespace
+
+const char* to_string(PacketClass cls)
+{
+    switch (cls) {
+    case PacketClass::Lldp: return "lldp";
+    case PacketClass::Arp: return "arp";
+    case PacketClass::TableMiss: return "table-miss";
+    case PacketClass::Inspect: return "inspect";
+    }
+    return "unknown";
+}
+
+PacketClass classify(const void* data, size_t len)
+{
+    if (len < sizeof(packet_in_header))
+        return PacketClass::Inspect;
+
+    packet_in_header hdr;
+    std::memcpy(&hdr, data, sizeof(hdr));
+
+    // match is padded to 8 bytes, then 2 bytes of padding before frame
+    size_t match_len = (size_t(hdr.match_length) + 7) / 8 * 8;
+    size_t frame_off = offsetof(packet_in_header, match_type) + match_len + 2;
+    auto bytes = static_cast<const uint8_t*>(data);
+
+    if (frame_off + 14 <= len) {
+        size_t type_off = frame_off + 12;
+        uint16_t eth_type = read_be16(bytes + type_off);
+        while ((eth_type == ETH_TYPE_VLAN || eth_type == ETH_TYPE_QINQ)
+                && type_off + 6 <= len) {
+            type_off += 4;
+            eth_type = read_be16(bytes + type_off);
+        }
+
+        if (eth_type == ETH_TYPE_LLDP)
+            return PacketClass::Lldp;
+        if (eth_type == ETH_TYPE_ARP)
+            return PacketClass::Arp;
+    }
+
+    return uint8_t(hdr.reason) == OFPR_NO_MATCH ? PacketClass::TableMiss
+                                                : PacketClass::Inspect;
+}
+
+Settings Settings::fromConfig(const Config& config)
+{
+    Settings ret;
+    auto cfg = config_cd(config, "admission");
+
+    ret.enabled = config_get(cfg, "enabled", ret.enabled);
+    ret.rate = config_get(cfg, "rate", ret.rate);
+    ret.burst = config_get(cfg, "burst", ret.burst);
+    ret.queue_size = config_get(cfg, "queue-size", int(ret.queue_size));
+    ret.drain_interval = config_get(cfg, "drain-interval",
+                                    int(ret.drain_interval));
+
+    if (ret.burst < 1.0)
+        ret.burst = 1.0;
+    if (ret.drain_interval == 0)
+        ret.drain_interval = 1;
+
+    auto it = cfg.find("classes");
+    if (it != cfg.end()) {
+        std::array<bool, class_count> ranked {};
+        uint8_t next = 0;
+        for (const auto& name : it->second.array_items()) {
+            auto cls = static_cast<size_t>(parse_class(name.string_value()));
+            if (ranked[cls])
+                continue;
+            ranked[cls] = true;
+            ret.rank[cls] = next++;
+        }
+        // not mentioned classes are served last in default order
+        for (size_t cls = 0; cls < class_count; ++cls) {
+            if (not ranked[cls])
+                ret.rank[cls] = next++;
+        }
+    }
+
+    return ret;
+}
+
+SwitchAdmission::SwitchAdmission(const Settings& settings)
+    : m_settings(settings)
+    , m_tokens(settings.burst)
+    , m_last_refill(clock::now())
+{ }
+
+void SwitchAdmission::refill()
+{
+    auto now = clock::now();
+    std::chrono::duration<double> elapsed = now - m_last_refill;
+    m_last_refill = now;
+    m_tokens = std::min(m_settings.burst,
+                        m_tokens + elapsed.count() * m_settings.rate);
+}
+
+bool SwitchAdmission::tryAdmit(PacketClass cls)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // keep order: newcomers can't overtake queued messages
+    if (m_depth != 0)
+        return false;
+
+    refill();
+    if (m_tokens < 1.0)
+        return false;
+
+    m_tokens -= 1.0;
+    ++stats(cls).admitted;
+    return true;
+}
+
+bool SwitchAdmission::enqueue(Message msg, Message& evicted)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    evicted = Message();
+
+    if (m_depth >= m_settings.queue_size) {
+        // find lowest priority non-empty queue
+        size_t victim = class_count;
+        while (victim > 0 && m_queues[victim - 1].empty())
+            --victim;
+
+        if (victim == 0 || victim - 1 <= rank(msg.cls)) {
+            ++stats(msg.cls).dropped;
+            return false;
+        }
+
+        auto& queue = m_queues[victim - 1];
+        evicted = queue.back();
+        queue.pop_back();
+        --m_depth;
+        ++stats(evicted.cls).dropped;
+    }
+
+    m_queues[rank(msg.cls)].push_back(msg);
+    ++m_depth;
+    ++stats(msg.cls).queued;
+    return true;
+}
+
+bool SwitchAdmission::dequeue(Message& msg)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_depth == 0)
+        return false;
+
+    refill();
+    if (m_tokens < 1.0)
+        return false;
+
+    for (auto& queue : m_queues) {
+        if (queue.empty())
+            continue;
+        msg = queue.front();
+        queue.pop_front();
+        --m_depth;
+        m_tokens -= 1.0;
+        ++stats(msg.cls).admitted;
+        return true;
+    }
+
+    return false;
+}
+
+std::vector<Message> SwitchAdmission::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Message> ret;
+    ret.reserve(m_depth);
+
+    for (auto& queue : m_queues) {
+        for (auto& msg : queue) {
+            ++stats(msg.cls).dropped;
+            ret.push_back(msg);
+        }
+        queue.clear();
+    }
+    m_depth = 0;
+
+    return ret;
+}
+
+Stats SwitchAdmission::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats ret;
+    ret.queue_depth = m_depth;
+    ret.classes = m_stats;
+    return ret;
+}
+
+} // namespace admission
+} // namespace runos
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Config.hh"
+
+namespace runos {
+namespace admission {
+
+/**
+ * Classes of packet-in messages used by admission control.
+ * Order of the classes in the queue is set by configuration.
+ */
+enum class PacketClass : uint8_t {
+    Lldp,
+    Arp,
+    TableMiss,
+    Inspect
+};
+
+constexpr size_t class_count = 4;
+
+const char* to_string(PacketClass cls);
+
+/**
+ * Classifies raw OFPT_PACKET_IN message without unpacking it.
+ * Malformed messages are classified as PacketClass::Inspect.
+ */
+PacketClass classify(const void* data, size_t len);
+
+/**
+ * Admission control settings. Read from `controller.admission` section:
+ * `"admission": { "enabled": true, "rate": 1000, "burst": 200,
+ *                 "queue-size": 1024, "drain-interval": 10,
+ *                 "classes": ["lldp", "arp", "table-miss", "inspect"] }`
+ */
+struct Settings {
+    bool enabled = false;
+    double rate = 1000.0;         // packet-ins per second per switch
+    double burst = 200.0;         // token bucket capacity
+    size_t queue_size = 1024;     // queued packet-ins per switch
+    unsigned drain_interval = 10; // milliseconds
+
+    // class -> rank, lower rank is served first
+    std::array<uint8_t, class_count> rank {{0, 1, 2, 3}};
+
+    static Settings fromConfig(const Config& config);
+};
+
+struct ClassStats {
+    uint64_t admitted = 0;
+    uint64_t queued = 0;
+    uint64_t dropped = 0;
+};
+
+struct Stats {
+    uint64_t dpid = 0;
+    size_t queue_depth = 0;
+    std::array<ClassStats, class_count> classes; // indexed by PacketClass
+};
+
+struct Message {
+    void* data = nullptr;
+    size_t len = 0;
+    PacketClass cls = PacketClass::Inspect;
+};
+
+/**
+ * Token bucket with bounded strict-priority queue for packet-ins
+ * of a single switch.
+ *
+ * All methods except stats() are called from the connection thread,
+ * stats() may be called from any thread.
+ */
+class SwitchAdmission {
+public:
+    explicit SwitchAdmission(const Settings& settings);
+
+    bool enabled() const
+    { return m_settings.enabled; }
+
+    /**
+     * Takes a token for message if nothing is queued.
+     * @return true if message should be dispatched right now.
+     */
+    bool tryAdmit(PacketClass cls);
+
+    /**
+     * Queues message. If the queue is full lower priority message may be
+     * displaced, it is returned in `evicted` and should be freed by caller.
+     * @return false if message itself was dropped.
+     */
+    bool enqueue(Message msg, Message& evicted);
+
+    /**
+     * Pops highest priority message if bucket has a token for it.
+     */
+    bool dequeue(Message& msg);
+
+    /**
+     * Removes all queued messages (e.g. on disconnect).
+     * Returned messages should be freed by caller.
+     */
+    std::vector<Message> flush();
+
+    Stats stats() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    const Settings m_settings;
+    double m_tokens;
+    clock::time_point m_last_refill;
+
+    std::array<std::deque<Message>, class_count> m_queues; // indexed by rank
+    size_t m_depth {0};
+    std::array<ClassStats, class_count> m_stats;
+
+    mutable std::mutex m_mutex;
+
+    void refill();
+    size_t rank(PacketClass cls) const
+    { return m_settings.rank[static_cast<size_t>(cls)]; }
+    ClassStats& stats(PacketClass cls)
+    { return m_stats[static_cast<size_t>(cls)]; }
+};
+
+} // namespace admission
+} // namespace runos
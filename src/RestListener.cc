@@ -23,6 +23,7 @@ REGISTER_APPLICATION(RestListener, {"controller", ""})
 void RestListener::registerRestHandler(RestHandler *handler)
 {
     VLOG(5) << "Registered handler: " << handler->restName();
+    std::lock_guard<std::mutex> lock(rest_handlers_mutex);
     rest_handlers[handler->restName()] = handler;
     if (handler->eventable()) {
         handler->setHash(cur_hash);
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
@@ -49,6 +50,7 @@ private:
     EventManager* em;
     std::unique_ptr<HttpServer> server;
     std::unordered_map<std::string, RestHandler*> rest_handlers;
+    std::mutex rest_handlers_mutex;
     uint32_t cur_hash;
 
     uint16_t listen_port;
@@ -1,6 +1,8 @@
 #include "Retic.hh"
 
+#include <algorithm>
 #include <chrono>
+#include <thread>
 
 #include "Controller.hh"
 #include "Common.hh"
@@ -8,12 +10,14 @@
 #include "retic/applier.hh"
 #include "retic/fdd.hh"
 #include "retic/fdd_compiler.hh"
+#include "retic/fdd_optimizer.hh"
 #include "retic/fdd_translator.hh"
 #include "retic/traverse_fdd.hh"
 #include "retic/tracer.hh"
 #include "retic/leaf_applier.hh"
 #include "retic/trace_tree.hh"
 #include "PacketParser.hh"
+#include "types/latency.hh"
 
 REGISTER_APPLICATION(Retic, {"controller", ""})
 
@@ -21,6 +25,97 @@ using namespace runos;
 
 using secs = std::chrono::seconds;
 
+namespace {
+
+const std::unordered_map<std::string, oxm::type>& pipeline_fields() {
+    static const std::unordered_map<std::string, oxm::type> ret = {
+        {"in_port", oxm::type(oxm::in_port())},
+        {"eth_type", oxm::type(oxm::eth_type())},
+        {"eth_src", oxm::type(oxm::eth_src())},
+        {"eth_dst", oxm::type(oxm::eth_dst())},
+        {"vlan_vid", oxm::type(oxm::vlan_vid())},
+        {"ip_proto", oxm::type(oxm::ip_proto())},
+        {"ipv4_src", oxm::type(oxm::ipv4_src())},
+        {"ipv4_dst", oxm::type(oxm::ipv4_dst())},
+        {"ipv6_src", oxm::type(oxm::ipv6_src())},
+        {"ipv6_dst", oxm::type(oxm::ipv6_dst())},
+        {"tcp_src", oxm::type(oxm::tcp_src())},
+        {"tcp_dst", oxm::type(oxm::tcp_dst())},
+        {"udp_src", oxm::type(oxm::udp_src())},
+        {"udp_dst", oxm::type(oxm::udp_dst())},
+    };
+    return ret;
+}
+
+// `next` modifies every bit modified by `prev`, so packet-out
+// actions of both can be applied one after another to one packet
+bool overwrites(const oxm::field_set& next, const oxm::field_set& prev) {
+    return std::all_of(prev.begin(), prev.end(), [&next](const oxm::field<>& f) {
+        auto it = next.find(f.type());
+        return it != next.end() && f.mask_bits().is_subset_of(it->mask_bits());
+    });
+}
+
+// copied under the snapshot lock, packet-outs are sent without it
+std::vector<oxm::field_set> leaf_actions(const retic::fdd::leaf& leaf) {
+    std::vector<oxm::field_set> ret;
+    ret.reserve(leaf.sets.size());
+    for (auto& s: leaf.sets) {
+        if (s.body.has_value()) {
+            throw std::runtime_error("There must not be leaf with handler");
+        }
+        ret.push_back(s.pred_actions);
+    }
+    return ret;
+}
+
+// Rules installed by packet-ins are timed as Install stage,
+// proactive installs of the whole policy aren't
+class InstallTimer : public retic::Backend {
+public:
+    explicit InstallTimer(retic::Backend& base)
+        : m_base(base)
+    { }
+
+    void install(oxm::field_set match, std::vector<oxm::field_set> actions,
+                 uint16_t priority, retic::FlowSettings flow_settings) override {
+        latency::Timer timer{latency::Stage::Install};
+        m_base.install(std::move(match), std::move(actions), priority, flow_settings);
+    }
+    void installBarrier(oxm::field_set match, uint16_t priority) override {
+        latency::Timer timer{latency::Stage::Install};
+        m_base.installBarrier(std::move(match), priority);
+    }
+    void installIn(retic::Stage stage, oxm::field_set match,
+                   std::vector<oxm::field_set> actions, uint16_t priority,
+                   retic::FlowSettings flow_settings) override {
+        latency::Timer timer{latency::Stage::Install};
+        m_base.installIn(stage, std::move(match), std::move(actions),
+                         priority, flow_settings);
+    }
+    void installBarrierIn(retic::Stage stage, oxm::field_set match,
+                          uint16_t priority) override {
+        latency::Timer timer{latency::Stage::Install};
+        m_base.installBarrierIn(stage, std::move(match), priority);
+    }
+    void installGoto(retic::Stage stage, oxm::field_set match,
+                     uint16_t priority, retic::Stage next) override {
+        latency::Timer timer{latency::Stage::Install};
+        m_base.installGoto(stage, std::move(match), priority, next);
+    }
+    void packetOuts(uint8_t* data, size_t data_len,
+                    std::vector<oxm::field_set> actions, uint64_t dpid,
+                    uint32_t buffer_id, const Packet& pkt) override {
+        m_base.packetOuts(data, data_len, std::move(actions), dpid,
+                          buffer_id, pkt);
+    }
+
+private:
+    retic::Backend& m_base;
+};
+
+} // namespace
+
 void Retic::init(Loader* loader, const Config& root_config)
 {
     this->registerPolicy("__builtin_donothing__", retic::stop());
@@ -28,21 +123,36 @@ void Retic::init(Loader* loader, const Config& root_config)
 
     ctrl->registerHandler<of13::PacketIn>([=](of13::PacketIn& pi, SwitchConnectionPtr conn) {
         DVLOG(10) << "PacketIn";
+        latency::Timer total_timer{latency::Stage::Total};
 
+        latency::Timer parse_timer{latency::Stage::Parse};
         PacketParser pp{pi, conn->dpid()};
+        parse_timer.stop();
 
-        retic::fdd::Traverser traverser(pp, m_backend.get());
-        auto& leaf = boost::apply_visitor(traverser, m_fdd);
-
+        auto snapshot = std::atomic_load(&m_snapshot);
+        if (snapshot == nullptr || snapshot->backend == nullptr) {
+            DVLOG(10) << "Rules are not installed, packet-in ignored";
+            return;
+        }
         std::vector<oxm::field_set> sets;
-        sets.reserve(sets.size());
-        for (auto& s: leaf.sets) {
-            if (s.body.has_value()) {
-                throw std::runtime_error("There must not be leaf with handler");
+        {
+            latency::Timer lookup_timer{latency::Stage::Lookup};
+            std::shared_lock<std::shared_mutex> shared_lock(snapshot->mutex);
+            auto leaf = boost::apply_visitor(retic::fdd::Finder{pp}, snapshot->fdd);
+            lookup_timer.stop();
+            if (leaf) {
+                sets = leaf_actions(*leaf);
+            } else {
+                // the lock isn't upgradable, another packet-in
+                // may augment the tree meanwhile
+                shared_lock.unlock();
+                std::lock_guard<std::shared_mutex> lock(snapshot->mutex);
+                InstallTimer backend{*snapshot->backend};
+                retic::fdd::Traverser traverser(pp, &backend);
+                sets = leaf_actions(boost::apply_visitor(traverser, snapshot->fdd));
             }
-            sets.push_back(s.pred_actions);
         }
-        m_backend->packetOuts(static_cast<uint8_t*>(pi.data()), pi.data_len(), sets, conn->dpid());
+        snapshot->backend->packetOuts(static_cast<uint8_t*>(pi.data()), pi.data_len(), sets, conn->dpid(), pi.buffer_id(), pp);
     });
 
     m_table = ctrl->getTable("retic");
@@ -50,13 +160,80 @@ void Retic::init(Loader* loader, const Config& root_config)
     m_main_policy = config_get(config, "main", "__builtin_donothing__");
     LOG(INFO) << "Main policy: " << m_main_policy;
 
+    m_field_order = config_get(config, "field-order", "oxm");
+    if (m_field_order != "oxm" && m_field_order != "static" &&
+            m_field_order != "sifting") {
+        LOG(ERROR) << "Unknown field order " << m_field_order;
+        throw std::runtime_error("Unknown field order");
+    }
+
+    // 0 for all cores
+    int compile_threads = config_get(config, "compile-threads", 1);
+    if (compile_threads == 0) {
+        compile_threads = std::thread::hardware_concurrency();
+    }
+    if (compile_threads > 1) {
+        m_compile_pool = std::make_unique<task_pool>(compile_threads - 1);
+        LOG(INFO) << "Compile policies with " << compile_threads << " threads";
+    }
+
+    // bytes of packet sent to controller by barrier rules,
+    // the rest is buffered on switch if it supports buffering
+    int miss_send_len = config_get(config, "miss-send-len", int(buffers::no_buffer_len));
+    if (miss_send_len < 0 || miss_send_len > buffers::no_buffer_len) {
+        LOG(ERROR) << "Bad miss-send-len " << miss_send_len;
+        throw std::runtime_error("Bad miss-send-len");
+    }
+    m_miss_send_len = miss_send_len;
+
+    std::string cache_path = config_get(config, "fdd-cache", "");
+    if (not cache_path.empty()) {
+        m_fdd_cache = std::make_unique<retic::fdd::DiagramCache>(cache_path);
+    }
+
+    // fields of stages after the first one, e.g. [["eth_dst"]],
+    // stage N is installed into table "retic" + N
+    auto pipeline_it = config.find("pipeline");
+    if (pipeline_it != config.end()) {
+        const auto& stages = pipeline_it->second.array_items();
+        for (size_t i = 0; i < stages.size(); ++i) {
+            for (const auto& name: stages[i].array_items()) {
+                auto field_it = pipeline_fields().find(name.string_value());
+                if (field_it == pipeline_fields().end()) {
+                    LOG(ERROR) << "Unknown pipeline field " << name.string_value();
+                    throw std::runtime_error("Unknown pipeline field");
+                }
+                m_stages[field_it->second] = i + 1;
+            }
+        }
+        LOG(INFO) << "Pipeline of " << stages.size() + 1 << " tables";
+
+        // Stage tables must stay free: the controller fills tables
+        // before the last one with goto-next defaults, but stages
+        // rely on drop on miss
+        if (m_table + stages.size() > 0xfe) {
+            LOG(ERROR) << "Pipeline doesn't fit after table " << int(m_table);
+            throw std::runtime_error("Too many pipeline stages");
+        }
+        for (const auto& [name, table]: config_cd(root_config, "tables")) {
+            if (name != "retic" && table.int_value() > m_table) {
+                LOG(ERROR) << "Table " << table.int_value() << " of " << name
+                           << " follows retic table " << int(m_table)
+                           << ", it conflicts with pipeline stages";
+                throw std::runtime_error("Pipeline stage tables are used");
+            }
+        }
+    }
+
 
     QObject::connect(ctrl, &Controller::switchUp, this, &Retic::onSwitchUp);
 }
 
 void Retic::startUp(Loader* loader) {
     try {
-        m_fdd = retic::fdd::compile(m_policies.at(m_main_policy));
+        auto snapshot = std::make_shared<Snapshot>();
+        snapshot->fdd = this->compileMain();
+        std::atomic_store(&m_snapshot, std::move(snapshot));
     } catch (std::out_of_range& oor) {
         LOG(ERROR) << "Can't find policy " << m_main_policy;
         // TODO: throw more properly exception
@@ -66,13 +243,17 @@ void Retic::startUp(Loader* loader) {
 
 void Retic::registerPolicy(std::string name, retic::policy policy) {
     LOG(INFO) << "Register policy: " << name;
+    std::lock_guard<std::mutex> lock(m_policies_mutex);
     m_policies[name] = policy;
 }
 
 void Retic::onSwitchUp(SwitchConnectionPtr conn, of13::FeaturesReply fr) {
-    m_backend = nullptr;
-    m_drivers[conn->dpid()] = makeDriver(conn);
-    this->reinstallRules();
+    std::lock_guard<std::mutex> lock(m_rules_mutex);
+    auto driver = makeDriver(conn);
+    // rules of a previous connection have unknown generations
+    driver->removeAllGenerations();
+    m_drivers[conn->dpid()] = driver;
+    this->reinstall();
 }
 
 std::vector<std::string> Retic::getPoliciesName() const {
@@ -84,25 +265,189 @@ std::vector<std::string> Retic::getPoliciesName() const {
     return ret;
 }
 
+retic::fdd::diagram Retic::getFdd() const {
+    auto snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot == nullptr) {
+        return retic::fdd::diagram{};
+    }
+    std::shared_lock<std::shared_mutex> lock(snapshot->mutex);
+    return snapshot->fdd;
+}
+
 void Retic::clearRules() {
-    m_backend = nullptr;
+    std::lock_guard<std::mutex> lock(m_rules_mutex);
+    auto snapshot = std::make_shared<Snapshot>();
+    if (m_compiled.has_value()) {
+        snapshot->fdd = *m_compiled;
+    }
+    // rules are removed with the last user of the previous snapshot
+    std::atomic_store(&m_snapshot, std::move(snapshot));
 }
 
 void Retic::reinstallRules() {
-    m_backend = std::make_unique<Of13Backend>(m_drivers, m_table);
-    m_fdd = retic::fdd::compile(m_policies.at(m_main_policy));
-    retic::fdd::Translator translator(*m_backend);
-    boost::apply_visitor(translator, m_fdd);
+    std::lock_guard<std::mutex> lock(m_rules_mutex);
+    this->reinstall();
+}
+
+void Retic::reinstall() {
+    // make-before-break: rules of the previous snapshot are removed
+    // only when the new ones are sent and packet-ins using it are done
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->backend = std::make_unique<Of13Backend>(m_drivers, m_table, m_miss_send_len);
+    snapshot->fdd = this->compileMain();
+    this->translate(*snapshot);
+    std::atomic_store(&m_snapshot, std::move(snapshot));
+}
+
+retic::fdd::diagram Retic::compileMain() {
+    using retic::fdd::FieldOrder;
+    const auto& policy = m_policies.at(m_main_policy);
+    if (m_compiled_policy.has_value() && *m_compiled_policy == policy) {
+        // e.g. on switch up, explored trace trees are dropped
+        // with the previous snapshot
+        return *m_compiled;
+    }
+
+    // the field order and pipeline stages change compiled diagram too
+    uint64_t key = retic::fdd::hash_policy(policy)
+                 ^ std::hash<std::string>()(m_field_order);
+    for (auto [type, stage]: m_stages) {
+        key ^= std::hash<oxm::type>()(type) * (2 * stage + 1);
+    }
+
+    std::optional<retic::fdd::diagram> compiled;
+    if (m_fdd_cache) {
+        compiled = m_fdd_cache->load(policy, key);
+        if (compiled.has_value()) {
+            LOG(INFO) << "Compiled policy is loaded from " << m_fdd_cache->path();
+        }
+    }
+
+    if (not compiled.has_value()) {
+        // fields of earlier stages go first with any order
+        FieldOrder::StageFunction stage_of;
+        if (not m_stages.empty()) {
+            stage_of = [this](oxm::type type) { return stageOf(type); };
+        }
+        FieldOrder order({}, stage_of);
+        if (m_field_order == "static") {
+            order = FieldOrder::fromPolicy(policy, stage_of);
+        } else if (m_field_order == "sifting") {
+            order = FieldOrder::sift(policy, FieldOrder::fromPolicy(policy, stage_of));
+        }
+        compiled = retic::fdd::optimize(
+            retic::fdd::compile(policy, order, m_compile_pool.get()));
+        if (m_fdd_cache && not m_fdd_cache->store(policy, key, *compiled)) {
+            LOG(WARNING) << "Can't write compiled policy to " << m_fdd_cache->path();
+        }
+    }
+
+    m_compiled_policy = policy;
+    m_compiled = std::move(compiled);
+    return *m_compiled;
+}
+
+void Retic::translate(Snapshot& snapshot) {
+    if (m_stages.empty()) {
+        retic::fdd::Translator translator(*snapshot.backend);
+        boost::apply_visitor(translator, snapshot.fdd);
+        return;
+    }
+    retic::fdd::Pipeline pipeline(*snapshot.backend, [this](oxm::type type) {
+        return stageOf(type);
+    });
+    pipeline.translate(snapshot.fdd);
+}
+
+unsigned Retic::stageOf(oxm::type type) const {
+    auto it = m_stages.find(type);
+    return it != m_stages.end() ? it->second : 0u;
+}
+
+void Retic::invalidate() {
+    if (m_invalidate_pending.exchange(true))
+        return;
+    QMetaObject::invokeMethod(this, "onInvalidate", Qt::QueuedConnection);
+}
+
+void Retic::invalidate(oxm::field<> field) {
+    {
+        std::lock_guard<std::mutex> lock(m_forget_mutex);
+        m_forget.push_back(field);
+    }
+    if (m_forget_pending.exchange(true))
+        return;
+    QMetaObject::invokeMethod(this, "onInvalidateFields", Qt::QueuedConnection);
+}
+
+void Retic::onInvalidateFields() {
+    m_forget_pending = false;
+    std::vector<oxm::field<>> fields;
+    {
+        std::lock_guard<std::mutex> lock(m_forget_mutex);
+        fields.swap(m_forget);
+    }
+
+    std::lock_guard<std::mutex> rules_lock(m_rules_mutex);
+    auto snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot == nullptr || snapshot->backend == nullptr) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(snapshot->mutex);
+    for (auto& field: fields) {
+        if (not retic::fdd::forget(snapshot->fdd, field)) {
+            lock.unlock();
+            DVLOG(5) << "Rules of " << field << " can't be removed selectively,"
+                     << " invalidating installed rules";
+            this->reinstall();
+            return;
+        }
+        DVLOG(5) << "Invalidating rules of " << field;
+        snapshot->backend->removeRules(oxm::field_set{field});
+    }
+}
+
+void Retic::onInvalidate() {
+    m_invalidate_pending = false;
+    std::lock_guard<std::mutex> lock(m_rules_mutex);
+    auto snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot == nullptr || snapshot->backend == nullptr) {
+        // rules are cleared or there are no switches yet
+        return;
+    }
+    DVLOG(5) << "Invalidating installed rules";
+    this->reinstall();
 }
 
 void Retic::setMain(std::string new_main) {
+    std::lock_guard<std::mutex> lock(m_rules_mutex);
     m_main_policy = new_main;
-    m_fdd = retic::fdd::compile(m_policies[m_main_policy]);
-    this->reinstallRules();
+    this->reinstall();
 }
 
 namespace runos {
 
+Of13Backend::Of13Backend(std::unordered_map<uint64_t, OFDriverPtr> drivers, uint8_t table,
+                         uint16_t miss_send_len)
+    : m_drivers(std::move(drivers)), m_table(table), m_miss_send_len(miss_send_len)
+{
+    for (auto& [dpid, driver]: m_drivers) {
+        m_generations[dpid] = driver->nextGeneration();
+    }
+}
+
+Of13Backend::~Of13Backend() {
+    for (auto& [dpid, driver]: m_drivers) {
+        driver->removeGeneration(m_generations.at(dpid));
+    }
+}
+
+void Of13Backend::removeRules(oxm::field_set match) {
+    for (auto& [dpid, driver]: m_drivers) {
+        driver->removeRules(match, m_generations.at(dpid));
+    }
+}
+
 // TODO: remove code duplication of switch detection in install and installBarrier method
 
 void Of13Backend::install(
@@ -110,30 +455,87 @@ void Of13Backend::install(
     std::vector<oxm::field_set> actions,
     uint16_t prio,
     retic::FlowSettings flow_settings
+) {
+    installIn(retic::Stage{}, std::move(match), std::move(actions),
+              prio, flow_settings);
+}
+
+void Of13Backend::installBarrier(oxm::field_set match, uint16_t prio) {
+    installBarrierIn(retic::Stage{}, std::move(match), prio);
+}
+
+uint8_t Of13Backend::table(retic::Stage stage, oxm::field_set& match) const {
+    static const auto ofb_metadata = oxm::metadata();
+    if (m_table + stage.index > 0xfe) {
+        throw std::out_of_range("Too many pipeline stages");
+    }
+    if (stage.index != 0) {
+        match.modify(ofb_metadata == stage.metadata);
+    }
+    return m_table + stage.index;
+}
+
+void Of13Backend::installIn(
+    retic::Stage stage,
+    oxm::field_set match,
+    std::vector<oxm::field_set> actions,
+    uint16_t prio,
+    retic::FlowSettings flow_settings
 ) {
     if (flow_settings.hard_timeout == retic::duration::zero()) {
         // there is no need to install its flow, becouse timeouts is zero
         return;
     }
     static const auto ofb_switch_id = oxm::switch_id();
+    uint8_t table_id = table(stage, match);
     auto switch_id_it = match.find(oxm::type(ofb_switch_id));
     if (switch_id_it != match.end()) {
         Packet& pkt_iface(match);
         uint64_t dpid = pkt_iface.load(ofb_switch_id);
         match.erase(oxm::mask<>(ofb_switch_id));
-        install_on(dpid, match, actions, prio, flow_settings);
+        install_on(table_id, dpid, match, actions, prio, flow_settings);
     } else {
         for (auto [dpid, driver]: m_drivers) {
-            install_on(dpid, match, actions, prio, flow_settings);
+            install_on(table_id, dpid, match, actions, prio, flow_settings);
         }
     }
 }
 
-void Of13Backend::installBarrier(oxm::field_set match, uint16_t prio) {
-    static const auto ofb_switch_id = oxm::switch_id();
-    auto switch_id_it = match.find(oxm::type(ofb_switch_id));
+void Of13Backend::installBarrierIn(
+    retic::Stage stage,
+    oxm::field_set match,
+    uint16_t prio
+) {
     Actions act;
     act.out_port = ports::to_controller;
+    act.max_len = m_miss_send_len;
+    install_actions(stage, std::move(match), prio, act);
+}
+
+void Of13Backend::installGoto(
+    retic::Stage stage,
+    oxm::field_set match,
+    uint16_t prio,
+    retic::Stage next
+) {
+    if (m_table + next.index > 0xfe) {
+        throw std::out_of_range("Too many pipeline stages");
+    }
+    Actions act;
+    act.goto_table = m_table + next.index;
+    act.metadata = next.metadata;
+    install_actions(stage, std::move(match), prio, act);
+}
+
+void Of13Backend::install_actions(
+    retic::Stage stage,
+    oxm::field_set match,
+    uint16_t prio,
+    Actions act
+) {
+    static const auto ofb_switch_id = oxm::switch_id();
+    uint8_t table_id = table(stage, match);
+    auto switch_id_it = match.find(oxm::type(ofb_switch_id));
 
     if (switch_id_it != match.end()) {
         Packet& pkt_iface(match);
@@ -144,22 +546,20 @@ void Of13Backend::installBarrier(oxm::field_set match, uint16_t prio) {
             LOG(WARNING) << "Needed to install rule. But there is no such switch";
             return;
         }
-        auto flow = driver_it->second->installRule(match, prio, act, m_table);
-        m_storage.push_back(flow);
+        driver_it->second->installRule(match, prio, act, table_id,
+                                       m_generations.at(dpid));
     } else {
         for (auto [dpid, driver]: m_drivers) {
-            auto flow = driver->installRule(match, prio, act, m_table);
-            m_storage.push_back(flow);
+            driver->installRule(match, prio, act, table_id,
+                                m_generations.at(dpid));
         }
     }
 }
 
-void Of13Backend::packetOuts(uint8_t* data, size_t data_len, std::vector<oxm::field_set> actions, uint64_t dpid) {
+void Of13Backend::packetOuts(uint8_t* data, size_t data_len, std::vector<oxm::field_set> actions, uint64_t dpid, uint32_t buffer_id, const Packet& pkt) {
     static const auto ofb_out_port = oxm::out_port();
     auto driver = m_drivers.at(dpid);
-    if (actions.empty()) {
-        return;
-    }
+    std::vector<Actions> outputs;
     for (auto& action: actions) {
         Actions driver_acts{};
         auto out_port_it = action.find(oxm::type(ofb_out_port));
@@ -169,12 +569,46 @@ void Of13Backend::packetOuts(uint8_t* data, size_t data_len, std::vector<oxm::fi
             action.erase(oxm::mask<>(ofb_out_port));
             driver_acts.out_port = out_port;
             driver_acts.set_fields = action;
-            driver->packetOut(data, data_len, driver_acts);
+            outputs.push_back(std::move(driver_acts));
+        }
+    }
+
+    if (outputs.empty()) {
+        if (buffer_id != buffers::no_buffer) {
+            // releases the buffer, packet is dropped
+            driver->packetOut(data, data_len, {}, buffer_id);
+        }
+        return;
+    }
+
+    // One packet-out sends all copies, so a buffered packet is sent
+    // whole. Outputs apply one after another, so each one first restores
+    // header values of the packet-in modified by the previous ones.
+    // Fewer restores if outputs overwrite modifications of the previous ones.
+    std::stable_sort(outputs.begin(), outputs.end(),
+        [](const Actions& lhs, const Actions& rhs) {
+            return std::distance(lhs.set_fields.begin(), lhs.set_fields.end()) <
+                   std::distance(rhs.set_fields.begin(), rhs.set_fields.end());
+        });
+    oxm::field_set modified;
+    for (auto& output: outputs) {
+        oxm::field_set set_fields;
+        if (not overwrites(output.set_fields, modified)) {
+            for (const auto& field: modified) {
+                set_fields.modify(pkt.load(oxm::mask<>(field)));
+            }
+        }
+        for (const auto& field: output.set_fields) {
+            set_fields.modify(field);
+            modified.modify(field);
         }
+        output.set_fields = std::move(set_fields);
     }
+    driver->packetOut(data, data_len, std::move(outputs), buffer_id);
 }
 
 void Of13Backend::install_on(
+    uint8_t table,
     uint64_t dpid,
     oxm::field_set match,
     std::vector<oxm::field_set> actions,
@@ -190,10 +624,13 @@ void Of13Backend::install_on(
     }
 
     OFDriverPtr driver = driver_it->second;
+    // rules of this backend are removed with its generation,
+    // even if the next backend is already created
+    uint32_t generation = m_generations.at(dpid);
 
     if (actions.empty()) {
         // drop packet
-        driver->installRule(match, prio, {}, m_table);
+        driver->installRule(match, prio, {}, table, generation);
         return;
     } 
     std::vector<Actions> buckets;
@@ -217,20 +654,17 @@ void Of13Backend::install_on(
 
     if (buckets.empty()) {
         // install drop rule
-        auto flow = driver->installRule(match, prio, {}, m_table);
-        m_storage.push_back(flow);
+        driver->installRule(match, prio, {}, table, generation);
     } else if(buckets.size() == 1) {
         // one actoinlist install directly into flow
-        auto flow = driver->installRule(match, prio, buckets[0], m_table);
-        m_storage.push_back(flow);
+        driver->installRule(match, prio, buckets[0], table, generation);
     } else {
         // many actionlists, create Group
 
         auto group = driver->installGroup(GroupType::All, buckets);
-        m_storage.push_back(group);
+        m_groups.push_back(group);
         Actions to_group = {.group_id = group->id()};
-        auto flow = driver->installRule(match, prio, to_group, m_table);
-        m_storage.push_back(flow);
+        driver->installRule(match, prio, to_group, table, generation);
     }
 }
 
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <unordered_map>
 #include <memory>
-#include <variant>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <vector>
 
 #include "Application.hh"
@@ -10,6 +13,8 @@
 #include "retic/policies.hh"
 #include "retic/backend.hh"
 #include "retic/fdd.hh"
+#include "retic/fdd_cache.hh"
+#include "types/task_pool.hh"
 #include "OFDriver.hh"
 #include "SwitchConnection.hh"
 #include <fluid/of13msg.hh>
@@ -29,34 +34,94 @@ public:
     const std::string& getMainName() const { return m_main_policy; }
     runos::retic::policy getMainPolicy() const { return m_policies.at(m_main_policy); }
     std::vector<std::string> getPoliciesName() const;
-    const runos::retic::fdd::diagram& getFdd() const {
-        return m_fdd;
-    }
+    /// Copy of the diagram with explored trace trees
+    runos::retic::fdd::diagram getFdd() const;
 
     void clearRules();
     void reinstallRules();
     void setMain(std::string new_main);
 
+    /**
+     * Schedules reinstall of rules and drops explored trace trees,
+     * e.g. when a policy function result became stale. Thread-safe,
+     * requests made before the reinstall happens are coalesced.
+     */
+    void invalidate();
+
+    /**
+     * Like invalidate(), but drops only explored trace trees and rules
+     * of packets with exact `field`, e.g. eth_dst of a moved host.
+     * Falls back to invalidate() if other rules depend on the field.
+     */
+    void invalidate(runos::oxm::field<> field);
+
 public slots:
     void onSwitchUp(runos::SwitchConnectionPtr conn, fluid_msg::of13::FeaturesReply fr);
 
+private slots:
+    void onInvalidate();
+    void onInvalidateFields();
+
 private:
     std::unordered_map<std::string, runos::retic::policy> m_policies;
-    runos::retic::fdd::diagram m_fdd;
+    std::mutex m_policies_mutex;
     std::string m_main_policy;
 
+    // Installed rules and the diagram they are translated from.
+    // Packet-in handlers take the current one and keep it until they
+    // are done, so a reinstall doesn't free it under their feet.
+    struct Snapshot {
+        std::unique_ptr<runos::Of13Backend> backend; // null if rules are cleared
+        runos::retic::fdd::diagram fdd;
+        // explored trace trees of fdd are looked up under a shared lock,
+        // they are augmented by one packet-in at a time
+        std::shared_mutex mutex;
+    };
+    // accessed with std::atomic_load and std::atomic_store
+    std::shared_ptr<Snapshot> m_snapshot;
+    // serializes reinstalls from the cli and invalidations
+    std::mutex m_rules_mutex;
+
     std::unordered_map<uint64_t, runos::OFDriverPtr> m_drivers;
-    std::unique_ptr<runos::Of13Backend> m_backend;
     uint8_t m_table;
+    // of barrier rules, whole packets by default
+    uint16_t m_miss_send_len = runos::buffers::no_buffer_len;
+    // stages of fields for multi-table pipeline, empty for one table
+    std::unordered_map<runos::oxm::type, unsigned> m_stages;
+    // order of fields in fdd: "oxm", "static" or "sifting"
+    std::string m_field_order;
+    // compiles independent policy terms in parallel, null for one thread
+    std::unique_ptr<runos::task_pool> m_compile_pool;
+    // the last compiled main policy, its diagram without explored trace trees
+    std::optional<runos::retic::policy> m_compiled_policy;
+    std::optional<runos::retic::fdd::diagram> m_compiled;
+    // survives restarts, null if disabled
+    std::unique_ptr<runos::retic::fdd::DiagramCache> m_fdd_cache;
+    std::atomic_bool m_invalidate_pending {false};
+    // fields to invalidate, see invalidate(field)
+    std::vector<runos::oxm::field<>> m_forget;
+    std::mutex m_forget_mutex;
+    std::atomic_bool m_forget_pending {false};
+
+    unsigned stageOf(runos::oxm::type type) const;
+    runos::retic::fdd::diagram compileMain();
+    void translate(Snapshot& snapshot);
+    void reinstall();
 };
 
 
 namespace runos {
+/**
+ * Installs rules of one policy generation.
+ * Rules are removed when the backend is destroyed, so to replace
+ * rules create the next backend first and destroy the old one then.
+ */
 class Of13Backend : public retic::Backend {
 public:
-    Of13Backend(std::unordered_map<uint64_t, OFDriverPtr> drivers, uint8_t table = 0)
-        : m_drivers(drivers), m_table(table)
-    { }
+    /// barrier rules send `miss_send_len` bytes of packets to controller
+    Of13Backend(std::unordered_map<uint64_t, OFDriverPtr> drivers, uint8_t table = 0,
+                uint16_t miss_send_len = buffers::no_buffer_len);
+    ~Of13Backend();
 
     void install(
         oxm::field_set match,
@@ -67,9 +132,27 @@ public:
 
     void installBarrier(oxm::field_set match, uint16_t prio) override;
 
-    void packetOuts (uint8_t* data, size_t data_len, std::vector<oxm::field_set> actions, uint64_t dpid) override;
+    void installIn(
+        retic::Stage stage,
+        oxm::field_set match,
+        std::vector<oxm::field_set> actions,
+        uint16_t prio,
+        retic::FlowSettings flow_settings
+    ) override;
+    void installBarrierIn(retic::Stage stage, oxm::field_set match,
+                          uint16_t prio) override;
+    void installGoto(retic::Stage stage, oxm::field_set match, uint16_t prio,
+                     retic::Stage next) override;
+
+    void packetOuts (uint8_t* data, size_t data_len, std::vector<oxm::field_set> actions, uint64_t dpid, uint32_t buffer_id, const Packet& pkt) override;
+
+    /// Removes rules of this generation which match is `match` or narrower
+    void removeRules(oxm::field_set match);
 private:
+    void install_actions(retic::Stage stage, oxm::field_set match,
+                         uint16_t prio, Actions act);
     void install_on(
+        uint8_t table,
         uint64_t dpid,
         oxm::field_set match,
         std::vector<oxm::field_set> actions,
@@ -77,8 +160,13 @@ private:
         retic::FlowSettings flow_settings
     );
     std::unordered_map<uint64_t, OFDriverPtr> m_drivers;
-    using OfObject = std::variant<GroupPtr, RulePtr>;
-    std::vector<OfObject> m_storage;
-    uint8_t m_table;
+    std::unordered_map<uint64_t, uint32_t> m_generations; // by dpid
+    // released after rules which refer to them are removed
+    std::vector<GroupPtr> m_groups;
+    uint8_t m_table; // of the first stage, next stages use following tables
+    uint16_t m_miss_send_len;
+
+    // adds the metadata match of `stage` to `match`
+    uint8_t table(retic::Stage stage, oxm::field_set& match) const;
 };
 } // namespace runos
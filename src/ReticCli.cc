@@ -58,7 +58,7 @@ public:
             }
             if (not vm["dump"].empty()) {
                 std::string out_file = vm["dump"].as<std::string>();
-                auto& diag = app->getFdd();
+                auto diag = app->getFdd();
                 std::ofstream file(out_file);
                 retic::dumpAsDot(diag, file);
             }
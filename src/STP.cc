@@ -16,19 +16,219 @@
 
 #include "STP.hh"
 
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/kruskal_min_spanning_tree.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <unordered_set>
+
+#include <QTimer>
 
-#include "Topology.hh"
 #include "Controller.hh"
 #include "SwitchConnection.hh"
 #include "Maple.hh"
-REGISTER_APPLICATION(STP, {"controller", "switch-manager", "link-discovery", "topology", ""})
+REGISTER_APPLICATION(STP, {"controller", "switch-manager", "link-discovery", ""})
 
 enum {
     FLOOD_GROUP = 0xf100d
 };
 
+/**
+ * Spanning forest over discovered links, maintained on
+ * every link change without full recomputation.
+ */
+class SpanningForest {
+public:
+    // links are stored with (from < to)
+    typedef std::pair<switch_and_port, switch_and_port> link_key;
+
+    struct Change {
+        std::vector<link_key> added;
+        std::vector<link_key> removed;
+
+        void touched(std::unordered_set<uint64_t>& dpids) const
+        {
+            for (const auto& l : added) {
+                dpids.insert(l.first.dpid);
+                dpids.insert(l.second.dpid);
+            }
+            for (const auto& l : removed) {
+                dpids.insert(l.first.dpid);
+                dpids.insert(l.second.dpid);
+            }
+        }
+    };
+
+    Change insert(switch_and_port from, switch_and_port to);
+    Change erase(switch_and_port from, switch_and_port to);
+
+    bool isSwitchPort(switch_and_port port) const
+    { return port_index.count(port) > 0; }
+
+    bool inTree(switch_and_port port) const
+    {
+        auto it = port_index.find(port);
+        return it != port_index.end() && links.at(it->second).in_tree;
+    }
+
+private:
+    struct LinkInfo {
+        bool in_tree;
+    };
+
+    std::map<link_key, LinkInfo> links;
+    std::unordered_map<switch_and_port, link_key> port_index;
+    // tree links adjacent to switch
+    std::unordered_map<uint64_t, std::vector<link_key>> tree_adj;
+
+    static link_key key(switch_and_port from, switch_and_port to)
+    { return from < to ? link_key{from, to} : link_key{to, from}; }
+
+    static uint64_t other(const link_key& l, uint64_t dpid)
+    { return l.first.dpid == dpid ? l.second.dpid : l.first.dpid; }
+
+    void addTree(const link_key& l);
+    void removeTree(const link_key& l);
+
+    // tree links on path between two switches, empty if not connected
+    bool treePath(uint64_t from, uint64_t to, std::vector<link_key>& path) const;
+    std::unordered_set<uint64_t> component(uint64_t dpid) const;
+};
+
+void SpanningForest::addTree(const link_key& l)
+{
+    links.at(l).in_tree = true;
+    tree_adj[l.first.dpid].push_back(l);
+    tree_adj[l.second.dpid].push_back(l);
+}
+
+void SpanningForest::removeTree(const link_key& l)
+{
+    links.at(l).in_tree = false;
+    for (uint64_t dpid : {l.first.dpid, l.second.dpid}) {
+        auto& adj = tree_adj[dpid];
+        adj.erase(std::remove(adj.begin(), adj.end(), l), adj.end());
+    }
+}
+
+bool SpanningForest::treePath(uint64_t from, uint64_t to,
+                              std::vector<link_key>& path) const
+{
+    std::unordered_map<uint64_t, link_key> via;
+    std::deque<uint64_t> queue {from};
+    via.emplace(from, link_key{});
+
+    while (not queue.empty() && via.count(to) == 0) {
+        uint64_t dpid = queue.front();
+        queue.pop_front();
+        auto adj = tree_adj.find(dpid);
+        if (adj == tree_adj.end())
+            continue;
+        for (const auto& l : adj->second) {
+            uint64_t next = other(l, dpid);
+            if (via.emplace(next, l).second)
+                queue.push_back(next);
+        }
+    }
+
+    if (via.count(to) == 0)
+        return false;
+
+    path.clear();
+    for (uint64_t dpid = to; dpid != from; ) {
+        const auto& l = via.at(dpid);
+        path.push_back(l);
+        dpid = other(l, dpid);
+    }
+    return true;
+}
+
+std::unordered_set<uint64_t> SpanningForest::component(uint64_t dpid) const
+{
+    std::unordered_set<uint64_t> ret {dpid};
+    std::deque<uint64_t> queue {dpid};
+
+    while (not queue.empty()) {
+        uint64_t cur = queue.front();
+        queue.pop_front();
+        auto adj = tree_adj.find(cur);
+        if (adj == tree_adj.end())
+            continue;
+        for (const auto& l : adj->second) {
+            uint64_t next = other(l, cur);
+            if (ret.insert(next).second)
+                queue.push_back(next);
+        }
+    }
+    return ret;
+}
+
+SpanningForest::Change SpanningForest::insert(switch_and_port from,
+                                              switch_and_port to)
+{
+    Change ret;
+    auto l = key(from, to);
+    if (from.dpid == to.dpid || links.count(l) > 0)
+        return ret;
+
+    links.emplace(l, LinkInfo{false});
+    port_index[from] = l;
+    port_index[to] = l;
+
+    // link inside of a tree would make a cycle
+    std::vector<link_key> cycle;
+    if (not treePath(from.dpid, to.dpid, cycle)) {
+        addTree(l);
+        ret.added.push_back(l);
+    }
+    return ret;
+}
+
+SpanningForest::Change SpanningForest::erase(switch_and_port from,
+                                             switch_and_port to)
+{
+    Change ret;
+    auto l = key(from, to);
+    auto it = links.find(l);
+    if (it == links.end())
+        return ret;
+
+    bool was_tree = it->second.in_tree;
+    if (was_tree) {
+        removeTree(l);
+        ret.removed.push_back(l);
+    }
+    links.erase(it);
+    // ports may already belong to a newer link
+    for (const auto& port : {l.first, l.second}) {
+        auto index = port_index.find(port);
+        if (index != port_index.end() && index->second == l)
+            port_index.erase(index);
+    }
+
+    if (not was_tree)
+        return ret;
+
+    // search for a link joining two parts of the tree
+    auto part = component(l.first.dpid);
+    auto replacement = links.end();
+    for (auto cand = links.begin(); cand != links.end(); ++cand) {
+        if (cand->second.in_tree)
+            continue;
+        bool first_in = part.count(cand->first.first.dpid) > 0;
+        bool second_in = part.count(cand->first.second.dpid) > 0;
+        if (first_in != second_in) {
+            replacement = cand;
+            break;
+        }
+    }
+
+    if (replacement != links.end()) {
+        addTree(replacement->first);
+        ret.added.push_back(replacement->first);
+    }
+    return ret;
+}
+
 void SwitchSTP::resetBroadcast()
 {
     for (auto port : ports) {
@@ -45,6 +245,7 @@ STPPorts SwitchSTP::getEnabledPorts()
         if (port.second->broadcast)
             result.push_back(port.second->port_no);
     }
+    std::sort(result.begin(), result.end());
     return result;
 }
 
@@ -63,6 +264,7 @@ void SwitchSTP::updateGroup()
         b.add_action(new of13::OutputAction(port, 0));
         gm.add_bucket(b);
     }
+    installed = std::move(ports);
     DVLOG(20) << "Update group in switch" << sw->id();
     sw->connection()->send(gm);
 }
@@ -94,6 +296,7 @@ void SwitchSTP::installGroup()
         b.add_action(new of13::OutputAction(port, 0));
         gm.add_bucket(b);
     }
+    installed = std::move(ports);
     DVLOG(20) << "Install group in switch" << sw->id();
     sw->connection()->send(gm);
 }
@@ -104,11 +307,15 @@ void SwitchSTP::setSwitchPort(uint32_t port_no, uint64_t dpid)
     ports.at(port_no)->nextSwitch = parent->switch_list[dpid];
 }
 
+STP::STP()
+    : forest(new SpanningForest)
+{ }
+
+STP::~STP() = default;
+
 void STP::init(Loader* loader, const Config& config)
 {
     QObject* ld = ILinkDiscovery::get(loader);
-    auto subconfig = config_cd(config, "stp");
-    poll_timeout = config_get(subconfig, "poll-timeout", 3);
     connect(ld, SIGNAL(linkDiscovered(switch_and_port, switch_and_port)),
                      this, SLOT(onLinkDiscovered(switch_and_port, switch_and_port)));
     connect(ld, SIGNAL(linkBroken(switch_and_port, switch_and_port)),
@@ -118,17 +325,11 @@ void STP::init(Loader* loader, const Config& config)
     connect(sw, &SwitchManager::switchDiscovered, this, &STP::onSwitchDiscovered);
     connect(sw, &SwitchManager::switchDown, this, &STP::onSwitchDown);
     connect(sw, &SwitchManager::switchUp, this, &STP::onSwitchUp);
-    topo = Topology::get(loader);
-
-    computed = false;
-    timer = new QTimer;
-    connect(timer, SIGNAL(timeout()), this, SLOT(computeSpanningTree()));
-    timer->start(poll_timeout * 1000);
 }
 
 STPPorts STP::getSTP(uint64_t dpid)
 {
-    if (switch_list.count(dpid) == 0 or not computed) {
+    if (switch_list.count(dpid) == 0) {
         return {};
     }
 
@@ -160,44 +361,40 @@ runos::retic::policy STP::broadcastPolicy() const {
 
 void STP::onLinkDiscovered(switch_and_port from, switch_and_port to)
 {
-    if (switch_list.count(from.dpid) == 0)
-        return;
+    auto change = forest->insert(from, to);
 
-    if (switch_list.count(to.dpid) == 0)
-        return;
+    if (switch_list.count(from.dpid) > 0 && switch_list.count(to.dpid) > 0) {
+        SwitchSTP* sw = switch_list[from.dpid];
+        if (!sw->existsPort(from.port)) {
+            Port* port = new Port(from.port);
+            sw->ports[from.port] = port;
+        }
+        sw->setSwitchPort(from.port, to.dpid);
 
-    SwitchSTP* sw = switch_list[from.dpid];
-    if (!sw->existsPort(from.port)) {
-        Port* port = new Port(from.port);
-        sw->ports[from.port] = port;
+        sw = switch_list[to.dpid];
+        if (!sw->existsPort(to.port)) {
+            Port* port = new Port(to.port);
+            sw->ports[to.port] = port;
+        }
+        sw->setSwitchPort(to.port, from.dpid);
     }
 
-    // port is disabled by default
-    sw->unsetBroadcast(from.port);
-    sw->updateGroup();
-
-    sw->setSwitchPort(from.port, to.dpid);
-
-    sw = switch_list[to.dpid];
-    if (!sw->existsPort(to.port)) {
-        Port* port = new Port(to.port);
-        sw->ports[to.port] = port;
+    std::unordered_set<uint64_t> touched {from.dpid, to.dpid};
+    change.touched(touched);
+    for (auto dpid : touched) {
+        syncSwitch(dpid);
     }
-
-    // port is disabled by default
-    sw->unsetBroadcast(to.port);
-    sw->updateGroup();
-
-    sw->setSwitchPort(to.port, from.dpid);
-
-    // recompute pathes for all switches
-    computed = false;
 }
 
 void STP::onLinkBroken(switch_and_port from, switch_and_port to)
 {
-    // recompute pathes for all switches
-    computed = false;
+    auto change = forest->erase(from, to);
+
+    std::unordered_set<uint64_t> touched;
+    change.touched(touched);
+    for (auto dpid : touched) {
+        syncSwitch(dpid);
+    }
 }
 
 void STP::onSwitchDiscovered(Switch* dp)
@@ -236,59 +433,49 @@ void STP::onPortUp(Switch *dp, of13::Port port)
             Port* p = new Port(port.port_no());
             sw->ports[port.port_no()] = p;
         }
-        sw->updateGroup();
+        syncSwitch(dp->id());
     }
 }
 
-void STP::computeSpanningTree()
+void STP::syncSwitch(uint64_t dpid)
 {
-    static std::mutex compute_mutex;
-    using namespace boost;
-    using namespace topology;
-
-    typedef graph_traits<TopologyGraph>::edge_descriptor edge_descriptor ;
-
-    // clear spanning tree before new computing
-
-    if (not computed){
-        VLOG(20) << "Compute spanning tree";
-        compute_mutex.lock();
-
-        // all switch-switch ports are not broadcast
-        for (auto sw : switch_list){
-            sw.second->resetBroadcast();
+    auto it = switch_list.find(dpid);
+    if (it == switch_list.end())
+        return;
+    SwitchSTP* sw = it->second;
+
+    // switch-switch ports are broadcast only if they are in spanning tree
+    for (auto& port : sw->ports) {
+        switch_and_port sp{dpid, port.first};
+        if (forest->isSwitchPort(sp))
+            port.second->to_switch = true;
+        if (port.second->to_switch) {
+            port.second->broadcast = forest->inTree(sp);
+            VLOG(10) << dpid << ":" << port.first
+                     << (port.second->broadcast ? " in" : " not in")
+                     << " spanning tree";
         }
-        spanning_tree.clear();
-
-        auto boost_kruskal = [this](const topology::TopologyGraph& g){
-            std::vector<edge_descriptor> result;
-            kruskal_minimum_spanning_tree(g, std::back_inserter(result),
-                    boost::weight_map( boost::get(&link_property::weight, g )) );
-            for (auto& i : result){
-                link_property l = g[i];
-                spanning_tree[l.source.dpid].push_back(l.source.port);
-                spanning_tree[l.target.dpid].push_back(l.target.port);
-            }
-
-        };
-        topo->apply(boost_kruskal);
+    }
 
-        // set ports broadcast in spanning tree
-        for (auto& i : spanning_tree){
-            SwitchSTP *sw = switch_list[i.first];
-            for (auto& p : i.second){
-                if (sw->existsPort(p)){
-                    sw->setBroadcast(p);
-                    VLOG(10) << i.first << ":" << p << " added in spanning tree";
-                }
+    if (sw->getEnabledPorts() != sw->installed) {
+        if (sw->sw->connection()->congested()) {
+            // changes made meanwhile are coalesced into one update
+            VLOG(10) << "Switch " << dpid << " is congested, group update deferred";
+            if (deferred.empty()) {
+                QTimer::singleShot(c_retry_interval, this, &STP::syncDeferred);
             }
-            // update bucket groups
-            sw->updateGroup();
+            deferred.insert(dpid);
+            return;
         }
-
-        computed = true;
-
-        compute_mutex.unlock();
+        sw->updateGroup();
     }
 }
 
+void STP::syncDeferred()
+{
+    std::unordered_set<uint64_t> pending;
+    pending.swap(deferred);
+    for (auto dpid : pending) {
+        syncSwitch(dpid);
+    }
+}
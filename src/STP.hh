@@ -17,9 +17,10 @@
 /** @file */
 #pragma once
 
-#include <QTimer>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "retic/policies.hh"
@@ -73,6 +74,9 @@ public:
 
     STPPorts getEnabledPorts();
 private:
+    // ports in the flood group on the switch, sorted
+    STPPorts installed;
+
     void clearGroup();
     void installGroup();
     friend STP;
@@ -84,7 +88,10 @@ private:
  * This application register function which implement flood action, and prevents
  * loops and storm of broadcast packets, by disabling some ports
  *
- * This application computes mininal spanning tree by kruskal alghorithm
+ * This application maintains spanning tree incrementally: a new link
+ * joins the tree only if it connects two trees, a broken tree link is
+ * replaced by any link joining two parts of the tree.
+ * Flood groups are updated only on switches which ports set changed.
  */
 class STP : public Application {
     Q_OBJECT
@@ -104,6 +111,9 @@ public:
 
     runos::retic::policy broadcastPolicy() const;
 
+    STP();
+    ~STP();
+
     void init(Loader* loader, const Config& config) override;
 /**
  * get enabling for flooding ports
@@ -120,18 +130,19 @@ protected slots:
     void onSwitchDown(Switch* dp);
     void onSwitchUp(Switch* dp);
     void onPortUp(Switch* dp, of13::Port port);
-    void computeSpanningTree();
 
 private:
-    unsigned int poll_timeout;
-
     std::unordered_map<uint64_t, SwitchSTP*> switch_list;
-    class Topology* topo;
 
     friend class SwitchSTP;
 
-    std::unordered_map<uint64_t, STPPorts> spanning_tree;
+    std::unique_ptr<class SpanningForest> forest;
+
+    // congested switches, their groups are updated when they catch up
+    std::unordered_set<uint64_t> deferred;
+    static constexpr int c_retry_interval = 100; // milliseconds
 
-    bool computed;
-    QTimer *timer;
+    // apply spanning tree to switch ports and update group if needed
+    void syncSwitch(uint64_t dpid);
+    void syncDeferred();
 };
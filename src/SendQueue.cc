@@ -0,0 +1,131 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SendQueue.hh"
+
+#include <cstring>
+
+namespace runos {
+namespace sendq {
+
+Settings Settings::fromConfig(const Config& config)
+{
+    Settings ret;
+    auto cfg = config_cd(config, "send-queue");
+
+    ret.enabled = config_get(cfg, "enabled", ret.enabled);
+    ret.drain_interval = config_get(cfg, "drain-interval",
+                                    int(ret.drain_interval));
+    ret.high_watermark = config_get(cfg, "high-watermark",
+                                    int(ret.high_watermark));
+    ret.max_bytes = config_get(cfg, "max-bytes", int(ret.max_bytes));
+    ret.max_wait = config_get(cfg, "max-wait", int(ret.max_wait));
+
+    if (ret.drain_interval == 0)
+        ret.drain_interval = 1;
+    if (ret.high_watermark > ret.max_bytes)
+        ret.high_watermark = ret.max_bytes;
+
+    return ret;
+}
+
+bool SendQueue::push(const void* data, size_t len,
+                     std::chrono::milliseconds timeout)
+{
+    bool fits = reserve(len);
+    if (not fits && timeout.count() > 0) {
+        std::unique_lock<std::mutex> lock(m_room_mutex);
+        ++m_waiters;
+        fits = m_room.wait_for(lock, timeout, [&] { return reserve(len); });
+        --m_waiters;
+    }
+    if (not fits) {
+        m_bytes.fetch_add(len, std::memory_order_relaxed);
+        ++m_overflows;
+    }
+
+    Message msg;
+    msg.data.reset(new uint8_t[len]);
+    msg.len = len;
+    std::memcpy(msg.data.get(), data, len);
+
+    ++m_depth;
+    ++m_queued;
+    m_queue.push(std::move(msg));
+    return fits;
+}
+
+bool SendQueue::reserve(size_t len)
+{
+    // concurrent pushes may overshoot the limit by a message each
+    // a message above the limit is queued alone
+    size_t bytes = m_bytes.fetch_add(len, std::memory_order_relaxed) + len;
+    if (bytes > m_settings.max_bytes && bytes != len) {
+        m_bytes.fetch_sub(len, std::memory_order_relaxed);
+        return false;
+    }
+
+    size_t peak = m_peak_bytes.load(std::memory_order_relaxed);
+    while (bytes > peak &&
+           not m_peak_bytes.compare_exchange_weak(peak, bytes,
+                                                  std::memory_order_relaxed))
+    { }
+    return true;
+}
+
+size_t SendQueue::clear()
+{
+    Message msg;
+    size_t ret = 0;
+    while (m_queue.pop(msg)) {
+        popped(msg);
+        ++ret;
+    }
+    m_dropped += ret;
+    wakeSenders();
+    return ret;
+}
+
+void SendQueue::popped(const Message& msg)
+{
+    --m_depth;
+    m_bytes.fetch_sub(msg.len, std::memory_order_relaxed);
+}
+
+void SendQueue::wakeSenders()
+{
+    // waiters also wake up by timeout, so a missed notification only delays them
+    if (m_waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_room_mutex);
+        m_room.notify_all();
+    }
+}
+
+Stats SendQueue::stats() const
+{
+    Stats ret;
+    ret.queue_depth = m_depth;
+    ret.queue_bytes = m_bytes;
+    ret.peak_bytes = m_peak_bytes;
+    ret.queued = m_queued;
+    ret.sent = m_sent;
+    ret.overflows = m_overflows;
+    ret.dropped = m_dropped;
+    return ret;
+}
+
+} // namespace sendq
+} // namespace runos
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#include "Config.hh"
+#include "types/mpsc_queue.hh"
+
+namespace runos {
+namespace sendq {
+
+/**
+ * Send queue settings. Read from `controller.send-queue` section:
+ * `"send-queue": { "enabled": true, "drain-interval": 1,
+ *                  "high-watermark": 262144, "max-bytes": 4194304,
+ *                  "max-wait": 100 }`
+ *
+ * Both limits count bytes the switch hasn't processed yet:
+ * queued ones and ones sent but not confirmed by a barrier reply.
+ */
+struct Settings {
+    bool enabled = false;
+    unsigned drain_interval = 1;       // milliseconds
+    size_t high_watermark = 256 << 10; // bytes, switch is congested above
+    size_t max_bytes = 4 << 20;        // bytes, senders wait for the switch above
+    unsigned max_wait = 100;           // milliseconds, then the message is queued anyway
+
+    static Settings fromConfig(const Config& config);
+};
+
+struct Stats {
+    uint64_t dpid = 0;
+    size_t queue_depth = 0; // messages
+    size_t queue_bytes = 0;
+    size_t peak_bytes = 0;
+    uint64_t queued = 0;
+    uint64_t sent = 0;
+    uint64_t overflows = 0; // queued over the limit after max-wait
+    uint64_t dropped = 0;   // queued to a disconnected switch
+    size_t unconfirmed_bytes = 0; // sent, but not processed by the switch yet
+};
+
+/**
+ * Messages to a single switch sent from threads other than its
+ * connection thread. They are copied into the queue without locks
+ * and sent by the connection thread in order, so senders don't
+ * contend for the connection.
+ *
+ * push(), bytes() and stats() are called from any thread,
+ * drain() and clear() by one thread at a time.
+ */
+class SendQueue {
+public:
+    explicit SendQueue(const Settings& settings)
+        : m_settings(settings)
+    { }
+
+    const Settings& settings() const
+    { return m_settings; }
+
+    /**
+     * Copies message to the queue. While the queue is full, waits up to
+     * `timeout` until drain() makes room for it. Messages are never
+     * refused: after the timeout the message is queued over the limit.
+     * @return false if the message is queued over the limit.
+     */
+    bool push(const void* data, size_t len,
+              std::chrono::milliseconds timeout = {});
+
+    /**
+     * Passes queued messages to `send(const void* data, size_t len)`
+     * in FIFO order until `budget` bytes are sent. The last message
+     * may exceed the budget.
+     */
+    template<class Send>
+    void drain(Send&& send, size_t budget = std::numeric_limits<size_t>::max())
+    {
+        Message msg;
+        size_t sent = 0;
+        while (sent < budget && m_queue.pop(msg)) {
+            send(msg.data.get(), msg.len);
+            sent += msg.len;
+            popped(msg);
+            ++m_sent;
+        }
+        if (sent > 0) {
+            wakeSenders();
+        }
+    }
+
+    /// Drops queued messages (e.g. on disconnect), returns their number
+    size_t clear();
+
+    /// Number of queued bytes
+    size_t bytes() const
+    { return m_bytes.load(std::memory_order_relaxed); }
+
+    /// The queue has no messages, some may be in the middle of push()
+    bool empty() const
+    { return m_depth.load() == 0; }
+
+    Stats stats() const;
+
+private:
+    struct Message {
+        std::unique_ptr<uint8_t[]> data;
+        size_t len = 0;
+    };
+
+    const Settings m_settings;
+    mpsc_queue<Message> m_queue;
+
+    std::atomic<size_t> m_depth {0};
+    std::atomic<size_t> m_bytes {0};
+    std::atomic<size_t> m_peak_bytes {0};
+    std::atomic<uint64_t> m_queued {0};
+    std::atomic<uint64_t> m_sent {0};
+    std::atomic<uint64_t> m_overflows {0};
+    std::atomic<uint64_t> m_dropped {0};
+
+    // senders waiting for room
+    std::mutex m_room_mutex;
+    std::condition_variable m_room;
+    std::atomic<unsigned> m_waiters {0};
+
+    /// Accounts a message if it fits into the queue
+    bool reserve(size_t len);
+    void popped(const Message& msg);
+    void wakeSenders();
+};
+
+} // namespace sendq
+} // namespace runos
@@ -156,6 +156,10 @@ void SwitchStats::pollTimeout()
         of13::MultipartRequestPortStats req;
         req.flags(0);
         req.port_no(of13::OFPP_ANY);
+        if (sw->connection()->congested()) {
+            DVLOG(5) << "Switch " << sw->id() << " is congested, stats are skipped";
+            continue;
+        }
         if (all_switches_stats.count(sw->id()))
             pdescr->request(sw->connection(), req);
     }
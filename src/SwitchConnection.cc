@@ -3,13 +3,16 @@
 #include <fluid/OFConnection.hh>
 #include <fluid/ofcommon/msg.hh>
 
+#include "Common.hh"
+#include "SendQueue.hh"
+
 using fluid_base::OFConnection;
 
 namespace runos {
 
 bool SwitchConnection::alive() const
 {
-    return m_ofconn ? m_ofconn->is_alive() : false;
+    return m_ofconn ? m_ofconn->is_alive() : m_replayed;
 }
 
 uint8_t SwitchConnection::version() const
@@ -19,14 +22,128 @@ uint8_t SwitchConnection::version() const
 
 void SwitchConnection::send(const fluid_msg::OFMsg& cmsg)
 {
-    if (not m_ofconn || not m_ofconn->is_alive()) return;
+    if (not alive()) return;
 
     auto& msg = const_cast<fluid_msg::OFMsg&>(cmsg);
     auto buf = msg.pack();
-    m_ofconn->send(buf, msg.length());
+    send(buf, msg.length());
     fluid_msg::OFMsg::free_buffer(buf);
 }
 
+namespace {
+// set in threads of connection event loops
+thread_local bool connection_thread = false;
+}
+
+void SwitchConnection::send(const void* data, size_t len)
+{
+    if (not m_ofconn || not m_ofconn->is_alive()) return;
+
+    if (m_send_queue && std::this_thread::get_id() != m_owner.load()) {
+        // Only the connection thread writes to the connection.
+        // Senders wait while the switch is behind, but connection
+        // threads of other switches have to keep serving them.
+        std::chrono::milliseconds timeout {
+            connection_thread ? 0 : m_send_queue->settings().max_wait
+        };
+        if (not m_send_queue->push(data, len, timeout) &&
+            m_overflows++ % 1000 == 0) {
+            LOG(WARNING) << "Send queue of switch " << std::hex << m_dpid
+                         << " is full, messages are queued over the limit";
+        }
+        return;
+    }
+
+    if (m_send_queue) {
+        // messages queued before go first
+        flushQueue();
+        if (not m_send_queue->empty()) {
+            m_send_queue->push(data, len);
+            return;
+        }
+    }
+    write(data, len);
+}
+
+bool SwitchConnection::congested() const
+{
+    return m_send_queue && m_send_queue->bytes() + unconfirmed() >
+                           m_send_queue->settings().high_watermark;
+}
+
+void SwitchConnection::own()
+{
+    m_owner = std::this_thread::get_id();
+    connection_thread = true;
+    // barriers sent to the old connection are never confirmed
+    m_markers.clear();
+    m_marked_bytes = m_sent_bytes;
+    m_unconfirmed = 0;
+}
+
+void SwitchConnection::flushQueue()
+{
+    if (not m_send_queue) return;
+
+    if (not m_ofconn || not m_ofconn->is_alive()) {
+        size_t dropped = m_send_queue->clear();
+        if (dropped > 0) {
+            LOG(WARNING) << "Switch " << std::hex << m_dpid << " is disconnected, "
+                         << std::dec << dropped << " queued messages dropped";
+        }
+        return;
+    }
+
+    size_t max_bytes = m_send_queue->settings().max_bytes;
+    if (unconfirmed() < max_bytes) {
+        m_send_queue->drain([this](const void* data, size_t len) {
+            write(data, len);
+        }, max_bytes - unconfirmed());
+    }
+    // confirm the tail, so the switch isn't waited for forever
+    if (m_markers.empty() && m_sent_bytes > m_marked_bytes) {
+        mark();
+    }
+}
+
+void SwitchConnection::write(const void* data, size_t len)
+{
+    m_ofconn->send(const_cast<void*>(data), len);
+    if (not m_send_queue) return;
+
+    m_sent_bytes += len;
+    m_unconfirmed += len;
+    if (m_sent_bytes - m_marked_bytes >= m_send_queue->settings().max_bytes / 8) {
+        mark();
+    }
+}
+
+void SwitchConnection::mark()
+{
+    Marker marker {MARKER_XID | (m_next_marker++ & ~MARKER_XID), m_sent_bytes};
+    of13::BarrierRequest barrier(marker.xid);
+    auto buf = barrier.pack();
+    m_ofconn->send(buf, barrier.length());
+    OFMsg::free_buffer(buf);
+
+    m_marked_bytes = m_sent_bytes;
+    m_markers.push_back(marker);
+}
+
+bool SwitchConnection::confirm(uint32_t xid)
+{
+    if ((xid & MARKER_XID) != MARKER_XID) return false;
+
+    // replies come in order, a lost one is confirmed by the next
+    while (not m_markers.empty()) {
+        Marker marker = m_markers.front();
+        m_markers.pop_front();
+        m_unconfirmed = m_sent_bytes - marker.offset;
+        if (marker.xid == xid) break;
+    }
+    return true;
+}
+
 void SwitchConnection::close()
 { 
     if (m_ofconn) m_ofconn->close(), m_ofconn = nullptr;
@@ -34,6 +151,10 @@ void SwitchConnection::close()
 
 SwitchConnection::SwitchConnection(OFConnection* ofconn, uint64_t dpid)
     : m_dpid(dpid), m_ofconn(ofconn)
-{ }
+{
+    own();
+}
+
+SwitchConnection::~SwitchConnection() = default;
 
 } // namespace runos
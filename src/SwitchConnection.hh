@@ -2,8 +2,12 @@
 
 #include "SwitchConnectionFwd.hh"
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
+#include <deque>
+#include <memory>
+#include <thread>
 
 #include <QMetaType>
 
@@ -19,6 +23,10 @@ class OFMsg;
 
 namespace runos {
 
+namespace sendq {
+class SendQueue;
+}
+
 /**
  * Connection with physical switch for OpenFlow communication
  */
@@ -38,15 +46,84 @@ public:
     /**
      * Send OpenFlow message to switch
      *
+     * If send queue is enabled, messages sent from threads other than
+     * the connection one are queued and sent by the connection thread.
+     * It sends only while the switch has less than `max-bytes` to
+     * process. If the queue is full, the sender waits up to `max-wait`
+     * for room (connection threads of other switches don't wait),
+     * so messages are never dropped while the switch is connected.
+     * Order of messages sent by one thread is kept.
+     *
      * @param msg message.
      */
     void send(const fluid_msg::OFMsg& msg);
 
+    /**
+     * Send already packed OpenFlow message to switch
+     *
+     * @param data message in wire format.
+     * @param len message length.
+     */
+    virtual void send(const void* data, size_t len);
+
+    /**
+     * The switch has more than `high-watermark` bytes to process:
+     * queued ones and ones it hasn't confirmed yet. It processes
+     * messages slower than they are sent, so senders of non-urgent
+     * messages (e.g. statistics requests) should back off.
+     */
+    bool congested() const;
+
     void close();
 
+    virtual ~SwitchConnection();
+
 protected:
     fluid_base::OFConnection* m_ofconn;
+    // replayed switch is alive without connection, messages to it are dropped
+    bool m_replayed {false};
+    // null if disabled
+    std::unique_ptr<sendq::SendQueue> m_send_queue;
+    // thread of the connection event loop, only it writes to m_ofconn
+    std::atomic<std::thread::id> m_owner;
     SwitchConnection(fluid_base::OFConnection* ofconn, uint64_t dpid);
+
+    /// Called by the connection thread when it takes the connection
+    void own();
+
+    /// Sends queued messages, called by the connection thread
+    void flushQueue();
+
+    /**
+     * Handles barrier reply of the connection thread, which confirms
+     * that the switch has processed messages sent before the barrier.
+     * @return false if the barrier wasn't sent by the connection.
+     */
+    bool confirm(uint32_t xid);
+
+    /// Sent bytes the switch hasn't confirmed
+    size_t unconfirmed() const
+    { return m_unconfirmed.load(std::memory_order_relaxed); }
+
+private:
+    // Markers are barriers sent every `max-bytes / 8` bytes
+    // with xids from the top of the xid space.
+    static constexpr uint32_t MARKER_XID = 0xff000000;
+    struct Marker {
+        uint32_t xid;
+        uint64_t offset; // m_sent_bytes before the barrier
+    };
+
+    // written by the connection thread only
+    uint64_t m_sent_bytes {0};
+    uint64_t m_marked_bytes {0};
+    uint32_t m_next_marker {0};
+    std::deque<Marker> m_markers;
+    std::atomic<size_t> m_unconfirmed {0};
+    std::atomic<uint64_t> m_overflows {0}; // for rate limited warnings
+
+    void write(const void* data, size_t len);
+    void mark();
 };
 
 } // namespace runos
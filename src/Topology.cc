@@ -16,7 +16,14 @@
 
 #include "Topology.hh"
 
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/dijkstra_shortest_paths_no_color_map.hpp>
@@ -89,6 +96,205 @@ json11::Json Link::to_floodlight_json() const {
 typedef TopologyGraph::vertex_descriptor
     vertex_descriptor;
 
+/**
+ * Shortest-path tree rooted at the destination switch.
+ * Vertices added after computation are treated as unreachable.
+ */
+struct RouteTree {
+    static constexpr int infinity = std::numeric_limits<int>::max();
+
+    std::vector<vertex_descriptor> pred;
+    std::vector<int> dist;
+
+    vertex_descriptor parent(vertex_descriptor v) const
+    { return v < pred.size() ? pred[v] : v; }
+
+    int distance(vertex_descriptor v) const
+    { return v < dist.size() ? dist[v] : infinity; }
+
+    bool uses(vertex_descriptor u, vertex_descriptor v) const
+    { return (u != v) && (parent(u) == v || parent(v) == u); }
+
+    // May new edge (u, v) make some path shorter?
+    bool improvedBy(vertex_descriptor u, vertex_descriptor v, int weight) const
+    {
+        int du = distance(u), dv = distance(v);
+        if (du != infinity && (dv == infinity || du + weight < dv))
+            return true;
+        if (dv != infinity && (du == infinity || dv + weight < du))
+            return true;
+        return false;
+    }
+};
+
+/**
+ * Loopless path, used by k-shortest paths search.
+ */
+struct Path {
+    std::vector<vertex_descriptor> vertices; // from source to target
+    std::vector<link_property> links;
+    int cost = 0;
+
+    bool uses(vertex_descriptor u, vertex_descriptor v) const
+    {
+        for (size_t i = 0; i + 1 < vertices.size(); ++i) {
+            if ((vertices[i] == u && vertices[i+1] == v) ||
+                (vertices[i] == v && vertices[i+1] == u))
+                return true;
+        }
+        return false;
+    }
+
+    friend bool operator==(const Path& lhs, const Path& rhs)
+    {
+        return std::equal(lhs.links.begin(), lhs.links.end(),
+                          rhs.links.begin(), rhs.links.end(),
+                          [](const link_property& a, const link_property& b) {
+                              return a.source == b.source && a.target == b.target;
+                          });
+    }
+};
+
+/**
+ * Dijkstra that is able to skip some vertices and links.
+ */
+class PathFinder {
+    const TopologyGraph& graph;
+public:
+    std::vector<bool> removed_vertices;
+    std::unordered_set<switch_and_port> removed_links; // by link source
+
+    explicit PathFinder(const TopologyGraph& graph)
+        : graph(graph), removed_vertices(num_vertices(graph), false)
+    { }
+
+    bool shortest(vertex_descriptor s, vertex_descriptor t, Path& ret) const
+    {
+        const int infinity = RouteTree::infinity;
+        size_t n = num_vertices(graph);
+        std::vector<int> dist(n, infinity);
+        std::vector<TopologyGraph::edge_descriptor> via(n);
+
+        using item = std::pair<int, vertex_descriptor>;
+        std::priority_queue<item, std::vector<item>, std::greater<item>> queue;
+        dist[s] = 0;
+        queue.push({0, s});
+
+        while (not queue.empty()) {
+            auto top = queue.top();
+            queue.pop();
+            auto u = top.second;
+            if (top.first > dist[u])
+                continue;
+            if (u == t)
+                break;
+
+            for (auto e : make_iterator_range(out_edges(u, graph))) {
+                const auto& link = graph[e];
+                auto v = target(e, graph);
+                if (removed_vertices[v] || removed_links.count(link.source))
+                    continue;
+                int d = top.first + link.weight;
+                if (d < dist[v]) {
+                    dist[v] = d;
+                    via[v] = e;
+                    queue.push({d, v});
+                }
+            }
+        }
+
+        if (dist[t] == infinity)
+            return false;
+
+        ret = Path();
+        ret.cost = dist[t];
+        for (auto v = t; v != s; v = source(via[v], graph)) {
+            ret.vertices.push_back(v);
+            ret.links.push_back(graph[via[v]]);
+        }
+        ret.vertices.push_back(s);
+        std::reverse(ret.vertices.begin(), ret.vertices.end());
+        std::reverse(ret.links.begin(), ret.links.end());
+        return true;
+    }
+};
+
+// Yen's k shortest loopless paths
+static std::vector<Path> k_shortest_paths(const TopologyGraph& graph,
+                                          vertex_descriptor s,
+                                          vertex_descriptor t,
+                                          size_t k, bool equal_cost)
+{
+    std::vector<Path> ret;
+    std::vector<Path> candidates;
+    Path path;
+
+    if (k == 0 || not PathFinder(graph).shortest(s, t, path))
+        return ret;
+    ret.push_back(std::move(path));
+
+    while (ret.size() < k) {
+        const Path& prev = ret.back();
+
+        for (size_t i = 0; i + 1 < prev.vertices.size(); ++i) {
+            PathFinder finder(graph);
+            auto spur = prev.vertices[i];
+            int root_cost = 0;
+
+            // Don't go through root path again
+            for (size_t j = 0; j < i; ++j) {
+                finder.removed_vertices[prev.vertices[j]] = true;
+                root_cost += prev.links[j].weight;
+            }
+            // Don't repeat known paths with the same root
+            for (const auto& known : ret) {
+                if (known.links.size() > i &&
+                    std::equal(prev.vertices.begin(), prev.vertices.begin() + i + 1,
+                               known.vertices.begin()))
+                {
+                    finder.removed_links.insert(known.links[i].source);
+                }
+            }
+
+            Path spur_path;
+            if (not finder.shortest(spur, t, spur_path))
+                continue;
+
+            Path candidate;
+            candidate.vertices.assign(prev.vertices.begin(), prev.vertices.begin() + i);
+            candidate.vertices.insert(candidate.vertices.end(),
+                                      spur_path.vertices.begin(),
+                                      spur_path.vertices.end());
+            candidate.links.assign(prev.links.begin(), prev.links.begin() + i);
+            candidate.links.insert(candidate.links.end(),
+                                   spur_path.links.begin(),
+                                   spur_path.links.end());
+            candidate.cost = root_cost + spur_path.cost;
+
+            if (std::find(candidates.begin(), candidates.end(), candidate) == candidates.end() &&
+                std::find(ret.begin(), ret.end(), candidate) == ret.end())
+            {
+                candidates.push_back(std::move(candidate));
+            }
+        }
+
+        if (candidates.empty())
+            break;
+
+        auto best = std::min_element(candidates.begin(), candidates.end(),
+                                     [](const Path& a, const Path& b) {
+                                         return a.cost < b.cost;
+                                     });
+        if (equal_cost && best->cost > ret.front().cost)
+            break;
+
+        ret.push_back(std::move(*best));
+        candidates.erase(best);
+    }
+
+    return ret;
+}
+
 struct TopologyImpl {
     QReadWriteLock graph_mutex;
 
@@ -96,6 +302,103 @@ struct TopologyImpl {
     std::unordered_map<uint64_t, vertex_descriptor>
         vertex_map;
 
+    // Lazily computed trees, keyed by destination vertex.
+    // Modified by readers under cache_mutex and
+    // invalidated by writers under exclusive graph_mutex.
+    std::unordered_map<vertex_descriptor, std::shared_ptr<const RouteTree>>
+        route_cache;
+    std::mutex cache_mutex;
+
+    std::shared_ptr<const RouteTree> routeTree(vertex_descriptor dst)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto it = route_cache.find(dst);
+            if (it != route_cache.end())
+                return it->second;
+        }
+
+        auto tree = std::make_shared<RouteTree>();
+        tree->pred.resize(num_vertices(graph));
+        tree->dist.resize(num_vertices(graph));
+        auto index = boost::get(vertex_index, graph);
+
+        dijkstra_shortest_paths_no_color_map(graph, dst,
+             weight_map( boost::get(&link_property::weight, graph) )
+            .predecessor_map( make_iterator_property_map(tree->pred.begin(), index) )
+            .distance_map( make_iterator_property_map(tree->dist.begin(), index) )
+            .distance_inf( RouteTree::infinity )
+        );
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        return route_cache.emplace(dst, std::move(tree)).first->second;
+    }
+
+    // Multipath settings and route sets, keyed by (from, to) vertices
+    size_t max_paths = 1;
+    bool equal_cost_only = true;
+    std::unordered_map<uint64_t, std::shared_ptr<const std::vector<Path>>>
+        path_cache;
+
+    std::shared_ptr<const std::vector<Path>> pathSet(vertex_descriptor from,
+                                                     vertex_descriptor to)
+    {
+        uint64_t key = uint64_t(from) << 32 | uint64_t(to);
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto it = path_cache.find(key);
+            if (it != path_cache.end())
+                return it->second;
+        }
+
+        auto paths = std::make_shared<const std::vector<Path>>(
+            k_shortest_paths(graph, from, to, max_paths, equal_cost_only));
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        return path_cache.emplace(key, std::move(paths)).first->second;
+    }
+
+    template<class Predicate>
+    void invalidate(Predicate&& affected)
+    {
+        for (auto it = route_cache.begin(); it != route_cache.end(); ) {
+            if (affected(*it->second)) {
+                it = route_cache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    template<class Predicate>
+    void invalidatePaths(Predicate&& affected)
+    {
+        for (auto it = path_cache.begin(); it != path_cache.end(); ) {
+            const auto& paths = *it->second;
+            if (std::any_of(paths.begin(), paths.end(), affected)) {
+                it = path_cache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    data_link_route route(const Path& path) const
+    {
+        data_link_route ret;
+        for (size_t i = 0; i < path.links.size(); ++i) {
+            const auto& link = path.links[i];
+            if (link.source.dpid == boost::get(dpid_t(), graph, path.vertices[i])) {
+                ret.push_back(link.source);
+                ret.push_back(link.target);
+            } else {
+                ret.push_back(link.target);
+                ret.push_back(link.source);
+            }
+        }
+        return ret;
+    }
+
     vertex_descriptor vertex(uint64_t dpid) {
         auto it = vertex_map.find(dpid);
         if (it != vertex_map.end()) {
@@ -112,6 +415,10 @@ struct TopologyImpl {
 
 void Topology::init(Loader *loader, const Config &config)
 {
+    auto app_config = config_cd(config, "topology");
+    m->max_paths = std::max(1, config_get(app_config, "max-paths", 1));
+    m->equal_cost_only = config_get(app_config, "equal-cost-only", true);
+
     QObject* ld = ILinkDiscovery::get(loader);
 
     QObject::connect(ld, SIGNAL(linkDiscovered(switch_and_port, switch_and_port)),
@@ -143,9 +450,16 @@ void Topology::linkDiscovered(switch_and_port from, switch_and_port to)
     }
 
     /* TODO: calculate metric */
+    const int weight = 1;
     auto u = m->vertex(from.dpid);
     auto v = m->vertex(to.dpid);
-    add_edge(u, v, link_property{from, to, 1}, m->graph);
+    add_edge(u, v, link_property{from, to, weight}, m->graph);
+
+    m->invalidate([=](const RouteTree& tree) {
+        return tree.improvedBy(u, v, weight);
+    });
+    // new link may give new alternative route for any pair
+    m->path_cache.clear();
 
     Link* link = new Link(from, to, 5, rand()%1000 + 2000);
     topo.push_back(link);
@@ -155,7 +469,16 @@ void Topology::linkDiscovered(switch_and_port from, switch_and_port to)
 void Topology::linkBroken(switch_and_port from, switch_and_port to)
 {
     QWriteLocker locker(&m->graph_mutex);
-    remove_edge(m->vertex(from.dpid), m->vertex(to.dpid), m->graph);
+    auto u = m->vertex(from.dpid);
+    auto v = m->vertex(to.dpid);
+    remove_edge(u, v, m->graph);
+
+    m->invalidate([=](const RouteTree& tree) {
+        return tree.uses(u, v);
+    });
+    m->invalidatePaths([=](const Path& path) {
+        return path.uses(u, v);
+    });
 
     Link* link = getLink(from, to);
     addEvent(Event::Delete, link);
@@ -168,30 +491,31 @@ data_link_route Topology::computeRoute(uint64_t from_dpid, uint64_t to_dpid)
 
     QReadLocker locker(&m->graph_mutex);
     const auto& graph = m->graph;
-    vector_property_map<vertex_descriptor> p;
-    vertex_descriptor v = m->vertex(from_dpid);
-
-    dijkstra_shortest_paths_no_color_map(graph, m->vertex(to_dpid),
-         weight_map( boost::get(&link_property::weight, graph) )
-        .predecessor_map( p )
-    );
-
     data_link_route ret;
 
+    // Don't modify graph under read lock: unknown switches has no routes
+    auto from_it = m->vertex_map.find(from_dpid);
+    auto to_it = m->vertex_map.find(to_dpid);
+    if (from_it == m->vertex_map.end() || to_it == m->vertex_map.end())
+        return ret;
+
+    auto tree = m->routeTree(to_it->second);
+    vertex_descriptor v = from_it->second;
 
     BOOST_ASSERT( v != TopologyGraph::null_vertex() );
 
-    for (; v != p[v]; v = p[v]) {
-        BOOST_ASSERT(edge(v, p[v], graph).second);
-        link_property link = graph[edge(v, p[v], graph).first];
+    for (; v != tree->parent(v); v = tree->parent(v)) {
+        auto p = tree->parent(v);
+        BOOST_ASSERT(edge(v, p, graph).second);
+        link_property link = graph[edge(v, p, graph).first];
 
         if (link.source.dpid == boost::get(dpid_t(), graph, v)) {
-            BOOST_ASSERT(link.target.dpid == boost::get(dpid_t(), graph, p[v]));
+            BOOST_ASSERT(link.target.dpid == boost::get(dpid_t(), graph, p));
             ret.push_back(link.source);
             ret.push_back(link.target);
         } else {
             BOOST_ASSERT(link.target.dpid == boost::get(dpid_t(), graph, v));
-            BOOST_ASSERT(link.source.dpid == boost::get(dpid_t(), graph, p[v]));
+            BOOST_ASSERT(link.source.dpid == boost::get(dpid_t(), graph, p));
             ret.push_back(link.target);
             ret.push_back(link.source);
         }
@@ -200,6 +524,54 @@ data_link_route Topology::computeRoute(uint64_t from_dpid, uint64_t to_dpid)
     return ret;
 }
 
+data_link_routes Topology::computeRoutes(uint64_t from_dpid, uint64_t to_dpid,
+                                        size_t max_routes, bool equal_cost)
+{
+    DVLOG(5) << "Computing up to " << max_routes << " routes between "
+             << from_dpid << " and " << to_dpid;
+
+    QReadLocker locker(&m->graph_mutex);
+    data_link_routes ret;
+
+    auto from_it = m->vertex_map.find(from_dpid);
+    auto to_it = m->vertex_map.find(to_dpid);
+    if (from_it == m->vertex_map.end() || to_it == m->vertex_map.end())
+        return ret;
+
+    std::vector<Path> paths;
+    if (max_routes == m->max_paths && equal_cost == m->equal_cost_only) {
+        paths = *m->pathSet(from_it->second, to_it->second);
+    } else {
+        paths = k_shortest_paths(m->graph, from_it->second, to_it->second,
+                                 max_routes, equal_cost);
+    }
+
+    for (const auto& path : paths) {
+        ret.push_back(m->route(path));
+    }
+    return ret;
+}
+
+data_link_route Topology::selectRoute(uint64_t from_dpid, uint64_t to_dpid,
+                                      size_t flow_hash)
+{
+    if (m->max_paths <= 1)
+        return computeRoute(from_dpid, to_dpid);
+
+    QReadLocker locker(&m->graph_mutex);
+
+    auto from_it = m->vertex_map.find(from_dpid);
+    auto to_it = m->vertex_map.find(to_dpid);
+    if (from_it == m->vertex_map.end() || to_it == m->vertex_map.end())
+        return data_link_route();
+
+    auto paths = m->pathSet(from_it->second, to_it->second);
+    if (paths->empty())
+        return data_link_route();
+
+    return m->route((*paths)[flow_hash % paths->size()]);
+}
+
 void Topology::apply(std::function<void(const TopologyGraph&)> f) const
 {
     QReadLocker locker(&m->graph_mutex);
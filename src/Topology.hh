@@ -33,6 +33,7 @@
 #include "json11.hpp"
 
 typedef std::vector< switch_and_port > data_link_route;
+typedef std::vector< data_link_route > data_link_routes;
 
 namespace topology{
 
@@ -82,6 +83,29 @@ public:
      */
     data_link_route computeRoute(uint64_t from, uint64_t to);
 
+    /**
+     * compute several loopless routes between two switches
+     * (Yen's k shortest paths)
+     * @param from switch route will be computed
+     * @param to switch be computed
+     * @param max_routes upper bound of returned routes count
+     * @param equal_cost return only routes as short as the shortest one
+     *
+     * @return computed routes, shortest first. Hop by hop.
+     */
+    data_link_routes computeRoutes(uint64_t from, uint64_t to,
+                                   size_t max_routes, bool equal_cost);
+
+    /**
+     * select one of the routes between two switches by flow hash.
+     * Set of routes is configured by `topology.max-paths` and
+     * `topology.equal-cost-only` and kept until topology changes.
+     * Packets of the same flow should have the same hash.
+     *
+     * @return selected route. Hop by hop.
+     */
+    data_link_route selectRoute(uint64_t from, uint64_t to, size_t flow_hash);
+
     /**
       * Apply an arbitary function to graph
       *
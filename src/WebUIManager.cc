@@ -140,7 +140,7 @@ void WebUIManager::newSwitch(Switch *dp)
 void WebUIManager::newHost(Host* dev)
 {
     WebObject* obj = new WebObject(dev->id(), false);
-    obj->display_name(dev->mac());
+    obj->display_name(boost::lexical_cast<std::string>(dev->mac()));
     m->objects.push_back(obj);
 }
 
@@ -22,6 +22,12 @@ struct Backend {
                             oxm::expirementer::full_field_set const& match,
                             oxm::field<> const& test,
                             uint64_t id) = 0;
+    // called with the same arguments as barrier_rule
+    // when the test is collapsed by garbage collection
+    virtual void remove_barrier(unsigned priority,
+                                oxm::expirementer::full_field_set const& match,
+                                oxm::field<> const& test,
+                                uint64_t id) { }
     virtual void barrier() { }
 };
 
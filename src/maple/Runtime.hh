@@ -71,6 +71,16 @@ public:
         trace_tree->update();
     }
 
+    size_t gc(size_t budget = 0)
+    {
+        return trace_tree->gc(budget);
+    }
+
+    bool gc_finished() const
+    {
+        return trace_tree->gc_finished();
+    }
+
     void invalidate()
     {
         trace_tree.reset(new TraceTree{backend});
@@ -18,6 +18,7 @@
 
 #include <unordered_map>
 #include <cmath>
+#include <vector>
 
 #include <boost/variant/variant.hpp>
 #include <boost/variant/get.hpp>
@@ -27,6 +28,7 @@
 #include <boost/optional.hpp>
 
 #include "api/Packet.hh"
+#include "types/case_map.hh"
 #include "TraceablePacketImpl.hh"
 
 namespace runos {
@@ -44,7 +46,7 @@ struct TraceTree::flow_node {
 // non recursive structes must be declared above recursive
 struct TraceTree::vload_node {
     oxm::mask<> mask;
-    std::unordered_map< bits<>, std::shared_ptr<node> >
+    case_map< std::shared_ptr<node> >
         cases;
 };
 
@@ -65,31 +67,98 @@ static uint64_t id_generator()
 
 struct TraceTree::load_node {
     oxm::mask<> mask;
-    std::unordered_map< bits<>, node >
+    case_map< node >
         cases;
 };
 
+// Inner nodes of the tree. They are freed with the tree in one pass
+// over the arenas, the tree isn't walked.
+struct TraceTree::Nodes {
+    node_arena<test_node> tests;
+    node_arena<load_node> loads;
+    node_arena<vload_node> vloads;
+
+    test_node& operator[](node_ref<test_node> ref) { return tests[ref]; }
+    load_node& operator[](node_ref<load_node> ref) { return loads[ref]; }
+    vload_node& operator[](node_ref<vload_node> ref) { return vloads[ref]; }
+    const test_node& operator[](node_ref<test_node> ref) const
+    { return tests[ref]; }
+    const load_node& operator[](node_ref<load_node> ref) const
+    { return loads[ref]; }
+    const vload_node& operator[](node_ref<vload_node> ref) const
+    { return vloads[ref]; }
+
+    // inner node of type T or nullptr
+    template<class T>
+    T* get(node* n)
+    {
+        auto ref = boost::get<node_ref<T>>(n);
+        return ref ? &(*this)[*ref] : nullptr;
+    }
+
+    // Frees the subtree and makes the node unexplored
+    void erase(node& n)
+    {
+        if (auto ref = boost::get<node_ref<test_node>>(&n)) {
+            erase(tests[*ref].positive);
+            erase(tests[*ref].negative);
+            tests.erase(*ref);
+        } else if (auto ref = boost::get<node_ref<load_node>>(&n)) {
+            for (auto& record : loads[*ref].cases) {
+                erase(record.second);
+            }
+            loads.erase(*ref);
+        } else if (auto ref = boost::get<node_ref<vload_node>>(&n)) {
+            for (auto& record : vloads[*ref].cases) {
+                // node may be shared by several vloads
+                if (record.second.use_count() == 1)
+                    erase(*record.second);
+            }
+            vloads.erase(*ref);
+        }
+        n = unexplored();
+    }
+};
+
+// Where the previous gc pass stopped: branches taken from the root,
+// the positive one of a test or the key of a load case
+struct TraceTree::GcCursor {
+    struct Step {
+        bool positive;
+        bits<> key;
+    };
+    std::vector<Step> path;
+    bool pending = false; // the next pass resumes from path
+};
+
 struct TraceTree::Impl {
     class Lookup;
     class Compiler;
     class TracerImpl;
     class PriorityUpdater;
+    class Collector;
 };
 
 class TraceTree::Impl::Compiler : public boost::static_visitor<>
 {
     Backend& backend;
+    Nodes& nodes;
     oxm::expirementer::full_field_set match;
 
 public:
-    Compiler(Backend& backend,
+    Compiler(Backend& backend, Nodes& nodes,
             const oxm::expirementer::full_field_set &match)
-        : backend(backend), match(match)
+        : backend(backend), nodes(nodes), match(match)
     { }
-    Compiler(Backend& backend)
-        : backend(backend)
+    Compiler(Backend& backend, Nodes& nodes)
+        : backend(backend), nodes(nodes)
     { }
 
+    template<class T>
+    void operator()(node_ref<T> ref)
+    {
+        (*this)(nodes[ref]);
+    }
 
     void operator()(unexplored&)
     {
@@ -141,11 +210,18 @@ public:
 class TraceTree::Impl::Lookup : public boost::static_visitor<FlowPtr>
 {
     const Packet& pkt;
+    const Nodes& nodes;
 public:
-    explicit Lookup(const Packet& pkt)
-        : pkt(pkt)
+    Lookup(const Packet& pkt, const Nodes& nodes)
+        : pkt(pkt), nodes(nodes)
     { }
 
+    template<class T>
+    FlowPtr operator()(node_ref<T> ref) const
+    {
+        return (*this)(nodes[ref]);
+    }
+
     FlowPtr operator()(const unexplored&) const
     {
         return nullptr;
@@ -188,6 +264,7 @@ public:
 
 class TraceTree::Impl::TracerImpl : public Tracer {
     std::vector<node*> path;
+    Nodes& nodes;
     Backend& backend;
     uint16_t left_prio, right_prio;
 
@@ -205,11 +282,13 @@ class TraceTree::Impl::TracerImpl : public Tracer {
     void node_push(node* n) { path.push_back(n); }
 
 public:
-    explicit TracerImpl(node& root,
-                        Backend& backend,
-                        uint16_t left_prio,
-                        uint16_t right_prio)
-        : backend(backend), left_prio(left_prio), right_prio(right_prio)
+    TracerImpl(node& root,
+               Nodes& nodes,
+               Backend& backend,
+               uint16_t left_prio,
+               uint16_t right_prio)
+        : nodes(nodes), backend(backend)
+        , left_prio(left_prio), right_prio(right_prio)
     {
         path.push_back(&root);
     }
@@ -217,12 +296,13 @@ public:
     void load(oxm::field<> data) override
     {
         if (boost::get<unexplored>(node_ptr())) {
-            *node_ptr() = load_node{ oxm::mask<>(data), {} };
-            node_push( &boost::get<load_node>(*node_ptr())
+            auto ref = nodes.loads.emplace( oxm::mask<>(data) );
+            *node_ptr() = ref;
+            node_push( &nodes[ref]
                        .cases
                        .emplace(data.value_bits(), unexplored())
                        .first->second ); // inserted value
-        } else if (load_node* load = boost::get<load_node>(node_ptr())) {
+        } else if (load_node* load = nodes.get<load_node>(node_ptr())) {
             if (load->mask != oxm::mask<>(data))
                 RUNOS_THROW(inconsistent_trace());
             path.push_back(&load->cases[ data.value_bits() ]);
@@ -245,12 +325,13 @@ public:
         ovload_masks = std::make_pair(oxm::mask<>(by), oxm::mask<>(what));
 
         if (boost::get<unexplored>(node_ptr())) {
-            *node_ptr() = load_node{ oxm::mask<>(by), {} };
-            node_push( &boost::get<load_node>(*node_ptr())
+            auto ref = nodes.loads.emplace( oxm::mask<>(by) );
+            *node_ptr() = ref;
+            node_push( &nodes[ref]
                         .cases
                         .emplace(by.value_bits(), unexplored())
                         .first->second ); // inserted value
-        } else if (load_node* load = boost::get<load_node>(node_ptr())) {
+        } else if (load_node* load = nodes.get<load_node>(node_ptr())) {
             if (load->mask != oxm::mask<>(by))
                 RUNOS_THROW(inconsistent_trace());
             path.push_back(&load->cases[ by.value_bits() ]);
@@ -259,13 +340,14 @@ public:
         }
 
         if (boost::get<unexplored>(node_ptr())) {
-            *node_ptr() = vload_node{ oxm::mask<>(what), {} };
-            vload_ends.second =  boost::get<vload_node>(*node_ptr())
+            auto ref = nodes.vloads.emplace( oxm::mask<>(what) );
+            *node_ptr() = ref;
+            vload_ends.second =  nodes[ref]
                         .cases
                         .emplace(what.value_bits(), std::make_shared<node>())
                         .first->second; //inserted value
             node_push(vload_ends.second.get());
-        } else if (vload_node* vload = boost::get<vload_node>(node_ptr())) {
+        } else if (vload_node* vload = nodes.get<vload_node>(node_ptr())) {
             if (vload->mask != oxm::mask<>(what))
                 RUNOS_THROW(inconsistent_trace());
 
@@ -297,18 +379,17 @@ public:
             if (test_prio <= left_prio or test_prio >= right_prio)
                 RUNOS_THROW(priority_exceeded());
             uint64_t id = id_generator();
-            *node_ptr() = test_node{
+            auto ref = nodes.tests.emplace(
                 pred, unexplored(), unexplored{}, id, test_prio
-            };
+            );
+            *node_ptr() = ref;
 
-            node_push( ret ?
-                &boost::get<test_node>(node_ptr())->positive :
-                &boost::get<test_node>(node_ptr())->negative );
+            node_push( ret ? &nodes[ref].positive : &nodes[ref].negative );
             auto tmp_match = match;
             tmp_match.add(pred);
             backend.barrier_rule(test_prio, tmp_match, pred, id);
 
-        } else if (test_node* test = boost::get<test_node>(node_ptr())) {
+        } else if (test_node* test = nodes.get<test_node>(node_ptr())) {
             if (test->need != pred)
                 RUNOS_THROW(inconsistent_trace());
             test_prio = test->prio;
@@ -356,9 +437,9 @@ public:
             }
         }
 
-        return [node=node, match=match, &backend=backend](){
+        return [node=node, match=match, &backend=backend, &nodes=nodes](){
             backend.barrier();
-            Impl::Compiler compiler(backend, match);
+            Impl::Compiler compiler(backend, nodes, match);
             boost::apply_visitor(compiler, *node);
             backend.barrier();
         };
@@ -369,16 +450,20 @@ public:
     {
         //TODO check all variants
 
-        load_node* load = boost::get<load_node>(from);
+        load_node* load = nodes.get<load_node>(from);
         node* middle = &load->cases[ by.value_bits() ];
 
         if (boost::get<unexplored>(middle)) {
-            *middle = vload_node{ oxm::mask<>(what), {} };
-            boost::get<vload_node>(*middle)
+            auto ref = nodes.vloads.emplace( oxm::mask<>(what) );
+            *middle = ref;
+            nodes[ref]
                 .cases
                 .emplace(what.value_bits(),  to);
-        } else if(vload_node* vload = boost::get<vload_node>( middle  )){
-            vload->cases[what.value_bits()] = to;
+        } else if(vload_node* vload = nodes.get<vload_node>( middle  )){
+            auto& next = vload->cases[what.value_bits()];
+            if (next && next != to && next.use_count() == 1)
+                nodes.erase(*next);
+            next = to;
         }
     }
 };
@@ -394,17 +479,25 @@ class TraceTree::Impl::PriorityUpdater {
     using Depth = std::unordered_map<uint64_t, Scope>;
     Depth depth;
 
+    Nodes& nodes;
     uint16_t from;
     uint16_t to;
 
     class DepthCounter : public boost::static_visitor<unsigned>
     {
         Depth &depth;
+        const Nodes& nodes;
     public:
-        DepthCounter(Depth &depth)
-            :depth(depth)
+        DepthCounter(Depth &depth, const Nodes& nodes)
+            :depth(depth), nodes(nodes)
         { }
 
+        template<class T>
+        unsigned operator()(node_ref<T> ref) const
+        {
+            return (*this)(nodes[ref]);
+        }
+
         unsigned operator()(const unexplored&) const
         {
             return 1;
@@ -450,16 +543,24 @@ class TraceTree::Impl::PriorityUpdater {
     class PriorityAssigner : public boost::static_visitor<>
     {
         const Depth& depth;
+        Nodes& nodes;
         double from, to;
 
         double average(double from, double to, unsigned k, unsigned m)
         { return (from * m + to * k) / (m + k); }
 
     public:
-        PriorityAssigner(const Depth& depth, uint16_t from, uint16_t to)
-            : depth(depth), from(from), to(to)
+        PriorityAssigner(const Depth& depth, Nodes& nodes,
+                         uint16_t from, uint16_t to)
+            : depth(depth), nodes(nodes), from(from), to(to)
         { }
 
+        template<class T>
+        void operator()(node_ref<T> ref)
+        {
+            (*this)(nodes[ref]);
+        }
+
         void operator() (unexplored&)
         {
             // do nothing
@@ -507,44 +608,233 @@ class TraceTree::Impl::PriorityUpdater {
 
 public:
 
-    PriorityUpdater(uint16_t from, uint16_t to)
-        : from(from), to(to)
+    PriorityUpdater(Nodes& nodes, uint16_t from, uint16_t to)
+        : nodes(nodes), from(from), to(to)
     { }
 
     void operator() (node& node)
     {
-        DepthCounter dc{depth};
+        DepthCounter dc{depth, nodes};
         boost::apply_visitor(dc, node);
 
-        PriorityAssigner pa{depth, from, to};
+        PriorityAssigner pa{depth, nodes, from, to};
         boost::apply_visitor(pa, node);
     }
 
 };
 
+// Returns true if the node is unexplored after collection.
+// Nodes not visited because of the budget are alive. A pass resumes
+// at the cursor: branches before it were visited by previous passes.
+// If a case is erased or the case map is rehashed meanwhile, some
+// branches are visited twice or left for the next full pass,
+// collecting twice is safe.
+class TraceTree::Impl::Collector : public boost::static_visitor<bool>
+{
+    using Step = GcCursor::Step;
+
+    Backend& backend;
+    Nodes& nodes;
+    oxm::expirementer::full_field_set match;
+    size_t budget; // of visited nodes, zero means unlimited
+    size_t visited = 0;
+    const std::vector<Step>& resume;
+    bool resuming;
+    std::vector<Step> path;
+
+    // step of the resumed path at the current depth
+    const Step* resumeStep() const
+    {
+        return resuming ? &resume[path.size()] : nullptr;
+    }
+
+    static bool isUnexplored(const node& n)
+    {
+        return boost::get<unexplored>(&n) != nullptr;
+    }
+
+public:
+    size_t removed = 0;
+    bool stopped = false;
+    std::vector<Step> stopped_at;
+
+    Collector(Backend& backend, Nodes& nodes,
+              size_t budget, const GcCursor& cursor)
+        : backend(backend)
+        , nodes(nodes)
+        , budget(budget)
+        , resume(cursor.path)
+        , resuming(cursor.pending)
+    { }
+
+    template<class T>
+    bool operator()(node_ref<T> ref)
+    {
+        return (*this)(nodes[ref]);
+    }
+
+    bool operator()(unexplored&)
+    {
+        return true;
+    }
+
+    bool operator()(flow_node& leaf)
+    {
+        return leaf.flow.expired();
+    }
+
+    bool operator()(test_node& test)
+    {
+        const Step* step = resumeStep();
+        bool negative;
+        match.exclude(test.need);
+        if (step && step->positive) {
+            // collected by previous passes
+            negative = isUnexplored(test.negative);
+        } else {
+            path.push_back(Step{false, {}});
+            negative = collect(test.negative);
+            path.pop_back();
+        }
+        match.include(oxm::mask<>(test.need));
+
+        match.add(test.need);
+        path.push_back(Step{true, {}});
+        bool positive = collect(test.positive);
+        path.pop_back();
+        if (negative && positive)
+            backend.remove_barrier(test.prio, match, test.need, test.id);
+        match.erase(oxm::mask<>(test.need));
+
+        return negative && positive;
+    }
+
+    template<class Cases>
+    typename Cases::iterator first(Cases& cases)
+    {
+        const Step* step = resumeStep();
+        if (step == nullptr)
+            return cases.begin();
+        auto it = cases.find(step->key);
+        if (it == cases.end()) {
+            resuming = false;
+            return cases.begin();
+        }
+        return it;
+    }
+
+    bool operator()(load_node& load)
+    {
+        auto type = load.mask.type();
+
+        for (auto it = first(load.cases);
+             it != load.cases.end() && not stopped; ) {
+            match.add((type == it->first) & load.mask);
+            path.push_back(Step{false, it->first});
+            bool dead = collect(it->second);
+            path.pop_back();
+            match.erase(load.mask);
+
+            if (dead) {
+                it = load.cases.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return load.cases.empty();
+    }
+
+    bool operator()(vload_node& vload)
+    {
+        auto type = vload.mask.type();
+
+        for (auto it = first(vload.cases);
+             it != vload.cases.end() && not stopped; ) {
+            match.add((type == it->first) & vload.mask);
+            path.push_back(Step{false, it->first});
+            // node may be shared by several vloads, collecting twice is safe
+            bool dead = collect(*it->second);
+            path.pop_back();
+            match.erase(vload.mask);
+
+            if (dead) {
+                it = vload.cases.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return vload.cases.empty();
+    }
+
+    bool collect(node& n)
+    {
+        if (resuming && path.size() >= resume.size())
+            resuming = false; // reached the cursor
+        if (isUnexplored(n)) {
+            resuming = false;
+            return true;
+        }
+        if (stopped)
+            return false;
+        // nodes on the way to the cursor aren't counted,
+        // so every pass makes progress
+        if (not resuming) {
+            if (budget != 0 && visited >= budget) {
+                stopped = true;
+                stopped_at = path;
+                return false;
+            }
+            visited++;
+        }
+
+        bool dead = boost::apply_visitor(*this, n);
+        resuming = false; // the cursor is passed or gone
+        if (not dead)
+            return false;
+        nodes.erase(n); // its children are already unexplored
+        removed++;
+        return true;
+    }
+};
+
 FlowPtr TraceTree::lookup(const Packet& pkt) const
 {
-    return boost::apply_visitor(Impl::Lookup(pkt), *m_root);
+    return boost::apply_visitor(Impl::Lookup(pkt, *m_nodes), *m_root);
 }
 
 std::unique_ptr<Tracer> TraceTree::augment()
 {
     return std::unique_ptr<Tracer>(
-            new Impl::TracerImpl(*m_root, m_backend, left_prio, right_prio)
+            new Impl::TracerImpl(*m_root, *m_nodes, m_backend,
+                                 left_prio, right_prio)
         );
 }
 
 void TraceTree::update()
 {
-    Impl::PriorityUpdater pu(left_prio, right_prio);
+    Impl::PriorityUpdater pu(*m_nodes, left_prio, right_prio);
     pu(*m_root);
 }
 
+size_t TraceTree::gc(size_t budget)
+{
+    Impl::Collector collector {m_backend, *m_nodes, budget, *m_gc_cursor};
+    collector.collect(*m_root);
+    m_gc_cursor->path = std::move(collector.stopped_at);
+    m_gc_cursor->pending = collector.stopped;
+    return collector.removed;
+}
+
+bool TraceTree::gc_finished() const
+{
+    return not m_gc_cursor->pending;
+}
+
 void TraceTree::commit()
 {
     m_backend.remove(oxm::field_set{});
     m_backend.barrier();
-    Impl::Compiler compiler {m_backend};
+    Impl::Compiler compiler {m_backend, *m_nodes};
     boost::apply_visitor(compiler, *m_root);
     m_backend.barrier();
 }
@@ -553,9 +843,11 @@ TraceTree::TraceTree(Backend &backend,
                      uint16_t left_prio,
                      uint16_t right_prio)
     : m_backend(backend)
+    , m_nodes(new Nodes)
     , m_root(new node)
     , left_prio(left_prio)
     , right_prio(right_prio)
+    , m_gc_cursor(new GcCursor)
 { }
 
 TraceTree::TraceTree(Backend &backend,
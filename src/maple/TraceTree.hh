@@ -18,7 +18,8 @@
 
 #include <memory>
 #include <boost/variant/variant_fwd.hpp>
-#include <boost/variant/recursive_wrapper_fwd.hpp>
+
+#include "types/node_arena.hh"
 
 #include "Flow.hh"
 #include "Backend.hh"
@@ -46,7 +47,15 @@ public:
 
     void commit();
     void update();
-    void gc();
+
+    // Prunes branches of expired flows, collapses tests with no
+    // explored branches and removes their barrier rules.
+    // Visits at most `budget` nodes (0 means the whole tree) and the
+    // next call resumes where this one stopped, so a pass over a big
+    // tree is split into short ones. Returns count of removed nodes.
+    size_t gc(size_t budget = 0);
+    // The last gc() call reached the end of the tree
+    bool gc_finished() const;
 
 protected:
     struct unexplored;
@@ -55,19 +64,24 @@ protected:
     struct load_node;
     struct vload_node;
 
+    // inner nodes live in arenas of the tree
     using node =
         boost::variant< unexplored
                       , flow_node
-                      , vload_node
-                      , boost::recursive_wrapper<test_node>
-                      , boost::recursive_wrapper<load_node>
+                      , node_ref<test_node>
+                      , node_ref<load_node>
+                      , node_ref<vload_node>
                       >;
 
     struct Impl;
+    struct Nodes;
+    struct GcCursor;
 
     Backend& m_backend;
+    std::unique_ptr<Nodes> m_nodes;
     std::unique_ptr<node> m_root;
     uint16_t left_prio, right_prio;
+    std::unique_ptr<GcCursor> m_gc_cursor;
 };
 
 } // namespace maple
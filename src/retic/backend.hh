@@ -1,11 +1,19 @@
 #pragma once
 
+#include <stdexcept>
+
 #include <oxm/field_set.hh>
 #include "policies.hh"
 
 namespace runos {
 namespace retic {
 
+/** Table of the multi-table pipeline, see fdd::Pipeline */
+struct Stage {
+    unsigned index = 0; // 0 is the first table, its rules don't match metadata
+    uint64_t metadata = 0;
+};
+
 class Backend {
 public:
     virtual void install(
@@ -18,14 +26,116 @@ public:
         oxm::field_set match,
         uint16_t priority
     ) = 0;
+    /**
+     * install() into the table of `stage`, the rule matches its metadata.
+     * install() and installBarrier() use the first table.
+     */
+    virtual void installIn(
+        Stage stage,
+        oxm::field_set match,
+        std::vector<oxm::field_set> action,
+        uint16_t priority,
+        FlowSettings flow_settings
+    ) {
+        if (stage.index != 0) {
+            throw std::logic_error("Backend doesn't support multi-table pipeline");
+        }
+        install(std::move(match), std::move(action), priority, flow_settings);
+    }
+    virtual void installBarrierIn(
+        Stage stage,
+        oxm::field_set match,
+        uint16_t priority
+    ) {
+        if (stage.index != 0) {
+            throw std::logic_error("Backend doesn't support multi-table pipeline");
+        }
+        installBarrier(std::move(match), priority);
+    }
+    /** Sends packets from the table of `stage` to the one of `next` */
+    virtual void installGoto(
+        Stage stage,
+        oxm::field_set match,
+        uint16_t priority,
+        Stage next
+    ) {
+        throw std::logic_error("Backend doesn't support multi-table pipeline");
+    }
+    /**
+     * Sends copies of the packet modified by every of `actions`.
+     * `buffer_id` is of the packet-in, 0xffffffff if the switch
+     * didn't buffer it and `data` is the whole packet.
+     * `pkt` is the parsed packet-in, its header values undo
+     * modifications of one copy before the next one.
+     */
     virtual void packetOuts(
         uint8_t* data,
         size_t data_len,
         std::vector<oxm::field_set> actions,
-        uint64_t dpid
+        uint64_t dpid,
+        uint32_t buffer_id,
+        const Packet& pkt
     ) = 0;
     virtual ~Backend() = default;
 };
 
+/**
+ * Installs rules of install() and installBarrier() into `stage`
+ * of `base`, e.g. for trace trees of the stage leaves.
+ * Keeps no state in `base`, so calls for different stages may interleave.
+ */
+class StageBackend : public Backend {
+public:
+    StageBackend(Backend& base, Stage stage)
+        : m_base(base), m_stage(stage)
+    { }
+
+    void install(
+        oxm::field_set match,
+        std::vector<oxm::field_set> action,
+        uint16_t priority,
+        FlowSettings flow_settings
+    ) override {
+        m_base.installIn(m_stage, std::move(match), std::move(action),
+                         priority, flow_settings);
+    }
+    void installBarrier(oxm::field_set match, uint16_t priority) override {
+        m_base.installBarrierIn(m_stage, std::move(match), priority);
+    }
+    void installIn(
+        Stage stage,
+        oxm::field_set match,
+        std::vector<oxm::field_set> action,
+        uint16_t priority,
+        FlowSettings flow_settings
+    ) override {
+        m_base.installIn(stage, std::move(match), std::move(action),
+                         priority, flow_settings);
+    }
+    void installBarrierIn(Stage stage, oxm::field_set match,
+                          uint16_t priority) override {
+        m_base.installBarrierIn(stage, std::move(match), priority);
+    }
+    void installGoto(Stage stage, oxm::field_set match,
+                     uint16_t priority, Stage next) override {
+        m_base.installGoto(stage, std::move(match), priority, next);
+    }
+    void packetOuts(
+        uint8_t* data,
+        size_t data_len,
+        std::vector<oxm::field_set> actions,
+        uint64_t dpid,
+        uint32_t buffer_id,
+        const Packet& pkt
+    ) override {
+        m_base.packetOuts(data, data_len, std::move(actions), dpid,
+                          buffer_id, pkt);
+    }
+
+private:
+    Backend& m_base;
+    Stage m_stage;
+};
+
 } // namespace retic
 } // namespace runos
@@ -8,6 +8,7 @@
 
 #include <oxm/field.hh>
 #include <oxm/field_set.hh>
+#include <types/slab.hh>
 
 #include "policies.hh"
 #include "trace_tree.hh"
@@ -85,6 +86,8 @@ struct leaf {
     FlowSettings flow_settings;
     trace_tree::node maple_tree;
     mutable uint16_t prio_down, prio_up; // TODO: unhack me
+    mutable unsigned stage = 0; // table of the leaf rules, see Pipeline
+    mutable uint64_t metadata = 0;
 };
 
 
@@ -101,6 +104,11 @@ struct node {
     oxm::field<> field;
     diagram positive;
     diagram negative;
+
+    static void* operator new(size_t size)
+    { return slab<node>::allocate(size); }
+    static void operator delete(void* p, size_t size)
+    { slab<node>::deallocate(p, size); }
 };
 
 struct diagram_holder {
@@ -0,0 +1,362 @@
+#include "fdd_cache.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/variant/static_visitor.hpp>
+
+namespace runos {
+namespace retic {
+namespace fdd {
+
+namespace {
+
+const char magic[8] = {'R', 'E', 'T', 'I', 'C', 'F', 'D', 'D'};
+const uint32_t version = 1;
+const uint32_t no_function = uint32_t(-1);
+
+enum Tag: uint8_t {
+    LEAF = 0,
+    NODE = 1
+};
+
+struct Header {
+    char magic[8];      // "RETICFDD"
+    uint32_t version;
+    uint32_t functions; // number of packet functions in the policy
+    uint64_t key;
+    uint64_t size;      // of the diagram following the header
+};
+
+// Packet functions and field types of policy, computes its hash
+struct PolicyIndex: public boost::static_visitor<>
+{
+    uint64_t hash = 0;
+    std::vector<PacketFunction> functions;
+    std::unordered_map<uint64_t, uint32_t> positions; // by function id
+    std::unordered_set<oxm::type> types;
+
+    void combine(uint64_t h) {
+        hash ^= h + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    }
+
+    void add(const oxm::field<>& f) {
+        types.insert(f.type());
+        combine(std::hash<oxm::type>()(f.type()));
+        combine(std::hash<bits<>>()(f.value_bits()));
+        combine(std::hash<bits<>>()(f.mask_bits()));
+    }
+
+    void operator()(const Stop&) {
+        combine(1);
+    }
+    void operator()(const Id&) {
+        combine(2);
+    }
+    void operator()(const Filter& fil) {
+        combine(3);
+        add(fil.field);
+    }
+    void operator()(const Modify& mod) {
+        combine(4);
+        add(mod.field);
+    }
+    void operator()(const FlowSettings& flow) {
+        combine(5);
+        combine(flow.idle_timeout.count());
+        combine(flow.hard_timeout.count());
+    }
+    void operator()(const Negation& neg) {
+        combine(6);
+        boost::apply_visitor(*this, neg.pol);
+    }
+    void operator()(const PacketFunction& f) {
+        combine(7);
+        auto [it, inserted] = positions.emplace(f.id, functions.size());
+        if (inserted) {
+            functions.push_back(f);
+        }
+        combine(it->second);
+    }
+    void operator()(const Sequential& seq) {
+        combine(8);
+        boost::apply_visitor(*this, seq.one);
+        boost::apply_visitor(*this, seq.two);
+    }
+    void operator()(const Parallel& par) {
+        combine(9);
+        boost::apply_visitor(*this, par.one);
+        boost::apply_visitor(*this, par.two);
+    }
+};
+
+PolicyIndex index_policy(const policy& p) {
+    PolicyIndex ret;
+    boost::apply_visitor(ret, p);
+    return ret;
+}
+
+class Writer: public boost::static_visitor<>
+{
+public:
+    explicit Writer(const PolicyIndex& index)
+        : m_index(index)
+    { }
+
+    std::string data;
+
+    void operator()(const leaf& l) {
+        put<uint8_t>(LEAF);
+        put<uint32_t>(l.flow_settings.idle_timeout.count());
+        put<uint32_t>(l.flow_settings.hard_timeout.count());
+        put<uint32_t>(l.sets.size());
+        for (auto& action: l.sets) {
+            write(action);
+        }
+    }
+
+    void operator()(const node& n) {
+        put<uint8_t>(NODE);
+        write(n.field);
+        boost::apply_visitor(*this, n.positive);
+        boost::apply_visitor(*this, n.negative);
+    }
+
+private:
+    const PolicyIndex& m_index;
+
+    template<class T>
+    void put(T value) {
+        data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void write(const bits<>& b) {
+        std::vector<bits<>::block_type> buffer(b.num_blocks());
+        b.to_buffer(buffer.data());
+        put<uint16_t>(b.size());
+        data.append(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    }
+
+    void write(const oxm::field<>& f) {
+        oxm::type t = f.type();
+        put<uint16_t>(t.ns());
+        put<uint8_t>(t.id());
+        put<uint8_t>(t.maskable());
+        put<uint16_t>(t.nbits());
+        write(f.value_bits());
+        write(f.mask_bits());
+    }
+
+    void write(const action_unit& action) {
+        put<uint32_t>(std::distance(action.pred_actions.begin(),
+                                    action.pred_actions.end()));
+        for (const oxm::field<>& f: action.pred_actions) {
+            write(f);
+        }
+        // throws out_of_range if the function is not from the policy
+        put<uint32_t>(action.body.has_value()
+                        ? m_index.positions.at(action.body->id)
+                        : no_function);
+        put<uint8_t>(action.post_actions != nullptr);
+        if (action.post_actions != nullptr) {
+            write(*action.post_actions);
+        }
+    }
+};
+
+class Reader {
+public:
+    Reader(const uint8_t* begin, const uint8_t* end, const PolicyIndex& index)
+        : m_pos(begin), m_end(end), m_index(index)
+    { }
+
+    bool done() const {
+        return m_pos == m_end;
+    }
+
+    diagram read() {
+        uint8_t tag = get<uint8_t>();
+        if (tag == NODE) {
+            oxm::field<> f = read_field();
+            diagram positive = read();
+            diagram negative = read();
+            return node{f, std::move(positive), std::move(negative)};
+        } else if (tag != LEAF) {
+            throw std::runtime_error("Bad diagram tag");
+        }
+
+        leaf ret;
+        ret.flow_settings.idle_timeout = duration(get<uint32_t>());
+        ret.flow_settings.hard_timeout = duration(get<uint32_t>());
+        uint32_t count = get<uint32_t>();
+        for (uint32_t i = 0; i < count; ++i) {
+            ret.sets.push_back(read_action());
+        }
+        return ret;
+    }
+
+private:
+    const uint8_t* m_pos;
+    const uint8_t* m_end;
+    const PolicyIndex& m_index;
+
+    void need(size_t n) const {
+        if (size_t(m_end - m_pos) < n) {
+            throw std::runtime_error("Truncated diagram");
+        }
+    }
+
+    template<class T>
+    T get() {
+        need(sizeof(T));
+        T ret;
+        std::memcpy(&ret, m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return ret;
+    }
+
+    bits<> read_bits() {
+        size_t nbits = get<uint16_t>();
+        size_t nblocks = (nbits + 7) / 8;
+        need(nblocks);
+        bits<> ret(nbits, m_pos);
+        m_pos += nblocks;
+        return ret;
+    }
+
+    oxm::field<> read_field() {
+        uint16_t ns = get<uint16_t>();
+        uint8_t id = get<uint8_t>();
+        bool maskable = get<uint8_t>();
+        uint16_t nbits = get<uint16_t>();
+        oxm::type t{ns, id, maskable, nbits};
+        // the policy one knows how to print itself
+        auto it = m_index.types.find(t);
+        if (it != m_index.types.end()) {
+            t = *it;
+        }
+        bits<> value = read_bits();
+        bits<> mask = read_bits();
+        return oxm::field<>(t, value, mask);
+    }
+
+    action_unit read_action() {
+        oxm::field_set acts;
+        uint32_t count = get<uint32_t>();
+        for (uint32_t i = 0; i < count; ++i) {
+            acts.modify(read_field());
+        }
+
+        std::optional<PacketFunction> body;
+        uint32_t function = get<uint32_t>();
+        if (function != no_function) {
+            body = m_index.functions.at(function);
+        }
+
+        std::unique_ptr<action_unit> post;
+        if (get<uint8_t>()) {
+            post.reset(new action_unit(read_action()));
+        }
+        return action_unit(acts, body, post);
+    }
+};
+
+} // namespace
+
+uint64_t hash_policy(const policy& p) {
+    return index_policy(p).hash;
+}
+
+std::optional<diagram> DiagramCache::load(const policy& p, uint64_t key) const {
+    int fd = ::open(m_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(Header))) {
+        map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return std::nullopt;
+    }
+
+    auto begin = static_cast<const uint8_t*>(map);
+    Header header;
+    std::memcpy(&header, begin, sizeof(header));
+
+    std::optional<diagram> ret;
+    if (std::memcmp(header.magic, magic, sizeof(magic)) == 0 &&
+        header.version == version &&
+        header.key == key &&
+        header.size == uint64_t(st.st_size) - sizeof(Header))
+    {
+        PolicyIndex index = index_policy(p);
+        if (header.functions == index.functions.size()) {
+            try {
+                Reader reader{begin + sizeof(Header), begin + st.st_size, index};
+                ret = reader.read();
+                if (not reader.done()) {
+                    ret.reset();
+                }
+            } catch (std::exception&) {
+                // corrupted, will be compiled and overwritten
+                ret.reset();
+            }
+        }
+    }
+
+    ::munmap(map, st.st_size);
+    return ret;
+}
+
+bool DiagramCache::store(const policy& p, uint64_t key, const diagram& d) const {
+    PolicyIndex index = index_policy(p);
+    Writer writer{index};
+    try {
+        boost::apply_visitor(writer, d);
+    } catch (std::out_of_range&) {
+        return false;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.functions = index.functions.size();
+    header.key = key;
+    header.size = writer.data.size();
+
+    // readers never see a partially written file
+    std::string tmp = m_path + ".tmp";
+    std::FILE* file = std::fopen(tmp.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(writer.data.data(), 1, writer.data.size(), file)
+                  == writer.data.size();
+    ok = (std::fclose(file) == 0) && ok;
+    if (ok) {
+        ok = std::rename(tmp.c_str(), m_path.c_str()) == 0;
+    }
+    if (not ok) {
+        std::remove(tmp.c_str());
+    }
+    return ok;
+}
+
+} // namespace fdd
+} // namespace retic
+} // namespace runos
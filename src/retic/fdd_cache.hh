@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "fdd.hh"
+#include "policies.hh"
+
+namespace runos {
+namespace retic {
+namespace fdd {
+
+// Structural hash of policy. Packet functions are opaque,
+// they are hashed by their position in the policy, not by id:
+// ids depend on the order handlers were created in.
+uint64_t hash_policy(const policy& p);
+
+// Compiled diagram kept in a file to skip compilation on restart.
+//
+// Diagram is stored in pre-order and decoded from the mapped file.
+// Packet functions of leaves are stored as positions in the policy
+// and taken from the policy passed to load(), field types are
+// restored the same way. The file is only readable on the machine
+// which wrote it.
+class DiagramCache {
+public:
+    explicit DiagramCache(std::string path)
+        : m_path(std::move(path))
+    { }
+
+    // Diagram stored for the policy with the key,
+    // nullopt if there is no such one
+    std::optional<diagram> load(const policy& p, uint64_t key) const;
+
+    // Replaces the stored diagram, returns false on i/o error
+    bool store(const policy& p, uint64_t key, const diagram& d) const;
+
+    const std::string& path() const
+    { return m_path; }
+
+private:
+    std::string m_path;
+};
+
+} // namespace fdd
+} // namespace retic
+} // namespace runos
@@ -15,8 +15,29 @@ namespace retic {
 namespace fdd {
 
 
-diagram compile(const policy& p) {
-    Compiler compiler;
+namespace {
+
+// the rest are compiled faster than they can be forked
+bool is_compound(const policy& p) {
+    return boost::get<Sequential>(&p) != nullptr ||
+           boost::get<Parallel>(&p) != nullptr ||
+           boost::get<Negation>(&p) != nullptr;
+}
+
+// a + b + c + ... is a chain of nested Parallel
+void flatten(const policy& p, std::vector<const policy*>& terms) {
+    if (auto par = boost::get<Parallel>(&p)) {
+        flatten(par->one, terms);
+        flatten(par->two, terms);
+    } else {
+        terms.push_back(&p);
+    }
+}
+
+} // namespace
+
+diagram compile(const policy& p, const FieldOrder& order, task_pool* pool) {
+    Compiler compiler{order, pool};
     return boost::apply_visitor(compiler, p);
 }
 
@@ -40,17 +61,42 @@ diagram Compiler::operator()(const Id& id) const {
     return leaf{{oxm::field_set{}}};
 }
 diagram Compiler::operator()(const Sequential& s) const {
-    sequential_composition dispatcher;
-    diagram d1 = boost::apply_visitor(*this, s.one);
-    diagram d2 = boost::apply_visitor(*this, s.two);
+    sequential_composition dispatcher{m_order};
+    diagram d1, d2;
+    if (m_pool != nullptr && is_compound(s.one) && is_compound(s.two)) {
+        m_pool->invoke([&]() { d1 = boost::apply_visitor(*this, s.one); },
+                       [&]() { d2 = boost::apply_visitor(*this, s.two); });
+    } else {
+        d1 = boost::apply_visitor(*this, s.one);
+        d2 = boost::apply_visitor(*this, s.two);
+    }
     return boost::apply_visitor(dispatcher, d1, d2);
 }
 diagram Compiler::operator()(const Parallel& p) const {
-    parallel_composition dispatcher;
+    if (m_pool != nullptr) {
+        // compose the chain as a balanced tree, its halves in parallel
+        std::vector<const policy*> terms;
+        flatten(p.one, terms);
+        flatten(p.two, terms);
+        return parallel(terms, 0, terms.size());
+    }
+    parallel_composition dispatcher{m_order};
     diagram d1 = boost::apply_visitor(*this, p.one);
     diagram d2 = boost::apply_visitor(*this, p.two);
     return boost::apply_visitor(dispatcher, d1, d2);
 }
+diagram Compiler::parallel(const std::vector<const policy*>& terms,
+                           size_t begin, size_t end) const {
+    if (end - begin == 1) {
+        return boost::apply_visitor(*this, *terms[begin]);
+    }
+    size_t middle = begin + (end - begin) / 2;
+    diagram d1, d2;
+    m_pool->invoke([&]() { d1 = parallel(terms, begin, middle); },
+                   [&]() { d2 = parallel(terms, middle, end); });
+    parallel_composition dispatcher{m_order};
+    return boost::apply_visitor(dispatcher, d1, d2);
+}
 diagram Compiler::operator()(const PacketFunction& f) const {
     return leaf{ {{oxm::field_set{}, f}} };
 }
@@ -105,7 +151,7 @@ diagram parallel_composition::operator()(const node& lhs, const node& rhs) const
                 *this, diagram(rhs), diagram(lhs)
             );
         }
-    } else if (compare_types(lhs.field.type(), rhs.field.type()) > 0) {
+    } else if (order.compare(lhs.field.type(), rhs.field.type()) > 0) {
         diagram positive = boost::apply_visitor(*this, diagram(lhs.positive), diagram(rhs));
         diagram negative = boost::apply_visitor(*this, diagram(lhs.negative), diagram(rhs));
         return node{lhs.field, positive, negative};
@@ -127,7 +173,7 @@ diagram sequential_composition::operator()(const leaf& lhs, const diagram& rhs)
     }
 
     diagram result = leaf{{}, lhs.flow_settings};
-    parallel_composition parallel;
+    parallel_composition parallel{order};
     for (auto& action: lhs.sets) {
         left_action_applier applier{action};
         diagram current = boost::apply_visitor(applier, rhs);
@@ -140,9 +186,9 @@ diagram sequential_composition::operator()(const node& lhs, const diagram& rhs)
 {
     diagram one = boost::apply_visitor(*this, lhs.positive, rhs);
     diagram two = boost::apply_visitor(*this, lhs.negative, rhs);
-    diagram one_restricted = restriction{lhs.field, one, true}.apply();
-    diagram two_restricted = restriction{lhs.field, two, false}.apply();
-    parallel_composition parallel;
+    diagram one_restricted = restriction{lhs.field, one, true, order}.apply();
+    diagram two_restricted = restriction{lhs.field, two, false, order}.apply();
+    parallel_composition parallel{order};
     return boost::apply_visitor(parallel, one_restricted, two_restricted);
 }
 
@@ -210,7 +256,9 @@ diagram negation_composition::operator()(const node& l) const {
 diagram restriction::apply() {
     struct applier_true : public boost::static_visitor<diagram>
     {
-        applier_true(oxm::field<> f) : f(f) { }
+        applier_true(oxm::field<> f, const FieldOrder& order)
+            : f(f), order(order)
+        { }
 
         diagram operator()(const leaf& l) const {
             return node{f, l, leaf{}};
@@ -221,7 +269,7 @@ diagram restriction::apply() {
                 return node{f, n.positive, leaf{}};
             } else if (n.field.type() == f.type()) {
                 return boost::apply_visitor(*this, n.negative);
-            } else if (compare_types(f.type(), n.field.type()) > 0) {
+            } else if (order.compare(f.type(), n.field.type()) > 0) {
                 return node{f, n, leaf{}};
             } else {
                 diagram positive = boost::apply_visitor(*this, n.positive);
@@ -230,11 +278,14 @@ diagram restriction::apply() {
             }
         }
         const oxm::field<> &f;
+        const FieldOrder& order;
     };
 
     struct applier_false : public boost::static_visitor<diagram>
     {
-        applier_false(oxm::field<> f) : f(f) { }
+        applier_false(oxm::field<> f, const FieldOrder& order)
+            : f(f), order(order)
+        { }
 
         diagram operator()(const leaf& l) const {
             return node{f, leaf{}, l};
@@ -249,7 +300,7 @@ diagram restriction::apply() {
                 } else {
                     return node{f, leaf{}, n};
                 }
-            } else if (compare_types(f.type(), n.field.type()) > 0) {
+            } else if (order.compare(f.type(), n.field.type()) > 0) {
                 return node{f, leaf{}, n};
             } else {
                 diagram positive = boost::apply_visitor(*this, n.positive);
@@ -258,11 +309,12 @@ diagram restriction::apply() {
             }
         }
         const oxm::field<> &f;
+        const FieldOrder& order;
     };
     if (test) {
-        return boost::apply_visitor(applier_true(field), d);
+        return boost::apply_visitor(applier_true(field, order), d);
     } else {
-        return boost::apply_visitor(applier_false(field), d);
+        return boost::apply_visitor(applier_false(field, order), d);
     }
 }
 
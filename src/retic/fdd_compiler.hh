@@ -1,28 +1,40 @@
 #pragma once
 
+#include <vector>
+
 #include <oxm/field.hh>
 #include <oxm/field_set.hh>
+#include <types/task_pool.hh>
 
 #include "fdd.hh"
+#include "fdd_order.hh"
 #include "policies.hh"
 
 namespace runos {
 namespace retic {
 namespace fdd {
 
-diagram compile(const policy&);
+// With pool independent subterms are compiled in parallel
+diagram compile(const policy&, const FieldOrder& order = FieldOrder::natural(),
+                task_pool* pool = nullptr);
 
 class restriction {
 public:
     oxm::field<> field;
     diagram d;
     bool test; // positive or negative test
+    const FieldOrder& order = FieldOrder::natural();
 
     diagram apply();
 };
 
 class Compiler: public boost::static_visitor<diagram> {
 public:
+    explicit Compiler(const FieldOrder& order = FieldOrder::natural(),
+                      task_pool* pool = nullptr)
+        : m_order(order), m_pool(pool)
+    { }
+
     diagram operator()(const Filter& fil) const;
     diagram operator()(const Negation& neg) const;
     diagram operator()(const Modify& mod) const;
@@ -32,6 +44,12 @@ public:
     diagram operator()(const Parallel&) const;
     diagram operator()(const PacketFunction&) const;
     diagram operator()(const FlowSettings&) const;
+private:
+    const FieldOrder& m_order;
+    task_pool* m_pool;
+
+    diagram parallel(const std::vector<const policy*>& terms,
+                     size_t begin, size_t end) const;
 };
 
 bool operator==(const leaf& lhs, const leaf& rhs);
@@ -42,16 +60,28 @@ int compare_types(const oxm::type lhs, oxm::type rhs);
 
 struct parallel_composition: public boost::static_visitor<diagram>
 {
+    explicit parallel_composition(const FieldOrder& order = FieldOrder::natural())
+        : order(order)
+    { }
+
     diagram operator()(const leaf& lhs, const leaf& rhs) const;
     diagram operator()(const node& lhs, const leaf& rhs) const;
     diagram operator()(const leaf& lhs, const node& rhs) const;
     diagram operator()(const node&, const node&) const;
+
+    const FieldOrder& order;
 };
 
 struct sequential_composition: public boost::static_visitor<diagram>
 {
+    explicit sequential_composition(const FieldOrder& order = FieldOrder::natural())
+        : order(order)
+    { }
+
     diagram operator()(const leaf& lhs, const diagram& rhs) const;
     diagram operator()(const node& lhs, const diagram& rhs) const;
+
+    const FieldOrder& order;
 private:
     struct left_action_applier: public boost::static_visitor<diagram>
     {
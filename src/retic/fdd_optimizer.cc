@@ -0,0 +1,60 @@
+#include "fdd_optimizer.hh"
+
+#include "fdd_compiler.hh"
+
+namespace runos {
+namespace retic {
+namespace fdd {
+
+diagram optimize(const diagram& d) {
+    Optimizer optimizer;
+    return boost::apply_visitor(optimizer, d);
+}
+
+diagram Optimizer::operator()(const leaf& l) {
+    return l;
+}
+
+diagram Optimizer::operator()(const node& n) {
+    if (auto known = outcome(n.field)) {
+        return boost::apply_visitor(*this, *known ? n.positive : n.negative);
+    }
+
+    m_path.push_back(test{n.field, true});
+    diagram positive = boost::apply_visitor(*this, n.positive);
+    m_path.back().positive = false;
+    diagram negative = boost::apply_visitor(*this, n.negative);
+    m_path.pop_back();
+
+    if (positive == negative) {
+        return positive;
+    }
+    return node{n.field, std::move(positive), std::move(negative)};
+}
+
+std::optional<bool> Optimizer::outcome(const oxm::field<>& field) const {
+    for (const auto& t: m_path) {
+        if (t.field.type() != field.type()) {
+            continue;
+        }
+        bool intersects = t.field & field;
+        if (t.positive) {
+            if (not intersects) {
+                return false;
+            }
+            // t.field is more specific
+            if (field.mask_bits().is_subset_of(t.field.mask_bits())) {
+                return true;
+            }
+        } else if (intersects &&
+                   t.field.mask_bits().is_subset_of(field.mask_bits())) {
+            // field is more specific than failed test
+            return false;
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace fdd
+} // namespace retic
+} // namespace runos
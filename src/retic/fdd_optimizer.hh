@@ -0,0 +1,40 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <oxm/field.hh>
+
+#include "fdd.hh"
+
+namespace runos {
+namespace retic {
+namespace fdd {
+
+// Simplifies compiled diagram before translation to rules.
+// Result is equal to the source on every packet, so it may be
+// traversed instead of the source.
+diagram optimize(const diagram&);
+
+// Removes tests with known outcome (shadowed by tests above them,
+// their rules could never match) and tests with equal branches
+// (sibling leaves with the same actions are merged into one wider rule).
+class Optimizer: public boost::static_visitor<diagram> {
+public:
+    diagram operator()(const leaf& l);
+    diagram operator()(const node& n);
+
+private:
+    struct test {
+        oxm::field<> field;
+        bool positive;
+    };
+    // tests from the root to current node
+    std::vector<test> m_path;
+
+    std::optional<bool> outcome(const oxm::field<>& field) const;
+};
+
+} // namespace fdd
+} // namespace retic
+} // namespace runos
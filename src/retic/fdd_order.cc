@@ -0,0 +1,153 @@
+#include "fdd_order.hh"
+
+#include <algorithm>
+
+#include <boost/variant/static_visitor.hpp>
+
+#include "fdd_compiler.hh"
+#include "fdd_optimizer.hh"
+
+namespace runos {
+namespace retic {
+namespace fdd {
+
+namespace {
+
+struct FilterCounter: public boost::static_visitor<>
+{
+    std::unordered_map<oxm::type, size_t> counts;
+    std::vector<oxm::type> types;
+
+    void operator()(const Filter& fil) {
+        if (counts[fil.field.type()]++ == 0) {
+            types.push_back(fil.field.type());
+        }
+    }
+    void operator()(const Negation& neg) {
+        boost::apply_visitor(*this, neg.pol);
+    }
+    void operator()(const Sequential& seq) {
+        boost::apply_visitor(*this, seq.one);
+        boost::apply_visitor(*this, seq.two);
+    }
+    void operator()(const Parallel& par) {
+        boost::apply_visitor(*this, par.one);
+        boost::apply_visitor(*this, par.two);
+    }
+    template<class T>
+    void operator()(const T&) { }
+};
+
+struct DiagramSize: public boost::static_visitor<size_t>
+{
+    size_t operator()(const leaf&) const {
+        return 1;
+    }
+    size_t operator()(const node& n) const {
+        return 1 + boost::apply_visitor(*this, n.positive)
+                 + boost::apply_visitor(*this, n.negative);
+    }
+};
+
+// number of nodes and leaves, as it will be translated
+size_t compiled_size(const policy& p, const FieldOrder& order) {
+    diagram d = optimize(compile(p, order));
+    return boost::apply_visitor(DiagramSize(), d);
+}
+
+} // namespace
+
+FieldOrder::FieldOrder(std::vector<oxm::type> order, StageFunction stage_of)
+    : m_order(std::move(order))
+    , m_stage_of(std::move(stage_of))
+{
+    std::stable_sort(m_order.begin(), m_order.end(),
+        [this](oxm::type lhs, oxm::type rhs) {
+            return stage(lhs) < stage(rhs);
+        });
+    for (size_t i = 0; i < m_order.size(); ++i) {
+        m_rank.emplace(m_order[i], i);
+    }
+}
+
+const FieldOrder& FieldOrder::natural() {
+    static const FieldOrder ret;
+    return ret;
+}
+
+FieldOrder FieldOrder::fromPolicy(const policy& p, StageFunction stage_of) {
+    FilterCounter counter;
+    boost::apply_visitor(counter, p);
+
+    std::vector<oxm::type> order = std::move(counter.types);
+    std::sort(order.begin(), order.end(), [&counter](oxm::type lhs, oxm::type rhs) {
+        size_t lhs_count = counter.counts.at(lhs);
+        size_t rhs_count = counter.counts.at(rhs);
+        if (lhs_count != rhs_count) {
+            return lhs_count > rhs_count;
+        }
+        return compare_types(lhs, rhs) > 0;
+    });
+    return FieldOrder(std::move(order), std::move(stage_of));
+}
+
+FieldOrder FieldOrder::sift(const policy& p, const FieldOrder& initial) {
+    std::vector<oxm::type> order = initial.types();
+    size_t best = compiled_size(p, initial);
+
+    for (oxm::type type: initial.types()) {
+        std::vector<oxm::type> rest = order;
+        rest.erase(std::find(rest.begin(), rest.end(), type));
+        // positions inside the block of its stage, the order is sorted by stage
+        unsigned type_stage = initial.stage(type);
+        auto first = std::find_if(rest.begin(), rest.end(), [&](oxm::type t) {
+            return initial.stage(t) >= type_stage;
+        });
+        auto last = std::find_if(first, rest.end(), [&](oxm::type t) {
+            return initial.stage(t) > type_stage;
+        });
+        size_t begin = first - rest.begin(), end = last - rest.begin();
+        for (size_t pos = begin; pos <= end; ++pos) {
+            std::vector<oxm::type> candidate = rest;
+            candidate.insert(candidate.begin() + pos, type);
+            if (candidate == order) {
+                continue;
+            }
+            size_t size = compiled_size(p, FieldOrder(candidate, initial.m_stage_of));
+            if (size < best) {
+                best = size;
+                order = std::move(candidate);
+            }
+        }
+    }
+    return FieldOrder(std::move(order), initial.m_stage_of);
+}
+
+int FieldOrder::compare(oxm::type lhs, oxm::type rhs) const {
+    if (m_stage_of) {
+        unsigned lhs_stage = stage(lhs);
+        unsigned rhs_stage = stage(rhs);
+        if (lhs_stage != rhs_stage) {
+            return lhs_stage < rhs_stage ? 1 : -1;
+        }
+    }
+    size_t lhs_rank = rank(lhs);
+    size_t rhs_rank = rank(rhs);
+    if (lhs_rank != rhs_rank) {
+        return lhs_rank < rhs_rank ? 1 : -1;
+    }
+    return compare_types(lhs, rhs);
+}
+
+size_t FieldOrder::rank(oxm::type t) const {
+    auto it = m_rank.find(t);
+    return it != m_rank.end() ? it->second : m_order.size();
+}
+
+unsigned FieldOrder::stage(oxm::type t) const {
+    return m_stage_of ? m_stage_of(t) : 0u;
+}
+
+} // namespace fdd
+} // namespace retic
+} // namespace runos
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <oxm/field.hh>
+
+#include "policies.hh"
+
+namespace runos {
+namespace retic {
+namespace fdd {
+
+// Order of field types in diagram, from the root to leaves.
+// Listed types go first, the others follow by their OXM numbering.
+// With pipeline stages types of earlier stages go first anyway,
+// so each path of the diagram passes the stages in order.
+class FieldOrder {
+public:
+    // stage of the pipeline where the type is tested, see fdd::Pipeline
+    using StageFunction = std::function<unsigned(oxm::type)>;
+
+    // by OXM numbering only
+    FieldOrder() = default;
+    explicit FieldOrder(std::vector<oxm::type> order,
+                        StageFunction stage_of = nullptr);
+
+    static const FieldOrder& natural();
+
+    // Static heuristic: types tested by more filters of the policy
+    // go closer to the root, their tests are shared by more branches.
+    static FieldOrder fromPolicy(const policy& p,
+                                 StageFunction stage_of = nullptr);
+
+    // Sifting: every type is moved through all positions of its stage
+    // and left in the one with the smallest compiled diagram.
+    // Takes a compilation per position, use on policies with few fields.
+    static FieldOrder sift(const policy& p, const FieldOrder& initial);
+
+    // Same as compare_types: positive if lhs goes before rhs
+    int compare(oxm::type lhs, oxm::type rhs) const;
+
+    const std::vector<oxm::type>& types() const
+    { return m_order; }
+
+private:
+    std::vector<oxm::type> m_order; // sorted by stage
+    std::unordered_map<oxm::type, size_t> m_rank;
+    StageFunction m_stage_of;
+
+    size_t rank(oxm::type t) const;
+    unsigned stage(oxm::type t) const;
+};
+
+} // namespace fdd
+} // namespace retic
+} // namespace runos
@@ -1,10 +1,21 @@
 #include "fdd_translator.hh"
 
+#include "fdd_compiler.hh"
+
 namespace runos {
 namespace retic {
 namespace fdd {
 
 void Translator::operator()(const node& n) {
+    if (m_pipeline != nullptr) {
+        unsigned next_stage = m_pipeline->stageOf(n.field);
+        if (next_stage > m_stage.index) {
+            uint64_t metadata = m_pipeline->enqueue(next_stage, n);
+            m_backend.installGoto(m_stage, match, leafPriority(),
+                                  Stage{next_stage, metadata});
+            return;
+        }
+    }
 
     struct {
         uint16_t prio_up;
@@ -60,19 +71,123 @@ void Translator::operator()(const node& n) {
 
 void Translator::operator()(const leaf& l) {
     uint16_t local_prio_up = previous_mask.has_value() ? prio_middle : prio_up;
-    uint16_t prio = prio_down / 2 + local_prio_up / 2;
+    uint16_t prio = leafPriority();
     l.prio_up = local_prio_up;
     l.prio_down = prio_down;
+    l.stage = m_stage.index;
+    l.metadata = m_stage.metadata;
+    if (m_stage.index != 0 && l.sets.empty() && match.empty()) {
+        // the lowest rule of the stage drops packets,
+        // stage tables have no miss rule and drop them anyway
+        return;
+    }
     std::vector<oxm::field_set> sets;
     sets.reserve(l.sets.size());
     for (auto& s: l.sets) {
         if (s.body.has_value()) {
-            m_backend.installBarrier(match, prio);
+            if (m_stage.index == 0) {
+                m_backend.installBarrier(match, prio);
+            } else {
+                m_backend.installBarrierIn(m_stage, match, prio);
+            }
             return;
         }
         sets.push_back(s.pred_actions);
     }
-    m_backend.install(match, sets, prio, l.flow_settings);
+    if (m_stage.index == 0) {
+        m_backend.install(match, sets, prio, l.flow_settings);
+    } else {
+        m_backend.installIn(m_stage, match, sets, prio, l.flow_settings);
+    }
+}
+
+uint16_t Translator::leafPriority() const {
+    uint16_t local_prio_up = previous_mask.has_value() ? prio_middle : prio_up;
+    return prio_down / 2 + local_prio_up / 2;
+}
+
+namespace {
+
+// Duplicates of translated subdiagrams are walked with it
+// to annotate their leaves
+struct NullBackend : Backend {
+    void install(oxm::field_set, std::vector<oxm::field_set>,
+                 uint16_t, FlowSettings) override
+    { }
+    void installBarrier(oxm::field_set, uint16_t) override
+    { }
+    void installIn(Stage, oxm::field_set, std::vector<oxm::field_set>,
+                   uint16_t, FlowSettings) override
+    { }
+    void installBarrierIn(Stage, oxm::field_set, uint16_t) override
+    { }
+    void installGoto(Stage, oxm::field_set, uint16_t, Stage) override
+    { }
+    void packetOuts(uint8_t*, size_t, std::vector<oxm::field_set>,
+                    uint64_t, uint32_t, const Packet&) override
+    { }
+};
+
+// Equal diagrams have equal hashes, leaf actions are left for operator==
+struct ShapeHash : boost::static_visitor<size_t> {
+    static void combine(size_t& seed, size_t h) {
+        seed ^= h + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+
+    size_t operator()(const leaf& l) const {
+        return l.sets.size();
+    }
+
+    size_t operator()(const node& n) const {
+        size_t ret = std::hash<oxm::type>()(n.field.type());
+        combine(ret, std::hash<bits<>>()(n.field.value_bits()));
+        combine(ret, boost::apply_visitor(*this, n.positive));
+        combine(ret, boost::apply_visitor(*this, n.negative));
+        return ret;
+    }
+};
+
+} // namespace
+
+void Pipeline::translate(const diagram& d) {
+    m_queue.clear();
+    m_known.clear();
+    m_last_metadata.clear();
+
+    Translator first{m_backend, *this, Stage{}};
+    boost::apply_visitor(first, d);
+
+    NullBackend null;
+    while (not m_queue.empty()) {
+        Job job = m_queue.front();
+        m_queue.pop_front();
+
+        Backend& backend = job.install ? m_backend : null;
+        Translator translator{backend, *this, job.stage};
+        translator(*job.root);
+    }
+}
+
+uint64_t Pipeline::enqueue(unsigned stage, const node& root) {
+    size_t hash = ShapeHash()(root);
+    ShapeHash::combine(hash, stage);
+
+    auto range = m_known.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const Job& known = it->second;
+        if (known.stage.index == stage && *known.root == root) {
+            m_queue.push_back(Job{&root, known.stage, false});
+            return known.stage.metadata;
+        }
+    }
+
+    if (m_last_metadata.size() <= stage) {
+        m_last_metadata.resize(stage + 1, 0);
+    }
+    Job job{&root, Stage{stage, ++m_last_metadata[stage]}, true};
+    m_known.emplace(hash, job);
+    m_queue.push_back(job);
+    return job.stage.metadata;
 }
 
 } // namespace fdd
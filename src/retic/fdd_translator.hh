@@ -1,6 +1,10 @@
 #pragma once
 
+#include <deque>
+#include <functional>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 #include <boost/variant/static_visitor.hpp>
 
 #include "fdd.hh"
@@ -10,10 +14,19 @@ namespace runos {
 namespace retic {
 namespace fdd {
 
+class Pipeline;
+
 class Translator : boost::static_visitor<> {
 public:
     Translator(Backend& backend) : m_backend(backend) { }
 
+    // translates a part of diagram of `stage` of the pipeline
+    Translator(Backend& backend, Pipeline& pipeline, Stage stage)
+    : m_backend(backend)
+    , m_pipeline(&pipeline)
+    , m_stage(stage)
+    { }
+
     Translator(
         Backend& backend,
         oxm::field_set pre_match,
@@ -34,6 +47,59 @@ private:
     uint16_t prio_up = 65535u;
     uint16_t prio_middle = 0;
     std::optional<oxm::mask<>> previous_mask = std::nullopt;
+
+    Pipeline* m_pipeline = nullptr;
+    Stage m_stage;
+
+    uint16_t leafPriority() const;
+};
+
+/**
+ * Translates diagram into several tables linked with goto-table.
+ *
+ * Every field belongs to a stage (table), fields of stage 0 are tested
+ * in the first table. A node testing a field of a later stage than
+ * the current one starts a subdiagram of that stage: the path leading
+ * to it becomes a goto rule writing the subdiagram id into metadata,
+ * and the subdiagram is translated into the table of its stage matching
+ * that metadata. Equal subdiagrams are translated once, so the rule
+ * count is the sum of stage sizes instead of their product.
+ *
+ * Fields should be ordered by stage in the diagram, a field of an
+ * earlier stage found below a later one is tested in the later table.
+ */
+class Pipeline {
+public:
+    using StageFunction = std::function<unsigned(oxm::type)>;
+
+    Pipeline(Backend& backend, StageFunction stage_of)
+        : m_backend(backend)
+        , m_stage_of(std::move(stage_of))
+    { }
+
+    void translate(const diagram& d);
+
+private:
+    friend class Translator;
+
+    struct Job {
+        const node* root;
+        Stage stage;
+        bool install; // false for duplicates: only leaves are annotated
+    };
+
+    Backend& m_backend;
+    StageFunction m_stage_of;
+    std::deque<Job> m_queue;
+    // translated subdiagrams by stage and shape hash
+    std::unordered_multimap<size_t, Job> m_known;
+    std::vector<uint64_t> m_last_metadata; // by stage
+
+    unsigned stageOf(const oxm::field<>& field) const
+    { return m_stage_of(field.type()); }
+
+    // returns metadata of the subdiagram
+    uint64_t enqueue(unsigned stage, const node& root);
 };
 
 } // namespace fdd
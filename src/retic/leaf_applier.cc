@@ -1,5 +1,7 @@
 #include "leaf_applier.hh"
 
+#include "types/latency.hh"
+
 namespace runos {
 namespace retic {
 
@@ -18,6 +20,7 @@ std::vector<tracer::Trace> getTraces(const fdd::leaf& l, const Packet& orig_pkt)
 
         auto pkt = orig_pkt.clone();
         tracer::Tracer tracer(wrapped_handler);
+        latency::Timer timer{latency::Stage::Execute};
         tracer::Trace tr = tracer.trace(*pkt);
         ret.push_back(tr);
     }
@@ -3,6 +3,7 @@
 #include "fdd.hh"
 #include "fdd_compiler.hh"
 #include "fdd_translator.hh"
+#include "traverse_fdd.hh"
 
 namespace runos {
 namespace retic {
@@ -71,6 +72,64 @@ std::shared_ptr<fdd::diagram_holder> Augmention::finish(policy p) {
     return leaf->kat_diagram;
 }
 
+namespace {
+
+class Forgetter : public boost::static_visitor<bool> {
+public:
+    explicit Forgetter(const oxm::field<>& field)
+        : m_field(field)
+        , m_pkt{field}
+    { }
+
+    bool operator()(unexplored&) const {
+        return true;
+    }
+
+    bool operator()(leaf_node& leaf) const {
+        // nested handlers may load the field
+        return leaf.kat_diagram == nullptr ||
+               fdd::forget(leaf.kat_diagram->value, m_field);
+    }
+
+    bool operator()(test_node& test) const {
+        if (test.need.type() != m_field.type()) {
+            bool positive = boost::apply_visitor(*this, test.positive);
+            return boost::apply_visitor(*this, test.negative) && positive;
+        }
+        if (not m_pkt.test(test.need)) {
+            return boost::apply_visitor(*this, test.negative);
+        }
+        return not test.need.exact() &&
+               boost::apply_visitor(*this, test.positive);
+    }
+
+    bool operator()(load_node& load) const {
+        if (load.mask.type() != m_field.type()) {
+            bool ret = true;
+            for (auto& [bits, n]: load.cases) {
+                ret = boost::apply_visitor(*this, n) && ret;
+            }
+            return ret;
+        }
+        if (load.mask.exact()) {
+            load.cases.erase(m_field.value_bits());
+            return true;
+        }
+        auto it = load.cases.find(m_pkt.load(load.mask).value_bits());
+        return it == load.cases.end() || boost::apply_visitor(*this, it->second);
+    }
+
+private:
+    const oxm::field<>& m_field;
+    oxm::field_set m_pkt;
+};
+
+} // namespace
+
+bool forget(node& root, const oxm::field<>& field) {
+    return boost::apply_visitor(Forgetter{field}, root);
+}
+
 std::ostream& operator<<(std::ostream& out, const unexplored& u) {
     return  out << "unexplored";
 }
@@ -4,7 +4,6 @@
 
 #include <exception>
 #include <memory>
-#include <unordered_map>
 #include <ostream>
 
 #include <boost/variant/variant_fwd.hpp>
@@ -12,6 +11,8 @@
 
 #include "oxm/field.hh"
 #include "oxm/field_set.hh"
+#include "types/case_map.hh"
+#include "types/slab.hh"
 
 #include "tracer.hh"
 #include "backend.hh"
@@ -49,11 +50,21 @@ struct test_node {
     oxm::field<> need;
     node positive;
     node negative;
+
+    static void* operator new(size_t size)
+    { return slab<test_node>::allocate(size); }
+    static void operator delete(void* p, size_t size)
+    { slab<test_node>::deallocate(p, size); }
 };
 
 struct load_node {
     oxm::mask<> mask;
-    std::unordered_map<bits<>, node> cases;
+    case_map<node> cases;
+
+    static void* operator new(size_t size)
+    { return slab<load_node>::allocate(size); }
+    static void operator delete(void* p, size_t size)
+    { slab<load_node>::deallocate(p, size); }
 };
 
 class Augmention : public boost::static_visitor<> {
@@ -85,6 +96,16 @@ private:
     uint16_t prio_up;
 };
 
+/**
+ * Forgets explored branches of packets with exact `field`, they are
+ * explored again by the next such packet. Branches which don't load
+ * the field are kept, their results don't depend on it.
+ * @return false if a test on the field was explored: its barrier rule
+ *         matches the field too, so rules of the field can't be removed
+ *         without breaking the test.
+ */
+bool forget(node& root, const oxm::field<>& field);
+
 std::ostream& operator<<(std::ostream& out, const unexplored& u);
 std::ostream& operator<<(std::ostream& out, const leaf_node& l);
 std::ostream& operator<<(std::ostream& out, const test_node& t);
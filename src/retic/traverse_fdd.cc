@@ -1,6 +1,9 @@
 #include "traverse_fdd.hh"
 
 #include <algorithm>
+#include <optional>
+
+#include "types/latency.hh"
 
 #include "traverse_trace_tree.hh"
 #include "trace_tree.hh"
@@ -30,6 +33,30 @@ private:
     const Packet& m_pkt;
 };
 
+class Forgetter: public boost::static_visitor<bool> {
+public:
+    explicit Forgetter(const oxm::field<>& field)
+        : m_field(field)
+        , m_pkt{field}
+    { }
+    bool operator()(leaf& l) const {
+        return trace_tree::forget(l.maple_tree, m_field);
+    }
+    bool operator()(node& n) const {
+        if (n.field.type() != m_field.type()) {
+            bool positive = boost::apply_visitor(*this, n.positive);
+            return boost::apply_visitor(*this, n.negative) && positive;
+        }
+        if (not m_pkt.test(n.field)) {
+            return boost::apply_visitor(*this, n.negative);
+        }
+        return not n.field.exact() && boost::apply_visitor(*this, n.positive);
+    }
+private:
+    const oxm::field<>& m_field;
+    oxm::field_set m_pkt;
+};
+
 // leaf of Packet hard_timeout == duration::zero()
 bool leaf_is_temporary(const Packet& pkt, const diagram& d) {
     auto& l = boost::apply_visitor(PlainTraverser{pkt}, d);
@@ -39,6 +66,9 @@ bool leaf_is_temporary(const Packet& pkt, const diagram& d) {
 }
 
 leaf& Traverser::operator()(leaf& l) {
+    if (m_stage_leaf == nullptr) {
+        m_stage_leaf = &l;
+    }
 
     if (std::any_of(
             l.sets.begin(), l.sets.end(),
@@ -50,10 +80,19 @@ leaf& Traverser::operator()(leaf& l) {
         if (next_fdd == nullptr or leaf_is_temporary(m_pkt, next_fdd->value)) {
             // has no value for this packet
             // should create it
+            latency::Timer timer{latency::Stage::Augment};
             auto traces = retic::getTraces(l, m_pkt);
             auto merged_trace = tracer::mergeTrace(traces, m_match);
+            // nested leaves share the table of the outermost one
+            std::optional<StageBackend> staged;
+            Backend* backend = m_backend;
+            if (m_backend && m_stage_leaf->stage != 0) {
+                staged.emplace(*m_backend, Stage{m_stage_leaf->stage,
+                                                 m_stage_leaf->metadata});
+                backend = &*staged;
+            }
             trace_tree::Augmention augmenter(
-                &(l.maple_tree), m_backend, m_match, l.prio_down, l.prio_up
+                &(l.maple_tree), backend, m_match, l.prio_down, l.prio_up
             );
             for (auto& n: merged_trace.values()) {
                 boost::apply_visitor(augmenter, n);
@@ -83,6 +122,31 @@ leaf& Traverser::operator()(node& n) {
     }
 }
 
+const leaf* Finder::operator()(leaf& l) const {
+    if (std::none_of(
+            l.sets.begin(), l.sets.end(),
+            [](auto& x){ return x.body.has_value(); }
+    )) {
+        return &l;
+    }
+
+    trace_tree::Traverser traverser{m_pkt};
+    auto next_fdd = boost::apply_visitor(traverser, l.maple_tree).first;
+    if (next_fdd == nullptr or leaf_is_temporary(m_pkt, next_fdd->value)) {
+        return nullptr;
+    }
+    return boost::apply_visitor(*this, next_fdd->value);
+}
+
+const leaf* Finder::operator()(node& n) const {
+    return m_pkt.test(n.field) ? boost::apply_visitor(*this, n.positive)
+                               : boost::apply_visitor(*this, n.negative);
+}
+
+bool forget(diagram& d, const oxm::field<>& field) {
+    return boost::apply_visitor(Forgetter{field}, d);
+}
+
 } // fdd
 } // retic
 } // runos
@@ -25,9 +25,32 @@ private:
     const Packet& m_pkt;
     oxm::field_set m_match;
     Backend* m_backend;
+    const leaf* m_stage_leaf = nullptr; // leaf of the top diagram
 
 };
 
+// Finds the leaf of packet in explored trace trees without changing
+// them, so finders may run concurrently. Returns null if a trace tree
+// has to be augmented, use Traverser then.
+class Finder: public boost::static_visitor<const leaf*> {
+public:
+    explicit Finder(const Packet& pkt)
+        : m_pkt(pkt)
+    { }
+    const leaf* operator()(leaf& l) const;
+    const leaf* operator()(node& n) const;
+private:
+    const Packet& m_pkt;
+};
+
+/**
+ * Forgets explored trace trees of packets with exact `field`,
+ * see trace_tree::forget().
+ * @return false if rules matching the field are static or belong to
+ *         tests on it, so they can't be removed selectively.
+ */
+bool forget(diagram& d, const oxm::field<>& field);
+
 } // fdd
 } // retic
 } // runos
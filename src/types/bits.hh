@@ -70,6 +70,8 @@ namespace runos {
     public:
         typedef boost::dynamic_bitset<uint8_t> super;
 
+        bits() = default;
+
         bits(const super other)
             : super(std::move(other))
         { }
@@ -0,0 +1,409 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "bits.hh"
+#include "slab.hh"
+
+namespace runos {
+
+/**
+ * Map from bits<> to `V` for fan-out of trace tree load nodes.
+ *
+ * Keys are folded into 64-bit integers (exactly, when they are not
+ * wider than 64 bits), so lookups never hash or compare bitsets.
+ * Up to `small_size` cases are kept in an inline array sorted by key;
+ * bigger maps switch to an open-addressing hash table with linear
+ * probing.
+ *
+ * All keys of a map are expected to have the same width.
+ *
+ * Interface is a subset of std::unordered_map. Like there, entries
+ * never move: pointers and references to them stay valid until
+ * the entry is erased. Iterators are invalidated by insertion and
+ * erasure, erase() returns an iterator to the next entry.
+ * Iteration order is unspecified.
+ */
+template<class V>
+class case_map {
+public:
+    using key_type = bits<>;
+    using mapped_type = V;
+    using value_type = std::pair<const bits<>, V>;
+    using size_type = size_t;
+
+    static constexpr size_t small_size = 8;
+
+private:
+    struct slot {
+        uint64_t key;
+        value_type* entry;
+    };
+
+    using allocator = slab_allocator<value_type>;
+
+    static value_type* tombstone()
+    { return reinterpret_cast<value_type*>(uintptr_t(1)); }
+
+    static bool is_used(const slot& s)
+    { return s.entry != nullptr && s.entry != tombstone(); }
+
+    static uint64_t fold(const bits<>& key)
+    {
+        if (key.size() <= 64)
+            return key.to_ulong();
+        // rare (ipv6), full keys are compared on match
+        return std::hash<bits<>>()(key);
+    }
+
+    static size_t mix(uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return size_t(key);
+    }
+
+    static bool matches(const slot& s, uint64_t key, const bits<>& full)
+    {
+        return s.key == key &&
+               (full.size() <= 64 || s.entry->first == full);
+    }
+
+    // inline array while m_table is empty
+    std::array<slot, small_size> m_small;
+    std::unique_ptr<slot[]> m_table;
+    size_t m_capacity = 0; // of m_table, power of two
+    size_t m_size = 0;
+    size_t m_used = 0;     // m_size + tombstones, for m_table only
+
+    slot* slots()
+    { return m_table ? m_table.get() : m_small.data(); }
+    const slot* slots() const
+    { return m_table ? m_table.get() : m_small.data(); }
+    size_t slot_count() const
+    { return m_table ? m_capacity : m_size; }
+
+public:
+    template<bool Const>
+    class basic_iterator {
+        friend class case_map;
+        template<bool> friend class basic_iterator;
+        using slot_ptr = std::conditional_t<Const, const slot*, slot*>;
+        slot_ptr m_pos;
+        slot_ptr m_end;
+
+        void skip()
+        {
+            while (m_pos != m_end && not is_used(*m_pos))
+                ++m_pos;
+        }
+
+        basic_iterator(slot_ptr pos, slot_ptr end)
+            : m_pos(pos), m_end(end)
+        { skip(); }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = case_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference =
+            std::conditional_t<Const, const value_type&, value_type&>;
+        using pointer =
+            std::conditional_t<Const, const value_type*, value_type*>;
+
+        basic_iterator() = default;
+
+        // iterator -> const_iterator
+        template<bool C, class = std::enable_if_t<Const && !C>>
+        basic_iterator(const basic_iterator<C>& other)
+            : m_pos(other.m_pos), m_end(other.m_end)
+        { }
+
+        reference operator*() const { return *m_pos->entry; }
+        pointer operator->() const { return m_pos->entry; }
+
+        basic_iterator& operator++()
+        {
+            ++m_pos;
+            skip();
+            return *this;
+        }
+
+        basic_iterator operator++(int)
+        {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        friend bool operator==(const basic_iterator& lhs,
+                               const basic_iterator& rhs)
+        { return lhs.m_pos == rhs.m_pos; }
+        friend bool operator!=(const basic_iterator& lhs,
+                               const basic_iterator& rhs)
+        { return lhs.m_pos != rhs.m_pos; }
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    case_map() = default;
+
+    case_map(const case_map& other)
+    {
+        for (auto& record : other) {
+            emplace(record.first, record.second);
+        }
+    }
+
+    case_map(std::initializer_list<value_type> init)
+    {
+        for (auto& record : init) {
+            emplace(record.first, record.second);
+        }
+    }
+
+    case_map(case_map&& other) noexcept
+        : m_small(other.m_small)
+        , m_table(std::move(other.m_table))
+        , m_capacity(other.m_capacity)
+        , m_size(other.m_size)
+        , m_used(other.m_used)
+    {
+        other.m_capacity = other.m_size = other.m_used = 0;
+    }
+
+    case_map& operator=(case_map other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~case_map()
+    { clear(); }
+
+    void swap(case_map& other) noexcept
+    {
+        std::swap(m_small, other.m_small);
+        std::swap(m_table, other.m_table);
+        std::swap(m_capacity, other.m_capacity);
+        std::swap(m_size, other.m_size);
+        std::swap(m_used, other.m_used);
+    }
+
+    iterator begin()
+    { return iterator(slots(), slots() + slot_count()); }
+    iterator end()
+    { return iterator(slots() + slot_count(), slots() + slot_count()); }
+    const_iterator begin() const
+    { return const_iterator(slots(), slots() + slot_count()); }
+    const_iterator end() const
+    { return const_iterator(slots() + slot_count(), slots() + slot_count()); }
+
+    size_t size() const
+    { return m_size; }
+    bool empty() const
+    { return m_size == 0; }
+
+    iterator find(const bits<>& key)
+    {
+        slot* s = find_slot(fold(key), key);
+        return s ? iterator(s, slots() + slot_count()) : end();
+    }
+
+    const_iterator find(const bits<>& key) const
+    {
+        auto s = const_cast<case_map*>(this)->find_slot(fold(key), key);
+        return s ? const_iterator(s, slots() + slot_count()) : end();
+    }
+
+    size_t count(const bits<>& key) const
+    { return find(key) != end() ? 1 : 0; }
+
+    template<class... Args>
+    std::pair<iterator, bool> emplace(const bits<>& key, Args&&... args)
+    {
+        uint64_t folded = fold(key);
+        if (slot* s = find_slot(folded, key))
+            return {iterator(s, slots() + slot_count()), false};
+
+        allocator alloc;
+        value_type* entry = alloc.allocate(1);
+        try {
+            new (entry) value_type(std::piecewise_construct,
+                                   std::forward_as_tuple(key),
+                                   std::forward_as_tuple(
+                                       std::forward<Args>(args)...));
+        } catch (...) {
+            alloc.deallocate(entry, 1);
+            throw;
+        }
+
+        slot* s = insert_slot(folded, entry);
+        return {iterator(s, slots() + slot_count()), true};
+    }
+
+    V& operator[](const bits<>& key)
+    { return emplace(key).first->second; }
+
+    V& at(const bits<>& key)
+    {
+        auto it = find(key);
+        if (it == end())
+            throw std::out_of_range("case_map::at");
+        return it->second;
+    }
+
+    const V& at(const bits<>& key) const
+    {
+        auto it = find(key);
+        if (it == end())
+            throw std::out_of_range("case_map::at");
+        return it->second;
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        slot* s = const_cast<slot*>(pos.m_pos);
+        destroy(s->entry);
+        --m_size;
+        if (m_table) {
+            s->entry = tombstone();
+            return iterator(s, slots() + slot_count());
+        }
+        std::move(s + 1, m_small.data() + m_size + 1, s);
+        return iterator(s, slots() + slot_count());
+    }
+
+    size_t erase(const bits<>& key)
+    {
+        auto it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < slot_count(); ++i) {
+            if (is_used(slots()[i]))
+                destroy(slots()[i].entry);
+        }
+        m_table.reset();
+        m_capacity = m_size = m_used = 0;
+    }
+
+private:
+    static void destroy(value_type* entry)
+    {
+        entry->~value_type();
+        allocator().deallocate(entry, 1);
+    }
+
+    slot* find_slot(uint64_t key, const bits<>& full)
+    {
+        if (not m_table) {
+            slot* first = m_small.data();
+            slot* last = first + m_size;
+            slot* it = std::lower_bound(first, last, key,
+                [](const slot& s, uint64_t k) { return s.key < k; });
+            for (; it != last && it->key == key; ++it) {
+                if (matches(*it, key, full))
+                    return it;
+            }
+            return nullptr;
+        }
+
+        size_t mask = m_capacity - 1;
+        for (size_t i = mix(key) & mask; ; i = (i + 1) & mask) {
+            slot& s = m_table[i];
+            if (s.entry == nullptr)
+                return nullptr;
+            if (s.entry != tombstone() && matches(s, key, full))
+                return &s;
+        }
+    }
+
+    slot* insert_slot(uint64_t key, value_type* entry)
+    {
+        if (not m_table && m_size < small_size) {
+            slot* first = m_small.data();
+            slot* last = first + m_size;
+            slot* it = std::upper_bound(first, last, key,
+                [](uint64_t k, const slot& s) { return k < s.key; });
+            std::move_backward(it, last, last + 1);
+            *it = slot{key, entry};
+            ++m_size;
+            return it;
+        }
+
+        // keep load factor (with tombstones) below 3/4
+        if (not m_table || (m_used + 1) * 4 > m_capacity * 3) {
+            size_t capacity = small_size * 2;
+            while ((m_size + 1) * 2 > capacity)
+                capacity *= 2;
+            rehash(capacity);
+        }
+
+        size_t mask = m_capacity - 1;
+        size_t i = mix(key) & mask;
+        while (is_used(m_table[i]))
+            i = (i + 1) & mask;
+        if (m_table[i].entry == nullptr)
+            ++m_used;
+        m_table[i] = slot{key, entry};
+        ++m_size;
+        return &m_table[i];
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::unique_ptr<slot[]> table(new slot[capacity]());
+        size_t mask = capacity - 1;
+        for (size_t j = 0; j < slot_count(); ++j) {
+            const slot& s = slots()[j];
+            if (not is_used(s))
+                continue;
+            size_t i = mix(s.key) & mask;
+            while (table[i].entry != nullptr)
+                i = (i + 1) & mask;
+            table[i] = s;
+        }
+        m_table = std::move(table);
+        m_capacity = capacity;
+        m_used = m_size;
+    }
+};
+
+} // namespace runos
@@ -0,0 +1,98 @@
+#include "latency.hh"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace runos {
+namespace latency {
+
+namespace {
+
+struct Recorder {
+    std::array<concurrent_histogram, stage_count> stages;
+};
+
+// Recorders are never freed: controller threads live as long as the
+// process, and counts of finished threads should stay in the snapshot.
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Recorder>> recorders;
+};
+
+Registry& registry()
+{
+    static Registry ret;
+    return ret;
+}
+
+std::atomic_bool is_enabled {true};
+
+Recorder& local()
+{
+    thread_local Recorder* ret = nullptr;
+    if (ret == nullptr) {
+        auto& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.recorders.emplace_back(new Recorder());
+        ret = reg.recorders.back().get();
+    }
+    return *ret;
+}
+
+} // namespace
+
+const char* to_string(Stage stage)
+{
+    switch (stage) {
+    case Stage::Parse: return "parse";
+    case Stage::Lookup: return "lookup";
+    case Stage::Execute: return "execute";
+    case Stage::Augment: return "augment";
+    case Stage::Install: return "install";
+    case Stage::Total: return "total";
+    }
+    return "unknown";
+}
+
+bool enabled()
+{
+    return is_enabled.load(std::memory_order_relaxed);
+}
+
+void enable(bool on)
+{
+    is_enabled.store(on, std::memory_order_relaxed);
+}
+
+void record(Stage stage, uint64_t ns)
+{
+    local().stages[static_cast<size_t>(stage)].record(ns);
+}
+
+Snapshot snapshot()
+{
+    Snapshot ret;
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& rec : reg.recorders) {
+        for (size_t i = 0; i < stage_count; ++i) {
+            ret[i].merge(rec->stages[i]);
+        }
+    }
+    return ret;
+}
+
+void reset()
+{
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& rec : reg.recorders) {
+        for (auto& h : rec->stages) {
+            h.clear();
+        }
+    }
+}
+
+} // namespace latency
+} // namespace runos
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace runos {
+namespace latency {
+
+/**
+ * Log-linear histogram of nanosecond values in the spirit of HdrHistogram.
+ *
+ * Values below 2^sub_bits are counted exactly, every next power of two
+ * is split into 2^sub_bits equal buckets, so relative error of reported
+ * values is below 2^-sub_bits (~3%). Values above `max_value` are clamped.
+ *
+ * `Counter` is either uint64_t or std::atomic<uint64_t>. The latter is
+ * used by per-thread recorders: a single thread records, others may read
+ * at any time without locks.
+ */
+template<class Counter>
+class basic_histogram {
+public:
+    static constexpr unsigned sub_bits = 5;
+    static constexpr unsigned max_bits = 36; // ~68 seconds
+    static constexpr uint64_t max_value = (uint64_t(1) << max_bits) - 1;
+    static constexpr size_t bucket_count =
+        size_t(max_bits - sub_bits + 1) << sub_bits;
+
+    static size_t bucket(uint64_t value)
+    {
+        if (value > max_value)
+            value = max_value;
+        if (value < (uint64_t(1) << sub_bits))
+            return size_t(value);
+        unsigned msb = 63 - __builtin_clzll(value);
+        unsigned shift = msb - sub_bits;
+        return (size_t(shift + 1) << sub_bits) |
+               size_t((value >> shift) & ((1u << sub_bits) - 1));
+    }
+
+    static uint64_t lowest(size_t bucket)
+    {
+        if (bucket < (size_t(1) << sub_bits))
+            return bucket;
+        unsigned shift = unsigned(bucket >> sub_bits) - 1;
+        uint64_t mantissa = (bucket & ((1u << sub_bits) - 1)) | (1u << sub_bits);
+        return mantissa << shift;
+    }
+
+    static uint64_t highest(size_t bucket)
+    {
+        if (bucket < (size_t(1) << sub_bits))
+            return bucket;
+        unsigned shift = unsigned(bucket >> sub_bits) - 1;
+        return lowest(bucket) + (uint64_t(1) << shift) - 1;
+    }
+
+    void record(uint64_t value)
+    {
+        add(m_counts[bucket(value)], 1);
+        add(m_count, 1);
+        add(m_sum, value);
+    }
+
+    template<class C>
+    void merge(const basic_histogram<C>& other)
+    {
+        for (size_t i = 0; i < bucket_count; ++i) {
+            add(m_counts[i], other.at(i));
+        }
+        add(m_count, other.count());
+        add(m_sum, other.sum());
+    }
+
+    void clear()
+    {
+        for (auto& c : m_counts) {
+            set(c, 0);
+        }
+        set(m_count, 0);
+        set(m_sum, 0);
+    }
+
+    uint64_t at(size_t bucket) const
+    { return get(m_counts[bucket]); }
+
+    uint64_t count() const
+    { return get(m_count); }
+
+    uint64_t sum() const
+    { return get(m_sum); }
+
+    double mean() const
+    { return count() ? double(sum()) / count() : 0.0; }
+
+    uint64_t min() const
+    {
+        for (size_t i = 0; i < bucket_count; ++i) {
+            if (at(i) != 0)
+                return lowest(i);
+        }
+        return 0;
+    }
+
+    uint64_t max() const
+    {
+        for (size_t i = bucket_count; i-- > 0; ) {
+            if (at(i) != 0)
+                return highest(i);
+        }
+        return 0;
+    }
+
+    /** Highest value equivalent to `q`-quantile, `q` in [0, 1] */
+    uint64_t quantile(double q) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+            return 0;
+        uint64_t rank = uint64_t(q * total + 0.5);
+        if (rank == 0)
+            rank = 1;
+        if (rank > total)
+            rank = total;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += at(i);
+            if (seen >= rank)
+                return highest(i);
+        }
+        return max();
+    }
+
+private:
+    std::array<Counter, bucket_count> m_counts {};
+    Counter m_count {};
+    Counter m_sum {};
+
+    static void add(uint64_t& c, uint64_t v)
+    { c += v; }
+    static void add(std::atomic<uint64_t>& c, uint64_t v)
+    { c.fetch_add(v, std::memory_order_relaxed); }
+
+    static void set(uint64_t& c, uint64_t v)
+    { c = v; }
+    static void set(std::atomic<uint64_t>& c, uint64_t v)
+    { c.store(v, std::memory_order_relaxed); }
+
+    static uint64_t get(const uint64_t& c)
+    { return c; }
+    static uint64_t get(const std::atomic<uint64_t>& c)
+    { return c.load(std::memory_order_relaxed); }
+};
+
+using histogram = basic_histogram<uint64_t>;
+using concurrent_histogram = basic_histogram<std::atomic<uint64_t>>;
+
+/**
+ * Stages of packet-in processing.
+ * Stages may nest: e.g. policy execution is a part of augmentation.
+ */
+enum class Stage : uint8_t {
+    Parse,   // PacketParser construction
+    Lookup,  // trace tree or fdd lookup
+    Execute, // user policy execution
+    Augment, // trace tree augmentation
+    Install, // flow-mod and group-mod emission of a packet-in
+    Total    // whole packet-in handler
+};
+
+constexpr size_t stage_count = 6;
+
+const char* to_string(Stage stage);
+
+using Snapshot = std::array<histogram, stage_count>; // indexed by Stage
+
+bool enabled();
+void enable(bool on);
+
+/**
+ * Records `ns` into the histogram of the calling thread.
+ * Aggregation happens only in snapshot().
+ */
+void record(Stage stage, uint64_t ns);
+
+/** Sums histograms of all threads */
+Snapshot snapshot();
+
+void reset();
+
+/**
+ * Records lifetime of the scope into `stage`.
+ */
+class Timer {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit Timer(Stage stage)
+        : m_stage(stage)
+        , m_active(enabled())
+    {
+        if (m_active)
+            m_start = clock::now();
+    }
+
+    ~Timer()
+    { stop(); }
+
+    /** Records elapsed time now instead of at the end of the scope */
+    void stop()
+    {
+        if (m_active) {
+            auto elapsed = clock::now() - m_start;
+            record(m_stage, std::chrono::duration_cast<
+                       std::chrono::nanoseconds>(elapsed).count());
+            m_active = false;
+        }
+    }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+private:
+    const Stage m_stage;
+    bool m_active;
+    clock::time_point m_start;
+};
+
+} // namespace latency
+} // namespace runos
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <unordered_map>
+
+namespace runos {
+
+/**
+ * Keys ordered by last use, O(1) touch and erase.
+ * Not thread-safe.
+ */
+template<class Key, class Hash = std::hash<Key>>
+class lru_order {
+public:
+    /** Makes `key` the most recently used, adds it if needed */
+    void touch(const Key& key)
+    {
+        auto it = m_pos.find(key);
+        if (it != m_pos.end()) {
+            m_keys.splice(m_keys.begin(), m_keys, it->second);
+        } else {
+            m_keys.push_front(key);
+            m_pos.emplace(key, m_keys.begin());
+        }
+    }
+
+    /** @return false if there is no `key` */
+    bool erase(const Key& key)
+    {
+        auto it = m_pos.find(key);
+        if (it == m_pos.end())
+            return false;
+        m_keys.erase(it->second);
+        m_pos.erase(it);
+        return true;
+    }
+
+    /** The least recently used key, the order must not be empty */
+    const Key& coldest() const
+    { return m_keys.back(); }
+
+    bool empty() const
+    { return m_keys.empty(); }
+
+    size_t size() const
+    { return m_keys.size(); }
+
+private:
+    // the coldest are at the back
+    std::list<Key> m_keys;
+    std::unordered_map<Key, typename std::list<Key>::iterator, Hash> m_pos;
+};
+
+} // namespace runos
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace runos {
+
+/**
+ * Unbounded lock-free FIFO queue with many producers and one consumer
+ * (Vyukov's intrusive queue).
+ *
+ * push() is wait-free: one exchange of the head and one store. pop()
+ * must be called by one thread at a time; it may return false while a
+ * push is half done, the element is popped by one of the next calls.
+ * Elements pushed by one thread are popped in the order they were pushed.
+ */
+template<class T>
+class mpsc_queue {
+    struct link {
+        std::atomic<link*> next {nullptr};
+    };
+
+    struct node : link {
+        explicit node(T&& value)
+            : value(std::move(value))
+        { }
+        T value;
+    };
+
+public:
+    mpsc_queue()
+        : m_head(&m_stub)
+        , m_tail(&m_stub)
+    { }
+
+    ~mpsc_queue()
+    {
+        T value;
+        while (pop(value)) { }
+    }
+
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    /// Any thread
+    void push(T value)
+    {
+        push(new node(std::move(value)));
+    }
+
+    /// Consumer thread only, false if nothing to pop
+    bool pop(T& value)
+    {
+        link* tail = m_tail;
+        link* next = tail->next.load(std::memory_order_acquire);
+
+        if (tail == &m_stub) {
+            if (next == nullptr)
+                return false;
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next == nullptr) {
+            // tail is the last element unless a producer is linking it
+            if (tail != m_head.load(std::memory_order_acquire))
+                return false;
+            push(&m_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if (next == nullptr)
+                return false;
+        }
+
+        m_tail = next;
+        node* n = static_cast<node*>(tail);
+        value = std::move(n->value);
+        delete n;
+        return true;
+    }
+
+private:
+    std::atomic<link*> m_head; // the last pushed, producers side
+    link* m_tail;              // the next to pop, consumer side
+    link m_stub;
+
+    void push(link* l)
+    {
+        l->next.store(nullptr, std::memory_order_relaxed);
+        link* prev = m_head.exchange(l, std::memory_order_acq_rel);
+        prev->next.store(l, std::memory_order_release);
+    }
+};
+
+} // namespace runos
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace runos {
+
+/** Reference to a node of node_arena<T>, a parent keeps it for a child */
+template<class T>
+struct node_ref {
+    uint32_t index;
+
+    friend bool operator==(node_ref lhs, node_ref rhs)
+    { return lhs.index == rhs.index; }
+    friend bool operator!=(node_ref lhs, node_ref rhs)
+    { return lhs.index != rhs.index; }
+};
+
+/**
+ * Storage of tree nodes of one type, owned by the tree.
+ *
+ * Nodes are addressed by 32-bit indices, so children are referenced
+ * by node_ref<T> instead of owning pointers and the tree doesn't free
+ * them one by one. Nodes are placed one after another in blocks of
+ * `BlockSize` nodes, which never move: pointers to a node stay valid
+ * until it is erased. Slots of erased nodes are reused.
+ *
+ * clear() and the destructor destroy remaining nodes in one pass
+ * over the blocks, without walking the tree, and return the blocks
+ * to the system.
+ *
+ * Not thread-safe.
+ */
+template<class T, size_t BlockSize = 1024>
+class node_arena {
+    static_assert((BlockSize & (BlockSize - 1)) == 0,
+                  "BlockSize must be a power of two");
+
+    static constexpr uint32_t npos = uint32_t(-1);
+
+    union slot {
+        T value;
+        uint32_t next_free;
+
+        slot() : next_free(npos) { }
+        ~slot() { }
+    };
+
+    std::vector<std::unique_ptr<slot[]>> m_blocks;
+    std::vector<uint64_t> m_live; // bit per slot
+    uint32_t m_free = npos;       // list of erased slots
+    uint32_t m_end = 0;           // slots below were used
+    size_t m_size = 0;
+
+    slot& at(uint32_t index)
+    { return m_blocks[index / BlockSize][index % BlockSize]; }
+    const slot& at(uint32_t index) const
+    { return m_blocks[index / BlockSize][index % BlockSize]; }
+
+    bool live(uint32_t index) const
+    { return m_live[index / 64] >> (index % 64) & 1; }
+    void set_live(uint32_t index, bool value)
+    {
+        uint64_t bit = uint64_t(1) << (index % 64);
+        if (value)
+            m_live[index / 64] |= bit;
+        else
+            m_live[index / 64] &= ~bit;
+    }
+
+    uint32_t take()
+    {
+        if (m_free != npos) {
+            uint32_t ret = m_free;
+            m_free = at(ret).next_free;
+            return ret;
+        }
+        if (m_end == m_blocks.size() * BlockSize) {
+            if (m_end + BlockSize - 1 >= npos)
+                throw std::bad_alloc();
+            m_blocks.emplace_back(new slot[BlockSize]);
+            m_live.resize(m_blocks.size() * BlockSize / 64 + 1);
+        }
+        return m_end++;
+    }
+
+public:
+    using value_type = T;
+    using reference = node_ref<T>;
+    static constexpr size_t block_size = BlockSize;
+
+    node_arena() = default;
+    node_arena(const node_arena&) = delete;
+    node_arena& operator=(const node_arena&) = delete;
+
+    ~node_arena()
+    { clear(); }
+
+    template<class... Args>
+    reference emplace(Args&&... args)
+    {
+        uint32_t index = take();
+        slot& s = at(index);
+        try {
+            new (&s.value) T{std::forward<Args>(args)...};
+        } catch (...) {
+            s.next_free = m_free;
+            m_free = index;
+            throw;
+        }
+        set_live(index, true);
+        m_size++;
+        return reference{index};
+    }
+
+    /** Destroys the node, its children aren't touched */
+    void erase(reference ref)
+    {
+        slot& s = at(ref.index);
+        s.value.~T();
+        s.next_free = m_free;
+        m_free = ref.index;
+        set_live(ref.index, false);
+        m_size--;
+    }
+
+    T& operator[](reference ref)
+    { return at(ref.index).value; }
+    const T& operator[](reference ref) const
+    { return at(ref.index).value; }
+
+    /** Destroys all nodes and frees memory */
+    void clear()
+    {
+        for (uint32_t word = 0; word < m_live.size(); word++) {
+            for (uint64_t bits = m_live[word]; bits != 0; bits &= bits - 1) {
+                uint32_t index = word * 64 + __builtin_ctzll(bits);
+                at(index).value.~T();
+            }
+        }
+        m_blocks.clear();
+        m_blocks.shrink_to_fit();
+        m_live.clear();
+        m_live.shrink_to_fit();
+        m_free = npos;
+        m_end = 0;
+        m_size = 0;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    /** Bytes taken from the system */
+    size_t capacity_bytes() const
+    { return m_blocks.size() * BlockSize * sizeof(slot); }
+};
+
+} // namespace runos
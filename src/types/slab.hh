@@ -0,0 +1,347 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+namespace runos {
+
+/**
+ * Pool of fixed-size chunks for small, frequently allocated objects
+ * such as tree nodes.
+ *
+ * Every thread carves chunks from its own 64 KiB slabs by bumping a
+ * pointer and keeps free chunks in lists of their slabs, so allocation
+ * takes no locks. A chunk freed by another thread goes back to its
+ * owner: slabs are aligned to their size and start with a header
+ * pointing to the owner, which takes such chunks from a lock-free list
+ * on the next allocation. A slab with no allocated chunks is returned
+ * to the system, except the last one of its thread with free chunks.
+ * Slabs of an exited thread are adopted by the next new thread.
+ */
+template<size_t Size, size_t Align>
+class slab_pool {
+    union chunk {
+        chunk* next;
+        alignas(Align) unsigned char storage[Size];
+    };
+
+    struct local;
+
+    struct header {
+        local* owner;
+        // slabs of the owner with free chunks
+        header* prev = nullptr;
+        header* next = nullptr;
+        bool has_room = false;
+        chunk* free = nullptr;
+        size_t carved = 0; // chunks taken by bumping
+        size_t live = 0;   // allocated chunks
+
+        explicit header(local* owner)
+            : owner(owner)
+        { }
+    };
+
+    static constexpr size_t slab_size = 64 * 1024;
+    static constexpr size_t first_chunk =
+        (sizeof(header) + alignof(chunk) - 1) / alignof(chunk) * alignof(chunk);
+    static constexpr size_t chunks_per_slab =
+        first_chunk + sizeof(chunk) < slab_size
+            ? (slab_size - first_chunk) / sizeof(chunk) : 1;
+
+    static std::atomic<size_t>& slabs()
+    {
+        static std::atomic<size_t> ret {0};
+        return ret;
+    }
+
+    static chunk* chunk_at(header* h, size_t i) noexcept
+    {
+        return reinterpret_cast<chunk*>(
+            reinterpret_cast<unsigned char*>(h) + first_chunk) + i;
+    }
+
+    struct local {
+        header* room = nullptr; // owner thread only
+        std::atomic<chunk*> remote {nullptr}; // freed by other threads
+        local* next_abandoned = nullptr;
+
+        void link(header* h) noexcept
+        {
+            h->prev = nullptr;
+            h->next = room;
+            if (room)
+                room->prev = h;
+            room = h;
+            h->has_room = true;
+        }
+
+        void unlink(header* h) noexcept
+        {
+            if (h->prev)
+                h->prev->next = h->next;
+            else
+                room = h->next;
+            if (h->next)
+                h->next->prev = h->prev;
+            h->prev = h->next = nullptr;
+            h->has_room = false;
+        }
+
+        header* grow()
+        {
+            void* slab = ::operator new(first_chunk + chunks_per_slab * sizeof(chunk),
+                                        std::align_val_t(slab_size));
+            slabs().fetch_add(1, std::memory_order_relaxed);
+            header* h = new (slab) header{this};
+            link(h);
+            return h;
+        }
+
+        void* allocate()
+        {
+            if (remote.load(std::memory_order_relaxed) != nullptr) {
+                // takes the whole list, so there is no ABA
+                chunk* c = remote.exchange(nullptr, std::memory_order_acquire);
+                while (c) {
+                    chunk* next = c->next;
+                    release(c);
+                    c = next;
+                }
+            }
+
+            header* h = room ? room : grow();
+            chunk* ret;
+            if (h->free) {
+                ret = h->free;
+                h->free = ret->next;
+            } else {
+                ret = chunk_at(h, h->carved++);
+            }
+            h->live++;
+            if (h->free == nullptr && h->carved == chunks_per_slab)
+                unlink(h);
+            return ret;
+        }
+
+        // owner thread only
+        void release(chunk* c) noexcept
+        {
+            header* h = owner_of(c);
+            c->next = h->free;
+            h->free = c;
+            h->live--;
+            if (not h->has_room)
+                link(h);
+            if (h->live == 0 && (h->prev || h->next)) {
+                // other slab has room, this one isn't needed
+                unlink(h);
+                h->~header();
+                ::operator delete(h, std::align_val_t(slab_size));
+                slabs().fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        void push_remote(chunk* c) noexcept
+        {
+            chunk* head = remote.load(std::memory_order_relaxed);
+            do {
+                c->next = head;
+            } while (not remote.compare_exchange_weak(head, c,
+                                                      std::memory_order_release,
+                                                      std::memory_order_relaxed));
+        }
+    };
+
+    static header* owner_of(chunk* c) noexcept
+    {
+        auto slab = reinterpret_cast<uintptr_t>(c) & ~uintptr_t(slab_size - 1);
+        return reinterpret_cast<header*>(slab);
+    }
+
+    struct registry {
+        std::mutex mutex;
+        local* abandoned = nullptr;
+    };
+
+    static registry& reg()
+    {
+        static registry* ret = new registry; // used until the last thread exits
+        return *ret;
+    }
+
+    static local* adopt()
+    {
+        registry& r = reg();
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            if (local* ret = r.abandoned) {
+                r.abandoned = ret->next_abandoned;
+                return ret;
+            }
+        }
+        return new local;
+    }
+
+    static void abandon(local* l)
+    {
+        registry& r = reg();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        l->next_abandoned = r.abandoned;
+        r.abandoned = l;
+    }
+
+    // trivially destructible, valid during the whole thread life
+    static local*& current()
+    {
+        static thread_local local* ret = nullptr;
+        return ret;
+    }
+
+    static bool& exited()
+    {
+        static thread_local bool ret = false;
+        return ret;
+    }
+
+    struct reaper {
+        ~reaper()
+        {
+            abandon(current());
+            current() = nullptr;
+            exited() = true;
+        }
+    };
+
+public:
+    static void* allocate()
+    {
+        if (local* l = current())
+            return l->allocate();
+
+        if (exited()) {
+            // destructors of other thread-locals allocate
+            local* l = adopt();
+            void* ret = l->allocate();
+            abandon(l);
+            return ret;
+        }
+
+        static thread_local reaper r;
+        (void) r;
+        current() = adopt();
+        return current()->allocate();
+    }
+
+    static void deallocate(void* p) noexcept
+    {
+        if (p == nullptr)
+            return;
+        chunk* c = static_cast<chunk*>(p);
+        local* owner = owner_of(c)->owner;
+        if (owner == current()) {
+            owner->release(c);
+        } else {
+            owner->push_remote(c);
+        }
+    }
+
+    /** Slabs taken from the system by pools of this size */
+    static size_t slab_count() noexcept
+    {
+        return slabs().load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Class-specific allocation functions backed by slab_pool.
+ * Keeps `T` an aggregate, usage:
+ *
+ *     struct node {
+ *         ...
+ *         static void* operator new(size_t size)
+ *         { return slab<node>::allocate(size); }
+ *         static void operator delete(void* p, size_t size)
+ *         { slab<node>::deallocate(p, size); }
+ *     };
+ *
+ * Sizes other than sizeof(T) (derived classes) use the global heap.
+ */
+template<class T>
+struct slab {
+    using pool = slab_pool<sizeof(T), alignof(T)>;
+
+    static void* allocate(size_t size)
+    {
+        if (size != sizeof(T))
+            return ::operator new(size);
+        return pool::allocate();
+    }
+
+    static void deallocate(void* p, size_t size) noexcept
+    {
+        if (size != sizeof(T))
+            ::operator delete(p);
+        else
+            pool::deallocate(p);
+    }
+};
+
+/**
+ * Standard allocator taking single objects from slab_pool.
+ * Suitable for node-based containers: their nodes come from the pool,
+ * arrays (e.g. hash buckets) from the global heap.
+ */
+template<class T>
+struct slab_allocator {
+    using value_type = T;
+
+    slab_allocator() noexcept = default;
+    template<class U>
+    slab_allocator(const slab_allocator<U>&) noexcept
+    { }
+
+    T* allocate(size_t n)
+    {
+        if (n == 1)
+            return static_cast<T*>(slab_pool<sizeof(T), alignof(T)>::allocate());
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        if (n == 1)
+            slab_pool<sizeof(T), alignof(T)>::deallocate(p);
+        else
+            ::operator delete(p);
+    }
+
+    template<class U>
+    friend bool operator==(const slab_allocator&, const slab_allocator<U>&)
+    { return true; }
+    template<class U>
+    friend bool operator!=(const slab_allocator&, const slab_allocator<U>&)
+    { return false; }
+};
+
+} // namespace runos
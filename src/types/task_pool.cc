@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "task_pool.hh"
+
+#include <chrono>
+
+namespace runos {
+
+namespace {
+
+struct binding {
+    const task_pool* pool = nullptr;
+    size_t queue = 0;
+};
+
+binding& current()
+{
+    thread_local binding ret;
+    return ret;
+}
+
+} // namespace
+
+task_pool::task_pool(size_t threads)
+{
+    for (size_t i = 0; i < threads + 1; ++i) {
+        m_queues.emplace_back(new queue());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        m_workers.emplace_back(&task_pool::work, this, i);
+    }
+}
+
+task_pool::~task_pool()
+{
+    m_stop = true;
+    {
+        std::lock_guard<std::mutex> lock(m_idle_mutex);
+        m_idle.notify_all();
+    }
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+task_pool::participant::participant(task_pool& pool)
+    : m_pool(pool)
+    , m_external(current().pool != &pool)
+{
+    if (m_external) {
+        m_pool.m_external.lock();
+        current() = binding{&pool, pool.m_queues.size() - 1};
+    }
+    m_queue = current().queue;
+}
+
+task_pool::participant::~participant()
+{
+    if (m_external) {
+        current() = binding{};
+        m_pool.m_external.unlock();
+    }
+}
+
+void task_pool::push(size_t self, task& t)
+{
+    ++m_pending;
+    {
+        std::lock_guard<std::mutex> lock(m_queues[self]->mutex);
+        m_queues[self]->tasks.push_back(&t);
+    }
+    m_idle.notify_one();
+}
+
+bool task_pool::pop(size_t self, task& t)
+{
+    std::lock_guard<std::mutex> lock(m_queues[self]->mutex);
+    auto& tasks = m_queues[self]->tasks;
+    // nested forks are joined before, so `t` is on the back unless stolen
+    if (tasks.empty() || tasks.back() != &t)
+        return false;
+    tasks.pop_back();
+    --m_pending;
+    return true;
+}
+
+bool task_pool::steal(size_t self)
+{
+    for (size_t i = 1; i < m_queues.size(); ++i) {
+        auto& victim = *m_queues[(self + i) % m_queues.size()];
+        task* t = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.empty())
+                continue;
+            t = victim.tasks.front();
+            victim.tasks.pop_front();
+        }
+        --m_pending;
+        execute(*t);
+        return true;
+    }
+    return false;
+}
+
+void task_pool::wait(size_t self, task& t)
+{
+    while (not t.done.load(std::memory_order_acquire)) {
+        if (not steal(self)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void task_pool::work(size_t self)
+{
+    current() = binding{this, self};
+    while (not m_stop) {
+        if (steal(self))
+            continue;
+        std::unique_lock<std::mutex> lock(m_idle_mutex);
+        m_idle.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+            return m_stop || m_pending > 0;
+        });
+    }
+}
+
+void task_pool::execute(task& t)
+{
+    try {
+        t.run(t.arg);
+    } catch (...) {
+        t.error = std::current_exception();
+    }
+    t.done.store(true, std::memory_order_release);
+}
+
+} // namespace runos
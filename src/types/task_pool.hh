@@ -0,0 +1,146 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace runos {
+
+/**
+ * Fork-join pool of worker threads with work stealing, for divide and
+ * conquer computations such as compilation of policy terms.
+ *
+ * Every participating thread has a deque of forked tasks: the owner
+ * pushes and pops them at the back, idle threads steal from the front,
+ * so the oldest (usually the biggest) tasks are stolen. A thread waiting
+ * for a stolen task runs stolen tasks meanwhile, so nested invoke()
+ * never blocks a worker.
+ *
+ * Threads outside of the pool take part in the computation while they
+ * are in invoke(), one of them at a time.
+ */
+class task_pool {
+public:
+    /// `threads` workers besides the calling thread,
+    /// with 0 invoke() runs everything on the calling thread
+    explicit task_pool(size_t threads);
+    ~task_pool();
+
+    task_pool(const task_pool&) = delete;
+    task_pool& operator=(const task_pool&) = delete;
+
+    /// Number of threads taking part in invoke(), the caller included
+    size_t concurrency() const
+    { return m_workers.size() + 1; }
+
+    /**
+     * Runs `a` and `b`, possibly in parallel, and returns when both
+     * are done. `b` runs on the calling thread. If any of them throws,
+     * the exception is rethrown after both are finished.
+     */
+    template<class A, class B>
+    void invoke(A&& a, B&& b)
+    {
+        if (m_workers.empty()) {
+            b();
+            a();
+            return;
+        }
+
+        using function = std::remove_reference_t<A>;
+        task forked;
+        forked.run = [](void* f) { (*static_cast<function*>(f))(); };
+        forked.arg = const_cast<void*>(static_cast<const void*>(&a));
+
+        participant self(*this);
+        push(self.queue(), forked);
+
+        std::exception_ptr error;
+        try {
+            b();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        if (pop(self.queue(), forked)) {
+            execute(forked);
+        } else {
+            wait(self.queue(), forked);
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+        if (forked.error)
+            std::rethrow_exception(forked.error);
+    }
+
+private:
+    struct task {
+        void (*run)(void*) = nullptr;
+        void* arg = nullptr;
+        std::atomic_bool done {false};
+        std::exception_ptr error;
+    };
+
+    struct queue {
+        std::mutex mutex;
+        std::deque<task*> tasks;
+    };
+
+    // Binds the calling thread to its queue while it is in invoke()
+    class participant {
+    public:
+        explicit participant(task_pool& pool);
+        ~participant();
+        size_t queue() const
+        { return m_queue; }
+    private:
+        task_pool& m_pool;
+        size_t m_queue;
+        bool m_external;
+    };
+
+    // queue of worker N, the last one is used by an external thread
+    std::vector<std::unique_ptr<queue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::mutex m_external;
+
+    std::atomic_bool m_stop {false};
+    std::atomic<size_t> m_pending {0};
+    std::mutex m_idle_mutex;
+    std::condition_variable m_idle;
+
+    void push(size_t self, task& t);
+    bool pop(size_t self, task& t);
+    bool steal(size_t self);
+    void wait(size_t self, task& t);
+    void work(size_t self);
+
+    static void execute(task& t);
+};
+
+} // namespace runos
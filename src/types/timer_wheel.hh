@@ -0,0 +1,174 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace runos {
+
+/**
+ * Hierarchical timer wheel keyed by `Key`.
+ *
+ * Time is measured in abstract ticks. Level `L` has 64 slots
+ * each spanning 64^L ticks, timers are moved to lower levels when
+ * their slot comes close (cascading), so schedule, cancel and expiry
+ * of a timer are O(1) amortized.
+ *
+ * A key has at most one pending timer, scheduling it again replaces
+ * the previous deadline. Callbacks of `advance()` may schedule and
+ * cancel timers, including ones expiring at the same tick.
+ */
+template<class Key, class Hash = std::hash<Key>>
+class timer_wheel {
+public:
+    using tick_type = uint64_t;
+
+    static constexpr unsigned slot_bits = 6;
+    static constexpr unsigned levels = 4;
+    static constexpr tick_type slots = tick_type(1) << slot_bits;
+    static constexpr tick_type max_delay =
+        (tick_type(1) << (slot_bits * levels)) - 1;
+
+    explicit timer_wheel(tick_type now = 0)
+        : m_next(now + 1)
+    { }
+
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+    /** Last processed tick */
+    tick_type now() const
+    { return m_next - 1; }
+
+    size_t size() const
+    { return m_index.size(); }
+
+    bool empty() const
+    { return m_index.empty(); }
+
+    bool scheduled(const Key& key) const
+    { return m_index.count(key) != 0; }
+
+    /**
+     * Schedules timer for `key` at `deadline` tick.
+     * Deadlines in the past expire on the next tick,
+     * too distant ones are clamped to `max_delay`.
+     */
+    void schedule(const Key& key, tick_type deadline)
+    {
+        cancel(key);
+        if (deadline < m_next)
+            deadline = m_next;
+        if (deadline - m_next > max_delay)
+            deadline = m_next + max_delay;
+
+        auto& slot = slotFor(deadline);
+        auto pos = slot.insert(slot.end(), key);
+        m_index.emplace(key, Entry{deadline, &slot, pos});
+    }
+
+    /** @return false if there was no timer for `key` */
+    bool cancel(const Key& key)
+    {
+        auto it = m_index.find(key);
+        if (it == m_index.end())
+            return false;
+        it->second.slot->erase(it->second.pos);
+        m_index.erase(it);
+        return true;
+    }
+
+    /**
+     * Processes ticks up to `to` (inclusive) calling `fn(key)`
+     * for every expired timer in deadline order.
+     */
+    template<class F>
+    void advance(tick_type to, F&& fn)
+    {
+        while (m_next <= to) {
+            const tick_type t = m_next;
+
+            for (unsigned level = 1; level < levels; ++level) {
+                if (index(t, level - 1) != 0)
+                    break;
+                cascade(m_wheel[level][index(t, level)]);
+            }
+
+            m_next = t + 1;
+
+            // detach slot, so timers rescheduled by fn don't refire
+            std::list<Key> expired;
+            expired.splice(expired.end(), m_wheel[0][index(t, 0)]);
+            for (auto& key : expired)
+                m_index.at(key).slot = &expired;
+
+            while (not expired.empty()) {
+                Key key = std::move(expired.front());
+                expired.pop_front();
+                m_index.erase(key);
+                fn(key);
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        tick_type deadline;
+        std::list<Key>* slot;
+        typename std::list<Key>::iterator pos;
+    };
+
+    using Slots = std::array<std::list<Key>, slots>;
+
+    std::array<Slots, levels> m_wheel;
+    std::unordered_map<Key, Entry, Hash> m_index;
+    tick_type m_next; // first unprocessed tick
+
+    static size_t index(tick_type t, unsigned level)
+    { return (t >> (slot_bits * level)) & (slots - 1); }
+
+    std::list<Key>& slotFor(tick_type deadline)
+    {
+        tick_type delta = deadline - m_next;
+        unsigned level = 0;
+        while (level + 1 < levels &&
+               delta >= (tick_type(1) << (slot_bits * (level + 1))))
+            ++level;
+        return m_wheel[level][index(deadline, level)];
+    }
+
+    void cascade(std::list<Key>& slot)
+    {
+        std::list<Key> moved;
+        moved.splice(moved.end(), slot);
+        while (not moved.empty()) {
+            auto& entry = m_index.at(moved.front());
+            auto& target = slotFor(entry.deadline);
+            target.splice(target.end(), moved, moved.begin());
+            entry.slot = &target;
+            entry.pos = std::prev(target.end());
+        }
+    }
+};
+
+} // namespace runos
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// Minimal micro-benchmark harness in the spirit of Google Benchmark.
+//
+//   void bm_something(bench::State& state) {
+//       auto input = prepare(state.arg());
+//       while (state.keepRunning()) {
+//           bench::doNotOptimize(work(input));
+//       }
+//   }
+//   BENCHMARK(bm_something)->args({8, 64, 512});
+//
+// Iteration count is calibrated to run every case at least `--min-time`
+// seconds, the case is repeated `--repetitions` times and the median
+// time per iteration is reported.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace runos {
+namespace bench {
+
+template<class T>
+inline void doNotOptimize(T&& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+class State {
+public:
+    State(uint64_t iterations, int64_t arg)
+        : m_iterations(iterations)
+        , m_left(iterations)
+        , m_arg(arg)
+    { }
+
+    bool keepRunning()
+    {
+        if (m_left == m_iterations)
+            m_start = clock::now();
+        if (m_left != 0) {
+            --m_left;
+            return true;
+        }
+        m_elapsed += clock::now() - m_start;
+        return false;
+    }
+
+    int64_t arg() const
+    { return m_arg; }
+
+    // exclude setup made inside the loop from measurement
+    void pauseTiming()
+    { m_elapsed += clock::now() - m_start; }
+    void resumeTiming()
+    { m_start = clock::now(); }
+
+    // items processed by all iterations
+    void setItemsProcessed(uint64_t items)
+    { m_items = items; }
+    uint64_t itemsProcessed() const
+    { return m_items; }
+
+    double seconds() const
+    { return std::chrono::duration<double>(m_elapsed).count(); }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    const uint64_t m_iterations;
+    uint64_t m_left;
+    const int64_t m_arg;
+    uint64_t m_items {0};
+    clock::time_point m_start;
+    clock::duration m_elapsed {clock::duration::zero()};
+};
+
+using Function = void (*)(State&);
+
+class Benchmark {
+public:
+    Benchmark(const char* name, Function fn)
+        : m_name(name)
+        , m_fn(fn)
+    { }
+
+    Benchmark* arg(int64_t a)
+    { m_args.push_back(a); return this; }
+
+    Benchmark* args(std::initializer_list<int64_t> as)
+    { m_args.insert(m_args.end(), as); return this; }
+
+    const std::string& name() const
+    { return m_name; }
+
+    const std::vector<int64_t>& argList() const
+    { return m_args; }
+
+    Function function() const
+    { return m_fn; }
+
+private:
+    std::string m_name;
+    Function m_fn;
+    std::vector<int64_t> m_args;
+};
+
+inline std::vector<std::unique_ptr<Benchmark>>& registry()
+{
+    static std::vector<std::unique_ptr<Benchmark>> ret;
+    return ret;
+}
+
+inline Benchmark* registerBenchmark(const char* name, Function fn)
+{
+    registry().emplace_back(new Benchmark(name, fn));
+    return registry().back().get();
+}
+
+struct Options {
+    double min_time = 0.5; // seconds
+    unsigned repetitions = 3;
+    std::string filter;
+};
+
+inline double runCase(Function fn, int64_t arg, const Options& opts,
+                      uint64_t& iterations, uint64_t& items)
+{
+    // calibrate
+    iterations = 1;
+    for (;;) {
+        State state(iterations, arg);
+        fn(state);
+        if (state.seconds() >= opts.min_time / 10 || iterations >= (1ull << 40))
+            break;
+        double scale = state.seconds() > 0
+                     ? opts.min_time / 10 / state.seconds() * 1.4 : 10.0;
+        iterations = uint64_t(iterations * std::min(std::max(scale, 2.0), 10.0));
+    }
+    State probe(iterations, arg);
+    fn(probe);
+    if (probe.seconds() > 0)
+        iterations = std::max<uint64_t>(
+            1, uint64_t(iterations * opts.min_time / probe.seconds()));
+
+    std::vector<double> per_iteration;
+    for (unsigned i = 0; i < std::max(opts.repetitions, 1u); ++i) {
+        State state(iterations, arg);
+        fn(state);
+        per_iteration.push_back(state.seconds() / iterations);
+        items = state.itemsProcessed();
+    }
+    std::sort(per_iteration.begin(), per_iteration.end());
+    return per_iteration[per_iteration.size() / 2];
+}
+
+inline int runAll(int argc, char** argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto value = [&](const char* name) -> const char* {
+            size_t len = std::strlen(name);
+            if (a.compare(0, len, name) == 0 && a.size() > len && a[len] == '=')
+                return argv[i] + len + 1;
+            return nullptr;
+        };
+        if (auto v = value("--min-time")) {
+            opts.min_time = std::atof(v);
+        } else if (auto v = value("--repetitions")) {
+            opts.repetitions = unsigned(std::atoi(v));
+        } else if (auto v = value("--filter")) {
+            opts.filter = v;
+        } else {
+            std::fprintf(stderr, "Usage: %s [--filter=SUBSTR] "
+                         "[--min-time=SECONDS] [--repetitions=N]\n", argv[0]);
+            return a == "--help" ? 0 : 1;
+        }
+    }
+
+    std::printf("%-48s %14s %14s %14s\n",
+                "Benchmark", "Time, ns", "Iterations", "Items/s");
+    for (auto& b : registry()) {
+        auto args = b->argList();
+        bool has_arg = not args.empty();
+        if (not has_arg)
+            args.push_back(0);
+
+        for (int64_t arg : args) {
+            std::string name = b->name();
+            if (has_arg)
+                name += "/" + std::to_string(arg);
+            if (name.find(opts.filter) == std::string::npos)
+                continue;
+
+            uint64_t iterations, items;
+            double t = runCase(b->function(), arg, opts, iterations, items);
+            double items_per_sec = items
+                ? double(items) / (iterations * t) : 0.0;
+            std::printf("%-48s %14.1f %14llu %14.0f\n",
+                        name.c_str(), t * 1e9,
+                        (unsigned long long) iterations, items_per_sec);
+            std::fflush(stdout);
+        }
+    }
+    return 0;
+}
+
+} // namespace bench
+} // namespace runos
+
+#define BENCHMARK_CONCAT2(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT2(a, b)
+
+#define BENCHMARK(fn) \
+    static ::runos::bench::Benchmark* \
+        BENCHMARK_CONCAT(benchmark_, __LINE__) = \
+            ::runos::bench::registerBenchmark(#fn, fn)
+
+#define BENCHMARK_MAIN() \
+    int main(int argc, char** argv) \
+    { return ::runos::bench::runAll(argc, argv); }
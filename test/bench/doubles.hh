@@ -0,0 +1,81 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// In-memory doubles of Maple and Retic backends shared by benchmarks.
+// Backends count rules instead of sending them anywhere.
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "api/Packet.hh"
+#include "maple/Backend.hh"
+#include "maple/Flow.hh"
+#include "oxm/field_set.hh"
+#include "retic/backend.hh"
+
+namespace runos {
+namespace bench {
+
+/** Maple flow keeping an output port as its decision */
+class BenchFlow final : public maple::Flow {
+    uint32_t m_port {0};
+public:
+    void decision(uint32_t port)
+    { m_port = port; }
+    uint32_t decision() const
+    { return m_port; }
+
+    std::vector<std::pair<oxm::field<>, oxm::field<>>>
+    virtual_fields(oxm::mask<>, oxm::mask<>) const override
+    { return {}; }
+};
+
+struct CountingMapleBackend : maple::Backend {
+    uint64_t rules {0};
+
+    void install(unsigned, oxm::expirementer::full_field_set const&,
+                 maple::FlowPtr) override
+    { ++rules; }
+    void remove(maple::FlowPtr) override
+    { }
+    void remove(unsigned, oxm::field_set const&) override
+    { }
+    void remove(oxm::field_set const&) override
+    { }
+    void barrier_rule(unsigned, oxm::expirementer::full_field_set const&,
+                      oxm::field<> const&, uint64_t) override
+    { ++rules; }
+};
+
+struct CountingReticBackend : retic::Backend {
+    uint64_t rules {0};
+    uint64_t packet_outs {0};
+
+    void install(oxm::field_set, std::vector<oxm::field_set>, uint16_t,
+                 retic::FlowSettings) override
+    { ++rules; }
+    void installBarrier(oxm::field_set, uint16_t) override
+    { ++rules; }
+    void packetOuts(uint8_t*, size_t, std::vector<oxm::field_set> actions,
+                    uint64_t, uint32_t, const Packet&) override
+    { packet_outs += actions.size(); }
+};
+
+} // namespace bench
+} // namespace runos
@@ -0,0 +1,375 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Micro-benchmarks of core data structures:
+// oxm fields and field sets, bits, FDD compiler and translator,
+// Maple trace tree and PacketParser.
+
+#include "bench.hh"
+#include "doubles.hh"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <fluid/of13msg.hh>
+
+#include "api/Packet.hh"
+#include "maple/Runtime.hh"
+#include "oxm/field.hh"
+#include "oxm/field_set.hh"
+#include "oxm/openflow_basic.hh"
+#include "retic/fdd.hh"
+#include "retic/fdd_compiler.hh"
+#include "retic/fdd_translator.hh"
+#include "retic/policies.hh"
+#include "types/bits.hh"
+#include "types/ethaddr.hh"
+#include "types/ipv4addr.hh"
+#include "types/packet_headers.hh"
+#include "PacketParser.hh"
+
+using namespace runos;
+using bench::State;
+using bench::doNotOptimize;
+using bench::BenchFlow;
+using bench::CountingMapleBackend;
+using bench::CountingReticBackend;
+
+namespace {
+
+const oxm::in_port in_port;
+const oxm::eth_src eth_src;
+const oxm::eth_dst eth_dst;
+const oxm::eth_type eth_type;
+const oxm::ipv4_src ipv4_src;
+const oxm::ipv4_dst ipv4_dst;
+const oxm::switch_id switch_id;
+
+//////////////////////////////////////////////////////////////////////////
+// oxm
+
+void bm_field_construct(State& state)
+{
+    uint64_t i = 0;
+    while (state.keepRunning()) {
+        oxm::field<> f = oxm::field<oxm::eth_dst>(ethaddr(++i));
+        doNotOptimize(f);
+    }
+}
+BENCHMARK(bm_field_construct);
+
+void bm_field_masked_construct(State& state)
+{
+    const ethaddr mask("ff:ff:ff:00:00:00");
+    uint64_t i = 0;
+    while (state.keepRunning()) {
+        oxm::field<> f = oxm::field<oxm::eth_src>(ethaddr(++i), mask);
+        doNotOptimize(f);
+    }
+}
+BENCHMARK(bm_field_masked_construct);
+
+void bm_field_apply_mask(State& state)
+{
+    const oxm::field<> f = oxm::field<oxm::ipv4_dst>(ipv4addr("10.1.2.3"));
+    const oxm::mask<> m = oxm::mask<oxm::ipv4_dst>(ipv4addr("255.255.0.0"));
+    while (state.keepRunning()) {
+        oxm::field<> masked = f & m;
+        doNotOptimize(masked);
+    }
+}
+BENCHMARK(bm_field_apply_mask);
+
+void bm_field_match(State& state)
+{
+    const oxm::field<> f = oxm::field<oxm::eth_src>(
+            ethaddr("aa:11:cc:dd:11:11"), ethaddr("ff:00:ff:ff:00:00"));
+    const oxm::field<> v = oxm::field<oxm::eth_src>(
+            ethaddr("aa:bb:cc:dd:ee:ff"));
+    while (state.keepRunning()) {
+        bool match = f & v;
+        doNotOptimize(match);
+    }
+}
+BENCHMARK(bm_field_match);
+
+oxm::field_set make_field_set(int64_t nfields, uint64_t seed)
+{
+    const std::vector<oxm::field<>> fields {
+        in_port == uint32_t(seed % 48 + 1),
+        eth_src == ethaddr(seed),
+        eth_dst == ethaddr(seed + 1),
+        eth_type == 0x0800,
+        ipv4_src == ipv4addr(uint32_t(0x0a000000 + seed)),
+        ipv4_dst == ipv4addr(uint32_t(0x0a000000 + seed + 1)),
+        switch_id == seed % 16 + 1
+    };
+    oxm::field_set ret;
+    for (int64_t i = 0; i < nfields && i < int64_t(fields.size()); ++i) {
+        ret.modify(fields[i]);
+    }
+    return ret;
+}
+
+void bm_field_set_modify(State& state)
+{
+    uint64_t i = 0;
+    while (state.keepRunning()) {
+        auto fs = make_field_set(state.arg(), ++i);
+        doNotOptimize(fs);
+    }
+}
+BENCHMARK(bm_field_set_modify)->args({1, 4, 7});
+
+void bm_field_set_load(State& state)
+{
+    const oxm::field_set fs = make_field_set(7, 42);
+    const Packet& pkt = fs;
+    const oxm::mask<> masks[] = {
+        oxm::mask<>(in_port), oxm::mask<>(eth_dst), oxm::mask<>(ipv4_dst)
+    };
+    size_t i = 0;
+    while (state.keepRunning()) {
+        oxm::field<> f = pkt.load(masks[++i % 3]);
+        doNotOptimize(f);
+    }
+}
+BENCHMARK(bm_field_set_load);
+
+void bm_field_set_equal(State& state)
+{
+    const oxm::field_set lhs = make_field_set(state.arg(), 42);
+    const oxm::field_set rhs = make_field_set(state.arg(), 42);
+    while (state.keepRunning()) {
+        bool eq = lhs == rhs;
+        doNotOptimize(eq);
+    }
+}
+BENCHMARK(bm_field_set_equal)->args({1, 4, 7});
+
+//////////////////////////////////////////////////////////////////////////
+// bits
+
+void bm_bits_static_ops(State& state)
+{
+    bits<48> a(0xaabbccddeeffULL), m(0xffffff000000ULL);
+    while (state.keepRunning()) {
+        bits<48> r = (a & m) | (a ^ m);
+        doNotOptimize(r);
+    }
+}
+BENCHMARK(bm_bits_static_ops);
+
+void bm_bits_dynamic_ops(State& state)
+{
+    bits<> a = bits<48>(0xaabbccddeeffULL);
+    bits<> m = bits<48>(0xffffff000000ULL);
+    while (state.keepRunning()) {
+        bits<> r = (a & m) | (a ^ m);
+        doNotOptimize(r);
+    }
+}
+BENCHMARK(bm_bits_dynamic_ops);
+
+void bm_bits_hash(State& state)
+{
+    bits<> a = bits<48>(0xaabbccddeeffULL);
+    std::hash<bits<>> hash;
+    while (state.keepRunning()) {
+        size_t h = hash(a);
+        doNotOptimize(h);
+    }
+}
+BENCHMARK(bm_bits_hash);
+
+//////////////////////////////////////////////////////////////////////////
+// FDD
+
+// per-switch forwarding like the learning switch route_policy()
+retic::policy route_policy(int64_t hops)
+{
+    using namespace retic;
+    policy p = stop();
+    for (int64_t i = 0; i < hops; ++i) {
+        p = p + (filter(switch_id == uint64_t(i + 1)) >>
+                 filter(in_port == uint32_t(i % 4 + 1)) >>
+                 fwd(uint32_t(i % 4 + 2)));
+    }
+    return p;
+}
+
+// flooding over spanning tree like STP::broadcastPolicy()
+retic::policy broadcast_policy(int64_t switches)
+{
+    using namespace retic;
+    policy p = stop();
+    for (int64_t i = 0; i < switches; ++i) {
+        policy ports = fwd(1) + fwd(2) + fwd(3);
+        p = p + (filter(switch_id == uint64_t(i + 1)) >> ports);
+    }
+    return filter(eth_dst == ethaddr("ff:ff:ff:ff:ff:ff")) >> p;
+}
+
+void bm_fdd_compile_route(State& state)
+{
+    auto p = route_policy(state.arg());
+    while (state.keepRunning()) {
+        auto d = retic::fdd::compile(p);
+        doNotOptimize(d);
+    }
+}
+BENCHMARK(bm_fdd_compile_route)->args({4, 16, 64, 256});
+
+void bm_fdd_compile_broadcast(State& state)
+{
+    auto p = broadcast_policy(state.arg());
+    while (state.keepRunning()) {
+        auto d = retic::fdd::compile(p);
+        doNotOptimize(d);
+    }
+}
+BENCHMARK(bm_fdd_compile_broadcast)->args({4, 16, 64});
+
+void bm_fdd_translate(State& state)
+{
+    auto d = retic::fdd::compile(route_policy(state.arg()));
+    CountingReticBackend backend;
+    while (state.keepRunning()) {
+        retic::fdd::Translator translator(backend);
+        boost::apply_visitor(translator, d);
+    }
+    state.setItemsProcessed(backend.rules);
+}
+BENCHMARK(bm_fdd_translate)->args({4, 16, 64, 256});
+
+//////////////////////////////////////////////////////////////////////////
+// Maple trace tree
+
+using Runtime = maple::Runtime<uint32_t, BenchFlow>;
+
+uint32_t l2_policy(Packet& pkt, maple::FlowPtr)
+{
+    ethaddr dst = pkt.load(eth_dst);
+    uint64_t dpid = pkt.load(switch_id);
+    return uint32_t(dst.to_number() + dpid) % 48 + 1;
+}
+
+std::vector<oxm::field_set> make_packets(int64_t n)
+{
+    std::vector<oxm::field_set> ret;
+    ret.reserve(n);
+    for (int64_t i = 0; i < n; ++i) {
+        ret.push_back(make_field_set(7, uint64_t(i) * 7919));
+    }
+    return ret;
+}
+
+void bm_trace_tree_augment(State& state)
+{
+    auto packets = make_packets(state.arg());
+    CountingMapleBackend backend;
+    Runtime runtime{l2_policy, backend};
+    size_t i = 0;
+    while (state.keepRunning()) {
+        if (i == packets.size()) {
+            state.pauseTiming();
+            runtime.invalidate();
+            i = 0;
+            state.resumeTiming();
+        }
+        auto result = runtime.augment(packets[i++],
+                                      std::make_shared<BenchFlow>());
+        result.second();
+    }
+}
+BENCHMARK(bm_trace_tree_augment)->args({16, 1024});
+
+void bm_trace_tree_lookup(State& state)
+{
+    auto packets = make_packets(state.arg());
+    CountingMapleBackend backend;
+    Runtime runtime{l2_policy, backend};
+    for (auto& pkt : packets) {
+        runtime.augment(pkt, std::make_shared<BenchFlow>()).second();
+    }
+    size_t i = 0;
+    while (state.keepRunning()) {
+        auto flow = runtime(packets[i++ % packets.size()]);
+        doNotOptimize(flow);
+    }
+}
+BENCHMARK(bm_trace_tree_lookup)->args({16, 1024, 16384});
+
+//////////////////////////////////////////////////////////////////////////
+// PacketParser
+
+void bm_packet_parser(State& state)
+{
+    struct {
+        ethernet_hdr eth;
+        ipv4_hdr ip;
+    } frame;
+    std::memset(&frame, 0, sizeof(frame));
+    frame.eth.dst = 0x020000000001ULL;
+    frame.eth.src = 0x020000000002ULL;
+    frame.eth.type = 0x0800;
+    frame.ip.version = 4;
+    frame.ip.ihl = 5;
+    frame.ip.protocol = 17;
+    frame.ip.src = 0x0a000001;
+    frame.ip.dst = 0x0a000002;
+
+    fluid_msg::of13::PacketIn pi(1, OFP_NO_BUFFER, sizeof(frame), 0, 0, 0);
+    pi.add_oxm_field(new fluid_msg::of13::InPort(1));
+    pi.data(&frame, sizeof(frame));
+
+    while (state.keepRunning()) {
+        PacketParser pkt{pi, 1};
+        doNotOptimize(pkt);
+    }
+}
+BENCHMARK(bm_packet_parser);
+
+void bm_packet_parser_load(State& state)
+{
+    struct {
+        ethernet_hdr eth;
+        ipv4_hdr ip;
+    } frame;
+    std::memset(&frame, 0, sizeof(frame));
+    frame.eth.dst = 0x020000000001ULL;
+    frame.eth.type = 0x0800;
+    frame.ip.version = 4;
+    frame.ip.ihl = 5;
+    frame.ip.dst = 0x0a000002;
+
+    fluid_msg::of13::PacketIn pi(1, OFP_NO_BUFFER, sizeof(frame), 0, 0, 0);
+    pi.add_oxm_field(new fluid_msg::of13::InPort(1));
+    pi.data(&frame, sizeof(frame));
+    PacketParser pkt{pi, 1};
+    const Packet& p = pkt;
+
+    while (state.keepRunning()) {
+        oxm::field<> f = p.load(oxm::mask<>(ipv4_dst));
+        doNotOptimize(f);
+    }
+}
+BENCHMARK(bm_packet_parser_load);
+
+} // anonymous namespace
+
+BENCHMARK_MAIN()
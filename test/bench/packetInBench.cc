@@ -0,0 +1,386 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Packet-in throughput benchmark.
+//
+// Writes a message log of synthetic switches and OFPT_PACKET_IN streams
+// and replays it through the controller at full speed, so packet-ins
+// are processed by the handlers Maple or Retic register in Controller.
+// Replayed switches have no connections, messages sent to them are
+// dropped. Reports packets per second, per-stage latency percentiles
+// collected by the handlers and heap allocations per packet.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <fluid/of13msg.hh>
+
+#include "api/Packet.hh"
+#include "api/TraceablePacket.hh"
+#include "oxm/openflow_basic.hh"
+#include "retic/policies.hh"
+#include "types/ethaddr.hh"
+#include "types/ipv4addr.hh"
+#include "types/latency.hh"
+#include "types/packet_headers.hh"
+#include "Application.hh"
+#include "Common.hh"
+#include "Config.hh"
+#include "Decision.hh"
+#include "Flow.hh"
+#include "Loader.hh"
+#include "Maple.hh"
+#include "MessageLog.hh"
+#include "Retic.hh"
+#include "SwitchConnection.hh"
+
+namespace {
+std::atomic<uint64_t> allocations {0};
+}
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* ret = std::malloc(size ? size : 1))
+        return ret;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{ std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept
+{ std::free(ptr); }
+
+using namespace runos;
+namespace options = boost::program_options;
+
+namespace {
+
+struct Settings {
+    unsigned switches;
+    unsigned hosts;
+    unsigned ips;       // distinct IPv4 addresses per host
+    unsigned packets;
+    unsigned pool;      // distinct packet-ins in the stream
+    std::string policy; // "l2" or "l3"
+    std::string engine; // "maple" or "retic"
+    std::string log;    // message log to write and replay
+    unsigned seed;
+};
+
+// Host `h` is attached to switch `h % switches` on port `h / switches + 1`.
+// Switches are fully meshed, port `uplink_base + dpid` leads to `dpid`.
+constexpr uint32_t uplink_base = 1000;
+
+struct Topo {
+    unsigned switches;
+
+    uint64_t dpid(unsigned host) const
+    { return host % switches + 1; }
+
+    uint32_t port(unsigned host) const
+    { return host / switches + 1; }
+
+    uint32_t outPort(uint64_t at, unsigned host) const
+    { return dpid(host) == at ? port(host) : uplink_base + dpid(host); }
+
+    static ethaddr mac(unsigned host)
+    { return ethaddr(uint64_t(0x020000000000ULL + host)); }
+
+    static ipv4addr ip(unsigned host, unsigned alias)
+    { return ipv4addr(uint32_t(0x0a000000 + (alias << 20) + host)); }
+
+    // inverse of mac() and ip()
+    static unsigned host(ethaddr mac)
+    { return unsigned(mac.to_number() - 0x020000000000ULL); }
+
+    static unsigned host(ipv4addr ip)
+    { return ip.to_number() & 0xfffff; }
+};
+
+// Forwarding of the bench policies, set before applications start
+struct Forwarding {
+    Topo topo;
+    bool l3;
+
+    uint32_t outPort(Packet& pkt, uint64_t dpid) const
+    {
+        static const auto eth_dst = oxm::eth_dst();
+        static const auto ipv4_dst = oxm::ipv4_dst();
+        unsigned dst = l3 ? Topo::host(ipv4addr(pkt.load(ipv4_dst)))
+                          : Topo::host(ethaddr(pkt.load(eth_dst)));
+        return topo.outPort(dpid, dst);
+    }
+};
+
+Forwarding forwarding {Topo{1}, false};
+
+struct Frame {
+    ethernet_hdr eth;
+    ipv4_hdr ip;
+};
+static_assert(sizeof(Frame) == 34, "Unexpected alignment");
+
+struct PackedMessage {
+    std::vector<uint8_t> data;
+    uint64_t dpid;
+};
+
+template<class Message>
+PackedMessage pack(Message& msg, uint64_t dpid)
+{
+    uint8_t* data = msg.pack();
+    PackedMessage ret{std::vector<uint8_t>(data, data + msg.length()), dpid};
+    fluid_msg::OFMsg::free_buffer(data);
+    return ret;
+}
+
+std::vector<PackedMessage> make_stream(const Settings& s, const Topo& topo)
+{
+    std::mt19937 gen(s.seed);
+    std::uniform_int_distribution<unsigned> host(0, s.hosts - 1);
+    std::uniform_int_distribution<unsigned> alias(0, s.ips - 1);
+
+    std::vector<PackedMessage> ret;
+    ret.reserve(s.pool);
+    for (unsigned i = 0; i < s.pool; ++i) {
+        unsigned src = host(gen), dst = host(gen);
+
+        Frame frame;
+        std::memset(&frame, 0, sizeof(frame));
+        frame.eth.dst = Topo::mac(dst).to_number();
+        frame.eth.src = Topo::mac(src).to_number();
+        frame.eth.type = 0x0800;
+        frame.ip.version = 4;
+        frame.ip.ihl = 5;
+        frame.ip.total_len = sizeof(ipv4_hdr);
+        frame.ip.ttl = 64;
+        frame.ip.protocol = 17;
+        frame.ip.src = Topo::ip(src, alias(gen)).to_number();
+        frame.ip.dst = Topo::ip(dst, alias(gen)).to_number();
+
+        fluid_msg::of13::PacketIn pi(0, OFP_NO_BUFFER, sizeof(frame),
+                                     fluid_msg::of13::OFPR_NO_MATCH, 0, 0);
+        pi.add_oxm_field(new fluid_msg::of13::InPort(topo.port(src)));
+        pi.data(&frame, sizeof(frame));
+        ret.push_back(pack(pi, topo.dpid(src)));
+    }
+    return ret;
+}
+
+// Features replies of all switches go first, so they are up
+// when the stream is replayed
+void write_log(const Settings& s, const Topo& topo)
+{
+    msglog::Writer writer(s.log);
+    for (unsigned i = 0; i < s.switches; ++i) {
+        uint64_t dpid = i + 1;
+        fluid_msg::of13::FeaturesReply fr(i, dpid, 0, 0xfe, 0, 0);
+        auto msg = pack(fr, dpid);
+        writer.write(dpid, fluid_msg::of13::OFPT_FEATURES_REPLY,
+                     msg.data.data(), msg.data.size());
+    }
+
+    auto stream = make_stream(s, topo);
+    for (unsigned i = 0; i < s.packets; ++i) {
+        auto& msg = stream[i % stream.size()];
+        writer.write(msg.dpid, fluid_msg::of13::OFPT_PACKET_IN,
+                     msg.data.data(), msg.data.size());
+    }
+    writer.flush();
+}
+
+Config make_config(const Settings& s)
+{
+    using json11::Json;
+    return Config{
+        {"services", Json::array{s.engine + "-bench"}},
+        {"controller", Json::object{
+            {"replay", s.log},
+            {"replay-pacing", "fast"},
+            {"replay-quit", true}
+        }},
+        {"maple", Json::object{
+            {"pipeline", Json::array{"bench"}}
+        }},
+        {"retic", Json::object{
+            {"main", "bench"}
+        }}
+    };
+}
+
+void report(const Settings& s, double seconds, uint64_t allocs)
+{
+    std::printf("%-6s packets=%u pps=%.0f allocs/pkt=%.1f\n",
+                s.engine.c_str(), s.packets, s.packets / seconds,
+                double(allocs) / s.packets);
+
+    auto stages = latency::snapshot();
+    for (size_t i = 0; i < latency::stage_count; ++i) {
+        auto& h = stages[i];
+        if (h.count() == 0)
+            continue;
+        std::printf("  %-8s count=%llu p50=%lluns p99=%lluns max=%lluns\n",
+                    latency::to_string(latency::Stage(i)),
+                    (unsigned long long) h.count(),
+                    (unsigned long long) h.quantile(0.5),
+                    (unsigned long long) h.quantile(0.99),
+                    (unsigned long long) h.max());
+    }
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////
+// Policies
+
+class MapleBench : public Application {
+SIMPLE_APPLICATION(MapleBench, "maple-bench")
+public:
+    void init(Loader* loader, const Config&) override
+    {
+        const auto switch_id = oxm::switch_id();
+        Maple::get(loader)->registerHandler("bench",
+            [=](Packet& pkt, FlowPtr, Decision decision) {
+                return decision.unicast(
+                    forwarding.outPort(pkt, pkt.load(switch_id)));
+            });
+    }
+};
+
+REGISTER_APPLICATION(MapleBench, {"maple", ""})
+
+class ReticBench : public Application {
+SIMPLE_APPLICATION(ReticBench, "retic-bench")
+public:
+    void init(Loader* loader, const Config&) override
+    {
+        using namespace retic;
+        const auto switch_id = oxm::switch_id();
+        Retic::get(loader)->registerPolicy("bench", handler([=](Packet& pkt) {
+            auto tpkt = packet_cast<TraceablePacket>(pkt);
+            return fwd(forwarding.outPort(pkt, tpkt.watch(switch_id)));
+        }));
+    }
+};
+
+REGISTER_APPLICATION(ReticBench, {"retic", ""})
+
+int main(int argc, char** argv)
+{
+    Settings s;
+    options::options_description desc("Packet-in throughput benchmark");
+    desc.add_options()
+        ("help,h", "print this message")
+        ("switches,s", options::value(&s.switches)->default_value(16),
+            "number of switches")
+        ("hosts,m", options::value(&s.hosts)->default_value(1024),
+            "number of distinct MAC addresses")
+        ("ips,i", options::value(&s.ips)->default_value(1),
+            "number of IPv4 addresses per host")
+        ("packets,n", options::value(&s.packets)->default_value(1000000),
+            "number of packet-ins to process")
+        ("pool,p", options::value(&s.pool)->default_value(65536),
+            "number of distinct packet-ins in the stream")
+        ("policy", options::value(&s.policy)->default_value("l2"),
+            "forwarding policy: l2 (by eth_dst) or l3 (by ipv4_dst)")
+        ("engine,e", options::value(&s.engine)->default_value("maple"),
+            "maple or retic, both register packet-in handlers "
+            "so one is benchmarked per run")
+        ("log", options::value(&s.log),
+            "message log file, packetInBench-<engine>.msglog by default")
+        ("seed", options::value(&s.seed)->default_value(1),
+            "random seed of the stream");
+
+    options::variables_map vm;
+    try {
+        options::store(options::parse_command_line(argc, argv, desc), vm);
+        options::notify(vm);
+    } catch (options::error& e) {
+        std::cerr << e.what() << std::endl << desc << std::endl;
+        return 1;
+    }
+
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    if (s.switches == 0 || s.hosts == 0 || s.ips == 0 || s.ips > 16 ||
+        s.hosts >= (1u << 20) || s.packets == 0 || s.pool == 0 ||
+        (s.policy != "l2" && s.policy != "l3") ||
+        (s.engine != "maple" && s.engine != "retic"))
+    {
+        std::cerr << "Invalid arguments" << std::endl << desc << std::endl;
+        return 1;
+    }
+    if (s.log.empty()) {
+        s.log = "packetInBench-" + s.engine + ".msglog";
+    }
+
+    qRegisterMetaType<uint8_t>("uint8_t");
+    qRegisterMetaType<uint32_t>("uint32_t");
+    qRegisterMetaType<uint64_t>("uint64_t");
+    qRegisterMetaType<std::string>("std::string");
+    qRegisterMetaType<of13::PortStatus>();
+    qRegisterMetaType<of13::FeaturesReply>();
+    qRegisterMetaType<of13::FlowRemoved>();
+    qRegisterMetaType< std::shared_ptr<of13::Error> >();
+    qRegisterMetaType<of13::Port>();
+    qRegisterMetaType<of13::Match>();
+    qRegisterMetaType<runos::SwitchConnectionPtr>("SwitchConnectionPtr");
+    qRegisterMetaType<runos::Flow::State>("State");
+
+    google::InitGoogleLogging(argv[0]);
+    QCoreApplication app(argc, argv);
+
+    forwarding = Forwarding{Topo{s.switches}, s.policy == "l3"};
+    write_log(s, forwarding.topo);
+
+    std::printf("switches=%u hosts=%u ips=%u pool=%u policy=%s\n",
+                s.switches, s.hosts, s.ips, s.pool, s.policy.c_str());
+
+    Config config = make_config(s);
+    Loader loader(config);
+    loader.startAll();
+
+    latency::enable(true);
+    latency::reset();
+
+    // controller replays the log from the event loop
+    // and quits when it is done
+    using clock = std::chrono::steady_clock;
+    uint64_t allocs = allocations;
+    auto start = clock::now();
+    app.exec();
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    allocs = allocations - allocs;
+
+    std::remove(s.log.c_str());
+    report(s, seconds, allocs);
+    return 0;
+}
@@ -29,7 +29,8 @@ class MockSwitch : public maple::Backend {
         { return out << "prio=" << c.prio << ", " << c.match; }
     };
 
-    typedef std::map< Classifier, FlowPtr >
+    // rules of the same priority mustn't overlap
+    typedef std::multimap< Classifier, FlowPtr >
         FlowTable;
 
     FlowPtr miss;
@@ -40,42 +41,88 @@ public:
         : miss(miss)
     { }
    
-    virtual void install(unsigned priority,
-                         oxm::field_set const& fs,
-                         FlowPtr flow) override
+    void install(unsigned priority,
+                 oxm::field_set const& fs,
+                 FlowPtr flow)
     {
         Classifier classifier {priority, fs};
         BOOST_TEST_MESSAGE("Installing flow " << classifier);
-        BOOST_REQUIRE_MESSAGE(flow_table.emplace(classifier, flow).second,
-                              "Overlapping flow " << classifier);
+        auto range = flow_table.equal_range(classifier);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->first == classifier) {
+                // barriers are repeated for every explored branch
+                BOOST_REQUIRE_MESSAGE(it->second == flow,
+                                      "Overlapping flow " << classifier);
+                return;
+            }
+        }
+        flow_table.emplace(classifier, flow);
+    }
+
+    void install(unsigned priority,
+                 oxm::expirementer::full_field_set const& match,
+                 FlowPtr flow) override
+    {
+        for (auto& fs : match.included().fields()) {
+            install(priority, fs, flow);
+        }
+    }
+
+    void barrier_rule(unsigned priority,
+                      oxm::expirementer::full_field_set const& match,
+                      oxm::field<> const&,
+                      uint64_t) override
+    {
+        install(priority, match, miss);
     }
 
-    virtual void remove(FlowPtr flow) override
+    void remove_barrier(unsigned priority,
+                        oxm::expirementer::full_field_set const& match,
+                        oxm::field<> const&,
+                        uint64_t) override
+    {
+        for (auto& fs : match.included().fields()) {
+            remove(priority, fs);
+        }
+    }
+
+    void remove(FlowPtr flow) override
     {
         BOOST_TEST_MESSAGE("Removing flow " << flow);
-        for (auto it = flow_table.begin(); it != flow_table.end(); ++it) {
+        for (auto it = flow_table.begin(); it != flow_table.end(); ) {
             if (it->second == flow)
-                flow_table.erase(it);
+                it = flow_table.erase(it);
+            else
+                ++it;
         }
     }
 
-    virtual void remove(unsigned priority,
-                        oxm::field_set const& match) override
+    void remove(unsigned priority,
+                oxm::field_set const& match) override
     {
-        Classifier key{ priority, std::move(match) };
+        Classifier key{ priority, match };
         BOOST_TEST_MESSAGE("Removing flow " << key);
-        for (auto it = flow_table.begin(); it != flow_table.end(); ++it) {
+        for (auto it = flow_table.begin(); it != flow_table.end(); ) {
             if (it->first == key)
-                flow_table.erase(it);
+                it = flow_table.erase(it);
+            else
+                ++it;
         }
     }
 
-    virtual void remove(oxm::field_set const& match) override
+    // empty match removes all flows
+    void remove(oxm::field_set const& match) override
     {
         BOOST_TEST_MESSAGE("Removing flow " << match);
-        for (auto it = flow_table.begin(); it != flow_table.end(); ++it) {
+        if (match.empty()) {
+            flow_table.clear();
+            return;
+        }
+        for (auto it = flow_table.begin(); it != flow_table.end(); ) {
             if (it->first.match == match)
-                flow_table.erase(it);
+                it = flow_table.erase(it);
+            else
+                ++it;
         }
     }
 
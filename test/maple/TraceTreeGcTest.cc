@@ -0,0 +1,220 @@
+#define BOOST_TEST_MODULE Trace tree gc testcases
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "oxm/field.hh"
+#include "oxm/field_set.hh"
+#include "maple/Backend.hh"
+#include "maple/TraceTree.hh"
+
+using namespace runos;
+
+template<size_t N>
+struct F : oxm::define_type< F<N>, 0, N, 32, uint32_t, uint32_t, true >
+{ };
+
+namespace {
+
+struct TestFlow : maple::Flow {
+    std::vector< std::pair<oxm::field<>, oxm::field<>> >
+    virtual_fields(oxm::mask<>, oxm::mask<>) const override
+    { return {}; }
+};
+
+// prio, match, test, id
+using Barrier = std::tuple<unsigned, std::string, std::string, uint64_t>;
+
+template<class T>
+std::string str(const T& value)
+{
+    std::ostringstream out;
+    out << value;
+    return out.str();
+}
+
+struct RecordingBackend : maple::Backend {
+    std::vector<Barrier> barriers;
+    std::vector<Barrier> removed_barriers;
+
+    void install(unsigned, oxm::expirementer::full_field_set const&,
+                 maple::FlowPtr) override
+    { }
+    void remove(maple::FlowPtr) override
+    { }
+    void remove(unsigned, oxm::field_set const&) override
+    { }
+    void remove(oxm::field_set const&) override
+    { }
+
+    void barrier_rule(unsigned priority,
+                      oxm::expirementer::full_field_set const& match,
+                      oxm::field<> const& test,
+                      uint64_t id) override
+    {
+        barriers.emplace_back(priority, str(match), str(test), id);
+    }
+
+    void remove_barrier(unsigned priority,
+                        oxm::expirementer::full_field_set const& match,
+                        oxm::field<> const& test,
+                        uint64_t id) override
+    {
+        removed_barriers.emplace_back(priority, str(match), str(test), id);
+    }
+};
+
+// F1 == 1 -> F2 == 5 ? flow_pos : flow_neg
+// F1 == 2 -> flow_other
+struct Fixture {
+    RecordingBackend backend;
+    maple::TraceTree tree {backend};
+    std::shared_ptr<TestFlow> flow_pos = std::make_shared<TestFlow>();
+    std::shared_ptr<TestFlow> flow_neg = std::make_shared<TestFlow>();
+    std::shared_ptr<TestFlow> flow_other = std::make_shared<TestFlow>();
+
+    const oxm::field_set pkt_pos {F<1>() == 1, F<2>() == 5};
+    const oxm::field_set pkt_neg {F<1>() == 1, F<2>() == 6};
+    const oxm::field_set pkt_other {F<1>() == 2};
+
+    Fixture()
+    {
+        trace(1, true, flow_pos);
+        trace(1, false, flow_neg);
+
+        auto tracer = tree.augment();
+        tracer->load(F<1>() == 2);
+        tracer->finish(flow_other);
+    }
+
+    void trace(uint32_t f1, bool f2_is_5, maple::FlowPtr flow)
+    {
+        auto tracer = tree.augment();
+        tracer->load(F<1>() == f1);
+        tracer->test(F<2>() == 5, f2_is_5);
+        tracer->finish(flow);
+    }
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE( trace_tree_gc_tests, Fixture )
+
+BOOST_AUTO_TEST_CASE( live_flows_are_kept ) {
+    BOOST_CHECK_EQUAL(tree.gc(), 0u);
+    BOOST_CHECK(backend.removed_barriers.empty());
+    BOOST_CHECK(tree.lookup(pkt_pos) == flow_pos);
+    BOOST_CHECK(tree.lookup(pkt_neg) == flow_neg);
+    BOOST_CHECK(tree.lookup(pkt_other) == flow_other);
+}
+
+BOOST_AUTO_TEST_CASE( expired_leaf_is_pruned ) {
+    flow_pos.reset();
+    BOOST_CHECK_EQUAL(tree.gc(), 1u);
+
+    // the other branch keeps the test
+    BOOST_CHECK(backend.removed_barriers.empty());
+    BOOST_CHECK(tree.lookup(pkt_pos) == nullptr);
+    BOOST_CHECK(tree.lookup(pkt_neg) == flow_neg);
+    BOOST_CHECK(tree.lookup(pkt_other) == flow_other);
+
+    BOOST_CHECK_EQUAL(tree.gc(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_is_collapsed ) {
+    BOOST_REQUIRE_EQUAL(backend.barriers.size(), 1u);
+
+    flow_pos.reset();
+    flow_neg.reset();
+    // both leaves and the test, its load case is erased
+    BOOST_CHECK_EQUAL(tree.gc(), 3u);
+
+    BOOST_REQUIRE_EQUAL(backend.removed_barriers.size(), 1u);
+    BOOST_CHECK(backend.removed_barriers[0] == backend.barriers[0]);
+    BOOST_CHECK(tree.lookup(pkt_pos) == nullptr);
+    BOOST_CHECK(tree.lookup(pkt_neg) == nullptr);
+    BOOST_CHECK(tree.lookup(pkt_other) == flow_other);
+
+    // the case can be explored again
+    auto flow = std::make_shared<TestFlow>();
+    trace(1, false, flow);
+    BOOST_CHECK_EQUAL(backend.barriers.size(), 2u);
+    BOOST_CHECK(tree.lookup(pkt_neg) == flow);
+}
+
+BOOST_AUTO_TEST_CASE( empty_tree ) {
+    flow_pos.reset();
+    flow_neg.reset();
+    flow_other.reset();
+    // three leaves, the test and the root load
+    BOOST_CHECK_EQUAL(tree.gc(), 5u);
+    BOOST_CHECK_EQUAL(tree.gc(), 0u);
+    BOOST_CHECK_EQUAL(backend.removed_barriers.size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE( budgeted_passes_cover_tree ) {
+    flow_pos.reset();
+    flow_neg.reset();
+    flow_other.reset();
+
+    size_t removed = 0;
+    unsigned passes = 0;
+    do {
+        removed += tree.gc(1);
+        passes++;
+    } while (not tree.gc_finished());
+
+    BOOST_CHECK_GT(passes, 1u);
+    BOOST_CHECK_EQUAL(removed, 5u);
+    BOOST_CHECK_EQUAL(backend.removed_barriers.size(), 1u);
+    BOOST_CHECK_EQUAL(tree.gc(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( budgeted_pass_keeps_unvisited ) {
+    flow_pos.reset();
+    flow_neg.reset();
+
+    // only the root is visited
+    BOOST_CHECK_EQUAL(tree.gc(1), 0u);
+    BOOST_CHECK(not tree.gc_finished());
+    BOOST_CHECK(backend.removed_barriers.empty());
+    BOOST_CHECK(tree.lookup(pkt_other) == flow_other);
+
+    while (not tree.gc_finished())
+        tree.gc(2);
+    BOOST_CHECK_EQUAL(backend.removed_barriers.size(), 1u);
+    BOOST_CHECK(tree.lookup(pkt_pos) == nullptr);
+    BOOST_CHECK(tree.lookup(pkt_other) == flow_other);
+}
+
+BOOST_AUTO_TEST_CASE( tree_changed_between_passes ) {
+    flow_pos.reset();
+    BOOST_CHECK_EQUAL(tree.gc(2), 0u);
+    BOOST_REQUIRE(not tree.gc_finished());
+
+    // the resumed branch is gone
+    auto flow = std::make_shared<TestFlow>();
+    const oxm::field_set pkt {F<1>() == 3, F<2>() == 5};
+    flow_neg.reset();
+    flow_other.reset();
+    trace(3, true, flow);
+
+    while (not tree.gc_finished())
+        tree.gc(2);
+    BOOST_CHECK(tree.lookup(pkt_neg) == nullptr);
+    BOOST_CHECK(tree.lookup(pkt) == flow);
+
+    // a full pass finds nothing left
+    tree.gc();
+    BOOST_CHECK(tree.lookup(pkt_pos) == nullptr);
+    BOOST_CHECK(tree.lookup(pkt_other) == nullptr);
+    BOOST_CHECK(tree.lookup(pkt) == flow);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -31,6 +31,10 @@ public:
         : m_decision(other)
     { }
 
+    std::vector< std::pair<oxm::field<>, oxm::field<>> >
+    virtual_fields(oxm::mask<>, oxm::mask<>) const override
+    { return {}; }
+
     Decision decision()
     { return m_decision; }
     void decision(Decision other)
@@ -44,7 +48,7 @@ public:
     { m_decision = other.m_decision; return *this; }
 
      friend std::ostream& operator<<(std::ostream& out, MockFlow flow)
-    { return out << "Flow{ id=" << flow.id << ", decision = " << flow.m_decision; }
+    { return out << "Flow{ decision = " << flow.m_decision << " }"; }
 };
 
 int static_policy(Packet& pkt) {
@@ -82,8 +86,7 @@ BOOST_AUTO_TEST_CASE( static_policy_test ) {
     MockSwitch switch_ { miss_flow };
     maple::Runtime<int, Flow> runtime {
         std::bind(static_policy, std::placeholders::_1),
-        switch_,
-        miss_flow
+        switch_
     };
 
     oxm::field_set pkt = {
@@ -91,8 +94,8 @@ BOOST_AUTO_TEST_CASE( static_policy_test ) {
         { F<2>() == 0xA }
     };
 
-    BOOST_CHECK_EQUAL( runtime(pkt), miss_flow );
-    auto flow100_A = runtime.augment(pkt, make_flow());
+    BOOST_CHECK( runtime(pkt) == nullptr );
+    auto flow100_A = runtime.augment(pkt, make_flow()).first;
 
     BOOST_CHECK_EQUAL( runtime(pkt), flow100_A );
     BOOST_CHECK_EQUAL( flow100_A->decision(), static_policy(pkt) );
@@ -101,12 +104,12 @@ BOOST_AUTO_TEST_CASE( static_policy_test ) {
         { F<1>() == 101 },
         { F<3>() == 0xBB }
     };
-    auto flow101_NA = runtime.augment(pkt, make_flow());
+    auto flow101_NA = runtime.augment(pkt, make_flow()).first;
 
     for (uint32_t f3 = 0; f3 <= 0xFF; ++f3) {
         pkt.modify(F<3>() << f3);
         if ((f3 & 0xff) == 0xaa) {
-            BOOST_CHECK_EQUAL( runtime(pkt), miss_flow );
+            BOOST_CHECK( runtime(pkt) == nullptr );
         } else {
             BOOST_CHECK_EQUAL( runtime(pkt)->decision(), static_policy(pkt) );
             BOOST_CHECK_EQUAL( runtime(pkt), flow101_NA );
@@ -117,7 +120,7 @@ BOOST_AUTO_TEST_CASE( static_policy_test ) {
         { F<1>() == 100 },
         { F<2>() == 0xB }
     };
-    auto flow100_NA = runtime.augment(pkt, make_flow());
+    auto flow100_NA = runtime.augment(pkt, make_flow()).first;
 
     for (uint32_t f2 = 0; f2 <= 0xFF; ++f2) {
         pkt.modify(F<2>() << f2);
@@ -132,7 +135,7 @@ BOOST_AUTO_TEST_CASE( static_policy_test ) {
         { F<1>() == 101 },
         { F<3>() == 0xAA }
     };
-    auto flow101_A = runtime.augment(pkt, make_flow());
+    auto flow101_A = runtime.augment(pkt, make_flow()).first;
 
     for (unsigned f1 = 100; f1 <= 101; ++f1) {
         for (unsigned f2 = 0; f2 <= 0xf; ++f2) {
@@ -188,8 +191,12 @@ BOOST_AUTO_TEST_CASE( static_policy_test ) {
                 auto flow = std::dynamic_pointer_cast<Flow>(flow_);
                 BOOST_REQUIRE(flow);
 
-                BOOST_CHECK_MESSAGE(runtime(pkt) == flow,
-                        runtime(pkt)->decision() << " != " << flow->decision() <<
+                // unexplored packets miss the table
+                auto expected = runtime(pkt);
+                if (not expected)
+                    expected = miss_flow;
+                BOOST_CHECK_MESSAGE(expected == flow,
+                        expected->decision() << " != " << flow->decision() <<
                         " for F={" << f1 << ", " << f2 << ", " << f3 << "}");
 
                 if (f1 >= 50 && f1 <= 101) {
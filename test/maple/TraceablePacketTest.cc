@@ -73,7 +73,8 @@ struct PacketB : Fields {
 struct MockTracer : Tracer {
     MOCK_METHOD1(load, void(oxm::field<>));
     MOCK_METHOD2(test, void(oxm::field<>, bool));
-    MOCK_METHOD1(finish, void(std::shared_ptr<runos::maple::Flow>));
+    MOCK_METHOD1(finish, runos::maple::Installer(runos::maple::FlowPtr));
+    MOCK_METHOD2(vload, void(oxm::field<>, oxm::field<>));
 };
 
 BOOST_AUTO_TEST_SUITE( runos_maple_traceable_tests )
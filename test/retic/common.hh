@@ -21,12 +21,24 @@ struct MockBackend: public Backend {
         )
     );
     MOCK_METHOD2(installBarrier, void(oxm::field_set, uint16_t));
-    MOCK_METHOD4(packetOuts,
+    MOCK_METHOD5(installIn,
+        void(
+            Stage,
+            oxm::field_set,
+            std::vector<oxm::field_set>,
+            uint16_t,
+            FlowSettings
+    ));
+    MOCK_METHOD3(installBarrierIn, void(Stage, oxm::field_set, uint16_t));
+    MOCK_METHOD4(installGoto, void(Stage, oxm::field_set, uint16_t, Stage));
+    MOCK_METHOD6(packetOuts,
         void(
             uint8_t* data,
             size_t data_len,
             std::vector<oxm::field_set>,
-            uint64_t
+            uint64_t,
+            uint32_t,
+            const Packet&
         )
     );
 };
@@ -4,7 +4,10 @@
 #include "common.hh"
 
 #include "retic/fdd.hh"
+#include "retic/fdd_cache.hh"
 #include "retic/fdd_compiler.hh"
+#include "retic/fdd_optimizer.hh"
+#include "retic/fdd_order.hh"
 #include "retic/policies.hh"
 #include "retic/traverse_fdd.hh"
 #include "oxm/openflow_basic.hh"
@@ -775,6 +778,230 @@ TEST(FddCompilerTest, ComplexNegationTest) {
     EXPECT_EQ(true_value, d);
 }
 
+TEST(FddOptimizerTest, EqualBranches) {
+    fdd::diagram d = fdd::node {
+        F<1>() == 1,
+        fdd::leaf{{oxm::field_set{F<2>() == 2}}},
+        fdd::node {
+            F<3>() == 3,
+            fdd::leaf{{oxm::field_set{F<2>() == 2}}},
+            fdd::leaf{{oxm::field_set{F<2>() == 2}}}
+        }
+    };
+    fdd::diagram true_value = fdd::leaf{{oxm::field_set{F<2>() == 2}}};
+    EXPECT_EQ(true_value, fdd::optimize(d));
+}
+
+TEST(FddOptimizerTest, DifferentSettingsAreKept) {
+    fdd::diagram d = fdd::node {
+        F<1>() == 1,
+        fdd::leaf{{oxm::field_set{}}, FlowSettings{sec(10)}},
+        fdd::leaf{{oxm::field_set{}}}
+    };
+    EXPECT_EQ(d, fdd::optimize(d));
+}
+
+TEST(FddOptimizerTest, ShadowedTests) {
+    fdd::diagram d = fdd::node {
+        F<1>() == 1,
+        fdd::node {
+            F<1>() == 2, // never matches
+            fdd::leaf{},
+            fdd::node {
+                F<1>() == 1, // always matches
+                fdd::leaf{{oxm::field_set{F<2>() == 1}}},
+                fdd::leaf{}
+            }
+        },
+        fdd::node {
+            F<1>() == 1, // never matches
+            fdd::leaf{},
+            fdd::leaf{{oxm::field_set{F<2>() == 2}}}
+        }
+    };
+    fdd::diagram true_value = fdd::node {
+        F<1>() == 1,
+        fdd::leaf{{oxm::field_set{F<2>() == 1}}},
+        fdd::leaf{{oxm::field_set{F<2>() == 2}}}
+    };
+    EXPECT_EQ(true_value, fdd::optimize(d));
+}
+
+TEST(FddOptimizerTest, CompiledPolicy) {
+    policy p = (filter(F<1>() == 1) >> modify(F<2>() == 1)) +
+               (filter(F<1>() == 2) >> modify(F<2>() == 1)) +
+               (filter(F<3>() == 3) >> stop());
+    fdd::diagram d = fdd::optimize(fdd::compile(p));
+    for (uint32_t v: {1, 2, 3}) {
+        oxm::field_set fs{F<1>() == v, F<3>() == 3};
+        fdd::Traverser optimized{fs};
+        fdd::diagram source = fdd::compile(p);
+        fdd::Traverser plain{fs};
+        EXPECT_EQ(boost::apply_visitor(plain, source),
+                  boost::apply_visitor(optimized, d));
+    }
+}
+
+TEST(FieldOrderTest, Compare) {
+    fdd::FieldOrder order{{oxm::type(F<3>()), oxm::type(F<2>())}};
+    EXPECT_LT(0, order.compare(F<3>(), F<2>()));
+    EXPECT_GT(0, order.compare(F<2>(), F<3>()));
+    // not listed types go after listed ones
+    EXPECT_LT(0, order.compare(F<2>(), F<1>()));
+    EXPECT_LT(0, order.compare(F<1>(), F<4>()));
+    EXPECT_EQ(0, order.compare(F<1>(), F<1>()));
+}
+
+TEST(FieldOrderTest, FromPolicy) {
+    policy p = (filter(F<2>() == 1) >> modify(F<3>() == 1)) +
+               (filter(F<2>() == 2) >> filter(F<1>() == 1)) +
+               filter_not(F<2>() == 3);
+    auto types = fdd::FieldOrder::fromPolicy(p).types();
+    std::vector<oxm::type> true_value = {F<2>(), F<1>()};
+    EXPECT_EQ(true_value, types);
+}
+
+TEST(FieldOrderTest, CompileWithOrder) {
+    policy p = filter(F<1>() == 1) >> filter(F<2>() == 2);
+    fdd::FieldOrder order{{oxm::type(F<2>())}};
+    fdd::diagram d = fdd::optimize(fdd::compile(p, order));
+    fdd::diagram true_value = fdd::node {
+        F<2>() == 2,
+        fdd::node {F<1>() == 1, fdd::leaf{{oxm::field_set{}}}, fdd::leaf{}},
+        fdd::leaf{}
+    };
+    EXPECT_EQ(true_value, d);
+}
+
+TEST(FieldOrderTest, Sifting) {
+    // F<1> is tested on every branch, but F<2> decides the result
+    policy p = stop();
+    for (uint32_t i = 1; i <= 4; ++i) {
+        p = p + (filter(F<1>() == i) >> filter(F<2>() == 1) >> fwd(1));
+    }
+    auto order = fdd::FieldOrder::fromPolicy(p);
+    EXPECT_EQ(oxm::type(F<1>()), order.types().at(0));
+
+    auto sifted = fdd::FieldOrder::sift(p, order);
+    EXPECT_EQ(oxm::type(F<2>()), sifted.types().at(0));
+
+    struct : boost::static_visitor<size_t> {
+        size_t operator()(const fdd::leaf&) const { return 1; }
+        size_t operator()(const fdd::node& n) const {
+            return 1 + boost::apply_visitor(*this, n.positive)
+                     + boost::apply_visitor(*this, n.negative);
+        }
+    } size;
+    fdd::diagram before = fdd::optimize(fdd::compile(p, order));
+    fdd::diagram after = fdd::optimize(fdd::compile(p, sifted));
+    EXPECT_LT(boost::apply_visitor(size, after), boost::apply_visitor(size, before));
+}
+
+TEST(FieldOrderTest, SiftingWithStages) {
+    // the same policy as in Sifting, but F<2> is tested by the second table
+    policy p = stop();
+    for (uint32_t i = 1; i <= 4; ++i) {
+        p = p + (filter(F<1>() == i) >> filter(F<2>() == 1) >>
+                 filter(F<3>() == i % 2) >> fwd(1));
+    }
+    auto stage_of = [](oxm::type type) {
+        return type == oxm::type(F<2>()) || type == oxm::type(F<3>()) ? 1u : 0u;
+    };
+
+    // F<3> is listed before F<1>, but it is tested later
+    fdd::FieldOrder listed{{F<3>(), F<1>()}, stage_of};
+    std::vector<oxm::type> by_stage = {F<1>(), F<3>()};
+    EXPECT_EQ(by_stage, listed.types());
+    // not listed types of the first stage go before the second one
+    EXPECT_LT(0, listed.compare(F<4>(), F<3>()));
+    EXPECT_LT(0, listed.compare(F<3>(), F<2>()));
+
+    // without stages F<2> goes to the root
+    auto unstaged = fdd::FieldOrder::sift(p, fdd::FieldOrder::fromPolicy(p));
+    EXPECT_EQ(oxm::type(F<2>()), unstaged.types().at(0));
+
+    auto order = fdd::FieldOrder::fromPolicy(p, stage_of);
+    auto sifted = fdd::FieldOrder::sift(p, order);
+    ASSERT_EQ(3u, sifted.types().size());
+    EXPECT_EQ(oxm::type(F<1>()), sifted.types().at(0));
+    EXPECT_EQ(1u, stage_of(sifted.types().at(1)));
+    EXPECT_EQ(1u, stage_of(sifted.types().at(2)));
+
+    // stages don't decrease on any path, so no test goes back to a table
+    struct : boost::static_visitor<bool> {
+        std::function<unsigned(oxm::type)> stage_of;
+        unsigned stage = 0;
+        bool operator()(const fdd::leaf&) { return true; }
+        bool operator()(const fdd::node& n) {
+            unsigned node_stage = stage_of(n.field.type());
+            if (node_stage < stage)
+                return false;
+            unsigned saved = stage;
+            stage = node_stage;
+            bool ret = boost::apply_visitor(*this, n.positive) &&
+                       boost::apply_visitor(*this, n.negative);
+            stage = saved;
+            return ret;
+        }
+    } monotonic;
+    monotonic.stage_of = stage_of;
+    fdd::diagram d = fdd::optimize(fdd::compile(p, sifted));
+    EXPECT_TRUE(boost::apply_visitor(monotonic, d));
+    d = fdd::optimize(fdd::compile(p, fdd::FieldOrder({}, stage_of)));
+    EXPECT_TRUE(boost::apply_visitor(monotonic, d));
+}
+
+TEST(FddCompilerTest, ParallelCompile) {
+    policy p = stop();
+    for (uint32_t i = 1; i <= 32; ++i) {
+        p = p + (filter(F<1>() == i % 5) >> filter(F<2>() == i) >>
+                 (modify(F<3>() == i) + (filter(F<4>() == i) >> fwd(i))));
+    }
+    p = p >> (filter_not(F<3>() == 7) + modify(F<4>() == 1));
+
+    task_pool pool(3);
+    fdd::diagram sequential = fdd::compile(p);
+    fdd::diagram parallel = fdd::compile(p, fdd::FieldOrder::natural(), &pool);
+    EXPECT_EQ(sequential, parallel);
+}
+
+TEST(FddCacheTest, PolicyHash) {
+    auto make = [](uint32_t value) {
+        return (filter(F<1>() == value) >> handler([](Packet&) { return stop(); }))
+               + hard_timeout(sec(10));
+    };
+    // handlers are hashed by position, not by id
+    EXPECT_EQ(fdd::hash_policy(make(1)), fdd::hash_policy(make(1)));
+    EXPECT_NE(fdd::hash_policy(make(1)), fdd::hash_policy(make(2)));
+    EXPECT_NE(fdd::hash_policy(filter(F<1>() == 1) + filter(F<2>() == 1)),
+              fdd::hash_policy(filter(F<1>() == 1) >> filter(F<2>() == 1)));
+}
+
+TEST(FddCacheTest, StoreAndLoad) {
+    auto make = []() {
+        policy fun = handler([](Packet&) { return fwd(2); });
+        return (filter(F<1>() == 1) >> modify(F<2>() == 2) >> fun >> fwd(1)) +
+               (filter_not(F<3>() == 3) >> idle_timeout(sec(5))) +
+               filter(F<1>() == 1) >> fun;
+    };
+    policy p = make();
+    fdd::diagram d = fdd::compile(p);
+    fdd::DiagramCache cache{::testing::TempDir() + "fdd_cache_test"};
+    ASSERT_TRUE(cache.store(p, 42, d));
+
+    // restart: the same policy with new handlers
+    policy restarted = make();
+    auto loaded = cache.load(restarted, 42);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(fdd::compile(restarted), *loaded);
+    EXPECT_NE(d, *loaded); // handlers of the new policy are used
+
+    EXPECT_FALSE(cache.load(restarted, 43).has_value());
+    EXPECT_FALSE(cache.load(filter(F<1>() == 1), 42).has_value());
+    EXPECT_FALSE(fdd::DiagramCache{"/nonexistent/fdd_cache"}.load(p, 42).has_value());
+    std::remove(cache.path().c_str());
+}
+
 TEST(FddTraverseTest, FddTraverse) {
     fdd::diagram d = fdd::node{
         F<1>() == 1,
@@ -809,6 +1036,38 @@ TEST(FddTraverseTest, FddTraverseWithMaple) {
     EXPECT_EQ(l, fdd::leaf{{ oxm::field_set{F<2>() == 2} }});
 }
 
+TEST(FddTraverseTest, FinderDoesntAugment) {
+    int call_count = 0;
+    policy p = handler([&call_count](Packet& pkt) {
+        call_count++;
+        pkt.test(F<2>() == 2);
+        return modify(F<3>() << 3);
+    });
+    auto pf = boost::get<PacketFunction>(p);
+    fdd::diagram d = fdd::node {
+        F<1>() == 1,
+        fdd::leaf{{ {oxm::field_set{}, pf} }},
+        fdd::leaf{{ oxm::field_set{F<3>() == 4} }}
+    };
+
+    oxm::field_set fs{F<1>() == 1, F<2>() == 2};
+    EXPECT_EQ(boost::apply_visitor(fdd::Finder{fs}, d), nullptr);
+    EXPECT_EQ(call_count, 0);
+
+    fdd::Traverser traverser{fs};
+    fdd::leaf& l = boost::apply_visitor(traverser, d);
+    EXPECT_EQ(boost::apply_visitor(fdd::Finder{fs}, d), &l);
+    EXPECT_EQ(call_count, 1);
+
+    // the other branch of the test isn't explored yet
+    oxm::field_set other{F<1>() == 1, F<2>() == 3};
+    EXPECT_EQ(boost::apply_visitor(fdd::Finder{other}, d), nullptr);
+
+    oxm::field_set plain{F<1>() == 2};
+    EXPECT_EQ(*boost::apply_visitor(fdd::Finder{plain}, d),
+              fdd::leaf{{ oxm::field_set{F<3>() == 4} }});
+}
+
 TEST(FddTraverseTest, FddTraverseWithMapleCallMeTwice) {
     int call_count = 0;
     policy p = handler([&call_count](Packet& pkt) {
@@ -192,6 +192,89 @@ TEST(FddTraverse, FlowSettings) {
     boost::apply_visitor(translator, d);
 }
 
+TEST(FddPipeline, SharedSubdiagram) {
+    MockBackend backend;
+    auto second = fdd::node {
+        F<2>() == 2,
+        fdd::leaf{{ oxm::field_set{F<3>() == 3} }},
+        fdd::leaf{}
+    };
+    fdd::diagram d = fdd::node { F<1>() == 1, second, second };
+
+    auto first_stage = Field(&Stage::index, 0u);
+    auto second_stage = Field(&Stage::index, 1u);
+    Stage positive_next, negative_next, installed;
+    uint16_t positive_prio = 0, negative_prio = 0;
+    EXPECT_CALL(backend, installGoto(first_stage, oxm::field_set{F<1>() == 1}, _, second_stage))
+        .WillOnce(DoAll(SaveArg<2>(&positive_prio), SaveArg<3>(&positive_next)));
+    EXPECT_CALL(backend, installGoto(first_stage, oxm::field_set{}, _, second_stage))
+        .WillOnce(DoAll(SaveArg<2>(&negative_prio), SaveArg<3>(&negative_next)));
+    // the subdiagram is installed once
+    EXPECT_CALL(backend, installIn(second_stage, oxm::field_set{F<2>() == 2}, _, _, _))
+        .WillOnce(SaveArg<0>(&installed));
+    // drop at the bottom of the stage is the table miss
+    EXPECT_CALL(backend, installIn(_, oxm::field_set{}, _, _, _)).Times(0);
+    EXPECT_CALL(backend, install(_, _, _, _)).Times(0);
+
+    fdd::Pipeline pipeline(backend, [](oxm::type type) {
+        return type == oxm::type(F<2>()) ? 1u : 0u;
+    });
+    pipeline.translate(d);
+
+    EXPECT_NE(positive_next.metadata, 0u);
+    EXPECT_EQ(positive_next.metadata, negative_next.metadata);
+    EXPECT_EQ(installed.metadata, positive_next.metadata);
+    EXPECT_GT(positive_prio, negative_prio);
+}
+
+TEST(FddPipeline, LeavesKnowTheirStage) {
+    MockBackend backend;
+    policy p = handler([](Packet& pkt){return stop();});
+    auto pf = boost::get<PacketFunction>(p);
+    fdd::diagram d = fdd::node {
+        F<1>() == 1,
+        fdd::node { F<2>() == 2, fdd::leaf{{ {oxm::field_set{}, pf} }}, fdd::leaf{} },
+        fdd::leaf{}
+    };
+
+    Stage next;
+    EXPECT_CALL(backend, installGoto(_, _, _, Field(&Stage::index, 1u)))
+        .WillOnce(SaveArg<3>(&next));
+    // drop of the first stage, drop of the second one is the table miss
+    EXPECT_CALL(backend, install(_, _, _, _)).Times(1);
+    EXPECT_CALL(backend, installBarrierIn(Field(&Stage::index, 1u), _, _)).Times(1);
+
+    fdd::Pipeline pipeline(backend, [](oxm::type type) {
+        return type == oxm::type(F<2>()) ? 1u : 0u;
+    });
+    pipeline.translate(d);
+
+    auto& first = boost::get<fdd::node>(d);
+    auto& barrier = boost::get<fdd::leaf>(boost::get<fdd::node>(first.positive).positive);
+    EXPECT_EQ(barrier.stage, 1u);
+    EXPECT_EQ(barrier.metadata, next.metadata);
+    EXPECT_EQ(boost::get<fdd::leaf>(first.negative).stage, 0u);
+}
+
+TEST(FddPipeline, StageBackendKeepsNoState) {
+    MockBackend backend;
+    StageBackend second(backend, Stage{1, 7});
+    StageBackend third(backend, Stage{2, 9});
+
+    InSequence seq;
+    EXPECT_CALL(backend, installIn(AllOf(Field(&Stage::index, 1u),
+                                         Field(&Stage::metadata, 7u)), _, _, 10, _));
+    EXPECT_CALL(backend, installBarrierIn(AllOf(Field(&Stage::index, 2u),
+                                                Field(&Stage::metadata, 9u)), _, 20));
+    EXPECT_CALL(backend, installBarrierIn(Field(&Stage::index, 1u), _, 30));
+    EXPECT_CALL(backend, install(_, _, 40, _));
+
+    second.install(oxm::field_set{}, {}, 10, FlowSettings{});
+    third.installBarrier(oxm::field_set{}, 20);
+    second.installBarrier(oxm::field_set{}, 30);
+    backend.install(oxm::field_set{}, {}, 40, FlowSettings{});
+}
+
 // TestTreeTranslation
 //
 TEST(TraceTreeTranslation, Unexplored) {
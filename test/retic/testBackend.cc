@@ -22,11 +22,80 @@ using secs = std::chrono::seconds;
 
 class MockDriver: public OFDriver {
 public:
-    MOCK_METHOD4(installRule, RulePtr(oxm::field_set, uint16_t, Actions, uint8_t));
+    MOCK_METHOD5(installRule, RulePtr(oxm::field_set, uint16_t, Actions, uint8_t, uint32_t));
     MOCK_METHOD2(installGroup, GroupPtr(GroupType, std::vector<Actions>));
-    MOCK_METHOD3(packetOut, void(uint8_t* data, size_t data_len, Actions));
+    MOCK_METHOD4(packetOut, void(uint8_t* data, size_t data_len, std::vector<Actions>, uint32_t));
+    MOCK_METHOD0(nextGeneration, uint32_t());
+    MOCK_METHOD1(removeGeneration, void(uint32_t));
+    MOCK_METHOD2(removeRules, void(oxm::field_set, uint32_t));
+    MOCK_METHOD0(removeAllGenerations, void());
 };
 
+TEST(BackendTest, RemoveGeneration) {
+    auto mock_driver1 = std::make_shared<MockDriver>();
+    auto mock_driver2 = std::make_shared<MockDriver>();
+    std::unordered_map<uint64_t, OFDriverPtr> drivers {
+        {1, mock_driver1}, {2, mock_driver2}
+    };
+
+    EXPECT_CALL(*mock_driver1, nextGeneration()).WillOnce(Return(7));
+    EXPECT_CALL(*mock_driver2, nextGeneration()).WillOnce(Return(8));
+    auto backend = std::make_unique<Of13Backend>(drivers, 2);
+    Mock::VerifyAndClearExpectations(mock_driver1.get());
+    Mock::VerifyAndClearExpectations(mock_driver2.get());
+
+    EXPECT_CALL(*mock_driver1, removeGeneration(7));
+    EXPECT_CALL(*mock_driver2, removeGeneration(8));
+    backend.reset();
+}
+
+
+TEST(BackendTest, InterleavedGenerations) {
+    auto mock_driver = std::make_shared<MockDriver>();
+    std::unordered_map<uint64_t, OFDriverPtr> drivers {{1, mock_driver}};
+
+    EXPECT_CALL(*mock_driver, nextGeneration())
+        .WillOnce(Return(7))
+        .WillOnce(Return(8));
+    auto old_backend = std::make_unique<Of13Backend>(drivers, 2);
+    auto new_backend = std::make_unique<Of13Backend>(drivers, 2);
+
+    // e.g. a packet-in still holds the previous snapshot
+    InSequence seq;
+    EXPECT_CALL(*mock_driver, installRule(oxm::field_set{F<1>() == 1}, 10, _, 2, 7));
+    EXPECT_CALL(*mock_driver, installRule(oxm::field_set{F<1>() == 2}, 20, _, 2, 8));
+    EXPECT_CALL(*mock_driver, installRule(oxm::field_set{F<1>() == 3}, 30, _, 2, 7));
+    EXPECT_CALL(*mock_driver, removeGeneration(7));
+
+    old_backend->install(oxm::field_set{F<1>() == 1}, {}, 10, FlowSettings{});
+    new_backend->install(oxm::field_set{F<1>() == 2}, {}, 20, FlowSettings{});
+    old_backend->installBarrier(oxm::field_set{F<1>() == 3}, 30);
+    old_backend.reset();
+    Mock::VerifyAndClearExpectations(mock_driver.get());
+
+    EXPECT_CALL(*mock_driver, removeGeneration(8));
+}
+
+TEST(BackendTest, RemoveRules) {
+    auto mock_driver1 = std::make_shared<MockDriver>();
+    auto mock_driver2 = std::make_shared<MockDriver>();
+    std::unordered_map<uint64_t, OFDriverPtr> drivers {
+        {1, mock_driver1}, {2, mock_driver2}
+    };
+
+    EXPECT_CALL(*mock_driver1, nextGeneration()).WillOnce(Return(7));
+    EXPECT_CALL(*mock_driver2, nextGeneration()).WillOnce(Return(8));
+    auto backend = std::make_unique<Of13Backend>(drivers, 2);
+
+    EXPECT_CALL(*mock_driver1, removeRules(oxm::field_set{F<1>() == 1}, 7));
+    EXPECT_CALL(*mock_driver2, removeRules(oxm::field_set{F<1>() == 1}, 8));
+    backend->removeRules(oxm::field_set{F<1>() == 1});
+    Mock::VerifyAndClearExpectations(mock_driver1.get());
+    Mock::VerifyAndClearExpectations(mock_driver2.get());
+
+    EXPECT_CALL(*mock_driver1, removeGeneration(7));
+    EXPECT_CALL(*mock_driver2, removeGeneration(8));
+}
 
 TEST(BackendTest, DropPacket) {
     auto mock_driver = std::make_shared<MockDriver>();
@@ -38,7 +107,7 @@ TEST(BackendTest, DropPacket) {
     Actions actions = {};
 
     EXPECT_CALL(*mock_driver, 
-        installRule(oxm::field_set{F<1>() == 1}, 10, actions, 2));
+        installRule(oxm::field_set{F<1>() == 1}, 10, actions, 2, _));
 
     Of13Backend backend(drivers, 2);
     backend.install(
@@ -59,7 +128,7 @@ TEST(BackendTest, InstallSimpleRule) {
     Actions actions = {.out_port = 101, .set_fields = oxm::field_set{F<2>() == 2}};
 
     EXPECT_CALL(*mock_driver,
-        installRule(oxm::field_set{F<1>() == 1}, 10, actions, 2));
+        installRule(oxm::field_set{F<1>() == 1}, 10, actions, 2, _));
 
     Of13Backend backend(drivers, 2);
     backend.install(
@@ -70,6 +139,37 @@ TEST(BackendTest, InstallSimpleRule) {
     );
 }
 
+TEST(BackendTest, PipelineStages) {
+    auto mock_driver = std::make_shared<MockDriver>();
+    OFDriverPtr driver = mock_driver;
+    std::unordered_map<uint64_t, OFDriverPtr> drivers {
+        {1, driver}
+    };
+
+    Actions to_second = {.goto_table = 3, .metadata = 5};
+    Actions output = {.out_port = 101};
+    Actions barrier = {.out_port = ports::to_controller};
+
+    InSequence seq;
+    EXPECT_CALL(*mock_driver,
+        installRule(oxm::field_set{F<1>() == 1}, 10, to_second, 2, _));
+    EXPECT_CALL(*mock_driver,
+        installRule(oxm::field_set{F<2>() == 2, oxm::metadata() == 5}, 20, output, 3, _));
+    EXPECT_CALL(*mock_driver,
+        installRule(oxm::field_set{oxm::metadata() == 5}, 30, barrier, 3, _));
+    // the first stage doesn't match metadata
+    EXPECT_CALL(*mock_driver,
+        installRule(oxm::field_set{F<1>() == 2}, 40, output, 2, _));
+
+    Of13Backend backend(drivers, 2);
+    backend.installGoto(Stage{}, oxm::field_set{F<1>() == 1}, 10, Stage{1, 5});
+    backend.installIn(Stage{1, 5}, oxm::field_set{F<2>() == 2},
+                      {oxm::field_set{oxm::out_port() == 101}}, 20, FlowSettings{});
+    backend.installBarrierIn(Stage{1, 5}, oxm::field_set{}, 30);
+    backend.install(oxm::field_set{F<1>() == 2},
+                    {oxm::field_set{oxm::out_port() == 101}}, 40, FlowSettings{});
+}
+
 TEST(BackendTest, NoActions) {
     auto mock_driver = std::make_shared<MockDriver>();
     OFDriverPtr driver = mock_driver;
@@ -80,7 +180,7 @@ TEST(BackendTest, NoActions) {
     Actions actions = {};
 
     EXPECT_CALL(*mock_driver,
-        installRule(oxm::field_set{F<1>() == 1}, 10, actions, 2));
+        installRule(oxm::field_set{F<1>() == 1}, 10, actions, 2, _));
 
     Of13Backend backend(drivers, 2);
     backend.install(
@@ -115,7 +215,7 @@ TEST(BackendTest, MultiActions) {
     Actions to_group = {.group_id = 634};
 
     EXPECT_CALL(*mock_driver, 
-        installRule(oxm::field_set{F<1>() == 1}, 10, to_group, 2));
+        installRule(oxm::field_set{F<1>() == 1}, 10, to_group, 2, _));
 
     Of13Backend backend(drivers, 2);
     backend.install(
@@ -144,10 +244,10 @@ TEST(BackendTest, TwoSwitch) {
     Actions acts = {};
 
     EXPECT_CALL(*mock_driver1,
-        installRule(oxm::field_set{}, 10, acts, 2));
+        installRule(oxm::field_set{}, 10, acts, 2, _));
 
     EXPECT_CALL(*mock_driver2,
-        installRule(oxm::field_set{}, 10, acts, 2));
+        installRule(oxm::field_set{}, 10, acts, 2, _));
 
     Of13Backend backend(drivers, 2);
     backend.install(
@@ -173,10 +273,10 @@ TEST(BackendTest, TwoSwitchOneRule) {
     Actions acts = {};
 
     EXPECT_CALL(*mock_driver1,
-        installRule(_, _, _, _)).Times(0);
+        installRule(_, _, _, _, _)).Times(0);
 
     EXPECT_CALL(*mock_driver2,
-        installRule(oxm::field_set{}, 10, acts, 2));
+        installRule(oxm::field_set{}, 10, acts, 2, _));
 
     Of13Backend backend(drivers, 2);
     backend.install(
@@ -198,7 +298,7 @@ TEST(BackendTest, NoSwitchInAction) {
     Actions acts = {};
 
     EXPECT_CALL(*mock_driver1,
-        installRule(_, _, _, _)).Times(0);
+        installRule(_, _, _, _, _)).Times(0);
 
     Of13Backend backend(drivers, 2);
     backend.install(
@@ -224,10 +324,10 @@ TEST(BackendTest, TwoSwitchOneBarrierRule) {
     Actions acts = {.out_port = ports::to_controller};
 
     EXPECT_CALL(*mock_driver1,
-        installRule(_, _, _, _)).Times(0);
+        installRule(_, _, _, _, _)).Times(0);
 
     EXPECT_CALL(*mock_driver2,
-        installRule(oxm::field_set{}, 10, acts, 2));
+        installRule(oxm::field_set{}, 10, acts, 2, _));
 
     Of13Backend backend(drivers, 2);
     backend.installBarrier(
@@ -247,7 +347,7 @@ TEST(BackendTest, BarrierRule) {
     Actions acts = {.out_port = ports::to_controller};
 
     EXPECT_CALL(*mock_driver1,
-        installRule(oxm::field_set{}, 10, acts, 2));
+        installRule(oxm::field_set{}, 10, acts, 2, _));
 
     Of13Backend backend(drivers, 2);
     backend.installBarrier(
@@ -256,6 +356,19 @@ TEST(BackendTest, BarrierRule) {
     );
 }
 
+TEST(BackendTest, BarrierRuleMissSendLen) {
+    auto mock_driver = std::make_shared<MockDriver>();
+    OFDriverPtr driver = mock_driver;
+
+    Actions acts = {.out_port = ports::to_controller, .max_len = 128};
+
+    EXPECT_CALL(*mock_driver,
+        installRule(oxm::field_set{}, 10, acts, 2, _));
+
+    Of13Backend backend({{1, driver}}, 2, 128);
+    backend.installBarrier(oxm::field_set{}, 10);
+}
+
 TEST(BackendTest, BarrierRuleNoSwitch) {
     auto mock_driver1 = std::make_shared<MockDriver>();
     OFDriverPtr driver1 = mock_driver1;
@@ -267,7 +380,7 @@ TEST(BackendTest, BarrierRuleNoSwitch) {
     Actions acts = {.out_port = ports::to_controller};
 
     EXPECT_CALL(*mock_driver1,
-        installRule(_, _, _, _)).Times(0);
+        installRule(_, _, _, _, _)).Times(0);
 
     Of13Backend backend(drivers, 2);
     backend.installBarrier(
@@ -291,16 +404,132 @@ TEST(BackendTest, TestPacketOuts) {
     uint8_t data[16];
     size_t data_len = 16;
 
-    EXPECT_CALL(*mock_driver, packetOut(data, data_len, Actions{.out_port = 1}));
+    // the second output overwrites all fields of the first one
+    EXPECT_CALL(
+        *mock_driver,
+        packetOut(
+            data, data_len,
+            std::vector<Actions>{
+                Actions{.out_port = 1},
+                Actions{.out_port = 2, .set_fields = oxm::field_set{F<1>() == 1}}
+            },
+            buffers::no_buffer
+        )
+    );
+
+    backend.packetOuts(data, data_len, actions, 1, buffers::no_buffer, oxm::field_set{});
+}
+
+TEST(BackendTest, PacketOutsDifferentFields) {
+    auto mock_driver = std::make_shared<MockDriver>();
+    OFDriverPtr driver = mock_driver;
+
+    std::vector<oxm::field_set> actions = {
+        oxm::field_set{F<1>() == 1, oxm::out_port() == 1},
+        oxm::field_set{F<2>() == 2, oxm::out_port() == 2},
+        oxm::field_set{F<3>() == 3, oxm::out_port() == 3}
+    };
+    // header values of the packet-in
+    oxm::field_set pkt{F<1>() == 7, F<2>() == 8, F<3>() == 9};
+
+    Of13Backend backend({{1, driver}}, 1);
+
+    uint8_t data[16];
+    size_t data_len = 16;
+
+    // the buffered packet is sent whole once,
+    // each copy undoes modifications of the previous ones
+    EXPECT_CALL(
+        *mock_driver,
+        packetOut(
+            data, data_len,
+            std::vector<Actions>{
+                Actions{.out_port = 1, .set_fields = oxm::field_set{F<1>() == 1}},
+                Actions{.out_port = 2, .set_fields = oxm::field_set{F<1>() == 7, F<2>() == 2}},
+                Actions{.out_port = 3, .set_fields = oxm::field_set{F<1>() == 7, F<2>() == 8, F<3>() == 3}}
+            },
+            42
+        )
+    );
+
+    backend.packetOuts(data, data_len, actions, 1, 42, pkt);
+}
+
+TEST(BackendTest, PacketOutsPartialOverwrite) {
+    auto mock_driver = std::make_shared<MockDriver>();
+    OFDriverPtr driver = mock_driver;
+
+    // the second copy modifies F<1> too, but not every bit of it
+    std::vector<oxm::field_set> actions = {
+        oxm::field_set{F<1>() == 0x0102, oxm::out_port() == 1},
+        oxm::field_set{(F<1>() & 0xff00) == 0x0300, F<2>() == 2, oxm::out_port() == 2}
+    };
+    oxm::field_set pkt{F<1>() == 0x0405};
+
+    Of13Backend backend({{1, driver}}, 1);
+
+    uint8_t data[16];
+    size_t data_len = 16;
+
+    EXPECT_CALL(
+        *mock_driver,
+        packetOut(
+            data, data_len,
+            std::vector<Actions>{
+                Actions{.out_port = 1, .set_fields = oxm::field_set{F<1>() == 0x0102}},
+                Actions{.out_port = 2, .set_fields = oxm::field_set{F<1>() == 0x0305, F<2>() == 2}}
+            },
+            buffers::no_buffer
+        )
+    );
+
+    backend.packetOuts(data, data_len, actions, 1, buffers::no_buffer, pkt);
+}
+
+TEST(BackendTest, BufferedPacketOut) {
+    auto mock_driver = std::make_shared<MockDriver>();
+    OFDriverPtr driver = mock_driver;
+
+    std::vector<oxm::field_set> actions = {
+        oxm::field_set{F<1>() == 1, oxm::out_port() == 2},
+        oxm::field_set{F<1>() == 2, oxm::out_port() == 3}
+    };
+
+    Of13Backend backend({{1, driver}}, 1);
+
+    uint8_t data[16];
+    size_t data_len = 16;
+
     EXPECT_CALL(
         *mock_driver,
         packetOut(
             data, data_len,
-            Actions{.out_port = 2, .set_fields = oxm::field_set{F<1>() == 1}}
+            std::vector<Actions>{
+                Actions{.out_port = 2, .set_fields = oxm::field_set{F<1>() == 1}},
+                Actions{.out_port = 3, .set_fields = oxm::field_set{F<1>() == 2}}
+            },
+            42
         )
     );
 
-    backend.packetOuts(data, data_len, actions, 1);
+    backend.packetOuts(data, data_len, actions, 1, 42, oxm::field_set{});
+}
+
+TEST(BackendTest, DropBufferedPacket) {
+    auto mock_driver = std::make_shared<MockDriver>();
+    OFDriverPtr driver = mock_driver;
+
+    Of13Backend backend({{1, driver}}, 1);
+
+    uint8_t data[16];
+    size_t data_len = 16;
+
+    EXPECT_CALL(*mock_driver,
+        packetOut(data, data_len, std::vector<Actions>{}, 42));
+    backend.packetOuts(data, data_len, {oxm::field_set{F<1>() == 1}}, 1, 42, oxm::field_set{});
+
+    EXPECT_CALL(*mock_driver, packetOut(_, _, _, buffers::no_buffer)).Times(0);
+    backend.packetOuts(data, data_len, {}, 1, buffers::no_buffer, oxm::field_set{});
 }
 
 TEST(BackendTest, FlowSettings) {
@@ -314,7 +543,7 @@ TEST(BackendTest, FlowSettings) {
 
     EXPECT_CALL(*mock_driver,
         installRule(
-            _, _, Actions{.out_port = 1, .idle_timeout = 10, .hard_timeout = 20}, _
+            _, _, Actions{.out_port = 1, .idle_timeout = 10, .hard_timeout = 20}, _, _
         )
     ).Times(1);
 
@@ -335,7 +564,7 @@ TEST(BackendTest, FlowSettingsInfinitySettings) {
 
     EXPECT_CALL(*mock_driver,
         installRule(
-            _, _, Actions{.out_port = 1, .idle_timeout = 0, .hard_timeout = 0}, _
+            _, _, Actions{.out_port = 1, .idle_timeout = 0, .hard_timeout = 0}, _, _
         )
     ).Times(1);
 
@@ -354,7 +583,7 @@ TEST(BackendTest, FlowSettingsNoInstallRule) {
         oxm::field_set{oxm::out_port() == 1}
     };
 
-    EXPECT_CALL(*mock_driver, installRule(_, _, _, _)).Times(0);
+    EXPECT_CALL(*mock_driver, installRule(_, _, _, _, _)).Times(0);
 
     backend.install(
         oxm::field_set{}, actions, 10,
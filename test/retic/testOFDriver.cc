@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "oxm/openflow_basic.hh"
+#include "types/exception.hh"
+#include "OFDriver.hh"
+#include "SwitchConnection.hh"
+
+using namespace runos;
+using namespace ::testing;
+
+namespace {
+
+constexpr uint8_t OFPT_FLOW_MOD = 14;
+constexpr uint8_t OFPT_GROUP_MOD = 15;
+constexpr uint16_t OFPGC_ADD = 0;
+constexpr uint16_t OFPGC_DELETE = 2;
+constexpr uint8_t OFPFC_ADD = 0;
+constexpr uint8_t OFPFC_DELETE = 3;
+
+// Records messages in wire format instead of sending them
+class FakeConnection: public SwitchConnection {
+public:
+    FakeConnection()
+        : SwitchConnection(nullptr, 1)
+    {
+        m_replayed = true; // alive without OFConnection
+    }
+
+    void send(const void* data, size_t len) override {
+        auto bytes = static_cast<const uint8_t*>(data);
+        sent.emplace_back(bytes, bytes + len);
+    }
+
+    std::vector<std::vector<uint8_t>> sent;
+};
+
+struct GroupMod {
+    uint16_t command;
+    uint32_t group_id;
+};
+
+std::vector<GroupMod> group_mods(const FakeConnection& conn) {
+    std::vector<GroupMod> ret;
+    for (auto& msg : conn.sent) {
+        if (msg.size() < 16 || msg[1] != OFPT_GROUP_MOD)
+            continue;
+        ret.push_back(GroupMod{
+            uint16_t(msg[8] << 8 | msg[9]),
+            uint32_t(msg[12]) << 24 | uint32_t(msg[13]) << 16 |
+            uint32_t(msg[14]) << 8 | uint32_t(msg[15])
+        });
+    }
+    return ret;
+}
+
+struct FlowMod {
+    uint8_t command;
+    uint64_t cookie;
+    uint64_t cookie_mask;
+};
+
+uint64_t load64(const std::vector<uint8_t>& msg, size_t offset) {
+    uint64_t ret = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        ret = ret << 8 | msg[offset + i];
+    }
+    return ret;
+}
+
+std::vector<FlowMod> flow_mods(const FakeConnection& conn) {
+    std::vector<FlowMod> ret;
+    for (auto& msg : conn.sent) {
+        if (msg.size() < 26 || msg[1] != OFPT_FLOW_MOD)
+            continue;
+        ret.push_back(FlowMod{msg[25], load64(msg, 8), load64(msg, 16)});
+    }
+    return ret;
+}
+
+} // namespace
+
+TEST(OFDriverTest, OldGenerationKeepsInstalling) {
+    auto conn = std::make_shared<FakeConnection>();
+    auto driver = makeDriver(conn);
+
+    uint32_t old_gen = driver->nextGeneration();
+    uint32_t new_gen = driver->nextGeneration();
+    ASSERT_NE(old_gen, new_gen);
+
+    driver->installRule(oxm::field_set{}, 10, Actions{.out_port = 1}, 0, new_gen);
+    driver->installRule(oxm::field_set{}, 20, Actions{.out_port = 2}, 0, old_gen);
+    driver->removeGeneration(old_gen);
+
+    auto mods = flow_mods(*conn);
+    ASSERT_EQ(mods.size(), 3u);
+    EXPECT_EQ(mods[0].command, OFPFC_ADD);
+    EXPECT_EQ(mods[1].command, OFPFC_ADD);
+    EXPECT_EQ(mods[2].command, OFPFC_DELETE);
+    uint64_t mask = mods[2].cookie_mask;
+    // the delete removes the late rule of the old generation only
+    EXPECT_EQ(mods[1].cookie & mask, mods[2].cookie & mask);
+    EXPECT_NE(mods[0].cookie & mask, mods[2].cookie & mask);
+}
+
+TEST(OFDriverTest, RemoveRulesOfGeneration) {
+    auto conn = std::make_shared<FakeConnection>();
+    auto driver = makeDriver(conn);
+
+    uint32_t gen = driver->nextGeneration();
+    driver->installRule(oxm::field_set{oxm::in_port() == 1}, 10, Actions{.out_port = 1}, 0, gen);
+    driver->installRule(oxm::field_set{oxm::in_port() == 2}, 10, Actions{.out_port = 1}, 3, gen);
+    // no rules in this generation
+    driver->removeRules(oxm::field_set{oxm::in_port() == 1}, driver->nextGeneration());
+    driver->removeRules(oxm::field_set{oxm::in_port() == 1}, gen);
+
+    auto mods = flow_mods(*conn);
+    ASSERT_EQ(mods.size(), 4u);
+    EXPECT_EQ(mods[2].command, OFPFC_DELETE);
+    EXPECT_EQ(mods[3].command, OFPFC_DELETE);
+    // one delete per table of the generation
+    uint64_t mask = mods[2].cookie_mask;
+    EXPECT_EQ(mods[0].cookie & mask, mods[2].cookie & mask);
+    EXPECT_EQ(mods[1].cookie & mask, mods[3].cookie & mask);
+}
+
+TEST(OFDriverTest, SameBucketsShareGroup) {
+    auto conn = std::make_shared<FakeConnection>();
+    auto driver = makeDriver(conn);
+
+    std::vector<Actions> buckets {
+        Actions{.out_port = 1}, Actions{.out_port = 2}
+    };
+    GroupPtr first = driver->installGroup(GroupType::All, buckets);
+    GroupPtr second = driver->installGroup(GroupType::All, buckets);
+    ASSERT_EQ(first, second);
+
+    GroupPtr other_type = driver->installGroup(GroupType::Select, buckets);
+    EXPECT_NE(other_type->id(), first->id());
+
+    auto mods = group_mods(*conn);
+    ASSERT_EQ(mods.size(), 2u);
+    EXPECT_EQ(mods[0].command, OFPGC_ADD);
+    EXPECT_EQ(mods[0].group_id, first->id());
+    EXPECT_EQ(mods[1].command, OFPGC_ADD);
+    EXPECT_EQ(mods[1].group_id, other_type->id());
+}
+
+TEST(OFDriverTest, LastPointerRemovesGroup) {
+    auto conn = std::make_shared<FakeConnection>();
+    auto driver = makeDriver(conn);
+
+    std::vector<Actions> buckets { Actions{.out_port = 1} };
+    GroupPtr first = driver->installGroup(GroupType::Indirect, buckets);
+    GroupPtr second = driver->installGroup(GroupType::Indirect, buckets);
+    uint32_t id = first->id();
+
+    first.reset();
+    ASSERT_EQ(group_mods(*conn).size(), 1u);
+
+    second.reset();
+    auto mods = group_mods(*conn);
+    ASSERT_EQ(mods.size(), 2u);
+    EXPECT_EQ(mods[1].command, OFPGC_DELETE);
+    EXPECT_EQ(mods[1].group_id, id);
+
+    // removed group is not reused
+    GroupPtr third = driver->installGroup(GroupType::Indirect, buckets);
+    EXPECT_NE(third->id(), id);
+    mods = group_mods(*conn);
+    ASSERT_EQ(mods.size(), 3u);
+    EXPECT_EQ(mods[2].command, OFPGC_ADD);
+}
+
+TEST(OFDriverTest, IndirectGroupWithTwoBuckets) {
+    auto conn = std::make_shared<FakeConnection>();
+    auto driver = makeDriver(conn);
+
+    std::vector<Actions> buckets {
+        Actions{.out_port = 1}, Actions{.out_port = 2}
+    };
+    EXPECT_THROW(driver->installGroup(GroupType::Indirect, buckets),
+                 invalid_argument);
+    EXPECT_TRUE(group_mods(*conn).empty());
+}
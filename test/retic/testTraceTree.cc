@@ -336,6 +336,56 @@ TEST(TraverseTraceTree, Test) {
     EXPECT_EQ(match2, oxm::field_set{});
 }
 
+TEST(ForgetTraceTree, Load) {
+    oxm::field<> f1 = F<1>() == 1;
+    oxm::field<> f2 = F<1>() == 2;
+    auto dh = std::make_shared<fdd::diagram_holder>();
+    dh->value = fdd::leaf{};
+    trace_tree::node root = trace_tree::test_node{
+        F<2>() == 2,
+        trace_tree::load_node{
+            oxm::mask<>(f1),
+            {
+                {f1.value_bits(), trace_tree::leaf_node{stop(), dh}},
+                {f2.value_bits(), trace_tree::leaf_node{stop(), dh}}
+            }
+        },
+        trace_tree::leaf_node{stop(), dh}
+    };
+
+    EXPECT_TRUE(trace_tree::forget(root, f1));
+
+    oxm::field_set forgotten{F<1>() == 1, F<2>() == 2};
+    trace_tree::Traverser traverser1(forgotten);
+    EXPECT_EQ(nullptr, boost::apply_visitor(traverser1, root).first);
+
+    oxm::field_set kept{F<1>() == 2, F<2>() == 2};
+    trace_tree::Traverser traverser2(kept);
+    EXPECT_EQ(dh, boost::apply_visitor(traverser2, root).first);
+
+    // the result didn't depend on the field
+    oxm::field_set independent{F<1>() == 1, F<2>() == 3};
+    trace_tree::Traverser traverser3(independent);
+    EXPECT_EQ(dh, boost::apply_visitor(traverser3, root).first);
+}
+
+TEST(ForgetTraceTree, ExactTest) {
+    auto dh = std::make_shared<fdd::diagram_holder>();
+    dh->value = fdd::leaf{};
+    trace_tree::node root = trace_tree::test_node{
+        F<1>() == 1,
+        trace_tree::leaf_node{stop(), dh},
+        trace_tree::leaf_node{stop(), dh}
+    };
+    auto copy = root;
+
+    // packets with other values take the negative branch
+    EXPECT_TRUE(trace_tree::forget(root, F<1>() == 2));
+    EXPECT_EQ(copy, root);
+    // the barrier of the test matches the field
+    EXPECT_FALSE(trace_tree::forget(root, F<1>() == 1));
+}
+
 TEST(TraceTreeComplex, GetTracesMergeAndAugment) {
     MockBackend backend;
     trace_tree::node root = trace_tree::unexplored{};
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE admission tests
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "PacketInAdmission.hh"
+
+using namespace runos;
+using namespace runos::admission;
+
+namespace {
+
+// OFPT_PACKET_IN with empty OXM match and ethernet frame of `eth_type`
+std::vector<uint8_t> packet_in(uint8_t reason, uint16_t eth_type,
+                               bool vlan = false)
+{
+    std::vector<uint8_t> ret(8 + 16 + 8 + 2);
+    ret[0] = 4;  // version
+    ret[1] = 10; // OFPT_PACKET_IN
+    ret[8 + 6] = reason;
+    ret[8 + 16 + 1] = 1; // OFPMT_OXM
+    ret[8 + 16 + 3] = 4; // match length, padded to 8
+
+    std::vector<uint8_t> frame(14, 0);
+    if (vlan) {
+        frame[12] = 0x81;
+        frame.insert(frame.end(), 4, 0);
+        frame[16] = eth_type >> 8;
+        frame[17] = eth_type & 0xff;
+    } else {
+        frame[12] = eth_type >> 8;
+        frame[13] = eth_type & 0xff;
+    }
+    ret.insert(ret.end(), frame.begin(), frame.end());
+    ret[2] = ret.size() >> 8;
+    ret[3] = ret.size() & 0xff;
+    return ret;
+}
+
+PacketClass classify(const std::vector<uint8_t>& msg)
+{
+    return admission::classify(msg.data(), msg.size());
+}
+
+Message message(PacketClass cls, uintptr_t id)
+{
+    return Message{reinterpret_cast<void*>(id), 0, cls};
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE( runos_admission_tests )
+
+BOOST_AUTO_TEST_CASE( classification ) {
+    BOOST_CHECK(classify(packet_in(0, 0x88cc)) == PacketClass::Lldp);
+    BOOST_CHECK(classify(packet_in(1, 0x0806)) == PacketClass::Arp);
+    BOOST_CHECK(classify(packet_in(0, 0x0806, true)) == PacketClass::Arp);
+    BOOST_CHECK(classify(packet_in(0, 0x0800)) == PacketClass::TableMiss);
+    BOOST_CHECK(classify(packet_in(1, 0x0800)) == PacketClass::Inspect);
+
+    // truncated message
+    auto msg = packet_in(0, 0x88cc);
+    BOOST_CHECK(admission::classify(msg.data(), 20) == PacketClass::Inspect);
+}
+
+BOOST_AUTO_TEST_CASE( burst_and_refill ) {
+    Settings settings;
+    settings.enabled = true;
+    settings.rate = 100.0;
+    settings.burst = 2.0;
+    SwitchAdmission adm(settings);
+
+    BOOST_CHECK(adm.tryAdmit(PacketClass::Inspect));
+    BOOST_CHECK(adm.tryAdmit(PacketClass::Inspect));
+    BOOST_CHECK(not adm.tryAdmit(PacketClass::Inspect));
+
+    // one token per 10 ms, no more than burst
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BOOST_CHECK(adm.tryAdmit(PacketClass::Inspect));
+    BOOST_CHECK(adm.tryAdmit(PacketClass::Inspect));
+    BOOST_CHECK(not adm.tryAdmit(PacketClass::Inspect));
+
+    auto stats = adm.stats();
+    BOOST_CHECK_EQUAL(stats.classes[size_t(PacketClass::Inspect)].admitted, 4u);
+}
+
+BOOST_AUTO_TEST_CASE( drain_by_rank ) {
+    Settings settings;
+    settings.enabled = true;
+    settings.rate = 1e6;
+    settings.burst = 1.0;
+    SwitchAdmission adm(settings);
+
+    Message evicted;
+    BOOST_REQUIRE(adm.enqueue(message(PacketClass::Inspect, 1), evicted));
+    BOOST_REQUIRE(adm.enqueue(message(PacketClass::Arp, 2), evicted));
+    BOOST_REQUIRE(adm.enqueue(message(PacketClass::Lldp, 3), evicted));
+    BOOST_REQUIRE(adm.enqueue(message(PacketClass::Arp, 4), evicted));
+
+    // nothing overtakes queued messages
+    BOOST_CHECK(not adm.tryAdmit(PacketClass::Lldp));
+
+    std::vector<uintptr_t> order;
+    Message msg;
+    while (order.size() < 4) {
+        if (adm.dequeue(msg)) {
+            order.push_back(reinterpret_cast<uintptr_t>(msg.data));
+        }
+    }
+    BOOST_CHECK((order == std::vector<uintptr_t>{3, 2, 4, 1}));
+    BOOST_CHECK_EQUAL(adm.stats().queue_depth, 0u);
+}
+
+BOOST_AUTO_TEST_CASE( configured_rank ) {
+    Config config = json11::Json::object{
+        {"admission", json11::Json::object{
+            {"classes", json11::Json::array{"inspect", "lldp"}}
+        }}
+    };
+    Settings settings = Settings::fromConfig(config);
+    BOOST_CHECK_EQUAL(settings.rank[size_t(PacketClass::Inspect)], 0);
+    BOOST_CHECK_EQUAL(settings.rank[size_t(PacketClass::Lldp)], 1);
+    BOOST_CHECK_EQUAL(settings.rank[size_t(PacketClass::Arp)], 2);
+    BOOST_CHECK_EQUAL(settings.rank[size_t(PacketClass::TableMiss)], 3);
+}
+
+BOOST_AUTO_TEST_CASE( overflow ) {
+    Settings settings;
+    settings.enabled = true;
+    settings.queue_size = 2;
+    SwitchAdmission adm(settings);
+
+    Message evicted;
+    BOOST_CHECK(adm.enqueue(message(PacketClass::Inspect, 1), evicted));
+    BOOST_CHECK(adm.enqueue(message(PacketClass::Arp, 2), evicted));
+
+    // lower or equal priority is dropped
+    BOOST_CHECK(not adm.enqueue(message(PacketClass::Inspect, 3), evicted));
+    BOOST_CHECK(evicted.data == nullptr);
+
+    // higher priority evicts the lowest one
+    BOOST_CHECK(adm.enqueue(message(PacketClass::Lldp, 4), evicted));
+    BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(evicted.data), 1u);
+
+    auto stats = adm.stats();
+    BOOST_CHECK_EQUAL(stats.queue_depth, 2u);
+    BOOST_CHECK_EQUAL(stats.classes[size_t(PacketClass::Inspect)].dropped, 2u);
+
+    auto flushed = adm.flush();
+    BOOST_CHECK_EQUAL(flushed.size(), 2u);
+    BOOST_CHECK_EQUAL(adm.stats().queue_depth, 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
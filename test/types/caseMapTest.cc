@@ -0,0 +1,157 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE case_map tests
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+#include "types/case_map.hh"
+
+using namespace runos;
+
+namespace {
+
+bits<> key(uint64_t value, size_t width = 48)
+{
+    return bits<>(width, (unsigned long)value);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE( runos_types_tests )
+
+BOOST_AUTO_TEST_CASE( small_map ) {
+    case_map<int> m;
+    BOOST_CHECK(m.empty());
+    BOOST_CHECK(m.find(key(1)) == m.end());
+
+    BOOST_CHECK(m.emplace(key(3), 30).second);
+    BOOST_CHECK(m.emplace(key(1), 10).second);
+    BOOST_CHECK(not m.emplace(key(3), 33).second);
+    m[key(2)] = 20;
+
+    BOOST_CHECK_EQUAL(m.size(), 3u);
+    BOOST_CHECK_EQUAL(m.at(key(1)), 10);
+    BOOST_CHECK_EQUAL(m.at(key(2)), 20);
+    BOOST_CHECK_EQUAL(m.at(key(3)), 30);
+    BOOST_CHECK(m.find(key(3))->first == key(3));
+    BOOST_CHECK_EQUAL(m.count(key(4)), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( grows_into_hash_table ) {
+    case_map<uint64_t> m;
+    std::map<uint64_t, uint64_t> reference;
+    std::mt19937_64 rng(42);
+
+    for (int i = 0; i < 20000; ++i) {
+        uint64_t k = rng() & 0xffffffffffff;
+        m[key(k)] = i;
+        reference[k] = i;
+    }
+    BOOST_CHECK_EQUAL(m.size(), reference.size());
+    for (auto& [k, v] : reference) {
+        auto it = m.find(key(k));
+        BOOST_REQUIRE(it != m.end());
+        BOOST_CHECK_EQUAL(it->second, v);
+    }
+
+    size_t visited = 0;
+    for (auto& [k, v] : m) {
+        BOOST_CHECK_EQUAL(reference.at(k.to_ulong()), v);
+        ++visited;
+    }
+    BOOST_CHECK_EQUAL(visited, reference.size());
+}
+
+BOOST_AUTO_TEST_CASE( references_are_stable ) {
+    case_map<int> m;
+    int* first = &m[key(0)];
+    *first = 42;
+    for (uint64_t i = 1; i < 1000; ++i) {
+        m[key(i)] = int(i);
+    }
+    BOOST_CHECK_EQUAL(first, &m.at(key(0)));
+    BOOST_CHECK_EQUAL(*first, 42);
+}
+
+BOOST_AUTO_TEST_CASE( erase_while_iterating ) {
+    for (uint64_t n : {5, 8, 100}) {
+        case_map<std::unique_ptr<int>> m;
+        for (uint64_t i = 0; i < n; ++i) {
+            m.emplace(key(i), new int(int(i)));
+        }
+        for (auto it = m.begin(); it != m.end(); ) {
+            if (*it->second % 2 == 0)
+                it = m.erase(it);
+            else
+                ++it;
+        }
+        BOOST_CHECK_EQUAL(m.size(), n / 2);
+        for (uint64_t i = 0; i < n; ++i) {
+            BOOST_CHECK_EQUAL(m.count(key(i)), i % 2);
+        }
+
+        // tombstones are reused
+        for (uint64_t i = 0; i < n; i += 2) {
+            m.emplace(key(i), new int(int(i)));
+        }
+        BOOST_CHECK_EQUAL(m.size(), n);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( wide_keys ) {
+    case_map<std::string> m;
+    for (uint64_t i = 0; i < 50; ++i) {
+        bits<> k(128, (unsigned long)i);
+        k[127] = true;
+        m[k] = std::to_string(i);
+    }
+    for (uint64_t i = 0; i < 50; ++i) {
+        bits<> k(128, (unsigned long)i);
+        k[127] = true;
+        BOOST_CHECK_EQUAL(m.at(k), std::to_string(i));
+        k[127] = false;
+        BOOST_CHECK(m.find(k) == m.end());
+    }
+}
+
+BOOST_AUTO_TEST_CASE( copy_and_move ) {
+    case_map<int> m;
+    for (uint64_t i = 0; i < 20; ++i) {
+        m[key(i)] = int(i);
+    }
+    case_map<int> copy = m;
+    m[key(0)] = 100;
+    BOOST_CHECK_EQUAL(copy.at(key(0)), 0);
+    BOOST_CHECK_EQUAL(copy.size(), 20u);
+
+    case_map<int> moved = std::move(m);
+    BOOST_CHECK_EQUAL(moved.at(key(0)), 100);
+    BOOST_CHECK(m.empty());
+
+    case_map<int> small;
+    small[key(7)] = 7;
+    moved = small;
+    BOOST_CHECK_EQUAL(moved.size(), 1u);
+    BOOST_CHECK_EQUAL(moved.at(key(7)), 7);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
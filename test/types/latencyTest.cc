@@ -0,0 +1,98 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE latency tests
+
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "types/latency.hh"
+
+using namespace runos::latency;
+
+BOOST_AUTO_TEST_SUITE( runos_types_tests )
+
+BOOST_AUTO_TEST_CASE( buckets_are_contiguous ) {
+    for (size_t b = 1; b < histogram::bucket_count; ++b) {
+        BOOST_REQUIRE_EQUAL(histogram::lowest(b), histogram::highest(b - 1) + 1);
+        BOOST_REQUIRE_EQUAL(histogram::bucket(histogram::lowest(b)), b);
+        BOOST_REQUIRE_EQUAL(histogram::bucket(histogram::highest(b)), b);
+    }
+    BOOST_CHECK_EQUAL(histogram::highest(histogram::bucket_count - 1),
+                      histogram::max_value);
+    BOOST_CHECK_EQUAL(histogram::bucket(~uint64_t(0)),
+                      histogram::bucket_count - 1);
+}
+
+BOOST_AUTO_TEST_CASE( relative_error ) {
+    for (uint64_t v = 1; v < histogram::max_value; v = v * 3 + 7) {
+        auto b = histogram::bucket(v);
+        BOOST_CHECK_LE(histogram::lowest(b), v);
+        BOOST_CHECK_GE(histogram::highest(b), v);
+        BOOST_CHECK_LE(double(histogram::highest(b) - histogram::lowest(b)),
+                       v / 32.0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( quantiles ) {
+    histogram h;
+    BOOST_CHECK_EQUAL(h.quantile(0.5), 0u);
+    for (uint64_t v = 1; v <= 10000; ++v) {
+        h.record(v * 1000);
+    }
+    BOOST_CHECK_EQUAL(h.count(), 10000u);
+    BOOST_CHECK_CLOSE(h.mean(), 5000500.0, 0.001);
+    BOOST_CHECK_CLOSE(double(h.quantile(0.5)), 5000000.0, 3.2);
+    BOOST_CHECK_CLOSE(double(h.quantile(0.99)), 9900000.0, 3.2);
+    BOOST_CHECK_CLOSE(double(h.min()), 1000.0, 3.2);
+    BOOST_CHECK_CLOSE(double(h.max()), 10000000.0, 3.2);
+    BOOST_CHECK_GE(h.max(), 10000000u);
+}
+
+BOOST_AUTO_TEST_CASE( threads_are_aggregated ) {
+    reset();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([]{
+            for (int i = 0; i < 1000; ++i) {
+                record(Stage::Lookup, 100);
+            }
+            Timer timer{Stage::Total};
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    auto snap = snapshot();
+    const auto& lookup = snap[size_t(Stage::Lookup)];
+    BOOST_CHECK_EQUAL(lookup.count(), 4000u);
+    BOOST_CHECK_EQUAL(lookup.sum(), 400000u);
+    BOOST_CHECK_EQUAL(snap[size_t(Stage::Total)].count(), 4u);
+    BOOST_CHECK_EQUAL(snap[size_t(Stage::Parse)].count(), 0u);
+
+    reset();
+    BOOST_CHECK_EQUAL(snapshot()[size_t(Stage::Lookup)].count(), 0u);
+
+    enable(false);
+    { Timer timer{Stage::Total}; }
+    enable(true);
+    BOOST_CHECK_EQUAL(snapshot()[size_t(Stage::Total)].count(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
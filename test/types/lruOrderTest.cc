@@ -0,0 +1,80 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE lru_order tests
+
+#include <cstdint>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "types/lru_order.hh"
+
+using namespace runos;
+
+BOOST_AUTO_TEST_SUITE( runos_types_tests )
+
+BOOST_AUTO_TEST_CASE( touch_and_erase ) {
+    lru_order<uint64_t> lru;
+    BOOST_CHECK(lru.empty());
+
+    lru.touch(1);
+    lru.touch(2);
+    lru.touch(3);
+    BOOST_CHECK_EQUAL(lru.size(), 3u);
+    BOOST_CHECK_EQUAL(lru.coldest(), 1u);
+
+    lru.touch(1);
+    BOOST_CHECK_EQUAL(lru.size(), 3u);
+    BOOST_CHECK_EQUAL(lru.coldest(), 2u);
+
+    BOOST_CHECK(lru.erase(2));
+    BOOST_CHECK(not lru.erase(2));
+    BOOST_CHECK_EQUAL(lru.coldest(), 3u);
+}
+
+// the way Maple keeps flows under max-flows
+BOOST_AUTO_TEST_CASE( eviction_at_max_size ) {
+    const size_t max_size = 4;
+    lru_order<uint64_t> lru;
+    std::vector<uint64_t> evicted;
+
+    auto use = [&](uint64_t key) {
+        lru.touch(key);
+        while (lru.size() > max_size) {
+            evicted.push_back(lru.coldest());
+            lru.erase(lru.coldest());
+        }
+    };
+
+    for (uint64_t key = 1; key <= 4; ++key) {
+        use(key);
+    }
+    BOOST_CHECK(evicted.empty());
+
+    use(1); // 2 is the coldest now
+    use(5);
+    use(3);
+    use(6);
+
+    std::vector<uint64_t> expected {2, 4};
+    BOOST_CHECK_EQUAL_COLLECTIONS(evicted.begin(), evicted.end(),
+                                  expected.begin(), expected.end());
+    BOOST_CHECK_EQUAL(lru.size(), max_size);
+    BOOST_CHECK_EQUAL(lru.coldest(), 1u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
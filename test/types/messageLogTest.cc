@@ -0,0 +1,143 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE message log tests
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include "MessageLog.hh"
+
+using namespace runos;
+using namespace runos::msglog;
+
+namespace {
+
+struct TempFile {
+    std::string path;
+
+    TempFile()
+    {
+        char name[] = "/tmp/msglogXXXXXX";
+        int fd = ::mkstemp(name);
+        BOOST_REQUIRE(fd >= 0);
+        ::close(fd);
+        path = name;
+    }
+
+    ~TempFile()
+    {
+        std::remove(path.c_str());
+    }
+};
+
+struct Message {
+    uint64_t dpid;
+    uint8_t type;
+    std::vector<uint8_t> data;
+};
+
+const std::vector<Message> messages = {
+    {1, 10, {1, 2, 3}},                     // padded to 8
+    {2, 2,  {4, 5, 6, 7, 8, 9, 10, 11}},    // no padding
+    {0, 0,  {}},                            // empty
+    {0xffffffffffffffff, 19,
+            std::vector<uint8_t>(13, 0xab)} // padded to 16
+};
+
+void write_all(const std::string& path)
+{
+    Writer writer(path);
+    for (auto& m : messages) {
+        writer.write(m.dpid, m.type, m.data.data(), m.data.size());
+    }
+    BOOST_CHECK_EQUAL(writer.records(), messages.size());
+}
+
+size_t read_all(Reader& reader, size_t limit)
+{
+    Record record;
+    size_t n = 0;
+    uint64_t time = 0;
+    while (reader.next(record)) {
+        BOOST_REQUIRE(n < limit);
+        auto& m = messages[n++];
+        BOOST_CHECK_EQUAL(record.dpid, m.dpid);
+        BOOST_CHECK_EQUAL(record.type, m.type);
+        BOOST_CHECK_EQUAL_COLLECTIONS(record.data, record.data + record.len,
+                                      m.data.begin(), m.data.end());
+        BOOST_CHECK_EQUAL(uintptr_t(record.data) % 8, 0u);
+        BOOST_CHECK(record.time >= time);
+        time = record.time;
+    }
+    return n;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+    TempFile file;
+    write_all(file.path);
+
+    Reader reader(file.path);
+    BOOST_CHECK(reader.startTime() > 0);
+    BOOST_CHECK_EQUAL(read_all(reader, messages.size()), messages.size());
+
+    reader.rewind();
+    BOOST_CHECK_EQUAL(read_all(reader, messages.size()), messages.size());
+}
+
+BOOST_AUTO_TEST_CASE(truncated_record)
+{
+    TempFile file;
+    write_all(file.path);
+
+    struct stat st;
+    BOOST_REQUIRE(::stat(file.path.c_str(), &st) == 0);
+    BOOST_REQUIRE_EQUAL(st.st_size, off_t(sizeof(FileHeader) + 128));
+
+    // the last record is 24 bytes of header and 13 of data padded to 16,
+    // padding alone may be lost
+    {
+        BOOST_REQUIRE(::truncate(file.path.c_str(), st.st_size - 3) == 0);
+        Reader reader(file.path);
+        BOOST_CHECK_EQUAL(read_all(reader, messages.size()), 4u);
+    }
+
+    for (off_t cut : {4, 16, 20, 30}) {
+        BOOST_REQUIRE(::truncate(file.path.c_str(), st.st_size - cut) == 0);
+        Reader reader(file.path);
+        BOOST_CHECK_EQUAL(read_all(reader, messages.size()), 3u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(not_a_log)
+{
+    TempFile file;
+    std::FILE* f = std::fopen(file.path.c_str(), "wb");
+    std::fputs("definitely not a message log, but long enough", f);
+    std::fclose(f);
+
+    BOOST_CHECK_THROW(Reader reader(file.path), error);
+}
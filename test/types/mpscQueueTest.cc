@@ -0,0 +1,102 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE mpsc_queue tests
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "types/mpsc_queue.hh"
+
+using namespace runos;
+
+BOOST_AUTO_TEST_SUITE( runos_types_tests )
+
+BOOST_AUTO_TEST_CASE( fifo ) {
+    mpsc_queue<int> queue;
+    int value = 0;
+    BOOST_CHECK(not queue.pop(value));
+
+    for (int i = 0; i < 10; ++i) {
+        queue.push(i);
+    }
+    for (int i = 0; i < 10; ++i) {
+        BOOST_REQUIRE(queue.pop(value));
+        BOOST_CHECK_EQUAL(value, i);
+    }
+    BOOST_CHECK(not queue.pop(value));
+
+    // stub is reused after the queue was drained
+    queue.push(42);
+    BOOST_REQUIRE(queue.pop(value));
+    BOOST_CHECK_EQUAL(value, 42);
+    BOOST_CHECK(not queue.pop(value));
+}
+
+BOOST_AUTO_TEST_CASE( move_only ) {
+    mpsc_queue<std::unique_ptr<int>> queue;
+    queue.push(std::make_unique<int>(1));
+    queue.push(std::make_unique<int>(2));
+
+    std::unique_ptr<int> value;
+    BOOST_REQUIRE(queue.pop(value));
+    BOOST_CHECK_EQUAL(*value, 1);
+    // the rest is freed by the destructor
+}
+
+BOOST_AUTO_TEST_CASE( many_producers ) {
+    const int producers = 4;
+    const int count = 100000;
+    mpsc_queue<std::pair<int, int>> queue;
+
+    std::atomic_int started {0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, &started, p]() {
+            ++started;
+            while (started < producers) { }
+            for (int i = 0; i < count; ++i) {
+                queue.push({p, i});
+            }
+        });
+    }
+
+    // order is kept for every producer
+    std::vector<int> next(producers, 0);
+    int popped = 0;
+    std::pair<int, int> value;
+    while (popped < producers * count) {
+        if (not queue.pop(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        BOOST_REQUIRE_EQUAL(value.second, next[value.first]);
+        ++next[value.first];
+        ++popped;
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+    BOOST_CHECK(not queue.pop(value));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE node_arena tests
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "types/node_arena.hh"
+
+using namespace runos;
+
+namespace {
+
+struct counted {
+    static int alive;
+    std::string name;
+    node_ref<counted> child;
+
+    counted(std::string name, node_ref<counted> child = {0})
+        : name(std::move(name)), child(child)
+    { alive++; }
+    counted(const counted& other)
+        : name(other.name), child(other.child)
+    { alive++; }
+    ~counted()
+    { alive--; }
+};
+
+int counted::alive = 0;
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE( runos_types_tests )
+
+BOOST_AUTO_TEST_CASE( emplace_and_erase ) {
+    node_arena<counted, 64> arena;
+    auto a = arena.emplace("a");
+    auto b = arena.emplace("b", a);
+    BOOST_CHECK_EQUAL(arena.size(), 2u);
+    BOOST_CHECK_EQUAL(arena[b].name, "b");
+    BOOST_CHECK(arena[b].child == a);
+
+    counted* pa = &arena[a];
+    arena.erase(b);
+    BOOST_CHECK_EQUAL(counted::alive, 1);
+
+    // erased slot is reused, other nodes don't move
+    auto c = arena.emplace("c");
+    BOOST_CHECK(c == b);
+    for (int i = 0; i < 1000; i++) {
+        arena.emplace(std::to_string(i));
+    }
+    BOOST_CHECK_EQUAL(pa, &arena[a]);
+    BOOST_CHECK_EQUAL(arena[a].name, "a");
+    BOOST_CHECK_EQUAL(arena.size(), 1002u);
+}
+
+BOOST_AUTO_TEST_CASE( clear_releases_all ) {
+    {
+        node_arena<counted, 64> arena;
+        std::vector<node_ref<counted>> refs;
+        for (int i = 0; i < 500; i++) {
+            refs.push_back(arena.emplace(std::to_string(i)));
+        }
+        for (size_t i = 0; i < refs.size(); i += 3) {
+            arena.erase(refs[i]);
+        }
+        BOOST_CHECK_GT(arena.capacity_bytes(), 0u);
+
+        arena.clear();
+        BOOST_CHECK_EQUAL(counted::alive, 0);
+        BOOST_CHECK(arena.empty());
+        BOOST_CHECK_EQUAL(arena.capacity_bytes(), 0u);
+
+        // usable after clear
+        auto ref = arena.emplace("again");
+        BOOST_CHECK_EQUAL(ref.index, 0u);
+        BOOST_CHECK_EQUAL(counted::alive, 1);
+    }
+    BOOST_CHECK_EQUAL(counted::alive, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE send queue tests
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "SendQueue.hh"
+
+using namespace runos::sendq;
+
+namespace {
+
+Settings small()
+{
+    Settings ret;
+    ret.enabled = true;
+    ret.high_watermark = 16;
+    ret.max_bytes = 32;
+    return ret;
+}
+
+std::vector<uint64_t> drain_all(SendQueue& queue)
+{
+    std::vector<uint64_t> ret;
+    queue.drain([&ret](const void* data, size_t len) {
+        BOOST_REQUIRE_EQUAL(len, sizeof(uint64_t));
+        ret.push_back(*static_cast<const uint64_t*>(data));
+    });
+    return ret;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(full_queue_queues_over_limit)
+{
+    SendQueue queue(small());
+    for (uint64_t i = 0; i < 4; ++i) {
+        BOOST_CHECK(queue.push(&i, sizeof i));
+    }
+    BOOST_CHECK_EQUAL(queue.bytes(), 32u);
+
+    uint64_t extra = 4;
+    BOOST_CHECK(not queue.push(&extra, sizeof extra));
+    BOOST_CHECK_EQUAL(queue.stats().overflows, 1u);
+    BOOST_CHECK_EQUAL(queue.stats().dropped, 0u);
+
+    std::vector<uint64_t> expected {0, 1, 2, 3, 4};
+    auto sent = drain_all(queue);
+    BOOST_CHECK_EQUAL_COLLECTIONS(sent.begin(), sent.end(),
+                                  expected.begin(), expected.end());
+    BOOST_CHECK(queue.empty());
+    BOOST_CHECK_EQUAL(queue.stats().sent, 5u);
+}
+
+BOOST_AUTO_TEST_CASE(big_message_is_queued_alone)
+{
+    SendQueue queue(small());
+    std::vector<uint8_t> big(64);
+    BOOST_CHECK(queue.push(big.data(), big.size()));
+    BOOST_CHECK(not queue.push(big.data(), big.size()));
+
+    size_t sent = 0;
+    queue.drain([&sent](const void*, size_t len) { sent += len; });
+    BOOST_CHECK_EQUAL(sent, 2 * big.size());
+    BOOST_CHECK(queue.push(big.data(), big.size()));
+}
+
+BOOST_AUTO_TEST_CASE(drain_stops_at_budget)
+{
+    SendQueue queue(small());
+    for (uint64_t i = 0; i < 4; ++i) {
+        queue.push(&i, sizeof i);
+    }
+
+    size_t sent = 0;
+    queue.drain([&sent](const void*, size_t len) { sent += len; }, 12);
+    BOOST_CHECK_EQUAL(sent, 16u);
+    BOOST_CHECK_EQUAL(queue.bytes(), 16u);
+    BOOST_CHECK_EQUAL(drain_all(queue).size(), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(sender_waits_for_room)
+{
+    SendQueue queue(small());
+    for (uint64_t i = 0; i < 4; ++i) {
+        queue.push(&i, sizeof i);
+    }
+
+    uint64_t extra = 4;
+    bool fits = false;
+    std::thread sender([&queue, &extra, &fits] {
+        fits = queue.push(&extra, sizeof extra, std::chrono::seconds(10));
+    });
+    std::vector<uint64_t> sent;
+    while (sent.size() < 5) {
+        for (uint64_t msg : drain_all(queue)) {
+            sent.push_back(msg);
+        }
+    }
+    sender.join();
+    BOOST_CHECK(fits);
+    BOOST_CHECK_EQUAL(sent.back(), 4u);
+    BOOST_CHECK_EQUAL(queue.stats().overflows, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(clear_counts_dropped)
+{
+    SendQueue queue(small());
+    for (uint64_t i = 0; i < 3; ++i) {
+        queue.push(&i, sizeof i);
+    }
+    BOOST_CHECK_EQUAL(queue.clear(), 3u);
+    BOOST_CHECK_EQUAL(queue.stats().dropped, 3u);
+    BOOST_CHECK_EQUAL(queue.stats().queue_bytes, 0u);
+    BOOST_CHECK(drain_all(queue).empty());
+}
+
+BOOST_AUTO_TEST_CASE(waiting_senders_keep_order)
+{
+    // producers wait for room, as SwitchConnection::send does
+    SendQueue queue(small());
+    constexpr uint64_t threads = 4, count = 10000;
+
+    std::vector<std::thread> producers;
+    for (uint64_t t = 0; t < threads; ++t) {
+        producers.emplace_back([&queue, t] {
+            for (uint64_t i = 0; i < count; ++i) {
+                uint64_t msg = t << 32 | i;
+                queue.push(&msg, sizeof msg, std::chrono::milliseconds(10));
+            }
+        });
+    }
+
+    std::vector<uint64_t> next(threads, 0);
+    uint64_t received = 0;
+    while (received < threads * count) {
+        for (uint64_t msg : drain_all(queue)) {
+            uint64_t t = msg >> 32;
+            BOOST_REQUIRE_EQUAL(msg & 0xffffffff, next[t]);
+            ++next[t];
+            ++received;
+        }
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    BOOST_CHECK_EQUAL(queue.stats().dropped, 0u);
+    BOOST_CHECK_EQUAL(queue.stats().sent, threads * count);
+}
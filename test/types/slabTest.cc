@@ -0,0 +1,232 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE slab tests
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "types/slab.hh"
+
+using namespace runos;
+
+namespace {
+
+struct node {
+    uint64_t key;
+    std::unique_ptr<node> next;
+
+    static void* operator new(size_t size)
+    { return slab<node>::allocate(size); }
+    static void operator delete(void* p, size_t size)
+    { slab<node>::deallocate(p, size); }
+};
+
+struct big_node : node {
+    char payload[100];
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE( runos_types_tests )
+
+BOOST_AUTO_TEST_CASE( reuses_freed_chunks ) {
+    auto first = new node{1, nullptr};
+    void* addr = first;
+    delete first;
+
+    auto second = new node{2, nullptr};
+    BOOST_CHECK_EQUAL(static_cast<void*>(second), addr);
+    delete second;
+}
+
+BOOST_AUTO_TEST_CASE( chunks_are_distinct_and_aligned ) {
+    std::vector<node*> nodes;
+    std::set<node*> unique;
+    // more than one slab
+    for (uint64_t i = 0; i < 10000; ++i) {
+        nodes.push_back(new node{i, nullptr});
+        unique.insert(nodes.back());
+        BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(nodes.back())
+                            % alignof(node), 0u);
+    }
+    BOOST_CHECK_EQUAL(unique.size(), nodes.size());
+    for (uint64_t i = 0; i < nodes.size(); ++i) {
+        BOOST_CHECK_EQUAL(nodes[i]->key, i);
+        delete nodes[i];
+    }
+}
+
+BOOST_AUTO_TEST_CASE( empty_slabs_are_returned ) {
+    using pool = slab<node>::pool;
+    size_t before = pool::slab_count();
+
+    std::vector<node*> nodes;
+    for (uint64_t i = 0; i < 20000; ++i) {
+        nodes.push_back(new node{i, nullptr});
+    }
+    BOOST_CHECK_GT(pool::slab_count(), before + 1);
+
+    for (auto n : nodes) {
+        delete n;
+    }
+    // one slab is kept for the next allocations
+    BOOST_CHECK_LE(pool::slab_count(), before + 1);
+}
+
+BOOST_AUTO_TEST_CASE( slabs_freed_by_other_thread_are_returned ) {
+    using pool = slab<node>::pool;
+    size_t before = pool::slab_count();
+
+    std::vector<node*> nodes;
+    for (uint64_t i = 0; i < 20000; ++i) {
+        nodes.push_back(new node{i, nullptr});
+    }
+    std::thread consumer([&nodes]() {
+        for (auto n : nodes) {
+            delete n;
+        }
+    });
+    consumer.join();
+
+    // the owner takes chunks back on its next allocation
+    delete new node{0, nullptr};
+    BOOST_CHECK_LE(pool::slab_count(), before + 1);
+}
+
+BOOST_AUTO_TEST_CASE( derived_classes_use_heap ) {
+    node* n = new big_node{};
+    n->key = 42;
+    delete static_cast<big_node*>(n);
+}
+
+BOOST_AUTO_TEST_CASE( freed_by_other_thread ) {
+    std::vector<node*> nodes;
+    for (uint64_t i = 0; i < 1000; ++i) {
+        nodes.push_back(new node{i, nullptr});
+    }
+
+    std::thread consumer([&nodes]() {
+        for (auto n : nodes) {
+            delete n;
+        }
+    });
+    consumer.join();
+
+    // freed chunks are returned to this thread, it takes them
+    // when its own free list is empty, before carving new slabs
+    std::set<node*> freed(nodes.begin(), nodes.end());
+    std::vector<node*> again;
+    size_t reused = 0;
+    while (reused < freed.size() && again.size() < 100000) {
+        again.push_back(new node{0, nullptr});
+        reused += freed.count(again.back());
+    }
+    BOOST_CHECK_EQUAL(reused, freed.size());
+    for (auto n : again) {
+        delete n;
+    }
+}
+
+BOOST_AUTO_TEST_CASE( exited_thread_is_adopted ) {
+    std::vector<node*> nodes;
+    std::thread producer([&nodes]() {
+        for (uint64_t i = 0; i < 1000; ++i) {
+            nodes.push_back(new node{i, nullptr});
+        }
+    });
+    producer.join();
+
+    for (auto n : nodes) {
+        delete n;
+    }
+
+    // the next thread takes over the chunks of the exited one
+    std::set<node*> freed(nodes.begin(), nodes.end());
+    node* reused = nullptr;
+    std::thread successor([&reused]() {
+        reused = new node{0, nullptr};
+    });
+    successor.join();
+    BOOST_CHECK(freed.count(reused));
+    delete reused;
+}
+
+BOOST_AUTO_TEST_CASE( ping_pong ) {
+    // every thread frees what the next one allocated
+    constexpr int nthreads = 4;
+    constexpr int rounds = 20;
+    std::vector<std::vector<node*>> batches(nthreads);
+    std::vector<std::thread> threads;
+
+    for (int round = 0; round < rounds; ++round) {
+        threads.clear();
+        for (int t = 0; t < nthreads; ++t) {
+            threads.emplace_back([&batches, t, round]() {
+                auto& mine = batches[t];
+                auto& next = batches[(t + 1) % nthreads];
+                if (round % 2 == 0) {
+                    for (uint64_t i = 0; i < 2000; ++i) {
+                        mine.push_back(new node{i, nullptr});
+                    }
+                } else {
+                    for (auto n : next) {
+                        delete n;
+                    }
+                    next.clear();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    for (auto& batch : batches) {
+        BOOST_CHECK(batch.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE( allocator_in_container ) {
+    using map = std::unordered_map<
+        uint64_t, uint64_t,
+        std::hash<uint64_t>, std::equal_to<uint64_t>,
+        slab_allocator<std::pair<const uint64_t, uint64_t>>
+    >;
+
+    map m;
+    for (uint64_t i = 0; i < 5000; ++i) {
+        m.emplace(i, i * i);
+    }
+    for (uint64_t i = 0; i < 5000; i += 2) {
+        m.erase(i);
+    }
+    BOOST_CHECK_EQUAL(m.size(), 2500u);
+    for (uint64_t i = 1; i < 5000; i += 2) {
+        BOOST_CHECK_EQUAL(m.at(i), i * i);
+    }
+
+    map copy = m;
+    m.clear();
+    BOOST_CHECK_EQUAL(copy.size(), 2500u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
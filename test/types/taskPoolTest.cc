@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE task_pool tests
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "types/task_pool.hh"
+
+using namespace runos;
+
+namespace {
+
+uint64_t fib(task_pool& pool, unsigned n)
+{
+    if (n < 2)
+        return n;
+    uint64_t a = 0, b = 0;
+    pool.invoke([&]() { a = fib(pool, n - 1); },
+                [&]() { b = fib(pool, n - 2); });
+    return a + b;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE( runos_types_tests )
+
+BOOST_AUTO_TEST_CASE( without_workers ) {
+    task_pool pool(0);
+    BOOST_CHECK_EQUAL(pool.concurrency(), 1u);
+    BOOST_CHECK_EQUAL(fib(pool, 20), 6765u);
+}
+
+BOOST_AUTO_TEST_CASE( nested_forks ) {
+    task_pool pool(3);
+    BOOST_CHECK_EQUAL(pool.concurrency(), 4u);
+    BOOST_CHECK_EQUAL(fib(pool, 25), 75025u);
+}
+
+BOOST_AUTO_TEST_CASE( tasks_are_stolen ) {
+    task_pool pool(3);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+
+    std::function<void(unsigned)> spread = [&](unsigned depth) {
+        if (depth == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.insert(std::this_thread::get_id());
+            return;
+        }
+        pool.invoke([&]() { spread(depth - 1); },
+                    [&]() { spread(depth - 1); });
+    };
+    spread(6);
+    BOOST_CHECK_GT(threads.size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE( exceptions_are_propagated ) {
+    task_pool pool(2);
+    std::atomic_bool other_done {false};
+    BOOST_CHECK_THROW(
+        pool.invoke([]() { throw std::runtime_error("forked"); },
+                    [&]() { other_done = true; }),
+        std::runtime_error);
+    BOOST_CHECK(other_done);
+
+    // pool is still usable
+    BOOST_CHECK_EQUAL(fib(pool, 15), 610u);
+}
+
+BOOST_AUTO_TEST_CASE( external_threads ) {
+    task_pool pool(2);
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> results(4);
+    for (size_t i = 0; i < results.size(); ++i) {
+        threads.emplace_back([&pool, &results, i]() {
+            results[i] = fib(pool, 18);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (auto r : results) {
+        BOOST_CHECK_EQUAL(r, 2584u);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2018 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define BOOST_TEST_MODULE timer_wheel tests
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "types/timer_wheel.hh"
+
+using wheel = runos::timer_wheel<int>;
+
+BOOST_AUTO_TEST_SUITE( runos_types_tests )
+
+BOOST_AUTO_TEST_CASE( expires_at_deadline ) {
+    wheel w;
+    // cover every level and both sides of slot boundaries
+    std::vector<wheel::tick_type> deadlines = {
+        1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097,
+        70000, 262143, 262144, 300000, 5000000
+    };
+    for (size_t i = 0; i < deadlines.size(); ++i) {
+        w.schedule(int(i), deadlines[i]);
+    }
+    BOOST_CHECK_EQUAL(w.size(), deadlines.size());
+
+    std::map<int, wheel::tick_type> fired;
+    for (wheel::tick_type t = 1; t <= 5000000; t += 777) {
+        w.advance(t, [&](int key) { fired[key] = t; });
+    }
+    w.advance(5000000, [&](int key) { fired[key] = 5000000; });
+
+    BOOST_CHECK(w.empty());
+    for (size_t i = 0; i < deadlines.size(); ++i) {
+        BOOST_CHECK_GE(fired.at(int(i)), deadlines[i]);
+        BOOST_CHECK_LT(fired.at(int(i)), deadlines[i] + 777);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( exact_tick_order ) {
+    wheel w(1000);
+    w.schedule(1, 1000 + 5000);
+    w.schedule(2, 1000 + 70);
+    w.schedule(3, 1000 + 3);
+
+    std::vector<std::pair<int, wheel::tick_type>> fired;
+    for (wheel::tick_type t = 1001; t <= 7000; ++t) {
+        w.advance(t, [&](int key) { fired.emplace_back(key, w.now()); });
+    }
+
+    BOOST_REQUIRE_EQUAL(fired.size(), 3u);
+    BOOST_CHECK_EQUAL(fired[0].first, 3);
+    BOOST_CHECK_EQUAL(fired[0].second, 1003u);
+    BOOST_CHECK_EQUAL(fired[1].first, 2);
+    BOOST_CHECK_EQUAL(fired[1].second, 1070u);
+    BOOST_CHECK_EQUAL(fired[2].first, 1);
+    BOOST_CHECK_EQUAL(fired[2].second, 6000u);
+}
+
+BOOST_AUTO_TEST_CASE( reschedule_and_cancel ) {
+    wheel w;
+    w.schedule(1, 10);
+    w.schedule(2, 10);
+    w.schedule(1, 20); // replaces previous deadline
+    BOOST_CHECK_EQUAL(w.size(), 2u);
+    BOOST_CHECK(w.cancel(2));
+    BOOST_CHECK(not w.cancel(2));
+
+    std::vector<wheel::tick_type> fired;
+    w.advance(100, [&](int) { fired.push_back(w.now()); });
+    BOOST_REQUIRE_EQUAL(fired.size(), 1u);
+    BOOST_CHECK_EQUAL(fired[0], 20u);
+}
+
+BOOST_AUTO_TEST_CASE( callbacks_modify_wheel ) {
+    wheel w;
+    w.schedule(1, 5);
+    w.schedule(2, 5);
+    w.schedule(3, 5);
+
+    int periodic = 0;
+    std::vector<int> fired;
+    w.advance(5 + 64 * 3, [&](int key) {
+        fired.push_back(key);
+        if (key == 1) {
+            w.cancel(2); // expires at the same tick
+            w.schedule(1, w.now() + 64); // slot which is processed now
+            ++periodic;
+        }
+    });
+
+    BOOST_CHECK_EQUAL(periodic, 4);
+    BOOST_CHECK_EQUAL(std::count(fired.begin(), fired.end(), 2), 0);
+    BOOST_CHECK_EQUAL(std::count(fired.begin(), fired.end(), 3), 1);
+    BOOST_CHECK(w.scheduled(1));
+}
+
+BOOST_AUTO_TEST_CASE( past_deadlines ) {
+    wheel w(100);
+    w.schedule(1, 50);
+    std::vector<wheel::tick_type> fired;
+    w.advance(101, [&](int) { fired.push_back(w.now()); });
+    BOOST_REQUIRE_EQUAL(fired.size(), 1u);
+    BOOST_CHECK_EQUAL(fired[0], 101u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()